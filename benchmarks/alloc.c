@@ -0,0 +1,193 @@
+/*
+ * Copyright (c) 2020, Yanhui Shi <lime.syh at gmail dot com>
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * The allocator benchmark replays the process sizes of `csp_procs_meta` in a
+ * configure file generated by `cspcli analyze`(see `ALLOC_CONFIG` in the
+ * Makefile) against `csp_mem`, or against `malloc` with `alloc_with_malloc`
+ * which is what libcsp does with `--with-sysmalloc`, so linking jemalloc or
+ * mimalloc compares them too.
+ *
+ * It includes `mem.c` directly like the tests so that it can look into the
+ * heap. There are three phases:
+ *
+ *  - burst: allocate `BURST` processes and free all of them, like spawning a
+ *    tree of processes and joining it,
+ *  - churn: keep `LIVE` processes alive and replace a random one of them
+ *    `CHURN` times(one free and one allocation each), like a server with
+ *    short-lived handlers,
+ *  - merge: the cost of merging all the free spans of the fragmented heap.
+ *
+ * and a footprint report after the churn: the bytes requested by the live
+ * processes, the resident memory of the whole program and the arenas mapped.
+ */
+
+#include <unistd.h>
+#include "bench.h"
+
+#ifndef alloc_with_malloc
+#include "../src/mem.c"
+
+int csp_sched_np = 1;
+_Thread_local csp_core_t *csp_this_core = &(csp_core_t){.pid = 0};
+csp_stats_block_t csp_stats_shared;
+void csp_sched_yield(void) {}
+int csp_core_pools_node(size_t pid) { return -1; }
+
+#ifdef csp_with_mem_bitmap
+#define ALLOC_IMPL      "csp_mem_bitmap"
+#else
+#define ALLOC_IMPL      "csp_mem"
+#endif
+#define alloc_init()    csp_mem_init()
+#define alloc(size)     csp_mem_alloc(0, size)
+#define alloc_free(obj) csp_mem_free(0, obj)
+#else
+#ifndef ALLOC_IMPL
+#define ALLOC_IMPL      "malloc"
+#endif
+#define alloc_init()    true
+#define alloc(size)     malloc(size)
+#define alloc_free(obj) free(obj)
+#endif
+
+#define BURST (1 << 18)
+#define LIVE  (1 << 14)
+#define CHURN (1 << 21)
+
+extern size_t csp_procs_num;
+/* The same layout as `csp_proc_meta_t` of `src/proc.h`. */
+extern struct { size_t size, flags; } csp_procs_meta[];
+
+typedef struct { char *obj; size_t size; } alloc_obj_t;
+
+alloc_obj_t objs[BURST];
+size_t sizes[BURST], nsizes;
+uint64_t seed = 88172645463325252ULL;
+
+static uint64_t alloc_rand(void) {
+  seed ^= seed << 13;
+  seed ^= seed >> 7;
+  seed ^= seed << 17;
+  return seed;
+}
+
+/* The processes with elastic stacks, i.e. of size 0, are not allocated from
+ * the heap, see `src/proc.c`. */
+static void alloc_load_sizes(void) {
+  for (size_t i = 0; i < csp_procs_num; i++) {
+    if (csp_procs_meta[i].size > 0) {
+      sizes[nsizes++] = csp_procs_meta[i].size;
+    }
+  }
+  if (nsizes == 0) {
+    fprintf(stderr, "no process size in the configure file\n");
+    exit(EXIT_FAILURE);
+  }
+}
+
+static void alloc_one(alloc_obj_t *o) {
+  o->size = sizes[alloc_rand() % nsizes];
+  o->obj = alloc(o->size);
+  if (o->obj == NULL) {
+    perror("alloc error");
+    exit(EXIT_FAILURE);
+  }
+  /* Touch it like the process header at the top of a stack. */
+  o->obj[0] = 1;
+}
+
+static size_t alloc_rss(void) {
+  long pages = 0;
+  FILE *f = fopen("/proc/self/statm", "r");
+  if (f != NULL) {
+    if (fscanf(f, "%*s %ld", &pages) != 1) {
+      pages = 0;
+    }
+    fclose(f);
+  }
+  return (size_t)pages * (size_t)sysconf(_SC_PAGESIZE);
+}
+
+static void alloc_burst(void) {
+  int64_t start = bench_now();
+  for (int i = 0; i < BURST; i++) {
+    alloc_one(&objs[i]);
+  }
+  int64_t mid = bench_now();
+  for (int i = BURST - 1; i >= 0; i--) {
+    alloc_free(objs[i].obj);
+  }
+  int64_t end = bench_now();
+  bench_report("alloc", "burst_alloc", ALLOC_IMPL, BURST, mid - start);
+  bench_report("alloc", "burst_free", ALLOC_IMPL, BURST, end - mid);
+}
+
+static void alloc_churn(void) {
+  for (int i = 0; i < LIVE; i++) {
+    alloc_one(&objs[i]);
+  }
+  int64_t start = bench_now();
+  for (int i = 0; i < CHURN; i++) {
+    alloc_obj_t *o = &objs[alloc_rand() % LIVE];
+    alloc_free(o->obj);
+    alloc_one(o);
+  }
+  bench_report("alloc", "churn", ALLOC_IMPL, CHURN, bench_now() - start);
+
+  size_t live = 0, arenas = 0;
+  for (int i = 0; i < LIVE; i++) {
+    live += objs[i].size;
+  }
+#ifndef alloc_with_malloc
+  for (csp_mem_arena_link_t *a = csp_mem.heaps[0].arenas; a; a = a->next) {
+    arenas++;
+  }
+#endif
+  size_t rss = alloc_rss();
+  printf("{\"benchmark\":\"alloc\",\"variant\":\"footprint\",\"impl\":\"%s\","
+    "\"live_bytes\":%zu,\"rss_bytes\":%zu,\"arenas\":%zu,"
+    "\"rss_per_live\":%.2f}\n",
+    ALLOC_IMPL, live, rss, arenas, live > 0 ? (double)rss / live : 0
+  );
+  fflush(stdout);
+
+  for (int i = 0; i < LIVE; i++) {
+    alloc_free(objs[i].obj);
+  }
+}
+
+/* Merging only happens in `csp_mem`, when no free span is large enough. */
+static void alloc_merge(void) {
+#ifndef alloc_with_malloc
+  int64_t start = bench_now();
+  csp_mem_heap_merge(&csp_mem.heaps[0]);
+  bench_report("alloc", "merge", ALLOC_IMPL, 1, bench_now() - start);
+#endif
+}
+
+int main(void) {
+  if (!alloc_init()) {
+    perror("alloc init error");
+    exit(EXIT_FAILURE);
+  }
+  alloc_load_sizes();
+  alloc_burst();
+  alloc_churn();
+  alloc_merge();
+  return 0;
+}
@@ -0,0 +1,16 @@
+// A sample of the configure file generated by `cspcli analyze`, used by the
+// allocator benchmark if `ALLOC_CONFIG` isn't given. The sizes are the ones of
+// a small network service: most processes fit in the slabs and a few handlers
+// need several pages.
+
+#include <stdlib.h>
+size_t csp_cpu_cores = 1;
+size_t csp_max_threads = 1;
+size_t csp_max_procs_hint = 100000;
+size_t csp_spin_budget = 4;
+size_t csp_timer_slot = 0;
+size_t csp_mem_retain = 67108864;
+size_t csp_elastic_stack_size = 0;
+size_t csp_time_slice = 0;
+size_t csp_procs_num = 16;
+struct {size_t size, flags;} csp_procs_meta[] = {{256, 0}, {256, 0}, {320, 0}, {320, 0}, {448, 0}, {448, 0}, {576, 0}, {640, 0}, {960, 0}, {1344, 0}, {1984, 0}, {4096, 0}, {8192, 0}, {8192, 0}, {16384, 0}, {65536, 0}, };
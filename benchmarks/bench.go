@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) 2020, Yanhui Shi <lime.syh at gmail dot com>
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+package main
+
+import (
+	"fmt"
+	"syscall"
+)
+
+// The helpers shared by the go versions of the benchmarks, see bench.h for the
+// format of the output.
+
+func report(benchmark, variant string, ops, ns int64) {
+	reportWith(benchmark, variant, ops, ns, "", 0)
+}
+
+func reportWith(benchmark, variant string, ops, ns int64, key string,
+	val float64) {
+	nsPerOp := 0.0
+	if ops > 0 {
+		nsPerOp = float64(ns) / float64(ops)
+	}
+	fmt.Printf("{\"benchmark\":\"%s\",\"variant\":\"%s\",\"impl\":\"go\","+
+		"\"ops\":%d,\"ns\":%d,\"ns_per_op\":%.2f",
+		benchmark, variant, ops, ns, nsPerOp)
+	if key != "" {
+		fmt.Printf(",\"%s\":%.4f", key, val)
+	}
+	fmt.Printf("}\n")
+}
+
+// fairness returns Jain's fairness index of counts.
+func fairness(counts []uint64) float64 {
+	var sum, sumSq float64
+	for _, c := range counts {
+		sum += float64(c)
+		sumSq += float64(c) * float64(c)
+	}
+	if sumSq == 0 {
+		return 0
+	}
+	return sum * sum / (sumSq * float64(len(counts)))
+}
+
+func raiseNofile(n uint64) {
+	var r syscall.Rlimit
+	if err := syscall.Getrlimit(syscall.RLIMIT_NOFILE, &r); err != nil {
+		panic(err)
+	}
+	if r.Cur >= n {
+		return
+	}
+	r.Cur = n
+	if r.Max < n {
+		r.Max = n
+	}
+	if err := syscall.Setrlimit(syscall.RLIMIT_NOFILE, &r); err != nil {
+		panic(err)
+	}
+}
@@ -0,0 +1,170 @@
+/*
+ * Copyright (c) 2020, Yanhui Shi <lime.syh at gmail dot com>
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef LIBCSP_BENCHMARKS_BENCH_H
+#define LIBCSP_BENCHMARKS_BENCH_H
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/resource.h>
+
+/*
+ * The helpers shared by the libcsp and the pthread versions of the benchmarks,
+ * see `bench.go` for the go ones.
+ *
+ * Every benchmark prints one JSON object per line to the stdout, e.g.
+ *
+ *   {"benchmark":"pingpong","variant":"ss","impl":"libcsp","ops":1000000,
+ *    "ns":95000000,"ns_per_op":95.00}
+ *
+ * so `make benchmark | grep '^{'` gives the results of all of them to be
+ * compared between the implementations or the commits.
+ */
+
+static inline int64_t bench_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Report a result, `key` and `val` are an extra field if `key` isn't NULL. */
+static inline void bench_report_with(const char *benchmark,
+    const char *variant, const char *impl, int64_t ops, int64_t ns,
+    const char *key, double val) {
+  printf("{\"benchmark\":\"%s\",\"variant\":\"%s\",\"impl\":\"%s\","
+    "\"ops\":%ld,\"ns\":%ld,\"ns_per_op\":%.2f",
+    benchmark, variant, impl, (long)ops, (long)ns,
+    ops > 0 ? (double)ns / ops : 0
+  );
+  if (key != NULL) {
+    printf(",\"%s\":%.4f", key, val);
+  }
+  printf("}\n");
+  fflush(stdout);
+}
+
+#define bench_report(benchmark, variant, impl, ops, ns)                        \
+  bench_report_with(benchmark, variant, impl, ops, ns, NULL, 0)                \
+
+/* Jain's fairness index of `counts`, 1 means all of them are equal and
+ * `1 / n` means one of them takes everything. */
+static inline double bench_fairness(const uint64_t *counts, size_t n) {
+  double sum = 0, sum_sq = 0;
+  for (size_t i = 0; i < n; i++) {
+    sum += (double)counts[i];
+    sum_sq += (double)counts[i] * (double)counts[i];
+  }
+  return sum_sq == 0 ? 0 : sum * sum / (sum_sq * n);
+}
+
+/* Raise the limit of the open files to at least `n` or exit. */
+static inline void bench_raise_nofile(rlim_t n) {
+  struct rlimit r;
+  if (getrlimit(RLIMIT_NOFILE, &r) != 0) {
+    perror("getrlimit error");
+    exit(EXIT_FAILURE);
+  }
+  if (r.rlim_cur >= n) {
+    return;
+  }
+  r.rlim_cur = n;
+  if (r.rlim_max < n) {
+    r.rlim_max = n;
+  }
+  if (setrlimit(RLIMIT_NOFILE, &r) != 0) {
+    perror("setrlimit error, try a smaller CONNS");
+    exit(EXIT_FAILURE);
+  }
+}
+
+/*
+ * `bench_queue_t` is a bounded blocking queue guarded by a mutex, i.e. what
+ * the pthread programs usually use in place of the channels.
+ */
+typedef struct {
+  pthread_mutex_t mutex;
+  pthread_cond_t not_empty, not_full;
+  size_t cap, head, len;
+  void *items[];
+} bench_queue_t;
+
+static inline bench_queue_t *bench_queue_new(size_t cap) {
+  bench_queue_t *q = malloc(sizeof(bench_queue_t) + cap * sizeof(void *));
+  if (q == NULL) {
+    perror("malloc error");
+    exit(EXIT_FAILURE);
+  }
+  pthread_mutex_init(&q->mutex, NULL);
+  pthread_cond_init(&q->not_empty, NULL);
+  pthread_cond_init(&q->not_full, NULL);
+  q->cap = cap;
+  q->head = q->len = 0;
+  return q;
+}
+
+static inline void bench_queue_push(bench_queue_t *q, void *item) {
+  pthread_mutex_lock(&q->mutex);
+  while (q->len == q->cap) {
+    pthread_cond_wait(&q->not_full, &q->mutex);
+  }
+  q->items[(q->head + q->len++) % q->cap] = item;
+  pthread_cond_signal(&q->not_empty);
+  pthread_mutex_unlock(&q->mutex);
+}
+
+static inline void *bench_queue_pop(bench_queue_t *q) {
+  pthread_mutex_lock(&q->mutex);
+  while (q->len == 0) {
+    pthread_cond_wait(&q->not_empty, &q->mutex);
+  }
+  void *item = q->items[q->head];
+  q->head = (q->head + 1) % q->cap;
+  q->len--;
+  pthread_cond_signal(&q->not_full);
+  pthread_mutex_unlock(&q->mutex);
+  return item;
+}
+
+static inline void bench_queue_destroy(bench_queue_t *q) {
+  pthread_mutex_destroy(&q->mutex);
+  pthread_cond_destroy(&q->not_empty);
+  pthread_cond_destroy(&q->not_full);
+  free(q);
+}
+
+/* Create a thread with a small stack, so that there can be thousands of them,
+ * or exit. */
+static inline pthread_t bench_thread_new(void *(*fn)(void *), void *arg) {
+  pthread_t tid;
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  pthread_attr_setstacksize(&attr, 1 << 16);
+  errno = pthread_create(&tid, &attr, fn, arg);
+  pthread_attr_destroy(&attr);
+  if (errno != 0) {
+    perror("pthread_create error");
+    exit(EXIT_FAILURE);
+  }
+  return tid;
+}
+
+#endif
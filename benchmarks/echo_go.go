@@ -0,0 +1,95 @@
+/*
+ * Copyright (c) 2020, Yanhui Shi <lime.syh at gmail dot com>
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+package main
+
+import (
+	"fmt"
+	"io"
+	"net"
+	"sync"
+	"time"
+)
+
+// CONNS clients connect to an echo server on the loopback at once and each of
+// them sends ROUNDS messages of MSG bytes and waits for the echoes.
+const (
+	CONNS  = 10000
+	ROUNDS = 100
+	MSG    = 64
+)
+
+func serve(conn net.Conn) {
+	buf := make([]byte, MSG)
+	for {
+		if _, err := io.ReadFull(conn, buf); err != nil {
+			break
+		}
+		if _, err := conn.Write(buf); err != nil {
+			break
+		}
+	}
+	conn.Close()
+}
+
+func client(addr string, wg *sync.WaitGroup) {
+	conn, err := net.Dial("tcp", addr)
+	if err != nil {
+		panic(err)
+	}
+	buf := make([]byte, MSG)
+	for i := 0; i < ROUNDS; i++ {
+		if _, err := conn.Write(buf); err != nil {
+			panic(err)
+		}
+		if _, err := io.ReadFull(conn, buf); err != nil {
+			panic(err)
+		}
+	}
+	conn.Close()
+	wg.Done()
+}
+
+func main() {
+	raiseNofile(CONNS*2 + 64)
+
+	ln, err := net.Listen("tcp", "127.0.0.1:0")
+	if err != nil {
+		panic(err)
+	}
+
+	var wg sync.WaitGroup
+	wg.Add(CONNS)
+	start := time.Now()
+	go func() {
+		for i := 0; i < CONNS; i++ {
+			conn, err := ln.Accept()
+			if err != nil {
+				panic(err)
+			}
+			go serve(conn)
+		}
+	}()
+	for i := 0; i < CONNS; i++ {
+		go client(ln.Addr().String(), &wg)
+	}
+	wg.Wait()
+	ns := int64(time.Since(start))
+
+	report("echo", fmt.Sprintf("%dconns", CONNS), CONNS*ROUNDS, ns)
+	ln.Close()
+}
@@ -0,0 +1,151 @@
+/*
+ * Copyright (c) 2020, Yanhui Shi <lime.syh at gmail dot com>
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+#define csp_without_prefix
+
+#include <errno.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <libcsp/csp.h>
+#include "bench.h"
+
+/* `CONNS` clients connect to an echo server on the loopback at once and each
+ * of them sends `ROUNDS` messages of `MSG` bytes and waits for the echoes. */
+#ifndef CONNS
+#define CONNS   10000
+#endif
+#define ROUNDS  100
+#define MSG     64
+
+waitgroup_t wg;
+struct sockaddr_in addr;
+
+static bool echo_read(int fd, char *buf, size_t n) {
+  size_t done = 0;
+  while (done < n) {
+    ssize_t nread = read(fd, buf + done, n - done);
+    if (nread > 0) {
+      done += nread;
+    } else if (nread == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      netpoll_wait_read(fd, 0);
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool echo_write(int fd, const char *buf, size_t n) {
+  size_t done = 0;
+  while (done < n) {
+    ssize_t nwrite = write(fd, buf + done, n - done);
+    if (nwrite >= 0) {
+      done += nwrite;
+    } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      netpoll_wait_write(fd, 0);
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+proc void serve(int conn) {
+  char buf[MSG];
+  if (netpoll_register(conn)) {
+    while (echo_read(conn, buf, MSG) && echo_write(conn, buf, MSG));
+    netpoll_unregister(conn);
+  }
+  close(conn);
+}
+
+proc void serve_all(int sockfd) {
+  for (int i = 0; i < CONNS;) {
+    int conn = accept4(sockfd, NULL, NULL, SOCK_NONBLOCK);
+    if (conn >= 0) {
+      async(serve(conn));
+      i++;
+    } else if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+      netpoll_wait_read(sockfd, 0);
+    } else {
+      perror("accept error");
+      exit(EXIT_FAILURE);
+    }
+  }
+}
+
+proc void client(void) {
+  char buf[MSG] = {0};
+  int fd = socket(AF_INET, SOCK_STREAM|SOCK_NONBLOCK, IPPROTO_TCP);
+  if (fd < 0 || !netpoll_register(fd)) {
+    perror("client socket error");
+    exit(EXIT_FAILURE);
+  }
+  if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+    if (errno != EINPROGRESS) {
+      perror("connect error");
+      exit(EXIT_FAILURE);
+    }
+    netpoll_wait_write(fd, 0);
+  }
+  for (int i = 0; i < ROUNDS; i++) {
+    if (!echo_write(fd, buf, MSG) || !echo_read(fd, buf, MSG)) {
+      perror("echo error");
+      exit(EXIT_FAILURE);
+    }
+  }
+  netpoll_unregister(fd);
+  close(fd);
+  waitgroup_done(&wg);
+}
+
+int main(void) {
+  bench_raise_nofile(CONNS * 2 + 64);
+
+  int sockfd = socket(AF_INET, SOCK_STREAM|SOCK_NONBLOCK, IPPROTO_TCP);
+  socklen_t len = sizeof(addr);
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+  if (sockfd < 0 ||
+      bind(sockfd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+      listen(sockfd, 4096) != 0 ||
+      getsockname(sockfd, (struct sockaddr *)&addr, &len) != 0 ||
+      !netpoll_register(sockfd)) {
+    perror("listen error");
+    exit(EXIT_FAILURE);
+  }
+
+  waitgroup_init(&wg);
+  waitgroup_add(&wg, CONNS);
+  int64_t start = bench_now();
+  async(serve_all(sockfd));
+  for (int i = 0; i < CONNS; i++) {
+    async(client());
+  }
+  waitgroup_wait(&wg);
+  int64_t ns = bench_now() - start;
+
+  char variant[32];
+  snprintf(variant, sizeof(variant), "%dconns", CONNS);
+  bench_report("echo", variant, "libcsp", (int64_t)CONNS * ROUNDS, ns);
+
+  netpoll_unregister(sockfd);
+  close(sockfd);
+  return 0;
+}
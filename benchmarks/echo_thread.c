@@ -0,0 +1,135 @@
+/*
+ * Copyright (c) 2020, Yanhui Shi <lime.syh at gmail dot com>
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <errno.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include "bench.h"
+
+/* `CONNS` clients connect to an echo server on the loopback at once and each
+ * of them sends `ROUNDS` messages of `MSG` bytes and waits for the echoes. A
+ * thread serves every connection and a thread runs every client. */
+#ifndef CONNS
+#define CONNS   10000
+#endif
+#define ROUNDS  100
+#define MSG     64
+
+struct sockaddr_in addr;
+
+static bool echo_read(int fd, char *buf, size_t n) {
+  size_t done = 0;
+  while (done < n) {
+    ssize_t nread = read(fd, buf + done, n - done);
+    if (nread > 0) {
+      done += nread;
+    } else if (nread != -1 || errno != EINTR) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool echo_write(int fd, const char *buf, size_t n) {
+  size_t done = 0;
+  while (done < n) {
+    ssize_t nwrite = write(fd, buf + done, n - done);
+    if (nwrite >= 0) {
+      done += nwrite;
+    } else if (errno != EINTR) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void *serve(void *arg) {
+  char buf[MSG];
+  int conn = (int)(intptr_t)arg;
+  while (echo_read(conn, buf, MSG) && echo_write(conn, buf, MSG));
+  close(conn);
+  return NULL;
+}
+
+void *serve_all(void *arg) {
+  int sockfd = (int)(intptr_t)arg;
+  for (int i = 0; i < CONNS;) {
+    int conn = accept(sockfd, NULL, NULL);
+    if (conn >= 0) {
+      pthread_detach(bench_thread_new(serve, (void *)(intptr_t)conn));
+      i++;
+    } else if (errno != EINTR) {
+      perror("accept error");
+      exit(EXIT_FAILURE);
+    }
+  }
+  return NULL;
+}
+
+void *client(void *arg) {
+  char buf[MSG] = {0};
+  int fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+  if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+    perror("connect error");
+    exit(EXIT_FAILURE);
+  }
+  for (int i = 0; i < ROUNDS; i++) {
+    if (!echo_write(fd, buf, MSG) || !echo_read(fd, buf, MSG)) {
+      perror("echo error");
+      exit(EXIT_FAILURE);
+    }
+  }
+  close(fd);
+  return NULL;
+}
+
+pthread_t tids[CONNS];
+
+int main(void) {
+  bench_raise_nofile(CONNS * 2 + 64);
+
+  int sockfd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+  socklen_t len = sizeof(addr);
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+  if (sockfd < 0 ||
+      bind(sockfd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+      listen(sockfd, 4096) != 0 ||
+      getsockname(sockfd, (struct sockaddr *)&addr, &len) != 0) {
+    perror("listen error");
+    exit(EXIT_FAILURE);
+  }
+
+  int64_t start = bench_now();
+  pthread_t server = bench_thread_new(serve_all, (void *)(intptr_t)sockfd);
+  for (int i = 0; i < CONNS; i++) {
+    tids[i] = bench_thread_new(client, NULL);
+  }
+  for (int i = 0; i < CONNS; i++) {
+    pthread_join(tids[i], NULL);
+  }
+  int64_t ns = bench_now() - start;
+  pthread_join(server, NULL);
+
+  char variant[32];
+  snprintf(variant, sizeof(variant), "%dconns", CONNS);
+  bench_report("echo", variant, "thread", (int64_t)CONNS * ROUNDS, ns);
+
+  close(sockfd);
+  return 0;
+}
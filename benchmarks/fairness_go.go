@@ -0,0 +1,83 @@
+/*
+ * Copyright (c) 2020, Yanhui Shi <lime.syh at gmail dot com>
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+package main
+
+import (
+	"runtime"
+	"sync"
+	"sync/atomic"
+	"time"
+)
+
+// WORKERS goroutines do the same chunks of work for DURATION, either yielding
+// after every chunk or relying on the preemption, and the fairness index tells
+// how evenly the CPUs were shared among them.
+const (
+	WORKERS  = 64
+	CHUNK    = 10000
+	DURATION = time.Second
+)
+
+type counter struct {
+	n uint64
+	_ [56]byte
+}
+
+var sink int
+
+func fairnessOf(variant string, yielding bool) {
+	var wg sync.WaitGroup
+	var stop atomic.Bool
+	counters := make([]counter, WORKERS)
+
+	start := time.Now()
+	wg.Add(WORKERS)
+	for i := range counters {
+		go func(c *counter) {
+			for !stop.Load() {
+				x := 0
+				for j := 0; j < CHUNK; j++ {
+					x += j
+				}
+				sink = x
+				c.n++
+				if yielding {
+					runtime.Gosched()
+				}
+			}
+			wg.Done()
+		}(&counters[i])
+	}
+	time.Sleep(DURATION)
+	stop.Store(true)
+	wg.Wait()
+	ns := int64(time.Since(start))
+
+	counts := make([]uint64, WORKERS)
+	var total uint64
+	for i, c := range counters {
+		counts[i] = c.n
+		total += c.n
+	}
+	reportWith("fairness", variant, int64(total), ns, "jain", fairness(counts))
+}
+
+func main() {
+	fairnessOf("yield", true)
+	fairnessOf("busy", false)
+}
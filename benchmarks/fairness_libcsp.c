@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) 2020, Yanhui Shi <lime.syh at gmail dot com>
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#define csp_without_prefix
+
+#include <libcsp/csp.h>
+#include "bench.h"
+
+/* `WORKERS` processes do the same chunks of work for `DURATION` nanoseconds,
+ * either yielding after every chunk or relying on the preemption, and the
+ * fairness index tells how evenly the cores were shared among them. */
+#define WORKERS   64
+#define CHUNK     10000
+#define DURATION  timer_second
+
+typedef struct { uint64_t n; } __attribute__((aligned(64))) counter_t;
+
+waitgroup_t wg;
+atomic_bool stop;
+counter_t counters[WORKERS];
+
+proc void worker(counter_t *counter, bool yielding) {
+  while (!atomic_load_explicit(&stop, memory_order_relaxed)) {
+    for (volatile int i = 0; i < CHUNK; i++);
+    counter->n++;
+    if (yielding) {
+      yield();
+    }
+  }
+  waitgroup_done(&wg);
+}
+
+void fairness(const char *variant, bool yielding) {
+  atomic_store(&stop, false);
+  waitgroup_init(&wg);
+  waitgroup_add(&wg, WORKERS);
+
+  int64_t start = bench_now();
+  for (int i = 0; i < WORKERS; i++) {
+    counters[i].n = 0;
+    async(worker(&counters[i], yielding));
+  }
+  hangup(DURATION);
+  atomic_store(&stop, true);
+  waitgroup_wait(&wg);
+  int64_t ns = bench_now() - start;
+
+  uint64_t counts[WORKERS], total = 0;
+  for (int i = 0; i < WORKERS; i++) {
+    total += counts[i] = counters[i].n;
+  }
+  bench_report_with("fairness", variant, "libcsp", total, ns,
+    "jain", bench_fairness(counts, WORKERS)
+  );
+}
+
+int main(void) {
+  fairness("yield", true);
+
+  /* The main process can only wake up in time if the workers are preempted,
+   * see `csp_time_slice`. */
+  fairness("busy", false);
+  return 0;
+}
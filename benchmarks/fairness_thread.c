@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) 2020, Yanhui Shi <lime.syh at gmail dot com>
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <sched.h>
+#include <stdatomic.h>
+#include "bench.h"
+
+/* `WORKERS` threads do the same chunks of work for `DURATION` nanoseconds,
+ * either yielding after every chunk or relying on the kernel, and the fairness
+ * index tells how evenly the CPUs were shared among them. */
+#define WORKERS   64
+#define CHUNK     10000
+#define DURATION  1000000000
+
+typedef struct { uint64_t n; } __attribute__((aligned(64))) counter_t;
+
+atomic_bool stop, yielding;
+counter_t counters[WORKERS];
+
+void *worker(void *arg) {
+  counter_t *counter = arg;
+  while (!atomic_load_explicit(&stop, memory_order_relaxed)) {
+    for (volatile int i = 0; i < CHUNK; i++);
+    counter->n++;
+    if (atomic_load_explicit(&yielding, memory_order_relaxed)) {
+      sched_yield();
+    }
+  }
+  return NULL;
+}
+
+void fairness(const char *variant, bool yield) {
+  pthread_t tids[WORKERS];
+  atomic_store(&stop, false);
+  atomic_store(&yielding, yield);
+
+  int64_t start = bench_now();
+  for (int i = 0; i < WORKERS; i++) {
+    counters[i].n = 0;
+    tids[i] = bench_thread_new(worker, &counters[i]);
+  }
+  nanosleep(&(struct timespec){
+    .tv_sec = DURATION / 1000000000, .tv_nsec = DURATION % 1000000000
+  }, NULL);
+  atomic_store(&stop, true);
+  for (int i = 0; i < WORKERS; i++) {
+    pthread_join(tids[i], NULL);
+  }
+  int64_t ns = bench_now() - start;
+
+  uint64_t counts[WORKERS], total = 0;
+  for (int i = 0; i < WORKERS; i++) {
+    total += counts[i] = counters[i].n;
+  }
+  bench_report_with("fairness", variant, "thread", total, ns,
+    "jain", bench_fairness(counts, WORKERS)
+  );
+}
+
+int main(void) {
+  fairness("yield", true);
+  fairness("busy", false);
+  return 0;
+}
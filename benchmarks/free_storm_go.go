@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) 2020, Yanhui Shi <lime.syh at gmail dot com>
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+package main
+
+import (
+	"fmt"
+	"sync"
+	"time"
+)
+
+// P producers allocate N objects in total and pass them to C consumers which
+// drop them, so the garbage collector frees them.
+const (
+	N   = 1 << 22
+	P   = 4
+	C   = 4
+	CAP = 1024
+)
+
+// The sizes of the objects, from the slabs to the spans of pages.
+var sizes = []int{16, 48, 128, 512, 2048, 8192}
+
+func main() {
+	var wg sync.WaitGroup
+	ch := make(chan []byte, CAP)
+
+	start := time.Now()
+	wg.Add(P + C)
+	for i := 0; i < C; i++ {
+		go func() {
+			for j := 0; j < N/C; j++ {
+				obj := <-ch
+				obj[0]++
+			}
+			wg.Done()
+		}()
+	}
+	for i := 0; i < P; i++ {
+		go func(id int) {
+			for j := 0; j < N/P; j++ {
+				obj := make([]byte, sizes[(j+id)%len(sizes)])
+				obj[0] = byte(j)
+				ch <- obj
+			}
+			wg.Done()
+		}(i)
+	}
+	wg.Wait()
+	ns := int64(time.Since(start))
+
+	report("free_storm", fmt.Sprintf("%dx%d", P, C), N, ns)
+}
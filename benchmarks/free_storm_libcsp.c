@@ -0,0 +1,90 @@
+/*
+ * Copyright (c) 2020, Yanhui Shi <lime.syh at gmail dot com>
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#define csp_without_prefix
+
+#include <libcsp/csp.h>
+#include "bench.h"
+
+/* `P` producers allocate `N` objects in total and pass them to `C` consumers
+ * which free them, so that most of the objects are freed by the other cores
+ * than the ones allocating them. */
+#define N       (1 << 22)
+#define P       4
+#define C       4
+#define CAP_EXP 10
+
+void *csp_mem_alloc(size_t pid, size_t size);
+void csp_mem_free(size_t pid, void *obj);
+
+/* The sizes of the objects, from the slabs to the spans of pages. */
+const size_t sizes[] = {16, 48, 128, 512, 2048, 8192};
+#define SIZES_NUM (sizeof(sizes) / sizeof(sizes[0]))
+
+typedef struct { char *obj; size_t pid; } item_t;
+
+chan_declare(mm, item_t, mm);
+chan_define(mm, item_t, mm);
+
+waitgroup_t wg;
+
+proc void producer(chan_t(mm) *chan, int id) {
+  for (int i = 0; i < N / P; i++) {
+    size_t pid = csp_this_core->pid;
+    item_t item = {
+      .obj = csp_mem_alloc(pid, sizes[(i + id) % SIZES_NUM]), .pid = pid
+    };
+    if (item.obj == NULL) {
+      perror("csp_mem_alloc error");
+      exit(EXIT_FAILURE);
+    }
+    item.obj[0] = (char)i;
+    chan_push(chan, item);
+  }
+  waitgroup_done(&wg);
+}
+
+proc void consumer(chan_t(mm) *chan) {
+  item_t item;
+  for (int i = 0; i < N / C; i++) {
+    chan_pop(chan, &item);
+    csp_mem_free(item.pid, item.obj);
+  }
+  waitgroup_done(&wg);
+}
+
+int main(void) {
+  chan_t(mm) *chan = chan_new(mm)(CAP_EXP);
+  waitgroup_init(&wg);
+  waitgroup_add(&wg, P + C);
+
+  int64_t start = bench_now();
+  for (int i = 0; i < C; i++) {
+    async(consumer(chan));
+  }
+  for (int i = 0; i < P; i++) {
+    async(producer(chan, i));
+  }
+  waitgroup_wait(&wg);
+  int64_t ns = bench_now() - start;
+
+  char variant[32];
+  snprintf(variant, sizeof(variant), "%dx%d", P, C);
+  bench_report("free_storm", variant, "libcsp", N, ns);
+  chan_destroy(chan);
+  return 0;
+}
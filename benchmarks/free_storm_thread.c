@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) 2020, Yanhui Shi <lime.syh at gmail dot com>
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "bench.h"
+
+/* `P` producers allocate `N` objects in total with `malloc` and pass them to
+ * `C` consumers which free them. */
+#define N   (1 << 22)
+#define P   4
+#define C   4
+#define CAP 1024
+
+/* The sizes of the objects, from the slabs to the spans of pages. */
+const size_t sizes[] = {16, 48, 128, 512, 2048, 8192};
+#define SIZES_NUM (sizeof(sizes) / sizeof(sizes[0]))
+
+bench_queue_t *queue;
+
+void *producer(void *arg) {
+  int id = (int)(intptr_t)arg;
+  for (int i = 0; i < N / P; i++) {
+    char *obj = malloc(sizes[(i + id) % SIZES_NUM]);
+    if (obj == NULL) {
+      perror("malloc error");
+      exit(EXIT_FAILURE);
+    }
+    obj[0] = (char)i;
+    bench_queue_push(queue, obj);
+  }
+  return NULL;
+}
+
+void *consumer(void *arg) {
+  for (int i = 0; i < N / C; i++) {
+    free(bench_queue_pop(queue));
+  }
+  return NULL;
+}
+
+int main(void) {
+  pthread_t tids[P + C];
+  queue = bench_queue_new(CAP);
+
+  int64_t start = bench_now();
+  for (int i = 0; i < C; i++) {
+    tids[i] = bench_thread_new(consumer, NULL);
+  }
+  for (int i = 0; i < P; i++) {
+    tids[C + i] = bench_thread_new(producer, (void *)(intptr_t)i);
+  }
+  for (int i = 0; i < P + C; i++) {
+    pthread_join(tids[i], NULL);
+  }
+  int64_t ns = bench_now() - start;
+
+  char variant[32];
+  snprintf(variant, sizeof(variant), "%dx%d", P, C);
+  bench_report("free_storm", variant, "thread", N, ns);
+  bench_queue_destroy(queue);
+  return 0;
+}
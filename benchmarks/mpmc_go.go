@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) 2020, Yanhui Shi <lime.syh at gmail dot com>
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+package main
+
+import (
+	"fmt"
+	"sync"
+	"time"
+)
+
+// P producers push N items in total to a channel of CAP slots and C consumers
+// pop them.
+const (
+	N   = 1 << 22
+	P   = 4
+	C   = 4
+	CAP = 1024
+)
+
+func main() {
+	var wg sync.WaitGroup
+	var sums [C]int64
+	ch := make(chan int64, CAP)
+
+	start := time.Now()
+	wg.Add(P + C)
+	for i := 0; i < C; i++ {
+		go func(sum *int64) {
+			for j := 0; j < N/C; j++ {
+				*sum += <-ch
+			}
+			wg.Done()
+		}(&sums[i])
+	}
+	for i := 0; i < P; i++ {
+		go func() {
+			for j := int64(0); j < N/P; j++ {
+				ch <- j
+			}
+			wg.Done()
+		}()
+	}
+	wg.Wait()
+	ns := int64(time.Since(start))
+
+	var sum int64
+	for _, s := range sums {
+		sum += s
+	}
+	if sum != P*(N/P)*(N/P-1)/2 {
+		panic(fmt.Sprintf("wrong sum %d", sum))
+	}
+	report("mpmc", fmt.Sprintf("%dx%d", P, C), N, ns)
+}
@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) 2020, Yanhui Shi <lime.syh at gmail dot com>
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#define csp_without_prefix
+
+#include <libcsp/csp.h>
+#include "bench.h"
+
+/* `P` producers push `N` items in total to a channel of `1 << CAP_EXP` slots
+ * and `C` consumers pop them. The channel is an `mm` one, or an `fc` one with
+ * `MPMC_FC`, see mpmc_fc_libcsp.c. Build with e.g. `CFLAGS="-O3 -DP=16 -DC=16"`
+ * to see how they scale with more cores. */
+#define N       (1 << 22)
+#ifndef P
+#define P       4
+#endif
+#ifndef C
+#define C       4
+#endif
+#define CAP_EXP 10
+
+#ifdef MPMC_FC
+#define KIND    "fc-"
+chan_declare(fc, int64_t, mm);
+chan_define(fc, int64_t, mm);
+#else
+#define KIND    ""
+chan_declare(mm, int64_t, mm);
+chan_define(mm, int64_t, mm);
+#endif
+
+waitgroup_t wg;
+int64_t sums[C];
+
+proc void producer(chan_t(mm) *chan) {
+  for (int64_t i = 0; i < N / P; i++) {
+    chan_push(chan, i);
+  }
+  waitgroup_done(&wg);
+}
+
+proc void consumer(chan_t(mm) *chan, int64_t *sum) {
+  int64_t val;
+  for (int i = 0; i < N / C; i++) {
+    chan_pop(chan, &val);
+    *sum += val;
+  }
+  waitgroup_done(&wg);
+}
+
+int main(void) {
+  chan_t(mm) *chan = chan_new(mm)(CAP_EXP);
+  waitgroup_init(&wg);
+  waitgroup_add(&wg, P + C);
+
+  int64_t start = bench_now();
+  for (int i = 0; i < C; i++) {
+    async(consumer(chan, &sums[i]));
+  }
+  for (int i = 0; i < P; i++) {
+    async(producer(chan));
+  }
+  waitgroup_wait(&wg);
+  int64_t ns = bench_now() - start;
+
+  int64_t sum = 0;
+  for (int i = 0; i < C; i++) {
+    sum += sums[i];
+  }
+  if (sum != (int64_t)P * (N / P) * (N / P - 1) / 2) {
+    fprintf(stderr, "wrong sum %ld\n", (long)sum);
+    exit(EXIT_FAILURE);
+  }
+
+  char variant[32];
+  snprintf(variant, sizeof(variant), KIND "%dx%d", P, C);
+  bench_report("mpmc", variant, "libcsp", N, ns);
+  chan_destroy(chan);
+  return 0;
+}
@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) 2020, Yanhui Shi <lime.syh at gmail dot com>
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "bench.h"
+
+/* `P` producers push `N` items in total to a queue of `CAP` slots and `C`
+ * consumers pop them. */
+#define N   (1 << 22)
+#define P   4
+#define C   4
+#define CAP 1024
+
+bench_queue_t *queue;
+int64_t sums[C];
+
+void *producer(void *arg) {
+  for (intptr_t i = 0; i < N / P; i++) {
+    bench_queue_push(queue, (void *)i);
+  }
+  return NULL;
+}
+
+void *consumer(void *arg) {
+  int64_t *sum = arg;
+  for (int i = 0; i < N / C; i++) {
+    *sum += (intptr_t)bench_queue_pop(queue);
+  }
+  return NULL;
+}
+
+int main(void) {
+  pthread_t tids[P + C];
+  queue = bench_queue_new(CAP);
+
+  int64_t start = bench_now();
+  for (int i = 0; i < C; i++) {
+    tids[i] = bench_thread_new(consumer, &sums[i]);
+  }
+  for (int i = 0; i < P; i++) {
+    tids[C + i] = bench_thread_new(producer, NULL);
+  }
+  for (int i = 0; i < P + C; i++) {
+    pthread_join(tids[i], NULL);
+  }
+  int64_t ns = bench_now() - start;
+
+  int64_t sum = 0;
+  for (int i = 0; i < C; i++) {
+    sum += sums[i];
+  }
+  if (sum != (int64_t)P * (N / P) * (N / P - 1) / 2) {
+    fprintf(stderr, "wrong sum %ld\n", (long)sum);
+    exit(EXIT_FAILURE);
+  }
+
+  char variant[32];
+  snprintf(variant, sizeof(variant), "%dx%d", P, C);
+  bench_report("mpmc", variant, "thread", N, ns);
+  bench_queue_destroy(queue);
+  return 0;
+}
@@ -0,0 +1,47 @@
+/*
+ * Copyright (c) 2020, Yanhui Shi <lime.syh at gmail dot com>
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+package main
+
+import "time"
+
+// The round trips of an item between two goroutines over two channels.
+const N = 1000000
+
+func pingpong(variant string, size int) {
+	ping, pong := make(chan int, size), make(chan int, size)
+	done := make(chan struct{})
+
+	start := time.Now()
+	go func() {
+		for i := 0; i < N; i++ {
+			pong <- <-ping
+		}
+		close(done)
+	}()
+	for i := 0; i < N; i++ {
+		ping <- i
+		<-pong
+	}
+	<-done
+	report("pingpong", variant, N, int64(time.Since(start)))
+}
+
+func main() {
+	pingpong("buffered", 2)
+	pingpong("un", 0)
+}
@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) 2020, Yanhui Shi <lime.syh at gmail dot com>
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#define csp_without_prefix
+
+#include <libcsp/csp.h>
+#include "bench.h"
+
+/* The round trips of an item between two processes over two channels. */
+#define N 1000000
+
+#define pingpong_define(K)                                                     \
+  chan_declare(K, int, K);                                                     \
+  chan_define(K, int, K);                                                      \
+                                                                               \
+  proc void ping_ ## K(chan_t(K) *ping, chan_t(K) *pong) {                     \
+    int val;                                                                   \
+    for (int i = 0; i < N; i++) {                                              \
+      chan_push(ping, i);                                                      \
+      chan_pop(pong, &val);                                                    \
+    }                                                                          \
+  }                                                                            \
+                                                                               \
+  proc void pong_ ## K(chan_t(K) *ping, chan_t(K) *pong) {                     \
+    int val;                                                                   \
+    for (int i = 0; i < N; i++) {                                              \
+      chan_pop(ping, &val);                                                    \
+      chan_push(pong, val);                                                    \
+    }                                                                          \
+  }                                                                            \
+                                                                               \
+  void pingpong_ ## K(void) {                                                  \
+    chan_t(K) *ping = chan_new(K)(1), *pong = chan_new(K)(1);                  \
+    int64_t start = bench_now();                                               \
+    sync(ping_ ## K(ping, pong); pong_ ## K(ping, pong));                      \
+    bench_report("pingpong", #K, "libcsp", N, bench_now() - start);            \
+    chan_destroy(ping);                                                        \
+    chan_destroy(pong);                                                        \
+  }                                                                            \
+
+pingpong_define(ss);
+pingpong_define(sm);
+pingpong_define(ms);
+pingpong_define(mm);
+pingpong_define(un);
+
+int main(void) {
+  pingpong_ss();
+  pingpong_sm();
+  pingpong_ms();
+  pingpong_mm();
+  pingpong_un();
+  return 0;
+}
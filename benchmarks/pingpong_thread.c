@@ -0,0 +1,48 @@
+/*
+ * Copyright (c) 2020, Yanhui Shi <lime.syh at gmail dot com>
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "bench.h"
+
+/* The round trips of an item between two threads over two queues. */
+#define N 1000000
+
+bench_queue_t *ping, *pong;
+
+void *pong_thread(void *arg) {
+  for (int i = 0; i < N; i++) {
+    bench_queue_push(pong, bench_queue_pop(ping));
+  }
+  return NULL;
+}
+
+int main(void) {
+  ping = bench_queue_new(1);
+  pong = bench_queue_new(1);
+
+  int64_t start = bench_now();
+  pthread_t tid = bench_thread_new(pong_thread, NULL);
+  for (intptr_t i = 0; i < N; i++) {
+    bench_queue_push(ping, (void *)i);
+    bench_queue_pop(pong);
+  }
+  pthread_join(tid, NULL);
+  bench_report("pingpong", "mutex", "thread", N, bench_now() - start);
+
+  bench_queue_destroy(ping);
+  bench_queue_destroy(pong);
+  return 0;
+}
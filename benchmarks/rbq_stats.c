@@ -0,0 +1,96 @@
+/*
+ * Copyright (c) 2020, Yanhui Shi <lime.syh at gmail dot com>
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * The false sharing benchmark of the `mptr` flags, i.e. `WRITERS` threads
+ * pushing to and `READERS` threads popping from one `mmrbq`, so that the
+ * writers publish neighbouring slots all the time. It includes `rbq.h`
+ * directly and is built with the layouts of the flags below(see
+ * `csp_rbq_stats_stride_exp` in `rbq.h`):
+ *
+ *  - padded: a cache line per flag, the default,
+ *  - shuffled: 8 flags per line with the shuffled index,
+ *  - packed: 8 flags per line in order, i.e. the false sharing to avoid.
+ *
+ * Run them under `perf c2c record` to compare the HITM events, e.g. `make
+ * benchmark_rbq_stats_c2c`.
+ */
+
+#include "bench.h"
+#include "../src/rbq.h"
+
+#if csp_rbq_stats_stride_exp == 3
+#define VARIANT "padded"
+#elif csp_rbq_stats_shuffle
+#define VARIANT "shuffled"
+#else
+#define VARIANT "packed"
+#endif
+
+#define WRITERS 4
+#define READERS 4
+#define CAP_EXP 10
+#define ITEMS   (1 << 22)
+
+csp_mmrbq_declare(int, int);
+csp_mmrbq_define(int, int);
+
+void csp_sched_yield(void) {}
+
+csp_mmrbq_t(int) *rbq;
+atomic_size_t popped;
+
+void *writer(void *arg) {
+  for (int i = 0; i < ITEMS / WRITERS; i++) {
+    while (!csp_mmrbq_try_push(int)(rbq, i)) {
+      csp_cpu_relax();
+    }
+  }
+  return NULL;
+}
+
+void *reader(void *arg) {
+  int item;
+  while (atomic_load_explicit(&popped, memory_order_relaxed) < ITEMS) {
+    if (csp_mmrbq_try_pop(int)(rbq, &item)) {
+      atomic_fetch_add_explicit(&popped, 1, memory_order_relaxed);
+    } else {
+      csp_cpu_relax();
+    }
+  }
+  return NULL;
+}
+
+int main(void) {
+  if ((rbq = csp_mmrbq_new(int)(CAP_EXP)) == NULL) {
+    perror("csp_mmrbq_new error");
+    exit(EXIT_FAILURE);
+  }
+
+  pthread_t tids[WRITERS + READERS];
+  int64_t start = bench_now();
+  for (int i = 0; i < WRITERS + READERS; i++) {
+    tids[i] = bench_thread_new(i < WRITERS ? writer : reader, NULL);
+  }
+  for (int i = 0; i < WRITERS + READERS; i++) {
+    pthread_join(tids[i], NULL);
+  }
+  bench_report("rbq_stats", VARIANT, "libcsp", ITEMS, bench_now() - start);
+
+  csp_mmrbq_destroy(int)(rbq);
+  return 0;
+}
@@ -0,0 +1,54 @@
+/*
+ * Copyright (c) 2020, Yanhui Shi <lime.syh at gmail dot com>
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+package main
+
+import (
+	"sync"
+	"time"
+)
+
+// Insert N timers and cancel all of them, then insert N timers spread over one
+// millisecond and wait until all of them are fired.
+const N = 1000000
+
+func main() {
+	timers := make([]*time.Timer, N)
+
+	start := time.Now()
+	for i := range timers {
+		timers[i] = time.AfterFunc(time.Hour, func() {})
+	}
+	mid := time.Now()
+	for i, t := range timers {
+		if !t.Stop() {
+			panic(i)
+		}
+	}
+	report("timer", "insert", N, int64(mid.Sub(start)))
+	report("timer", "cancel", N, int64(time.Since(mid)))
+
+	var wg sync.WaitGroup
+	wg.Add(N)
+	start = time.Now()
+	for i := range timers {
+		d := time.Millisecond + time.Duration(i%1000)*time.Microsecond
+		timers[i] = time.AfterFunc(d, wg.Done)
+	}
+	wg.Wait()
+	report("timer", "fire", N, int64(time.Since(start)))
+}
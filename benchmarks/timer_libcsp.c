@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) 2020, Yanhui Shi <lime.syh at gmail dot com>
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#define csp_without_prefix
+
+#include <libcsp/csp.h>
+#include "bench.h"
+
+/* Insert `N` timers and cancel all of them, then insert `N` timers spread over
+ * one millisecond and wait until all of them are fired. */
+#define N 1000000
+
+waitgroup_t wg;
+timer_t timers[N];
+
+proc void noop(void) {}
+
+proc void fire(void) {
+  waitgroup_done(&wg);
+}
+
+int main(void) {
+  int64_t start = bench_now();
+  for (int i = 0; i < N; i++) {
+    timers[i] = timer_after(timer_hour, noop());
+  }
+  int64_t mid = bench_now();
+  for (int i = 0; i < N; i++) {
+    if (!timer_cancel(timers[i])) {
+      fprintf(stderr, "failed to cancel the timer %d\n", i);
+      exit(EXIT_FAILURE);
+    }
+  }
+  int64_t end = bench_now();
+  bench_report("timer", "insert", "libcsp", N, mid - start);
+  bench_report("timer", "cancel", "libcsp", N, end - mid);
+
+  waitgroup_init(&wg);
+  waitgroup_add(&wg, N);
+  start = bench_now();
+  timer_time_t when = timer_now() + timer_millisecond;
+  for (int i = 0; i < N; i++) {
+    timers[i] = timer_at(when + i % 1000 * timer_microsecond, fire());
+  }
+  waitgroup_wait(&wg);
+  bench_report("timer", "fire", "libcsp", N, bench_now() - start);
+  return 0;
+}
@@ -0,0 +1,193 @@
+/*
+ * Copyright (c) 2020, Yanhui Shi <lime.syh at gmail dot com>
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <semaphore.h>
+#include <stdatomic.h>
+#include "bench.h"
+
+/* Insert `N` timers and cancel all of them, then insert `N` timers spread over
+ * one millisecond and wait until all of them are fired. */
+#define N 1000000
+
+/*
+ * The pthread programs usually run the timers in a dedicated thread: a binary
+ * heap guarded by a mutex and the thread waits on a condition until the
+ * earliest deadline or a new earlier timer.
+ */
+typedef struct {
+  int64_t when;
+  size_t idx;
+  void (*fn)(void);
+} timer_entry_t;
+
+#define timer_none SIZE_MAX
+
+struct {
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  timer_entry_t **heap;
+  size_t len;
+  bool stop;
+} timers;
+
+timer_entry_t entries[N];
+
+static void timer_swap(size_t i, size_t j) {
+  timer_entry_t *t = timers.heap[i];
+  timers.heap[i] = timers.heap[j];
+  timers.heap[j] = t;
+  timers.heap[i]->idx = i;
+  timers.heap[j]->idx = j;
+}
+
+static void timer_sift_up(size_t i) {
+  while (i > 0 && timers.heap[(i - 1) / 2]->when > timers.heap[i]->when) {
+    timer_swap(i, (i - 1) / 2);
+    i = (i - 1) / 2;
+  }
+}
+
+static void timer_sift_down(size_t i) {
+  while (true) {
+    size_t min = i, l = i * 2 + 1, r = i * 2 + 2;
+    if (l < timers.len && timers.heap[l]->when < timers.heap[min]->when) {
+      min = l;
+    }
+    if (r < timers.len && timers.heap[r]->when < timers.heap[min]->when) {
+      min = r;
+    }
+    if (min == i) {
+      return;
+    }
+    timer_swap(i, min);
+    i = min;
+  }
+}
+
+static void timer_remove(size_t i) {
+  timers.heap[i]->idx = timer_none;
+  if (i != --timers.len) {
+    timers.heap[i] = timers.heap[timers.len];
+    timers.heap[i]->idx = i;
+    timer_sift_down(i);
+    timer_sift_up(i);
+  }
+}
+
+void timer_add(timer_entry_t *t, int64_t when, void (*fn)(void)) {
+  t->when = when;
+  t->fn = fn;
+  pthread_mutex_lock(&timers.mutex);
+  t->idx = timers.len;
+  timers.heap[timers.len++] = t;
+  timer_sift_up(t->idx);
+  if (t->idx == 0) {
+    pthread_cond_signal(&timers.cond);
+  }
+  pthread_mutex_unlock(&timers.mutex);
+}
+
+bool timer_cancel(timer_entry_t *t) {
+  pthread_mutex_lock(&timers.mutex);
+  bool ok = t->idx != timer_none;
+  if (ok) {
+    timer_remove(t->idx);
+  }
+  pthread_mutex_unlock(&timers.mutex);
+  return ok;
+}
+
+void *timer_loop(void *arg) {
+  pthread_mutex_lock(&timers.mutex);
+  while (!timers.stop) {
+    if (timers.len == 0) {
+      pthread_cond_wait(&timers.cond, &timers.mutex);
+      continue;
+    }
+    timer_entry_t *t = timers.heap[0];
+    if (t->when > bench_now()) {
+      struct timespec ts = {
+        .tv_sec = t->when / 1000000000, .tv_nsec = t->when % 1000000000
+      };
+      pthread_cond_timedwait(&timers.cond, &timers.mutex, &ts);
+      continue;
+    }
+    timer_remove(0);
+    pthread_mutex_unlock(&timers.mutex);
+    t->fn();
+    pthread_mutex_lock(&timers.mutex);
+  }
+  pthread_mutex_unlock(&timers.mutex);
+  return NULL;
+}
+
+atomic_int fired;
+sem_t done;
+
+void noop(void) {}
+
+void fire(void) {
+  if (atomic_fetch_add(&fired, 1) + 1 == N) {
+    sem_post(&done);
+  }
+}
+
+int main(void) {
+  pthread_condattr_t attr;
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&timers.cond, &attr);
+  pthread_mutex_init(&timers.mutex, NULL);
+  timers.heap = malloc(N * sizeof(timer_entry_t *));
+  sem_init(&done, 0, 0);
+  if (timers.heap == NULL) {
+    perror("malloc error");
+    exit(EXIT_FAILURE);
+  }
+  pthread_t tid = bench_thread_new(timer_loop, NULL);
+
+  int64_t start = bench_now();
+  for (int i = 0; i < N; i++) {
+    timer_add(&entries[i], bench_now() + 3600 * (int64_t)1000000000, noop);
+  }
+  int64_t mid = bench_now();
+  for (int i = 0; i < N; i++) {
+    if (!timer_cancel(&entries[i])) {
+      fprintf(stderr, "failed to cancel the timer %d\n", i);
+      exit(EXIT_FAILURE);
+    }
+  }
+  int64_t end = bench_now();
+  bench_report("timer", "insert", "thread", N, mid - start);
+  bench_report("timer", "cancel", "thread", N, end - mid);
+
+  start = bench_now();
+  int64_t when = start + 1000000;
+  for (int i = 0; i < N; i++) {
+    timer_add(&entries[i], when + i % 1000 * 1000, fire);
+  }
+  sem_wait(&done);
+  bench_report("timer", "fire", "thread", N, bench_now() - start);
+
+  pthread_mutex_lock(&timers.mutex);
+  timers.stop = true;
+  pthread_cond_signal(&timers.cond);
+  pthread_mutex_unlock(&timers.mutex);
+  pthread_join(tid, NULL);
+  free(timers.heap);
+  return 0;
+}
@@ -25,16 +25,16 @@ chan_define(mm, int, mm);
 
 proc void consumer(chan_t(mm) *chan, int id) {
   int num = 0;
-  while (true) {
-    chan_pop(chan, &num);
+  /* `chan_pop` fails once the channel is closed and drained. */
+  while (chan_pop(chan, &num)) {
     printf("consumer %d received %d\n", id, num);
   }
+  printf("consumer %d exits\n", id);
 }
 
 proc void producer(chan_t(mm) *chan, int id, int factor) {
   int num = 0;
-  while (true) {
-    chan_push(chan, num * factor);
+  while (chan_push(chan, num * factor)) {
     printf("producer %d sent %d\n", id, num++ * factor);
   }
 }
@@ -50,6 +50,10 @@ int main(void) {
   );
 
   hangup(timer_second * 10);
+
+  /* Closing wakes up all producers and consumers at once. */
+  chan_close(chan);
+  hangup(timer_millisecond);
   chan_destroy(chan);
 
   return 0;
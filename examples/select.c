@@ -31,27 +31,19 @@ chan_define(mm, char, char);
 proc void choose(chan_t(int) *chn1, chan_t(char) *chn2) {
   srand(time(NULL));
 
-  /* We can make the simulation of `select` in golang. The only drawback of this
-   * simulation is the priority. We always check the channels by the order of
-   * which we write in the source code. But it's enough in most cases. */
+  /* `csp_select` parks the process until one of the cases is ready, and the
+   * cases are tried in a random order so none of them starves. */
   while (true) {
-    bool ok = false;
-
     int num;
-    if (csp_chan_try_pop(chn1, &num)) {
-      printf("chn1 received number %d\n", num);
-      ok = true;
-    }
-
-    if (csp_chan_try_push(chn2, rand() & 0x7f)) {
-      ok = true;
-    }
+    char chr = rand() & 0x7f;
 
-    /* If all channels failed, it's up to you to give up the control of the CPU
-     * or break the loop or do some other things. Actually it's the `default`
-     * case of the `select`. */
-    if (!ok) {
-      yield();
+    switch (csp_select(select_block,
+        select_recv(chn1, &num), select_send(chn2, &chr))) {
+      case 0:
+        printf("chn1 received number %d\n", num);
+        break;
+      case 1:
+        break;
     }
   }
 }
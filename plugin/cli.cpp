@@ -45,7 +45,9 @@ const std::string cli_usage = (
   "    file `config.c`. Libcsp plugin will generate the function stack frame \n"
   "    size to files with extension .sf and the function call graph to files \n"
   "    with extension .cg. This command will analyze the memory usage of all \n"
-  "    processes according to these files. You can set some configurations   \n"
+  "    processes according to these files. The results are saved to          \n"
+  "    `analyzer.idx` and only the functions whose frames or callees changed \n"
+  "    since the last run are analyzed again. You can set some configurations\n"
   "    with the following options:                                           \n"
   "                                                                          \n"
   "    Options:                                                              \n"
@@ -56,7 +58,9 @@ const std::string cli_usage = (
   "        install libcsp from source. Default is `/usr/local/`.             \n"
   "      --extra-su-file:                                                    \n"
   "        The extra stack usage file. The format of every line in it is `fn \n"
-  "        size`(e.g. `main 64`). It's used first if it's set.               \n"
+  "        size`(e.g. `main 64`). It's used first if it's set. A line `fn    \n"
+  "        elastic` makes the processes calling `fn` use elastic stacks if   \n"
+  "        `--elastic-stack-size` is set.                                    \n"
   "      --default-stack-size:                                               \n"
   "        The default stack size for an unknown function. Default is 2KB.   \n"
   "      --cpu-cores:                                                        \n"
@@ -67,9 +71,28 @@ const std::string cli_usage = (
   "      --max-procs-hint:                                                   \n"
   "        The hint of the max processes. Libcsp will initialize related     \n"
   "        resource according to it. Default is 100000.                      \n"
+  "      --spin-budget:                                                      \n"
+  "        The max number of spins an idle thread takes before it parks in   \n"
+  "        the kernel. Default is 1024.                                      \n"
+  "      --timer-slot:                                                       \n"
+  "        The time span in nanoseconds of a timing wheel slot, i.e. the     \n"
+  "        precision of timers when libcsp is configured with                \n"
+  "        `--with-timer-wheel`. Default is 1000000(1ms).                    \n"
+  "      --mem-retain:                                                       \n"
+  "        The bytes of free memory each core keeps before it returns the    \n"
+  "        rest to the OS. Default is 16777216(16MB).                        \n"
+  "      --elastic-stack-size:                                               \n"
+  "        The size of the guard-paged stacks reserved for the processes     \n"
+  "        whose stack usages are unknown, e.g. the recursive ones. Their    \n"
+  "        memory is only taken when used. Default is 0 which disables them. \n"
+  "      --time-slice:                                                       \n"
+  "        The time in nanoseconds a process may run before it's preempted,  \n"
+  "        e.g. 10000000(10ms). Every process stack grows by 4KB for it.     \n"
+  "        Default is 0 which disables the preemption.                       \n"
   "                                                                          \n"
   "  clean:                                                                  \n"
-  "    Clear related generated files in the working directory.               \n"
+  "    Clear related generated files in the working directory. The analyzer  \n"
+  "    index `analyzer.idx` is kept to speed up the next analysis.           \n"
   "                                                                          \n"
   "    Options:                                                              \n"
   "      --working-dir:                                                      \n"
@@ -115,6 +138,11 @@ struct option cli_cmd_analyze_options[] = {
   {"cpu-cores",           optional_argument, NULL, 0},
   {"max-threads",         optional_argument, NULL, 0},
   {"max-procs-hint",      optional_argument, NULL, 0},
+  {"spin-budget",         optional_argument, NULL, 0},
+  {"timer-slot",          optional_argument, NULL, 0},
+  {"mem-retain",          optional_argument, NULL, 0},
+  {"elastic-stack-size",  optional_argument, NULL, 0},
+  {"time-slice",          optional_argument, NULL, 0},
   {NULL,                  no_argument,       NULL, 0}
 };
 
@@ -199,6 +227,21 @@ public:
         case 7:
           options.max_procs_hint = num;
           break;
+        case 8:
+          options.spin_budget = num;
+          break;
+        case 9:
+          options.timer_slot = num;
+          break;
+        case 10:
+          options.mem_retain = num;
+          break;
+        case 11:
+          options.elastic_stack_size = num;
+          break;
+        case 12:
+          options.time_slice = num;
+          break;
         }
       }
     }
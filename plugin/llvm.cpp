@@ -0,0 +1,875 @@
+/*
+ * Copyright (c) 2020, Yanhui Shi <lime.syh at gmail dot com>
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * The LLVM version of libcsp plugin, loaded by clang with `-fpass-plugin`.
+ *
+ * It does the same work as the GCC plugin on the LLVM IR. The processes are
+ * wrapped at the start of the pipeline, i.e. before the inlining and in the
+ * pre-link step of LTO. The call graph and the stack frame of a function are
+ * recorded when the backend lays out its frame, so they describe the code
+ * which is really emitted, after the inlining of LTO if any.
+ */
+
+/* Libtool defines `PIC` which is a parameter name in the LLVM headers. */
+#undef PIC
+
+#include "llvm/ADT/Triple.h"
+#include "llvm/IR/DiagnosticHandler.h"
+#include "llvm/IR/DiagnosticInfo.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/InlineAsm.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/PassManager.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Passes/PassPlugin.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Transforms/Utils/Local.h"
+#include "fs.hpp"
+#include "namer.hpp"
+#include "sa.hpp"
+#include <cstdio>
+#include <iostream>
+#include <mutex>
+#include <unordered_map>
+
+/* Since the plugin is loaded after clang parses `-mllvm`, these options only
+ * work when the plugin is loaded by `-fplugin` too. */
+static llvm::cl::opt<bool> opt_building_libcsp(
+  "csp-building-libcsp", llvm::cl::desc("Whether we are building libcsp"),
+  llvm::cl::init(false)
+);
+
+static llvm::cl::opt<std::string> opt_installed_prefix(
+  "csp-installed-prefix", llvm::cl::desc("The prefix libcsp is installed to"),
+  llvm::cl::init(csp::default_installed_prefix)
+);
+
+static llvm::cl::opt<std::string> opt_working_dir(
+  "csp-working-dir", llvm::cl::desc("The working directory of libcsp"),
+  llvm::cl::init(csp::default_working_dir)
+);
+
+namespace csp {
+
+const std::string main                  = "main";
+const std::string csp_main              = "csp_main";
+const std::string csp_proc_nchild_set   = "csp_proc_nchild_set";
+const std::string csp_proc_new          = "csp_proc_new";
+const std::string csp_sched_proc_anchor = "csp_sched_proc_anchor";
+const std::string csp_sched_put_proc    = "csp_sched_put_proc";
+const std::string csp_sched_put_timer   = "csp_sched_put_timer";
+const std::string csp_sched_yield       = "csp_sched_yield";
+const std::string csp_timer_anchor      = "csp_timer_anchor";
+
+/* The remark the backend emits after it lays out the stack frame. */
+const std::string remark_pass_name      = "prologepilog";
+const std::string remark_name           = "StackSize";
+const std::string remark_arg_name       = "NumStackBytes";
+
+typedef enum {
+  TYPE_ASYNC_PROC,
+  TYPE_SYNC_PROC,
+  TYPE_MAIN_PROC,
+  TYPE_TIMER_PROC,
+  TYPE_MAIN_FUNC
+} build_type_t;
+
+/* The namer and the analyzer are shared by the modules of the LTO backends,
+ * which run in parallel. */
+std::mutex session_lock;
+
+class session_t {
+public:
+  session_t(): is_initialized(false) {}
+
+  void initialize(void) {
+    std::lock_guard<std::mutex> guard(session_lock);
+    if (this->is_initialized) {
+      return;
+    }
+
+    for (auto opt: {&opt_installed_prefix, &opt_working_dir}) {
+      if (opt->getNumOccurrences() > 0 && !filesystem_t::exist(*opt)) {
+        std::cerr << err_prefix << *opt << " doesn't exist." << std::endl;
+        exit(EXIT_FAILURE);
+      }
+    }
+
+    namer.initialize(opt_building_libcsp, opt_installed_prefix, opt_working_dir);
+    analyzer.set_working_dir(opt_working_dir);
+    this->is_initialized = true;
+  }
+
+  /* Clang exits without destroying the LLVM context, so we save the outputs
+   * when the plugin is unloaded. */
+  ~session_t() {
+    if (this->is_initialized) {
+      namer.save();
+      analyzer.save();
+    }
+  }
+
+private:
+  bool is_initialized;
+} session;
+
+std::string get_callee_name(const llvm::CallBase *call) {
+  auto fn = llvm::dyn_cast<llvm::Function>(
+    call->getCalledOperand()->stripPointerCasts()
+  );
+  return fn == nullptr ? "" : fn->getName().str();
+}
+
+/* The calls computing the arguments of a task return values or fill the
+ * memory of `sret`, while the tasks discard their results. */
+bool is_task(const llvm::CallBase *call) {
+  auto fn = call->getCalledFunction();
+  return (fn == nullptr || !fn->isIntrinsic()) && !call->isInlineAsm() &&
+    call->use_empty() && !call->hasStructRetAttr();
+}
+
+/* The instruction executed after `inst` if they are on a straight line. */
+llvm::Instruction *next_inst(llvm::Instruction *inst) {
+  if (auto br = llvm::dyn_cast<llvm::BranchInst>(inst)) {
+    return br->isUnconditional() ? &br->getSuccessor(0)->front() : nullptr;
+  }
+  if (auto invoke = llvm::dyn_cast<llvm::InvokeInst>(inst)) {
+    return &invoke->getNormalDest()->front();
+  }
+  return inst->getNextNode();
+}
+
+/* The next call after `inst` on a straight line. */
+llvm::CallBase *next_call(llvm::Instruction *inst) {
+  while ((inst = next_inst(inst)) != nullptr) {
+    if (auto call = llvm::dyn_cast<llvm::CallBase>(inst)) {
+      if (!llvm::isa<llvm::DbgInfoIntrinsic>(call)) {
+        return call;
+      }
+    }
+  }
+  return nullptr;
+}
+
+class proc_builder_t {
+public:
+  proc_builder_t(llvm::Module &module): module(module) {}
+
+  /*
+   * Build the wrapper function body in pure assembly language, see
+   * `proc_builder_t::build_fn_body` of `plugin/proc.hpp`. The only difference
+   * is that the wrapped function is passed to the asm statement with operand
+   * `${0:c}` so that it's still right after LTO renames a local function.
+   *
+   * An immediate starts with `$$` cause `$` leads an operand in LLVM.
+   */
+  std::string build_fn_body(build_type_t build_type, int args_len,
+      int &stack_frame, int &proc_reserved) {
+    std::string buff;
+    char instr[256];
+
+    if (build_type == TYPE_MAIN_FUNC) {
+      buff.append(
+        "push %rbp\n"
+        "call ${0:c}\n"
+        "call csp_core_start_main@plt\n"
+      );
+      return buff;
+    }
+
+    const char* pushes[6] = {
+      "push %rdi\n",
+      "push %rsi\n",
+      "push %rdx\n",
+      "push %rcx\n",
+      "push %r8\n",
+      "push %r9\n"
+    };
+
+    const char *pops[6] = {
+      "popq 0x18(%rdi)\n",
+      "popq 0x20(%rdi)\n",
+      "popq 0x28(%rdi)\n",
+      "popq 0x30(%rdi)\n",
+      "popq 0x38(%rdi)\n",
+      "popq 0x40(%rdi)\n"
+    };
+
+    stack_frame = 0;
+
+    bool need_padding = args_len > 6 || (args_len & 0x01) == 0;
+    if (need_padding) {
+      buff.append("push %rbp\n");
+      stack_frame += 8;
+    }
+
+    for (int i = (args_len < 6 ? args_len : 6) - 1; i >= 0; i--) {
+      buff.append(pushes[i]);
+      stack_frame += 8;
+    }
+
+    buff.insert(buff.length(), instr, sprintf(instr,
+      "mov $$0x%x, %%rdi\n"
+      "mov $$%d, %%rsi\n",
+      namer.current_id(), build_type == TYPE_SYNC_PROC
+    ));
+
+    buff.append(
+      "call csp_proc_new@plt\n"
+      "mov  %rax, %rdi\n"
+      "stmxcsr 0x48(%rdi)\n"
+      "fstcw   0x4c(%rdi)\n"
+    );
+
+    for (int i = 0, total = args_len < 6 ? args_len : 6; i < total; i++) {
+      buff.append(pops[i]);
+    }
+
+    if (build_type == TYPE_TIMER_PROC) {
+      if (args_len <= 6) {
+        buff.insert(buff.length(), instr, sprintf(instr,
+          "mov 0x%x(%%rdi), %%rax\n", 0x18 + ((args_len - 1) << 3)
+        ));
+      } else {
+        buff.insert(buff.length(), instr, sprintf(instr,
+          "mov 0x%x(%%rsp), %%rax\n", (args_len - 5) << 3
+        ));
+      }
+      buff.append("mov %rax, 0x50(%rdi)\n");
+    }
+
+    int rsv_num = 1;
+    if (args_len > 6) {
+      rsv_num += args_len - 6;
+    }
+    rsv_num += !(rsv_num & 0x01);
+
+    buff.append("mov 0x08(%rdi), %rax\n");
+    buff.insert(buff.length(), instr, sprintf(instr,
+      "sub $$0x%x, %%rax\n", rsv_num << 3
+    ));
+    buff.append("mov %rax, 0x00(%rdi)\n");
+
+    for (int i = args_len - 6; i >= 1; i--) {
+      buff.insert(buff.length(), instr, sprintf(instr,
+        "mov 0x%x(%%rsp), %%rsi\n"
+        "mov %%rsi, 0x%x(%%rax)\n",
+        (i + 1) << 3, i << 3
+      ));
+    }
+
+    buff.append(
+      "lea 0f(%rip), %rsi\n"
+      "mov %rsi, (%rax)\n"
+    );
+
+    if (!need_padding) {
+      buff.append("push %rbp\n");
+      stack_frame += 8;
+    }
+
+    buff.append(build_type == TYPE_TIMER_PROC ?
+      "call csp_sched_put_timer@plt\n" :
+      "call csp_sched_put_proc@plt\n"
+    );
+    buff.append(
+      "pop %rbp\n"
+      "retq\n"
+      "0: call ${0:c}@plt\n"
+    );
+    buff.append(build_type == TYPE_MAIN_PROC ?
+      "mov %rax, %rdi\n"
+      "call exit@plt\n" :
+      "call csp_core_proc_exit@plt\n"
+    );
+
+    proc_reserved = rsv_num << 3;
+    return buff;
+  }
+
+  /* The AArch64 version of `build_fn_body`, see `build_fn_body_aarch64` of
+   * `plugin/proc.hpp`. */
+  std::string build_fn_body_aarch64(build_type_t build_type, int args_len,
+      int &stack_frame, int &proc_reserved) {
+    std::string buff;
+    char instr[256];
+
+    buff.append("stp x29, x30, [sp, #-16]!\n");
+
+    if (build_type == TYPE_MAIN_FUNC) {
+      buff.append(
+        "bl ${0:c}\n"
+        "bl csp_core_start_main\n"
+      );
+      return buff;
+    }
+
+    int regs_len = args_len < 8 ? args_len : 8;
+    int stack_len = args_len - regs_len;
+
+    int regs_frame = ((regs_len + 1) >> 1) << 4;
+    stack_frame = 16 + regs_frame;
+    if (regs_frame > 0) {
+      buff.insert(buff.length(), instr, sprintf(instr,
+        "sub sp, sp, #0x%x\n", regs_frame
+      ));
+    }
+    for (int i = 0; i < regs_len; i += 2) {
+      buff.insert(buff.length(), instr, sprintf(instr,
+        "stp x%d, x%d, [sp, #0x%x]\n", i, i + 1, i << 3
+      ));
+    }
+
+    buff.insert(buff.length(), instr, sprintf(instr,
+      "mov x0, #0x%x\n"
+      "mov x1, #%d\n"
+      "bl  csp_proc_new\n"
+      "mrs x9, fpcr\n"
+      "str w9, [x0, #0xb0]\n",
+      namer.current_id(), build_type == TYPE_SYNC_PROC
+    ));
+
+    for (int i = 0; i < regs_len; i += 2) {
+      buff.insert(buff.length(), instr, sprintf(instr,
+        "ldp x9, x10, [sp, #0x%x]\n"
+        "stp x9, x10, [x0, #0x%x]\n",
+        i << 3, 0x18 + (i << 3)
+      ));
+    }
+    if (regs_frame > 0) {
+      buff.insert(buff.length(), instr, sprintf(instr,
+        "add sp, sp, #0x%x\n", regs_frame
+      ));
+    }
+
+    if (build_type == TYPE_TIMER_PROC) {
+      if (stack_len == 0) {
+        buff.insert(buff.length(), instr, sprintf(instr,
+          "ldr x9, [x0, #0x%x]\n", 0x18 + ((args_len - 1) << 3)
+        ));
+      } else {
+        buff.insert(buff.length(), instr, sprintf(instr,
+          "ldr x9, [sp, #0x%x]\n", 16 + ((stack_len - 1) << 3)
+        ));
+      }
+      buff.append("str x9, [x0, #0xb8]\n");
+    }
+
+    proc_reserved = ((stack_len + 1) >> 1) << 4;
+
+    buff.append("ldr x9, [x0, #0x08]\n");
+    if (proc_reserved > 0) {
+      buff.insert(buff.length(), instr, sprintf(instr,
+        "sub x9, x9, #0x%x\n", proc_reserved
+      ));
+    }
+    buff.append("str x9, [x0, #0x00]\n");
+
+    for (int i = 0; i < stack_len; i++) {
+      buff.insert(buff.length(), instr, sprintf(instr,
+        "ldr x10, [sp, #0x%x]\n"
+        "str x10, [x9, #0x%x]\n",
+        16 + (i << 3), i << 3
+      ));
+    }
+
+    buff.append(
+      "adr x10, 0f\n"
+      "str x10, [x0, #0x68]\n"
+    );
+    buff.append(build_type == TYPE_TIMER_PROC ?
+      "bl  csp_sched_put_timer\n" :
+      "bl  csp_sched_put_proc\n"
+    );
+    buff.append(
+      "ldp x29, x30, [sp], #16\n"
+      "ret\n"
+      "0: bl ${0:c}\n"
+    );
+    buff.append(build_type == TYPE_MAIN_PROC ?
+      "bl exit\n" : "bl csp_core_proc_exit\n"
+    );
+
+    return buff;
+  }
+
+  namer_type_t get_namer_type(build_type_t build_type) {
+    switch (build_type) {
+    case TYPE_ASYNC_PROC:
+      return NAMER_TYPE_ASYNC;
+    case TYPE_SYNC_PROC:
+      return NAMER_TYPE_SYNC;
+    case TYPE_TIMER_PROC:
+      return NAMER_TYPE_TIMER;
+    default:
+      return NAMER_TYPE_OTHER;
+    }
+  }
+
+  /* Wrap the called function `wrapped_fn` whose type and parameter attributes
+   * at the call site are `fn_type` and `attrs`. The wrapper of a timer takes
+   * the timestamp as its last argument. */
+  llvm::Function *build_fn(build_type_t build_type, llvm::Function *wrapped_fn,
+      llvm::FunctionType *fn_type, llvm::AttributeList attrs) {
+    auto &ctx = this->module.getContext();
+    auto is_main_func = build_type == TYPE_MAIN_FUNC;
+
+    auto namer_type = this->get_namer_type(build_type);
+    auto fn_name = is_main_func ? main : wrapped_fn->getName().str();
+    auto cache_key = fn_name + ":" + namer_type_labels[namer_type];
+
+    auto it = this->fn_cache.find(cache_key);
+    if (it != this->fn_cache.end()) {
+      return it->second;
+    }
+
+    if (!is_main_func) {
+      fn_name = namer.next_name(fn_name, namer_type);
+    }
+
+    std::vector<llvm::Type *> params(
+      fn_type->param_begin(), fn_type->param_end()
+    );
+    std::vector<llvm::AttributeSet> params_attrs;
+    for (size_t i = 0; i < params.size(); i++) {
+      params_attrs.push_back(attrs.getParamAttrs(i));
+    }
+    if (build_type == TYPE_TIMER_PROC) {
+      params.push_back(llvm::Type::getInt64Ty(ctx));
+      params_attrs.push_back(llvm::AttributeSet());
+    }
+
+    /* For compatibility, we set the return type of wrapper function to `int`
+     * as the GCC plugin. */
+    auto fn = llvm::Function::Create(
+      llvm::FunctionType::get(llvm::Type::getInt32Ty(ctx), params, false),
+      llvm::GlobalValue::ExternalLinkage, fn_name, this->module
+    );
+    fn->setAttributes(llvm::AttributeList::get(
+      ctx, llvm::AttributeSet(), llvm::AttributeSet(), params_attrs
+    ));
+    fn->addFnAttr(llvm::Attribute::Naked);
+    fn->addFnAttr(llvm::Attribute::NoInline);
+    fn->addFnAttr(llvm::Attribute::NoUnwind);
+
+    int stack_frame = 0, proc_reserved = 0;
+    std::string buff;
+    llvm::Triple triple(this->module.getTargetTriple());
+    if (triple.getArch() == llvm::Triple::aarch64) {
+      buff = this->build_fn_body_aarch64(
+        build_type, params.size(), stack_frame, proc_reserved
+      );
+    } else if (triple.getArch() == llvm::Triple::x86_64) {
+      buff = this->build_fn_body(
+        build_type, params.size(), stack_frame, proc_reserved
+      );
+    } else {
+      std::cerr << err_prefix << "unsupported target "
+        << triple.str() << "." << std::endl;
+      exit(EXIT_FAILURE);
+    }
+
+    llvm::IRBuilder<> builder(llvm::BasicBlock::Create(ctx, "", fn));
+    builder.CreateCall(llvm::InlineAsm::get(
+      llvm::FunctionType::get(
+        builder.getVoidTy(), {wrapped_fn->getType()}, false
+      ), buff, "X", true
+    ), {wrapped_fn});
+    builder.CreateUnreachable();
+
+    if (!is_main_func) {
+      stack_usage_t su;
+      su.type = MANUALLY;
+      su.frame_size = stack_frame;
+      su.proc_reserved = proc_reserved;
+      analyzer.add_stack_usage(fn_name, su);
+      analyzer.add_call(fn_name, csp_proc_new);
+      analyzer.add_call(fn_name,
+        build_type == TYPE_TIMER_PROC ? csp_sched_put_timer : csp_sched_put_proc
+      );
+    }
+
+    this->fn_cache[cache_key] = fn;
+    return fn;
+  }
+
+  /* Replace the task `call` with the call of its wrapper function. */
+  void build_call(build_type_t build_type, llvm::CallBase *call,
+      llvm::Value *when) {
+    auto wrapped_fn = llvm::dyn_cast<llvm::Function>(
+      call->getCalledOperand()->stripPointerCasts()
+    );
+    if (wrapped_fn == nullptr) {
+      std::cerr << err_prefix
+        << "The tasks of libcsp should call the functions directly."
+        << std::endl;
+      exit(EXIT_FAILURE);
+    }
+
+    /* The wrapper never throws, so we don't need to unwind from it. */
+    if (auto invoke = llvm::dyn_cast<llvm::InvokeInst>(call)) {
+      call = llvm::changeToCall(invoke);
+    }
+
+    auto fn = this->build_fn(
+      build_type, wrapped_fn, call->getFunctionType(), call->getAttributes()
+    );
+
+    std::vector<llvm::Value *> args(call->arg_begin(), call->arg_end());
+    if (when != nullptr) {
+      args.push_back(when);
+    }
+
+    auto new_call = llvm::CallInst::Create(fn, args, "", call);
+    new_call->setAttributes(fn->getAttributes().removeFnAttributes(
+      this->module.getContext()
+    ));
+    new_call->setDebugLoc(call->getDebugLoc());
+    call->eraseFromParent();
+  }
+
+  void build_proc_entry(llvm::CallBase *anchor, bool is_sync) {
+    auto nchild_set = next_call(anchor);
+    if (nchild_set == nullptr ||
+        get_callee_name(nchild_set) != csp_proc_nchild_set) {
+      std::cerr << err_prefix
+        << "It must be the call " << csp_proc_nchild_set
+        << " immediately after " << csp_sched_proc_anchor
+        << std::endl;
+      exit(EXIT_FAILURE);
+    }
+
+    /* Collect the tasks until `csp_sched_yield()`. */
+    std::vector<llvm::CallBase *> tasks;
+    auto yield = next_call(nchild_set);
+    for (; yield != nullptr; yield = next_call(yield)) {
+      if (get_callee_name(yield) == csp_sched_yield) {
+        break;
+      }
+      if (is_task(yield)) {
+        tasks.push_back(yield);
+      }
+    }
+    if (yield == nullptr) {
+      std::cerr << err_prefix
+        << "Tasks in `csp_async` or `csp_sync` should be straight-line calls."
+        << std::endl;
+      exit(EXIT_FAILURE);
+    }
+
+    anchor->eraseFromParent();
+
+    /* Remove the whole block if no task found. */
+    if (tasks.size() == 0) {
+      nchild_set->eraseFromParent();
+      yield->eraseFromParent();
+      return;
+    }
+
+    if (is_sync) {
+      nchild_set->setArgOperand(0, llvm::ConstantInt::get(
+        nchild_set->getArgOperand(0)->getType(), tasks.size()
+      ));
+    } else {
+      nchild_set->eraseFromParent();
+      yield->eraseFromParent();
+    }
+
+    for (auto task: tasks) {
+      this->build_call(
+        is_sync ? TYPE_SYNC_PROC : TYPE_ASYNC_PROC, task, nullptr
+      );
+    }
+  }
+
+  void build_timer_entry(llvm::CallBase *anchor) {
+    auto task = next_call(anchor);
+    while (task != nullptr && !is_task(task)) {
+      task = next_call(task);
+    }
+    if (task == nullptr) {
+      std::cerr << err_prefix
+        << "It must be a call immediately after " << csp_timer_anchor << "."
+        << std::endl;
+      exit(EXIT_FAILURE);
+    }
+
+    this->build_call(TYPE_TIMER_PROC, task, anchor->getArgOperand(0));
+    anchor->eraseFromParent();
+  }
+
+  bool build(llvm::Function &fn) {
+    std::vector<std::pair<llvm::CallBase *, std::string>> anchors;
+    for (auto &bb: fn) {
+      for (auto &inst: bb) {
+        if (auto call = llvm::dyn_cast<llvm::CallBase>(&inst)) {
+          auto name = get_callee_name(call);
+          if (name == csp_sched_proc_anchor || name == csp_timer_anchor) {
+            anchors.push_back({call, name});
+          }
+        }
+      }
+    }
+
+    for (auto &pair: anchors) {
+      if (pair.second == csp_timer_anchor) {
+        this->build_timer_entry(pair.first);
+        continue;
+      }
+
+      auto need_sync = llvm::dyn_cast<llvm::ConstantInt>(
+        pair.first->getArgOperand(0)
+      );
+      if (need_sync == nullptr) {
+        std::cerr << err_prefix << "The argument of "
+          << csp_sched_proc_anchor << " must be a constant." << std::endl;
+        exit(EXIT_FAILURE);
+      }
+      this->build_proc_entry(pair.first, !need_sync->isZero());
+    }
+
+    return anchors.size() > 0;
+  }
+
+  bool build(void) {
+    /* Change the name of `main()` to `csp_main`. */
+    auto main_fn = this->module.getFunction(main);
+    if (main_fn != nullptr && !main_fn->isDeclaration()) {
+      main_fn->setName(csp_main);
+    } else {
+      main_fn = nullptr;
+    }
+
+    std::vector<llvm::Function *> fns;
+    for (auto &fn: this->module) {
+      if (!fn.isDeclaration() && !namer.is_generated(fn.getName().str())) {
+        fns.push_back(&fn);
+      }
+    }
+
+    bool changed = main_fn != nullptr;
+    for (auto fn: fns) {
+      changed |= this->build(*fn);
+    }
+
+    if (main_fn != nullptr) {
+      auto fn_type = main_fn->getFunctionType();
+      auto attrs = main_fn->getAttributes();
+      this->build_fn(TYPE_MAIN_FUNC, this->build_fn(
+        TYPE_MAIN_PROC, main_fn, fn_type, attrs
+      ), fn_type, attrs);
+    }
+
+    return changed;
+  }
+
+private:
+  llvm::Module &module;
+  std::unordered_map<std::string, llvm::Function *> fn_cache;
+};
+
+/*
+ * Record the stack usage and the call graph of every function the backend
+ * emits.
+ *
+ * The backend reports the stack frame size with a remark, so we take over the
+ * diagnostic handler of the context to catch it and pass the others to the
+ * original handler.
+ */
+class stack_usage_handler_t: public llvm::DiagnosticHandler {
+public:
+  stack_usage_handler_t(std::unique_ptr<llvm::DiagnosticHandler> prev):
+    prev(std::move(prev)) {}
+
+  static void install(llvm::LLVMContext &ctx) {
+    std::lock_guard<std::mutex> guard(session_lock);
+    if (installed.find(ctx.getDiagHandlerPtr()) != installed.end()) {
+      return;
+    }
+
+    auto handler = new stack_usage_handler_t(ctx.getDiagnosticHandler());
+    installed.insert(handler);
+    ctx.setDiagnosticHandler(
+      std::unique_ptr<llvm::DiagnosticHandler>(handler)
+    );
+  }
+
+  bool handleDiagnostics(const llvm::DiagnosticInfo &di) override {
+    auto remark = llvm::dyn_cast<llvm::DiagnosticInfoOptimizationBase>(&di);
+    if (remark == nullptr || remark->getPassName() != remark_pass_name ||
+        remark->getRemarkName() != remark_name) {
+      return this->prev->handleDiagnostics(di);
+    }
+
+    for (auto &arg: remark->getArgs()) {
+      if (arg.Key == remark_arg_name) {
+        int64_t frame_size = -1;
+        std::stringstream ss(arg.Val);
+        ss >> frame_size;
+        this->add_stack_usage(
+          llvm::cast<llvm::DiagnosticInfoWithLocationBase>(remark)
+            ->getFunction(),
+          frame_size
+        );
+      }
+    }
+    return true;
+  }
+
+  bool isAnalysisRemarkEnabled(llvm::StringRef pass_name) const override {
+    return pass_name == remark_pass_name ||
+      this->prev->isAnalysisRemarkEnabled(pass_name);
+  }
+
+  bool isMissedOptRemarkEnabled(llvm::StringRef pass_name) const override {
+    return this->prev->isMissedOptRemarkEnabled(pass_name);
+  }
+
+  bool isPassedOptRemarkEnabled(llvm::StringRef pass_name) const override {
+    return this->prev->isPassedOptRemarkEnabled(pass_name);
+  }
+
+  bool isAnyRemarkEnabled() const override {
+    return true;
+  }
+
+private:
+  void add_stack_usage(const llvm::Function &fn, int64_t frame_size) {
+    std::string name = fn.getName().str();
+    std::lock_guard<std::mutex> guard(session_lock);
+
+    /* Stack frame size of wrapper function is already set in build_fn, so we
+     * just return here. */
+    if (namer.is_generated(name)) {
+      return;
+    }
+
+    auto it = naked_func_infos.find(name);
+    if (it != naked_func_infos.end()) {
+      analyzer.add_stack_usage(name, it->second.first);
+      analyzer.set_callees(name, it->second.second);
+      return;
+    }
+
+    /* The frame of a function whose local variables have dynamic sizes is not
+     * a reliable measure, so we discard it. */
+    stack_usage_t su;
+    std::set<std::string> callees;
+    for (auto &bb: fn) {
+      for (auto &inst: bb) {
+        if (auto alloca = llvm::dyn_cast<llvm::AllocaInst>(&inst)) {
+          if (!alloca->isStaticAlloca()) {
+            su.type = DYNAMIC;
+            frame_size = -1;
+          }
+        } else if (auto call = llvm::dyn_cast<llvm::CallBase>(&inst)) {
+          auto callee = call->getCalledFunction();
+          if (callee == nullptr) {
+            callee = llvm::dyn_cast<llvm::Function>(
+              call->getCalledOperand()->stripPointerCasts()
+            );
+          }
+          if (callee != nullptr && !callee->isIntrinsic()) {
+            callees.insert(callee->getName().str());
+          }
+        }
+      }
+    }
+
+    su.frame_size = frame_size;
+    analyzer.add_stack_usage(name, su);
+    analyzer.set_callees(name, callees);
+  }
+
+  static std::set<const llvm::DiagnosticHandler *> installed;
+  std::unique_ptr<llvm::DiagnosticHandler> prev;
+};
+
+std::set<const llvm::DiagnosticHandler *> stack_usage_handler_t::installed;
+
+class proc_pass_t: public llvm::PassInfoMixin<proc_pass_t> {
+public:
+  llvm::PreservedAnalyses run(llvm::Module &module,
+      llvm::ModuleAnalysisManager &) {
+    session.initialize();
+    stack_usage_handler_t::install(module.getContext());
+
+    std::lock_guard<std::mutex> guard(session_lock);
+    proc_builder_t proc_builder(module);
+    return proc_builder.build() ?
+      llvm::PreservedAnalyses::none() : llvm::PreservedAnalyses::all();
+  }
+};
+
+/* The backends of ThinLTO and full LTO skip the start of the pipeline, so we
+ * install the handler again at the places they run. */
+class stack_usage_pass_t: public llvm::PassInfoMixin<stack_usage_pass_t> {
+public:
+  llvm::PreservedAnalyses run(llvm::Module &module,
+      llvm::ModuleAnalysisManager &) {
+    session.initialize();
+    stack_usage_handler_t::install(module.getContext());
+    return llvm::PreservedAnalyses::all();
+  }
+
+  llvm::PreservedAnalyses run(llvm::Function &fn,
+      llvm::FunctionAnalysisManager &) {
+    session.initialize();
+    stack_usage_handler_t::install(fn.getContext());
+    return llvm::PreservedAnalyses::all();
+  }
+};
+
+}
+
+extern "C" LLVM_ATTRIBUTE_WEAK llvm::PassPluginLibraryInfo
+llvmGetPassPluginInfo() {
+  return {LLVM_PLUGIN_API_VERSION, "libcsp", LLVM_VERSION_STRING,
+    [](llvm::PassBuilder &pb) {
+      pb.registerPipelineStartEPCallback(
+        [](llvm::ModulePassManager &mpm, llvm::OptimizationLevel) {
+          mpm.addPass(csp::proc_pass_t());
+        }
+      );
+      pb.registerOptimizerLastEPCallback(
+        [](llvm::ModulePassManager &mpm, llvm::OptimizationLevel) {
+          mpm.addPass(csp::stack_usage_pass_t());
+        }
+      );
+      pb.registerPeepholeEPCallback(
+        [](llvm::FunctionPassManager &fpm, llvm::OptimizationLevel) {
+          fpm.addPass(csp::stack_usage_pass_t());
+        }
+      );
+
+      /* Allow `opt -passes=csp-proc` for debugging. */
+      pb.registerPipelineParsingCallback(
+        [](llvm::StringRef name, llvm::ModulePassManager &mpm,
+            llvm::ArrayRef<llvm::PassBuilder::PipelineElement>) {
+          if (name == "csp-proc") {
+            mpm.addPass(csp::proc_pass_t());
+            return true;
+          }
+          return false;
+        }
+      );
+    }
+  };
+}
@@ -33,24 +33,6 @@ const char *plugin_name = "libcsp";
  * prevent handling the newly added `main` function again. */
 bool is_main_handled = false;
 
-std::unordered_map<std::string, std::pair<csp::stack_usage_t,
-    std::set<std::string>>> naked_func_infos = {
-  {"csp_proc_restore",         {csp::stack_usage_t(-1, 0), {}}},
-  {"csp_core_anchor_save",     {csp::stack_usage_t(-1, 0), {}}},
-  {"csp_core_anchor_restore",  {csp::stack_usage_t(-1, 0), {}}},
-  /* `csp_core_proc_exit_inner` calls `csp_proc_destroy` on the thread stack,
-   * so we ignore it. */
-  {"csp_core_proc_exit_inner", {csp::stack_usage_t(-1, 0), {}}},
-  {
-    "csp_core_block_epilogue",
-    {csp::stack_usage_t(-1, 8), {"csp_core_block_epilogue_inner"}}
-  },
-  {
-    "csp_core_yield",
-    {csp::stack_usage_t(-1, 8), {"csp_core_anchor_restore"}}
-  },
-};
-
 tree collect_call(tree *node, int *walk_subtrees, void *caller) {
   if (TREE_CODE(*node) == CALL_EXPR) {
     csp::analyzer.add_call(*(std::string *)caller, csp::get_callee_name(*node));
@@ -96,8 +78,8 @@ void on_all_passes_end(void *gcc_data, void *user_data) {
     return;
   }
 
-  auto it = naked_func_infos.find(current_name);
-  if (it != naked_func_infos.end()) {
+  auto it = csp::naked_func_infos.find(current_name);
+  if (it != csp::naked_func_infos.end()) {
     csp::analyzer.add_stack_usage(current_name, it->second.first);
     csp::analyzer.set_callees(current_name, it->second.second);
     return;
@@ -153,6 +153,10 @@ public:
    */
   tree build_fn_body(build_type_t build_type, tree wrapped_fn, int args_len,
       tree extra_arg) {
+#if defined(__aarch64__)
+    return this->build_fn_body_aarch64(build_type, wrapped_fn, args_len);
+#endif
+
     tree fn_body = c_begin_compound_stmt(true);
 
     /* The generated asm code buffer. */
@@ -192,12 +196,12 @@ public:
     };
 
     const char *pops[6] = {
+      "popq 0x18(%rdi)\n",
+      "popq 0x20(%rdi)\n",
+      "popq 0x28(%rdi)\n",
       "popq 0x30(%rdi)\n",
       "popq 0x38(%rdi)\n",
-      "popq 0x40(%rdi)\n",
-      "popq 0x48(%rdi)\n",
-      "popq 0x50(%rdi)\n",
-      "popq 0x58(%rdi)\n"
+      "popq 0x40(%rdi)\n"
     };
 
     /* Stack frame size of the wrapper function in bytes. */
@@ -236,8 +240,8 @@ public:
       "mov  %rax, %rdi\n"
 
       /* Store mxcsr register and the x87 control word. */
-      "stmxcsr 0x18(%rdi)\n"
-      "fstcw   0x1c(%rdi)\n"
+      "stmxcsr 0x48(%rdi)\n"
+      "fstcw   0x4c(%rdi)\n"
     );
 
     /* Restore the stack and then store the arguments passed by registers. */
@@ -249,14 +253,14 @@ public:
     if (build_type == TYPE_TIMER_PROC) {
       if (args_len <= 6) {
         buff.insert(buff.length(), instr, sprintf(instr,
-          "mov 0x%x(%%rdi), %%rax\n", 0x30 + ((args_len - 1) << 3)
+          "mov 0x%x(%%rdi), %%rax\n", 0x18 + ((args_len - 1) << 3)
         ));
       } else {
         buff.insert(buff.length(), instr, sprintf(instr,
           "mov 0x%x(%%rsp), %%rax\n", (args_len - 5) << 3
         ));
       }
-      buff.append("mov %rax, 0x60(%rdi)\n");
+      buff.append("mov %rax, 0x50(%rdi)\n");
     }
 
     /* The reserved space in the process stack in 8-bytes. The initial one is
@@ -273,13 +277,13 @@ public:
     rsv_num += !(rsv_num & 0x01);
 
     /* Load %rbp. */
-    buff.append("mov 0x28(%rdi), %rax\n");
+    buff.append("mov 0x08(%rdi), %rax\n");
 
     /* Store %rsp. */
     buff.insert(buff.length(), instr, sprintf(instr,
       "sub $0x%x, %%rax\n", rsv_num << 3
     ));
-    buff.append("mov %rax, 0x20(%rdi)\n");
+    buff.append("mov %rax, 0x00(%rdi)\n");
 
     /* Copy arguments passed by stack from right to left if any. */
     for (int i = args_len - 6; i >= 1; i--) {
@@ -334,6 +338,15 @@ public:
       buff.append("call csp_core_proc_exit@plt\n");
     }
 
+    return this->finish_fn_body(
+      build_type, wrapped_fn, fn_body, buff, stack_frame, rsv_num << 3
+    );
+  }
+
+  /* Put the generated asm code to the wrapper function body and collect the
+   * call graph and the stack usage of it. */
+  tree finish_fn_body(build_type_t build_type, tree wrapped_fn, tree fn_body,
+      const std::string &buff, int stack_frame, int proc_reserved) {
     /* Put the asm statement to the statement list. */
     build_asm_stmt(true, build_asm_expr(
       DECL_SOURCE_LOCATION(wrapped_fn),
@@ -355,12 +368,151 @@ public:
     csp::stack_usage_t su;
     su.type = csp::MANUALLY;
     su.frame_size = stack_frame;
-    su.proc_reserved = rsv_num << 3;
+    su.proc_reserved = proc_reserved;
     csp::analyzer.add_stack_usage(csp::namer.current_name(), su);
 
     return fn_body;
   }
 
+  /*
+   * The AArch64 version of `build_fn_body`. According to AAPCS64 the first 8
+   * arguments are passed by x0-x7 and the others by stack in the increasing
+   * order starting at `sp`, the return address is in the link register and
+   * `sp` is always 16-bytes aligned.
+   */
+  tree build_fn_body_aarch64(build_type_t build_type, tree wrapped_fn,
+      int args_len) {
+    tree fn_body = c_begin_compound_stmt(true);
+    std::string buff;
+    char instr[256];
+
+    buff.append("stp x29, x30, [sp, #-16]!\n");
+
+    if (build_type == TYPE_MAIN_FUNC) {
+      buff.insert(buff.length(), instr, sprintf(instr,
+        "bl %s\n", fndecl_name(wrapped_fn)
+      ));
+      buff.append("bl csp_core_start_main\n");
+
+      build_asm_stmt(true, build_asm_expr(
+        DECL_SOURCE_LOCATION(wrapped_fn),
+        build_string(buff.length(), buff.c_str()),
+        NULL_TREE, NULL_TREE, NULL_TREE, NULL_TREE, true, false
+      ));
+
+      return c_end_compound_stmt(
+        DECL_SOURCE_LOCATION(wrapped_fn), fn_body, true
+      );
+    }
+
+    int regs_len = args_len < 8 ? args_len : 8;
+    int stack_len = args_len - regs_len;
+
+    /* Store the arguments passed by registers to the stack cause calling
+     * `csp_proc_new` may overrides them, in 16-bytes slots. */
+    int regs_frame = ((regs_len + 1) >> 1) << 4;
+    int stack_frame = 16 + regs_frame;
+    if (regs_frame > 0) {
+      buff.insert(buff.length(), instr, sprintf(instr,
+        "sub sp, sp, #0x%x\n", regs_frame
+      ));
+    }
+    for (int i = 0; i < regs_len; i += 2) {
+      buff.insert(buff.length(), instr, sprintf(instr,
+        "stp x%d, x%d, [sp, #0x%x]\n", i, i + 1, i << 3
+      ));
+    }
+
+    buff.insert(buff.length(), instr, sprintf(instr,
+      "mov x0, #0x%x\n"
+      "mov x1, #%d\n"
+      "bl  csp_proc_new\n"
+
+      /* Store the FPCR register. */
+      "mrs x9, fpcr\n"
+      "str w9, [x0, #0xb0]\n",
+      csp::namer.current_id(), build_type == TYPE_SYNC_PROC
+    ));
+
+    /* Restore the stack and then store the arguments passed by registers. The
+     * odd one copies a garbage register to a reserved slot. */
+    for (int i = 0; i < regs_len; i += 2) {
+      buff.insert(buff.length(), instr, sprintf(instr,
+        "ldp x9, x10, [sp, #0x%x]\n"
+        "stp x9, x10, [x0, #0x%x]\n",
+        i << 3, 0x18 + (i << 3)
+      ));
+    }
+    if (regs_frame > 0) {
+      buff.insert(buff.length(), instr, sprintf(instr,
+        "add sp, sp, #0x%x\n", regs_frame
+      ));
+    }
+
+    /* Store the timestamp. The arguments passed by stack are above the saved
+     * x29 and x30. */
+    if (build_type == TYPE_TIMER_PROC) {
+      if (stack_len == 0) {
+        buff.insert(buff.length(), instr, sprintf(instr,
+          "ldr x9, [x0, #0x%x]\n", 0x18 + ((args_len - 1) << 3)
+        ));
+      } else {
+        buff.insert(buff.length(), instr, sprintf(instr,
+          "ldr x9, [sp, #0x%x]\n", 16 + ((stack_len - 1) << 3)
+        ));
+      }
+      buff.append("str x9, [x0, #0xb8]\n");
+    }
+
+    /* Reserve space for arguments passed by stack, 16-bytes aligned. */
+    int proc_reserved = ((stack_len + 1) >> 1) << 4;
+
+    /* Store sp. */
+    buff.append("ldr x9, [x0, #0x08]\n");
+    if (proc_reserved > 0) {
+      buff.insert(buff.length(), instr, sprintf(instr,
+        "sub x9, x9, #0x%x\n", proc_reserved
+      ));
+    }
+    buff.append("str x9, [x0, #0x00]\n");
+
+    /* Copy arguments passed by stack if any. */
+    for (int i = 0; i < stack_len; i++) {
+      buff.insert(buff.length(), instr, sprintf(instr,
+        "ldr x10, [sp, #0x%x]\n"
+        "str x10, [x9, #0x%x]\n",
+        16 + (i << 3), i << 3
+      ));
+    }
+
+    /* Store the entry to the link register slot. */
+    buff.append(
+      "adr x10, 0f\n"
+      "str x10, [x0, #0x68]\n"
+    );
+
+    buff.append(build_type == TYPE_TIMER_PROC ?
+      "bl  csp_sched_put_timer\n" :
+      "bl  csp_sched_put_proc\n"
+    );
+    buff.append(
+      "ldp x29, x30, [sp], #16\n"
+      "ret\n"
+    );
+
+    /* The scheduler will schedule this process and jump here to run. */
+    buff.insert(buff.length(), instr, sprintf(instr,
+      "0: bl %s\n", fndecl_name(wrapped_fn)
+    ));
+    buff.append(build_type == TYPE_MAIN_PROC ?
+      "bl exit\n" : "bl csp_core_proc_exit\n"
+    );
+
+    return this->finish_fn_body(
+      build_type, wrapped_fn, fn_body, buff, stack_frame, proc_reserved
+    );
+  }
+
   csp::namer_type_t get_namer_type(build_type_t build_type) {
     csp::namer_type_t namer_type;
     switch (build_type) {
@@ -19,6 +19,9 @@
 #define LIBCSP_PLUGIN_SA_HPP
 
 #include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
 #include <ctime>
 #include <dirent.h>
 #include <fstream>
@@ -27,6 +30,7 @@
 #include <set>
 #include <sstream>
 #include <string>
+#include <thread>
 #include <unordered_map>
 #include <vector>
 #include "fs.hpp"
@@ -37,14 +41,42 @@ namespace csp {
 const std::string call_graph_ext            = ".cg";
 const std::string stack_frame_ext           = ".sf";
 const std::string config_file_name          = "config.c";
+const std::string index_file_name           = "analyzer.idx";
+const std::string index_magic               = "cspidx02";
 const std::string csp_prefix                = "csp_";
 const std::string fn_exit                   = "exit";
 const std::string fn_csp_core_proc_exit     = "csp_core_proc_exit";
 
 const size_t default_max_threads            = 1024;
 const size_t default_max_procs_hint         = 100000;
+const size_t default_spin_budget            = 1 << 10;
+const size_t default_timer_slot             = 1000000;
+const size_t default_mem_retain             = 16 << 20;
+
+/* The stack space every process reserves for the registers saved when it's
+ * preempted, see `csp_core_preempt_reserved` of `src/core.c`. */
+const size_t preempt_reserved               = 4096;
+const std::string elastic_by_user           = "elastic";
+
+/* The functions of <fenv.h> which change the FP environment. */
+const std::set<std::string> fenv_funcs      = {
+  "fesetenv", "feupdateenv", "feholdexcept", "fesetround", "fesetexceptflag",
+  "feenableexcept", "fedisableexcept", "fesetmode"
+};
+/* The functions of libcsp which park the running process. The channel and
+ * the other primitives reach them through the inlined macros or the call
+ * graphs installed with libcsp. */
+const std::set<std::string> blocking_funcs  = {
+  "csp_sched_yield", "csp_sched_park", "csp_sched_park_fn",
+  "csp_sched_handoff", "csp_sched_hangup", "csp_core_yield",
+  "csp_core_switch_to"
+};
 const size_t default_default_stack_size     = 1 << 11;
 
+/* The flags of `csp_proc_meta_t`, see `src/proc.h`. */
+const size_t proc_meta_fenv                 = 0x01;
+const size_t proc_meta_nonblocking          = 0x02;
+
 const int flag_stack_by_user                = 0x01;
 const int flag_csp_only                     = 0x02;
 
@@ -74,12 +106,27 @@ public:
    * Arguments` and `Padding` in the process memory layout. See `src/proc.h`. */
   int64_t proc_reserved;
 
+  /* Whether the max stack size is a guess, i.e. the function is recursive,
+   * calls a function whose stack usage is unknown or is marked `elastic` by
+   * user. */
+  bool is_unbounded;
+
+  /* Whether the function calls one of `fenv_funcs` directly or indirectly. */
+  bool touches_fenv;
+
+  /* Whether the function calls one of `blocking_funcs` directly or
+   * indirectly. */
+  bool may_block;
+
   stack_usage_t(int64_t max_stack_size, int64_t frame_size):
     type(STATIC),
     max_stack_size(max_stack_size),
     frame_size(frame_size),
     stack_by_user(-1),
-    proc_reserved(-1) {}
+    proc_reserved(-1),
+    is_unbounded(false),
+    touches_fenv(false),
+    may_block(false) {}
 
   stack_usage_t(int64_t max_stack_size): stack_usage_t(max_stack_size, -1) {}
 
@@ -92,13 +139,104 @@ public:
       << "max_stack_size: " << this->max_stack_size << " "
       << "stack_by_user: " << this->stack_by_user << " "
       << "frame_size: " << this->frame_size << " "
-      << "proc_reserved: " << this->proc_reserved
+      << "proc_reserved: " << this->proc_reserved << " "
+      << "is_unbounded: " << this->is_unbounded << " "
+      << "touches_fenv: " << this->touches_fenv << " "
+      << "may_block: " << this->may_block
       << ">";
     return ss.str();
   }
 
 };
 
+/* The stack usages and the callees of the naked functions of libcsp, which the
+ * compilers can't figure out. */
+const std::unordered_map<std::string, std::pair<stack_usage_t,
+    std::set<std::string>>> naked_func_infos = {
+  {"csp_proc_restore",         {stack_usage_t(-1, 0), {}}},
+  {"csp_core_anchor_save",     {stack_usage_t(-1, 0), {}}},
+  {"csp_core_anchor_restore",  {stack_usage_t(-1, 0), {}}},
+  /* `csp_core_proc_exit_inner` calls `csp_proc_destroy` on the thread stack,
+   * so we ignore it. */
+  {"csp_core_proc_exit_inner", {stack_usage_t(-1, 0), {}}},
+  /* `csp_core_switch_to` settles the yielded process on the thread stack. */
+  {"csp_core_switch_to",       {stack_usage_t(-1, 0), {}}},
+  {
+    "csp_core_block_epilogue",
+    {stack_usage_t(-1, 8), {"csp_core_block_epilogue_inner"}}
+  },
+  {
+    "csp_core_yield",
+    {stack_usage_t(-1, 8), {"csp_core_anchor_restore"}}
+  },
+};
+
+/* The records of a .sf or .cg file. The files are parsed in parallel but the
+ * records are applied in the order of the files, since a later stack usage of
+ * a function replaces the earlier one. */
+class loaded_file_t {
+public:
+  std::string path;
+  bool is_call_graph;
+  int flags;
+
+  /* The stack usages, or the functions marked `elastic` if the flag is set. */
+  std::vector<std::pair<std::string, stack_usage_t>> stack_usages;
+  std::vector<bool> elastic;
+
+  std::vector<std::pair<std::string, std::vector<std::string>>> calls;
+
+  loaded_file_t(std::string path, bool is_call_graph, int flags):
+    path(path), is_call_graph(is_call_graph), flags(flags) {}
+};
+
+/*
+ * An entry of the index the analyzer saves to `index_file_name` in the
+ * working directory after every run. It has the inputs of a function, i.e.
+ * what the .sf and .cg files say about it, and the result computed from
+ * them. The next run only analyzes the functions whose inputs changed and
+ * their callers, and takes the results of the others from the index.
+ */
+class index_entry_t {
+public:
+  /* Whether there is a stack usage of the function. */
+  bool known;
+  bool elastic;
+  int64_t frame_size;
+  int64_t proc_reserved;
+  int64_t stack_by_user;
+  std::vector<std::string> callees;
+
+  /* Whether the result below is computed, i.e. the function was reachable
+   * from the processes and not in a circle. */
+  bool analyzed;
+  int64_t max_stack_size;
+  bool is_unbounded;
+  bool touches_fenv;
+  bool may_block;
+
+  index_entry_t():
+    known(false),
+    elastic(false),
+    frame_size(-1),
+    proc_reserved(-1),
+    stack_by_user(-1),
+    analyzed(false),
+    max_stack_size(-1),
+    is_unbounded(false),
+    touches_fenv(false),
+    may_block(false) {}
+
+  bool same_inputs(const index_entry_t &other) const {
+    return this->known == other.known &&
+      this->elastic == other.elastic &&
+      this->frame_size == other.frame_size &&
+      this->proc_reserved == other.proc_reserved &&
+      this->stack_by_user == other.stack_by_user &&
+      this->callees == other.callees;
+  }
+};
+
 class analyzer_options_t {
 public:
   bool is_building_libcsp;
@@ -109,6 +247,11 @@ public:
   size_t cpu_cores;
   size_t max_threads;
   size_t max_procs_hint;
+  size_t spin_budget;
+  size_t timer_slot;
+  size_t mem_retain;
+  size_t elastic_stack_size;
+  size_t time_slice;
 
   analyzer_options_t():
     is_building_libcsp(false),
@@ -118,7 +261,12 @@ public:
     default_stack_size(default_default_stack_size),
     cpu_cores(0),
     max_threads(default_max_threads),
-    max_procs_hint(default_max_procs_hint)
+    max_procs_hint(default_max_procs_hint),
+    spin_budget(default_spin_budget),
+    timer_slot(default_timer_slot),
+    mem_retain(default_mem_retain),
+    elastic_stack_size(0),
+    time_slice(0)
   {}
 };
 
@@ -142,15 +290,21 @@ public:
   }
 
   void load(void) {
+    std::vector<loaded_file_t> files;
     if (!this->options.is_building_libcsp) {
-      this->load_from_dir(this->options.installed_prefix + subpath_share);
+      this->list_dir(this->options.installed_prefix + subpath_share, files);
     }
 
-    this->load_from_dir(this->get_working_dir());
+    this->list_dir(this->get_working_dir(), files);
     if (this->options.extra_su_file != "") {
-      this->load_stack_usage_from_file(
-        this->options.extra_su_file, flag_stack_by_user
-      );
+      files.push_back(loaded_file_t(
+        this->options.extra_su_file, false, flag_stack_by_user
+      ));
+    }
+
+    this->parse_files(files);
+    for (auto &file: files) {
+      this->apply_file(file);
     }
   }
 
@@ -184,10 +338,31 @@ public:
       return;
     }
 
+    auto inputs = this->collect_inputs();
+    this->load_index();
+    this->restore_unchanged(inputs);
+
     auto order = this->get_analyzing_order(wrapper_funcs);
     for (auto caller: order) {
+      /* Taken from the index. */
+      if (this->unchanged.find(caller) != this->unchanged.end()) {
+        continue;
+      }
+
       auto &su = this->stack_usages[caller];
 
+      auto it = this->call_graph.find(caller);
+      if (it != this->call_graph.end()) {
+        for (auto callee: it->second) {
+          if (this->touches_fenv(callee)) {
+            su.touches_fenv = true;
+          }
+          if (this->may_block(callee)) {
+            su.may_block = true;
+          }
+        }
+      }
+
       /* Already analyzed. */
       if (su.max_stack_size >= 0) {
         continue;
@@ -204,9 +379,13 @@ public:
         if (size > max_stack_size) {
           max_stack_size = size;
         }
+        if (this->is_unbounded(callee)) {
+          su.is_unbounded = true;
+        }
       }
       su.max_stack_size = max_stack_size + 8;
     }
+    this->save_index(inputs, order);
 
     /* Compute the final memory usage of every process. */
     for (auto pair: wrapper_funcs) {
@@ -219,18 +398,262 @@ public:
         su.max_stack_size = size;
       }
 
-      /* The size of `csp_proc_t`. Cause we make %rbp to be 16-bytes alignment,
-       * so we add extra 8-bytes if `sizeof(csp_procs_t) % 16 != 0`. */
-      size_t csp_proc_t_size = 22 << 3;
+      /* The size of `csp_proc_t` which is aligned to 64 bytes. */
+#if defined(__aarch64__)
+      size_t csp_proc_t_size = 40 << 3;
+#else
+      size_t csp_proc_t_size = 24 << 3;
+#endif
 
       /* All parts of the process plus 8-bytes call instruction space. */
       su.max_stack_size += su.proc_reserved + csp_proc_t_size + 8;
+      if (this->options.time_slice > 0) {
+        su.max_stack_size += preempt_reserved;
+      }
     }
 
     this->gen_config(wrapper_funcs);
   }
 
 private:
+  /* The inputs of all the functions in the stack usages and the call graph
+   * just after they're loaded. */
+  std::unordered_map<std::string, index_entry_t> collect_inputs(void) {
+    std::unordered_map<std::string, index_entry_t> inputs;
+    for (auto &pair: this->stack_usages) {
+      auto &entry = inputs[pair.first];
+      entry.known = true;
+      entry.elastic = pair.second.is_unbounded;
+      entry.frame_size = pair.second.frame_size;
+      entry.proc_reserved = pair.second.proc_reserved;
+      entry.stack_by_user = pair.second.stack_by_user;
+    }
+    for (auto &pair: this->call_graph) {
+      auto &entry = inputs[pair.first];
+      entry.callees.assign(pair.second.begin(), pair.second.end());
+      for (auto &callee: pair.second) {
+        inputs[callee];
+      }
+    }
+    return inputs;
+  }
+
+  /*
+   * Take the results of the functions from the index if neither their inputs
+   * nor those of any function they call directly or indirectly changed, i.e.
+   * all the changed functions and their callers are analyzed again.
+   */
+  void restore_unchanged(
+      const std::unordered_map<std::string, index_entry_t> &inputs) {
+    std::queue<std::string> queue;
+    std::set<std::string> changed;
+    for (auto &pair: inputs) {
+      auto it = this->index.find(pair.first);
+      if (it == this->index.end() || !it->second.analyzed ||
+          !it->second.same_inputs(pair.second)) {
+        queue.push(pair.first);
+        changed.insert(pair.first);
+      }
+    }
+
+    std::unordered_map<std::string, std::vector<std::string>> callers;
+    for (auto &pair: this->call_graph) {
+      for (auto &callee: pair.second) {
+        callers[callee].push_back(pair.first);
+      }
+    }
+    while (!queue.empty()) {
+      auto callee = queue.front();
+      queue.pop();
+      for (auto &caller: callers[callee]) {
+        if (changed.insert(caller).second) {
+          queue.push(caller);
+        }
+      }
+    }
+
+    for (auto &pair: inputs) {
+      if (changed.find(pair.first) != changed.end()) {
+        continue;
+      }
+      auto &entry = this->index[pair.first];
+      auto &su = this->stack_usages[pair.first];
+      su.max_stack_size = entry.max_stack_size;
+      su.is_unbounded = entry.is_unbounded;
+      su.touches_fenv = entry.touches_fenv;
+      su.may_block = entry.may_block;
+      this->unchanged.insert(pair.first);
+    }
+  }
+
+  static void write_u64(std::ostream &out, uint64_t val) {
+    for (int i = 0; i < 8; i++) {
+      out.put((char)(val >> (i * 8)));
+    }
+  }
+
+  static bool read_u64(std::istream &in, uint64_t &val) {
+    val = 0;
+    for (int i = 0; i < 8; i++) {
+      int c = in.get();
+      if (c == EOF) {
+        return false;
+      }
+      val |= (uint64_t)(unsigned char)c << (i * 8);
+    }
+    return true;
+  }
+
+  static bool read_i64(std::istream &in, int64_t &val) {
+    uint64_t u;
+    if (!read_u64(in, u)) {
+      return false;
+    }
+    val = (int64_t)u;
+    return true;
+  }
+
+  /*
+   * The index file is binary and starts with `index_magic` and the default
+   * stack size which the results depend on. Then it has the names of all the
+   * functions, and an entry for every name in the same order whose callees
+   * are the ordinals of the names:
+   *
+   *   u64 len, len * (u64 size, bytes)
+   *   len * (u64 flags, i64 frame_size, i64 proc_reserved, i64 stack_by_user,
+   *          i64 max_stack_size, u64 ncallees, ncallees * u64 callee)
+   *
+   * All the integers are little endian. An index which can't be read is
+   * ignored, so the first run or a run after a new analyzer which changes the
+   * format analyzes everything.
+   */
+  void load_index(void) {
+    this->index.clear();
+    std::ifstream in(this->full_path(index_file_name), std::ios::binary);
+    if (!in.is_open() || !this->read_index(in)) {
+      this->index.clear();
+    }
+  }
+
+  bool read_index(std::istream &in) {
+    std::string magic(index_magic.size(), '\0');
+    uint64_t stack_size, len;
+    if (!in.read(&magic[0], magic.size()) || magic != index_magic ||
+        !read_u64(in, stack_size) ||
+        stack_size != this->options.default_stack_size ||
+        !read_u64(in, len)) {
+      return false;
+    }
+
+    std::vector<std::string> names(len);
+    for (auto &name: names) {
+      uint64_t size;
+      if (!read_u64(in, size) || size > (1 << 20)) {
+        return false;
+      }
+      name.resize(size);
+      if (!in.read(&name[0], size)) {
+        return false;
+      }
+    }
+
+    for (auto &name: names) {
+      index_entry_t entry;
+      uint64_t flags, ncallees, callee;
+      if (!read_u64(in, flags) ||
+          !read_i64(in, entry.frame_size) ||
+          !read_i64(in, entry.proc_reserved) ||
+          !read_i64(in, entry.stack_by_user) ||
+          !read_i64(in, entry.max_stack_size) ||
+          !read_u64(in, ncallees) || ncallees > len) {
+        return false;
+      }
+      entry.known = flags & 0x01;
+      entry.elastic = flags & 0x02;
+      entry.analyzed = flags & 0x04;
+      entry.is_unbounded = flags & 0x08;
+      entry.touches_fenv = flags & 0x10;
+      entry.may_block = flags & 0x20;
+      for (uint64_t i = 0; i < ncallees; i++) {
+        if (!read_u64(in, callee) || callee >= len) {
+          return false;
+        }
+        entry.callees.push_back(names[callee]);
+      }
+      this->index[name] = entry;
+    }
+    return true;
+  }
+
+  /* Save the inputs and the results of the topologically sorted functions in
+   * `order` before the sizes of the processes are added. The ones appended
+   * for the circles are left out since their results depend on the order. */
+  void save_index(std::unordered_map<std::string, index_entry_t> &inputs,
+      const std::vector<std::string> &order) {
+    for (size_t i = 0; i < this->sorted_len; i++) {
+      auto &name = order[i];
+      auto it = inputs.find(name);
+      if (it == inputs.end()) {
+        continue;
+      }
+      auto &su = this->stack_usages[name];
+      it->second.analyzed = true;
+      it->second.max_stack_size = su.max_stack_size;
+      it->second.is_unbounded = su.is_unbounded;
+      it->second.touches_fenv = su.touches_fenv;
+      it->second.may_block = su.may_block;
+    }
+    for (auto &name: this->unchanged) {
+      auto &entry = this->index[name];
+      auto &input = inputs[name];
+      input.analyzed = true;
+      input.max_stack_size = entry.max_stack_size;
+      input.is_unbounded = entry.is_unbounded;
+      input.touches_fenv = entry.touches_fenv;
+      input.may_block = entry.may_block;
+    }
+
+    std::vector<std::string> names;
+    std::unordered_map<std::string, uint64_t> ordinals;
+    for (auto &pair: inputs) {
+      ordinals[pair.first] = names.size();
+      names.push_back(pair.first);
+    }
+
+    auto path = this->full_path(index_file_name), tmp = path + ".tmp";
+    std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+    if (!out.is_open()) {
+      return;
+    }
+    out.write(index_magic.data(), index_magic.size());
+    write_u64(out, this->options.default_stack_size);
+    write_u64(out, names.size());
+    for (auto &name: names) {
+      write_u64(out, name.size());
+      out.write(name.data(), name.size());
+    }
+    for (auto &name: names) {
+      auto &entry = inputs[name];
+      write_u64(out, entry.known | entry.elastic << 1 | entry.analyzed << 2 |
+        entry.is_unbounded << 3 | entry.touches_fenv << 4 |
+        entry.may_block << 5);
+      write_u64(out, entry.frame_size);
+      write_u64(out, entry.proc_reserved);
+      write_u64(out, entry.stack_by_user);
+      write_u64(out, entry.max_stack_size);
+      write_u64(out, entry.callees.size());
+      for (auto &callee: entry.callees) {
+        write_u64(out, ordinals[callee]);
+      }
+    }
+    out.close();
+
+    /* Replace the old index at once so that it's never half written. */
+    if (!out || std::rename(tmp.c_str(), path.c_str()) != 0) {
+      std::remove(tmp.c_str());
+    }
+  }
+
   void save_call_graph(void) {
     /* We need to set the openmode to fstream::app cause the path may exists. */
     auto file = this->assert_open(
@@ -294,8 +717,8 @@ private:
     file.close();
   }
 
-  void load_call_graph_from_file(std::string path) {
-    auto file = this->assert_open(path, std::fstream::in);
+  void parse_call_graph(loaded_file_t &loaded) {
+    auto file = this->assert_open(loaded.path, std::fstream::in);
 
     std::string line;
     while (std::getline(file, line)) {
@@ -306,31 +729,46 @@ private:
         continue;
       }
 
+      std::vector<std::string> callees;
       std::string callee;
       while (ss >> callee) {
-        this->add_call(caller, callee);
+        callees.push_back(callee);
       }
+      loaded.calls.push_back({caller, callees});
     }
 
     file.close();
   }
 
-  void load_stack_usage_from_file(std::string path, int flags) {
-    auto file = this->assert_open(path, std::fstream::in);
+  void parse_stack_usage(loaded_file_t &loaded) {
+    auto flags = loaded.flags;
+    auto file = this->assert_open(loaded.path, std::fstream::in);
 
     std::string line;
     while (std::getline(file, line)) {
       std::stringstream ss(line);
 
-      std::string fn;
+      std::string fn, word;
       int64_t frame, reserved;
-
-      if (!(ss >> fn) || !(ss >> frame) || frame < 0 || (
+      if (!(ss >> fn) || !(ss >> word) || (
           (flags & flag_csp_only) &&
           fn.substr(0, csp_prefix.size()) != csp_prefix)) {
         continue;
       }
 
+      /* The user marks a function with `fn elastic` so that the processes
+       * calling it get elastic stacks. */
+      if ((flags & flag_stack_by_user) && word == elastic_by_user) {
+        loaded.stack_usages.push_back({fn, stack_usage_t()});
+        loaded.elastic.push_back(true);
+        continue;
+      }
+
+      std::stringstream ws(word);
+      if (!(ws >> frame) || frame < 0) {
+        continue;
+      }
+
       stack_usage_t su;
       if (flags & flag_stack_by_user) {
         su.stack_by_user = frame;
@@ -341,13 +779,60 @@ private:
         }
       }
 
-      this->add_stack_usage(fn, su);
+      loaded.stack_usages.push_back({fn, su});
+      loaded.elastic.push_back(false);
     }
 
     file.close();
   }
 
-  void load_from_dir(std::string dir_path) {
+  void apply_file(loaded_file_t &loaded) {
+    for (auto &pair: loaded.calls) {
+      for (auto &callee: pair.second) {
+        this->add_call(pair.first, callee);
+      }
+    }
+    for (size_t i = 0; i < loaded.stack_usages.size(); i++) {
+      auto &pair = loaded.stack_usages[i];
+      if (loaded.elastic[i]) {
+        this->stack_usages[pair.first].is_unbounded = true;
+      } else {
+        this->add_stack_usage(pair.first, pair.second);
+      }
+    }
+  }
+
+  /* Parse the files with as many threads as the CPUs, since a large project
+   * has thousands of them. */
+  void parse_files(std::vector<loaded_file_t> &files) {
+    size_t nthreads = std::thread::hardware_concurrency();
+    if (nthreads > files.size()) {
+      nthreads = files.size();
+    }
+
+    std::atomic<size_t> next(0);
+    auto worker = [&]() {
+      size_t i;
+      while ((i = next++) < files.size()) {
+        if (files[i].is_call_graph) {
+          this->parse_call_graph(files[i]);
+        } else {
+          this->parse_stack_usage(files[i]);
+        }
+      }
+    };
+
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < nthreads; i++) {
+      threads.push_back(std::thread(worker));
+    }
+    worker();
+    for (auto &thread: threads) {
+      thread.join();
+    }
+  }
+
+  void list_dir(std::string dir_path, std::vector<loaded_file_t> &files) {
     std::vector<std::string> sf_names, cg_names;
     std::unordered_map<std::string, std::vector<std::string>> exts({
       {stack_frame_ext, sf_names}, {call_graph_ext, cg_names}
@@ -398,14 +883,16 @@ private:
 
       for (auto name: item.second) {
         if (item.first == call_graph_ext) {
-          this->load_call_graph_from_file(dir_path + name + call_graph_ext);
+          files.push_back(
+            loaded_file_t(dir_path + name + call_graph_ext, true, 0)
+          );
         } else {
           int flags = 0;
           if (dir_path == this->options.installed_prefix + subpath_share) {
             flags |= flag_csp_only;
           }
-          this->load_stack_usage_from_file(
-            dir_path + name + stack_frame_ext, flags
+          files.push_back(
+            loaded_file_t(dir_path + name + stack_frame_ext, false, flags)
           );
         }
       }
@@ -455,6 +942,11 @@ private:
       std::string caller = queue.front();
       queue.pop();
 
+      /* The callees of an unchanged function are unchanged too. */
+      if (this->unchanged.find(caller) != this->unchanged.end()) {
+        continue;
+      }
+
       auto it = this->call_graph.find(caller);
       if (it != this->call_graph.end()) {
         for (auto callee: it->second) {
@@ -485,6 +977,9 @@ private:
     for (auto pair: degrees) {
       if (pair.second == 0) {
         zero_degrees.push(pair.first);
+        if (this->unchanged.find(pair.first) != this->unchanged.end()) {
+          continue;
+        }
         if (this->stack_usages.find(pair.first) != this->stack_usages.end()) {
           auto &su = this->stack_usages[pair.first];
           if (su.stack_by_user >= 0) {
@@ -496,6 +991,7 @@ private:
           this->stack_usages[pair.first] = stack_usage_t(
             this->options.default_stack_size
           );
+          this->stack_usages[pair.first].is_unbounded = true;
         }
       }
     }
@@ -517,6 +1013,8 @@ private:
       }
     }
 
+    this->sorted_len = order.size();
+
     /* If there are circles in the call graph, the order may not contains all
      * wrapper functions. We put them to the end of order to force to compute
      * the max stack size of every wrapper function. */
@@ -530,6 +1028,38 @@ private:
     return order;
   }
 
+  /* Whether the function may change the FP environment. */
+  bool touches_fenv(std::string name) {
+    if (fenv_funcs.find(name) != fenv_funcs.end()) {
+      return true;
+    }
+    auto it = this->stack_usages.find(name);
+    return it != this->stack_usages.end() && it->second.touches_fenv;
+  }
+
+  /* Whether the function may park the running process. */
+  bool may_block(std::string name) {
+    if (blocking_funcs.find(name) != blocking_funcs.end()) {
+      return true;
+    }
+    auto it = this->stack_usages.find(name);
+    return it != this->stack_usages.end() && it->second.may_block;
+  }
+
+  /* Whether the max_stack_size of the function is a guess. It's the case if
+   * it doesn't exist or is not computed yet, i.e. it's in a circle. */
+  bool is_unbounded(std::string name) {
+    auto it = this->stack_usages.find(name);
+    if (it == this->stack_usages.end()) {
+      return true;
+    }
+    auto &su = it->second;
+    if (su.stack_by_user >= 0) {
+      return false;
+    }
+    return su.is_unbounded || su.max_stack_size < 0;
+  }
+
   /* Return the max_stack_size of the function. If it doesn't exist or is not
    * computed yet, return the default_stack_size. */
   size_t must_get_max_stack_size(std::string name) {
@@ -552,6 +1082,11 @@ private:
     auto cpu_cores = this->options.cpu_cores;
     auto max_threads = this->options.max_threads;
     auto max_procs_hint = this->options.max_procs_hint;
+    auto spin_budget = this->options.spin_budget;
+    auto timer_slot = this->options.timer_slot;
+    auto mem_retain = this->options.mem_retain;
+    auto elastic_stack_size = this->options.elastic_stack_size;
+    auto time_slice = this->options.time_slice;
 
     file
       << "// Configure file generated by libcsp cli." << std::endl
@@ -561,9 +1096,16 @@ private:
       << "size_t csp_cpu_cores = " << cpu_cores << ";" << std::endl
       << "size_t csp_max_threads = " << max_threads << ";" << std::endl
       << "size_t csp_max_procs_hint = " << max_procs_hint << ";" << std::endl
+      << "size_t csp_spin_budget = " << spin_budget << ";" << std::endl
+      << "size_t csp_timer_slot = " << timer_slot << ";" << std::endl
+      << "size_t csp_mem_retain = " << mem_retain << ";" << std::endl
+      << "size_t csp_elastic_stack_size = " << elastic_stack_size << ";"
+      << std::endl
+      << "size_t csp_time_slice = " << time_slice << ";" << std::endl
       << "size_t csp_procs_num = " << total << ";" << std::endl;
 
-    file << "size_t csp_procs_size[] = {";
+    /* The layout is the same as `csp_proc_meta_t` of `src/proc.h`. */
+    file << "struct {size_t size, flags;} csp_procs_meta[] = {";
     for (decltype(total) id = 0; id < total; id++) {
       auto it = wrapper_funcs.find(id);
       if (it == wrapper_funcs.end()) {
@@ -572,9 +1114,28 @@ private:
         exit(EXIT_FAILURE);
       }
 
-      size_t page_size = 1 << 12;
-      size_t size = this->stack_usages[it->second].max_stack_size;
-      file << ((size / page_size) + !!(size % page_size)) * page_size << ", ";
+      /* The processes with unbounded stacks get elastic stacks whose size is
+       * 0 here. See `src/proc.c`. */
+      size_t size = 0;
+      if (elastic_stack_size == 0 || !this->is_unbounded(it->second)) {
+        /* The small processes are allocated from the slabs of `mem.c` which
+         * only need 64-bytes alignment, the others take whole pages. */
+        size_t page_size = 1 << 12, slab_align = 64;
+        size = this->stack_usages[it->second].max_stack_size;
+        size_t align = size < page_size ? slab_align : page_size;
+        size = ((size / align) + !!(size % align)) * align;
+      }
+
+      /* A process never blocks only if all the functions it may reach are
+       * known, which also excludes the calls through function pointers. */
+      size_t flags = 0;
+      if (this->touches_fenv(it->second)) {
+        flags |= proc_meta_fenv;
+      }
+      if (!this->may_block(it->second) && !this->is_unbounded(it->second)) {
+        flags |= proc_meta_nonblocking;
+      }
+      file << "{" << size << ", " << flags << "}, ";
     }
     file << "};" << std::endl;
 
@@ -585,6 +1146,14 @@ private:
   std::unordered_map<std::string, stack_usage_t> stack_usages;
   std::unordered_map<std::string, std::set<std::string>> call_graph;
   analyzer_options_t options;
+
+  /* The index of the last run and the functions whose results are taken from
+   * it in this run. */
+  std::unordered_map<std::string, index_entry_t> index;
+  std::set<std::string> unchanged;
+
+  /* The number of the topologically sorted functions in the order. */
+  size_t sorted_len;
 } analyzer;
 
 }
@@ -0,0 +1,348 @@
+/*
+ * Copyright (c) 2020, Yanhui Shi <lime.syh at gmail dot com>
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef LIBCSP_BCAST_H
+#define LIBCSP_BCAST_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "rbq.h"
+#include "spinlock.h"
+#include "waitq.h"
+
+/*
+ * `csp_bcast_t` is the broadcast channel, i.e. one ring shared by all the
+ * subscribers as the multiple consumer sequences of Disruptor. A publisher
+ * writes an item once, and each subscriber reads it through its own cursor,
+ * so fanning out to N subscribers costs no more copies or shared updates than
+ * one channel.
+ *
+ * The publishers claim the sequences with CAS and publish them in order. A
+ * slot can be reused once the slowest subscriber has passed it, and what a
+ * publisher does when the slowest one is a ring behind is up to the policy:
+ *
+ * - `csp_bcast_block`: park the publisher until the slowest one catches up.
+ * - `csp_bcast_drop`: drop the new item, which is counted in `dropped`.
+ * - `csp_bcast_skip`: overwrite the oldest item, the lagging subscribers skip
+ *   the lost ones, which are counted in their `skipped`.
+ *
+ * Each subscriber must be used by one process at a time.
+ */
+
+#define csp_bcast_block             0
+#define csp_bcast_drop              1
+#define csp_bcast_skip              2
+
+#define csp_bcast_t(I)              csp_bcast_t_ ## I
+#define csp_bcast_sub_t(I)          csp_bcast_sub_t_ ## I
+#define csp_bcast_name(name, I)     csp_bcast_ ## name ## _ ## I
+#define csp_bcast_new(I)            csp_bcast_name(new, I)
+#define csp_bcast_try_publish(I)    csp_bcast_name(try_publish, I)
+#define csp_bcast_publish(I)        csp_bcast_name(publish, I)
+#define csp_bcast_subscribe(I)      csp_bcast_name(subscribe, I)
+#define csp_bcast_unsubscribe(I)    csp_bcast_name(unsubscribe, I)
+#define csp_bcast_try_recv(I)       csp_bcast_name(try_recv, I)
+#define csp_bcast_recv(I)           csp_bcast_name(recv, I)
+#define csp_bcast_destroy(I)        csp_bcast_name(destroy, I)
+
+#define csp_bcast_is_closed(b)      atomic_load(&(b)->closed)
+
+/* Close the channel and wake up all parked processes. The publishing fails
+ * after that, while the subscribers still read the remaining items. */
+#define csp_bcast_close(b) do {                                                \
+  atomic_store(&(b)->closed, true);                                            \
+  csp_waitq_broadcast(&(b)->recvq, &(b)->recvq.lock);                          \
+  csp_waitq_broadcast(&(b)->sendq, &(b)->sendq.lock);                          \
+} while (0)                                                                    \
+
+#define csp_bcast_declare(T, I)                                                \
+  typedef struct csp_bcast_t(I) csp_bcast_t(I);                                \
+                                                                               \
+  typedef struct {                                                             \
+    csp_bcast_t(I) *bcast;                                                     \
+                                                                               \
+    /* The sequence of the next item to read. It's written by the subscriber   \
+     * only and read by the publishers to find the slowest one. */             \
+    atomic_uint_fast64_t cursor;                                               \
+                                                                               \
+    /* The items overwritten before they were read, see `csp_bcast_skip`. */   \
+    uint64_t skipped;                                                          \
+                                                                               \
+    /* The index in `subs` of the channel. */                                  \
+    size_t idx;                                                                \
+  } csp_bcast_sub_t(I);                                                        \
+                                                                               \
+  struct csp_bcast_t(I) {                                                      \
+    /* The next sequence to claim by the publishers. */                        \
+    atomic_uint_fast64_t next;                                                 \
+    csp_rbq_padding_t _0;                                                      \
+                                                                               \
+    /* The items before `published` are readable. */                           \
+    atomic_uint_fast64_t published;                                            \
+    csp_rbq_padding_t _1;                                                      \
+                                                                               \
+    /* No subscriber is behind `gate`, i.e. the slots before `gate + cap` can  \
+     * be claimed. It's refreshed only when the ring looks full. */            \
+    atomic_uint_fast64_t gate;                                                 \
+    atomic_uint_fast64_t dropped;                                              \
+                                                                               \
+    T *items;                                                                  \
+    size_t cap, mask;                                                          \
+    int policy;                                                                \
+                                                                               \
+    csp_spinlock_t lock;                                                       \
+    csp_bcast_sub_t(I) **subs;                                                 \
+    size_t nsubs, subs_cap;                                                    \
+                                                                               \
+    csp_waitq_t sendq, recvq;                                                  \
+    atomic_bool closed;                                                        \
+  };                                                                           \
+                                                                               \
+  csp_bcast_t(I) *csp_bcast_new(I)(size_t cap_exp, int policy);                \
+  bool csp_bcast_try_publish(I)(csp_bcast_t(I) *bcast, T item);                \
+  bool csp_bcast_publish(I)(csp_bcast_t(I) *bcast, T item);                    \
+  csp_bcast_sub_t(I) *csp_bcast_subscribe(I)(csp_bcast_t(I) *bcast);           \
+  void csp_bcast_unsubscribe(I)(csp_bcast_sub_t(I) *sub);                      \
+  bool csp_bcast_try_recv(I)(csp_bcast_sub_t(I) *sub, T *item);                \
+  bool csp_bcast_recv(I)(csp_bcast_sub_t(I) *sub, T *item);                    \
+  void csp_bcast_destroy(I)(csp_bcast_t(I) *bcast);                            \
+                                                                               \
+
+#define csp_bcast_define(T, I)                                                 \
+  csp_bcast_t(I) *csp_bcast_new(I)(size_t cap_exp, int policy) {               \
+    csp_bcast_t(I) *bcast = (csp_bcast_t(I) *)calloc(                          \
+      1, sizeof(csp_bcast_t(I))                                                \
+    );                                                                         \
+    if (bcast == NULL) {                                                       \
+      return NULL;                                                             \
+    }                                                                          \
+                                                                               \
+    bcast->cap = 1 << cap_exp;                                                 \
+    bcast->mask = bcast->cap - 1;                                              \
+    bcast->items = (T *)malloc(sizeof(T) * bcast->cap);                        \
+    if (bcast->items == NULL) {                                                \
+      free(bcast);                                                             \
+      return NULL;                                                             \
+    }                                                                          \
+                                                                               \
+    atomic_init(&bcast->next, 0);                                              \
+    atomic_init(&bcast->published, 0);                                         \
+    atomic_init(&bcast->gate, 0);                                              \
+    atomic_init(&bcast->dropped, 0);                                           \
+    atomic_init(&bcast->closed, false);                                        \
+    bcast->policy = policy;                                                    \
+    csp_spinlock_init(&bcast->lock);                                           \
+    csp_waitq_init(&bcast->sendq);                                             \
+    csp_waitq_init(&bcast->recvq);                                             \
+    return bcast;                                                              \
+  }                                                                            \
+                                                                               \
+  /* Refresh `gate` with the cursor of the slowest subscriber. The published   \
+   * items are taken as read if there is no subscriber, since a new one starts \
+   * from `published`. */                                                      \
+  static uint64_t csp_bcast_name(gate, I)(csp_bcast_t(I) *bcast) {             \
+    csp_spinlock_lock(&bcast->lock);                                           \
+    uint64_t gate = atomic_load(&bcast->published);                            \
+    for (size_t i = 0; i < bcast->nsubs; i++) {                                \
+      uint64_t cursor = atomic_load_explicit(                                  \
+        &bcast->subs[i]->cursor, memory_order_acquire                          \
+      );                                                                       \
+      if (cursor < gate) {                                                     \
+        gate = cursor;                                                         \
+      }                                                                        \
+    }                                                                          \
+    atomic_store_explicit(&bcast->gate, gate, memory_order_relaxed);           \
+    csp_spinlock_unlock(&bcast->lock);                                         \
+    return gate;                                                               \
+  }                                                                            \
+                                                                               \
+  /* Publish `item` unless the ring is full for the slowest subscriber. With   \
+   * `csp_bcast_skip` the ring is never full, and the writer waits for its turn\
+   * before writing since it may overwrite a slot claimed just before it. */   \
+  bool csp_bcast_try_publish(I)(csp_bcast_t(I) *bcast, T item) {               \
+    if (csp_unlikely(csp_bcast_is_closed(bcast))) {                            \
+      return false;                                                            \
+    }                                                                          \
+                                                                               \
+    uint64_t seq = atomic_load_explicit(&bcast->next, memory_order_relaxed);   \
+    do {                                                                       \
+      if (bcast->policy != csp_bcast_skip && seq - atomic_load_explicit(       \
+            &bcast->gate, memory_order_relaxed) >= bcast->cap &&               \
+          seq - csp_bcast_name(gate, I)(bcast) >= bcast->cap) {                \
+        return false;                                                          \
+      }                                                                        \
+    } while (!atomic_compare_exchange_weak_explicit(&bcast->next, &seq,        \
+          seq + 1, memory_order_relaxed, memory_order_relaxed));               \
+                                                                               \
+    if (bcast->policy != csp_bcast_skip) {                                     \
+      bcast->items[seq & bcast->mask] = item;                                  \
+    }                                                                          \
+    while (atomic_load_explicit(&bcast->published, memory_order_acquire) !=    \
+        seq) {                                                                 \
+      csp_cpu_relax();                                                         \
+    }                                                                          \
+    if (bcast->policy == csp_bcast_skip) {                                     \
+      bcast->items[seq & bcast->mask] = item;                                  \
+    }                                                                          \
+    atomic_store_explicit(&bcast->published, seq + 1, memory_order_release);   \
+    /* The store mustn't pass the load of the waiters, or a receiver which     \
+     * has just checked `published` and is to wait is never woken up, see      \
+     * `csp_waitq_wait`. */                                                    \
+    atomic_thread_fence(memory_order_seq_cst);                                 \
+    csp_waitq_signal(&bcast->recvq, atomic_load(&bcast->recvq.len));           \
+    return true;                                                               \
+  }                                                                            \
+                                                                               \
+  /* Publish `item` once for all the subscribers. It blocks while the slowest  \
+   * subscriber is a ring behind with `csp_bcast_block`, and drops `item` with \
+   * `csp_bcast_drop`. It fails only if the item is dropped or the channel is  \
+   * closed. */                                                                \
+  bool csp_bcast_publish(I)(csp_bcast_t(I) *bcast, T item) {                   \
+    bool ok = false;                                                           \
+    if (bcast->policy == csp_bcast_block) {                                    \
+      csp_waitq_wait(&bcast->sendq, csp_bcast_is_closed(bcast) ||              \
+        (ok = csp_bcast_try_publish(I)(bcast, item))                           \
+      );                                                                       \
+    } else if (!(ok = csp_bcast_try_publish(I)(bcast, item)) &&                \
+        !csp_bcast_is_closed(bcast)) {                                         \
+      atomic_fetch_add_explicit(&bcast->dropped, 1, memory_order_relaxed);     \
+    }                                                                          \
+    return ok;                                                                 \
+  }                                                                            \
+                                                                               \
+  /* The subscriber receives the items published after it subscribes. */       \
+  csp_bcast_sub_t(I) *csp_bcast_subscribe(I)(csp_bcast_t(I) *bcast) {          \
+    csp_bcast_sub_t(I) *sub = (csp_bcast_sub_t(I) *)malloc(                    \
+      sizeof(csp_bcast_sub_t(I))                                               \
+    );                                                                         \
+    if (sub == NULL) {                                                         \
+      return NULL;                                                             \
+    }                                                                          \
+                                                                               \
+    csp_spinlock_lock(&bcast->lock);                                           \
+    if (bcast->nsubs == bcast->subs_cap) {                                     \
+      size_t cap = bcast->subs_cap == 0 ? 4 : bcast->subs_cap << 1;            \
+      csp_bcast_sub_t(I) **subs = (csp_bcast_sub_t(I) **)realloc(              \
+        bcast->subs, sizeof(csp_bcast_sub_t(I) *) * cap                        \
+      );                                                                       \
+      if (subs == NULL) {                                                      \
+        csp_spinlock_unlock(&bcast->lock);                                     \
+        free(sub);                                                             \
+        return NULL;                                                           \
+      }                                                                        \
+      bcast->subs = subs;                                                      \
+      bcast->subs_cap = cap;                                                   \
+    }                                                                          \
+    sub->bcast = bcast;                                                        \
+    sub->skipped = 0;                                                          \
+    sub->idx = bcast->nsubs;                                                   \
+    atomic_init(&sub->cursor, atomic_load(&bcast->published));                 \
+    bcast->subs[bcast->nsubs++] = sub;                                         \
+    csp_spinlock_unlock(&bcast->lock);                                         \
+    return sub;                                                                \
+  }                                                                            \
+                                                                               \
+  /* Remove the subscriber, the publishers stop waiting for it. */             \
+  void csp_bcast_unsubscribe(I)(csp_bcast_sub_t(I) *sub) {                     \
+    csp_bcast_t(I) *bcast = sub->bcast;                                        \
+    csp_spinlock_lock(&bcast->lock);                                           \
+    csp_bcast_sub_t(I) *last = bcast->subs[--bcast->nsubs];                    \
+    bcast->subs[sub->idx] = last;                                              \
+    last->idx = sub->idx;                                                      \
+    csp_spinlock_unlock(&bcast->lock);                                         \
+    free(sub);                                                                 \
+    csp_waitq_signal(&bcast->sendq, atomic_load(&bcast->sendq.len));           \
+  }                                                                            \
+                                                                               \
+  /* Read the next item of the subscriber. With `csp_bcast_skip`, a subscriber \
+   * which has fallen a ring behind skips to the oldest item still there, and  \
+   * the item is read again if it's overwritten in the meantime. */            \
+  bool csp_bcast_try_recv(I)(csp_bcast_sub_t(I) *sub, T *item) {               \
+    csp_bcast_t(I) *bcast = sub->bcast;                                        \
+    uint64_t seq = atomic_load_explicit(&sub->cursor, memory_order_relaxed);   \
+                                                                               \
+    while (true) {                                                             \
+      uint64_t published = atomic_load_explicit(                               \
+        &bcast->published, memory_order_acquire                                \
+      );                                                                       \
+      if (seq == published) {                                                  \
+        return false;                                                          \
+      }                                                                        \
+      if (bcast->policy != csp_bcast_skip) {                                   \
+        *item = bcast->items[seq & bcast->mask];                               \
+        break;                                                                 \
+      }                                                                        \
+                                                                               \
+      if (published - seq >= bcast->cap) {                                     \
+        sub->skipped += published - bcast->cap + 1 - seq;                      \
+        seq = published - bcast->cap + 1;                                      \
+      }                                                                        \
+      *item = bcast->items[seq & bcast->mask];                                 \
+      atomic_thread_fence(memory_order_acquire);                               \
+      if (atomic_load_explicit(&bcast->published, memory_order_relaxed) -      \
+          seq < bcast->cap) {                                                  \
+        break;                                                                 \
+      }                                                                        \
+    }                                                                          \
+                                                                               \
+    atomic_store_explicit(&sub->cursor, seq + 1, memory_order_release);        \
+    if (bcast->policy == csp_bcast_block) {                                    \
+      /* The same as `csp_bcast_try_publish` for the blocked publishers. */    \
+      atomic_thread_fence(memory_order_seq_cst);                               \
+      csp_waitq_signal(&bcast->sendq, 1);                                      \
+    }                                                                          \
+    return true;                                                               \
+  }                                                                            \
+                                                                               \
+  static bool csp_bcast_name(recv_ready, I)(                                   \
+    csp_bcast_sub_t(I) *sub, T *item, bool *ok                                 \
+  ) {                                                                          \
+    bool closed = csp_bcast_is_closed(sub->bcast);                             \
+    *ok = csp_bcast_try_recv(I)(sub, item);                                    \
+    return *ok || closed;                                                      \
+  }                                                                            \
+                                                                               \
+  /* Block until the next item is read, and return `false` only if the channel \
+   * is closed and the subscriber has read all the items. */                   \
+  bool csp_bcast_recv(I)(csp_bcast_sub_t(I) *sub, T *item) {                   \
+    bool ok;                                                                   \
+    csp_waitq_wait(&sub->bcast->recvq,                                         \
+      csp_bcast_name(recv_ready, I)(sub, item, &ok)                            \
+    );                                                                         \
+    return ok;                                                                 \
+  }                                                                            \
+                                                                               \
+  void csp_bcast_destroy(I)(csp_bcast_t(I) *bcast) {                           \
+    for (size_t i = 0; i < bcast->nsubs; i++) {                                \
+      free(bcast->subs[i]);                                                    \
+    }                                                                          \
+    free(bcast->subs);                                                         \
+    free(bcast->items);                                                        \
+    free(bcast);                                                               \
+  }                                                                            \
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -23,37 +23,235 @@ extern "C" {
 #endif
 
 #include "rbq.h"
+#include "waitq.h"
+
+/*
+ * A buffered channel(i.e. `ss`, `sm`, `ms`, `mm`, `el` and `fc`) is a ring
+ * buffer queue plus two wait queues. The blocking operations try the queue
+ * first and, when there is no room or no item, park the running process in
+ * `sendq` or `recvq` until the peer makes progress, in the same way as the
+ * sendq/recvq of `hchan` in Go. So an idle process waiting on a channel costs
+ * nothing.
+ *
+ * The ring of an elastic channel(i.e. `el`) grows with the backlog up to the
+ * capacity and shrinks back when it drains, see `elrbq` in `rbq.h`. It suits
+ * the channels which are sized for rare bursts.
+ *
+ * A combining channel(i.e. `fc`) is an `mm` one whose single item pushes and
+ * pops are batched by flat combining, see `fcrbq` in `rbq.h`. It suits the
+ * channels shared by many cores at once.
+ *
+ * An unbuffered channel(i.e. `un`) has no queue at all. A sender meeting a
+ * parked receiver writes the item to the destination of the receiver directly
+ * and hands the CPU to it, while a receiver meeting a parked sender reads the
+ * item from the sender's stack. Both wait queues are guarded by the lock of
+ * `sendq` so that a sender and a receiver never park at the same time.
+ *
+ * The buffered channels also lend their slots out to avoid copying large
+ * items, see `try_reserve` and `try_peek` in `rbq.h`. A writer gets slots with
+ * `csp_chan_reserve`, fills them in place and publishes them with
+ * `csp_chan_commit`, while a reader gets items with `csp_chan_peek` and gives
+ * the slots back with `csp_chan_release`. The unbuffered channels have no
+ * slots to lend, so the claims always fail.
+ */
+
+#define csp_chan_rsv_t                    csp_rbq_rsv_t
+
+/* `csp_chan_static(op, I)` is the operation `op` of the channel `I` selected
+ * at compile time, e.g. `csp_chan_static(try_push, I)(c, item)`. Unlike the
+ * function pointers used by `csp_chan_try_push` and the others, it calls the
+ * queue directly, so the compiler can inline the fast path of the queue into
+ * the caller when the channel is defined in the same translation unit or LTO
+ * is enabled. Both wake up the parked peers once they succeed. */
+#define csp_chan_static(op, I)            csp_chan_static_ ## op ## _ ## I
 
 #define csp_chan_t(I)                     csp_chan_t_ ## I
 #define csp_chan_new(I)                   csp_chan_new_ ## I
-#define csp_chan_try_push(c, item)        ((c)->try_push((c)->rbq, (item)))
-#define csp_chan_push(c, item)            ((c)->push((c)->rbq, (item)))
-#define csp_chan_try_pop(c, item)         ((c)->try_pop((c)->rbq, (item)))
-#define csp_chan_pop(c, item)             ((c)->pop((c)->rbq, (item)))
-#define csp_chan_try_pushm(c, items, n)   ((c)->try_pushm((c)->rbq, (items), n))
-#define csp_chan_pushm(c, items, n)       ((c)->pushm((c)->rbq, (items), n))
-#define csp_chan_try_popm(c, items, n)    ((c)->try_popm((c)->rbq, (items), n))
-#define csp_chan_popm(c, items, n)        ((c)->popm((c)->rbq, (items), n))
+#define csp_chan_name(name, I)            csp_chan_ ## name ## _ ## I
+#define csp_chan_try_push(c, item)        ((c)->try_push((c), (item)))
+#define csp_chan_push(c, item)            ((c)->push((c), (item)))
+#define csp_chan_try_pop(c, item)         ((c)->try_pop((c), (item)))
+#define csp_chan_pop(c, item)             ((c)->pop((c), (item)))
+#define csp_chan_try_pushm(c, items, n)   ((c)->try_pushm((c), (items), n))
+#define csp_chan_pushm(c, items, n)       ((c)->pushm((c), (items), n))
+#define csp_chan_try_popm(c, items, n)    ((c)->try_popm((c), (items), n))
+#define csp_chan_popm(c, items, n)        ((c)->popm((c), (items), n))
+#define csp_chan_try_reserve(c, n, rsv)   ((c)->try_reserve((c)->rbq, n, (rsv)))
+#define csp_chan_reserve(c, n, rsv)       ((c)->reserve((c), n, (rsv)))
+#define csp_chan_commit(c, rsv)           ((c)->commit((c), (rsv)))
+#define csp_chan_try_peek(c, n, rsv)      ((c)->try_peek((c)->rbq, n, (rsv)))
+#define csp_chan_peek(c, n, rsv)          ((c)->peek((c), n, (rsv)))
+#define csp_chan_release(c, rsv)          ((c)->release((c), (rsv)))
 #define csp_chan_destroy(c)                                                    \
   do { (c)->destroy((c)->rbq); free(c); } while (0)                            \
 
-#define csp_chan_declare(K, T, I)                                              \
-  csp_ ## K ## rbq_declare(T, I);                                              \
+#define csp_chan_is_closed(c)             atomic_load(&(c)->closed)
+
+/* Close the channel and wake up all parked processes at once. The blocking
+ * pushes fail after that, while the blocking pops still get the remaining items
+ * and fail only when the channel is drained. */
+#define csp_chan_close(c) do {                                                 \
+  atomic_store(&(c)->closed, true);                                            \
+  csp_waitq_broadcast(&(c)->recvq,                                             \
+    csp_chan_is_unbuffered(c) ? &(c)->sendq.lock : &(c)->recvq.lock            \
+  );                                                                           \
+  csp_waitq_broadcast(&(c)->sendq, &(c)->sendq.lock);                          \
+} while (0)                                                                    \
+
+/* The unbuffered channel has no queue and takes itself as `rbq`. */
+#define csp_chan_is_unbuffered(c)         ((void *)(c)->rbq == (void *)(c))
+
+/* Retry `op` until it succeeds or the channel is `blocked`, because `try_*` of
+ * the queues with multiple writers or readers may fail under contention even
+ * if there are room and items. */
+#define csp_chan_retry(op, blocked) ({                                         \
+  bool ok_;                                                                    \
+  while (!(ok_ = (op)) && !(blocked));                                         \
+  ok_;                                                                         \
+})                                                                             \
+
+#define csp_chan_declare(K, T, I)         csp_chan_ ## K ## _declare(T, I)
+#define csp_chan_define(K, T, I)          csp_chan_ ## K ## _define(T, I)
+
+#define csp_chan_ss_declare(T, I)         csp_chan_rbq_declare(ss, T, I)
+#define csp_chan_ss_define(T, I)          csp_chan_rbq_define(ss, T, I)
+#define csp_chan_sm_declare(T, I)         csp_chan_rbq_declare(sm, T, I)
+#define csp_chan_sm_define(T, I)          csp_chan_rbq_define(sm, T, I)
+#define csp_chan_ms_declare(T, I)         csp_chan_rbq_declare(ms, T, I)
+#define csp_chan_ms_define(T, I)          csp_chan_rbq_define(ms, T, I)
+#define csp_chan_mm_declare(T, I)         csp_chan_rbq_declare(mm, T, I)
+#define csp_chan_mm_define(T, I)          csp_chan_rbq_define(mm, T, I)
+#define csp_chan_el_declare(T, I)         csp_chan_rbq_declare(el, T, I)
+#define csp_chan_el_define(T, I)          csp_chan_rbq_define(el, T, I)
+#define csp_chan_fc_declare(T, I)         csp_chan_rbq_declare(fc, T, I)
+#define csp_chan_fc_define(T, I)          csp_chan_rbq_define(fc, T, I)
+
+#define csp_chan_type_declare(T, I)                                            \
   typedef struct {                                                             \
     void *rbq;                                                                 \
-    bool (*try_push)(void *rbq, T item);                                       \
-    bool (*try_pushm)(void *rbq, T *items, size_t n);                          \
-    bool (*try_pop)(void *rbq, T *item);                                       \
-    size_t (*try_popm)(void *rbq, T *, size_t n);                              \
-    void (*push)(void *rbq, T item);                                           \
-    void (*pushm)(void *rbq, T *item, size_t n);                               \
-    void (*pop)(void *rbq, T *item);                                           \
-    void (*popm)(void *rbq, T *item, size_t n);                                \
+    csp_waitq_t sendq, recvq;                                                  \
+    atomic_bool closed;                                                        \
+    bool (*try_push)(void *chan, T item);                                      \
+    bool (*try_pushm)(void *chan, T *items, size_t n);                         \
+    bool (*try_pop)(void *chan, T *item);                                      \
+    size_t (*try_popm)(void *chan, T *, size_t n);                             \
+    bool (*push)(void *chan, T item);                                          \
+    size_t (*pushm)(void *chan, T *item, size_t n);                            \
+    bool (*pop)(void *chan, T *item);                                          \
+    size_t (*popm)(void *chan, T *item, size_t n);                             \
+    T *(*try_reserve)(void *rbq, size_t n, csp_rbq_rsv_t *rsv);                \
+    T *(*reserve)(void *chan, size_t n, csp_rbq_rsv_t *rsv);                   \
+    void (*commit)(void *chan, csp_rbq_rsv_t *rsv);                            \
+    T *(*try_peek)(void *rbq, size_t n, csp_rbq_rsv_t *rsv);                   \
+    T *(*peek)(void *chan, size_t n, csp_rbq_rsv_t *rsv);                      \
+    void (*release)(void *chan, csp_rbq_rsv_t *rsv);                           \
     void (*destroy)(void *rbq);                                                \
+    /* The operations used by `csp_select`, see `select.h`. */                 \
+    bool (*select_send)(void *chan, void *item, csp_proc_t **woken);           \
+    bool (*select_recv)(void *chan, void *item, csp_proc_t **woken);           \
   } csp_chan_t(I);                                                             \
   csp_chan_t(I) *csp_chan_new(I)(size_t cap_exp);                              \
+  bool csp_chan_name(select_send, I)(void *c, void *item, csp_proc_t **woken); \
+  bool csp_chan_name(select_recv, I)(void *c, void *item, csp_proc_t **woken); \
+  bool csp_chan_name(push, I)(void *chan, T item);                             \
+  size_t csp_chan_name(pushm, I)(void *chan, T *items, size_t n);              \
+  bool csp_chan_name(pop, I)(void *chan, T *item);                             \
+  size_t csp_chan_name(popm, I)(void *chan, T *items, size_t n);               \
+  T *csp_chan_name(reserve, I)(void *chan, size_t n, csp_rbq_rsv_t *rsv);      \
+  void csp_chan_name(commit, I)(void *chan, csp_rbq_rsv_t *rsv);               \
+  T *csp_chan_name(peek, I)(void *chan, size_t n, csp_rbq_rsv_t *rsv);         \
+  void csp_chan_name(release, I)(void *chan, csp_rbq_rsv_t *rsv);              \
+                                                                               \
+/*------------------------------ buffered channel ----------------------------*/
+
+#define csp_chan_rbq_declare(K, T, I)                                          \
+  csp_ ## K ## rbq_declare(T, I);                                              \
+  csp_chan_type_declare(T, I)                                                  \
+  bool csp_chan_name(try_push, I)(void *chan, T item);                         \
+  bool csp_chan_name(try_pushm, I)(void *chan, T *items, size_t n);            \
+  bool csp_chan_name(try_pop, I)(void *chan, T *item);                         \
+  size_t csp_chan_name(try_popm, I)(void *chan, T *items, size_t n);           \
+  /* The peers may be parked in the blocking operations, so the non-blocking   \
+   * ones wake them up as well once they make progress. `csp_waitq_signal`     \
+   * checks the length first, so it's cheap if no one is waiting. */           \
+  csp_flatten bool csp_chan_static(try_push, I)(csp_chan_t(I) *c, T item) {    \
+    if (!csp_ ## K ## rbq_try_push(I)(c->rbq, item)) {                         \
+      return false;                                                            \
+    }                                                                          \
+    csp_waitq_signal(&c->recvq, 1);                                            \
+    return true;                                                               \
+  }                                                                            \
+  csp_flatten bool csp_chan_static(try_pushm, I)(                              \
+    csp_chan_t(I) *c, T *items, size_t n                                       \
+  ) {                                                                          \
+    if (!csp_ ## K ## rbq_try_pushm(I)(c->rbq, items, n)) {                    \
+      return false;                                                            \
+    }                                                                          \
+    csp_waitq_signal(&c->recvq, n);                                            \
+    return true;                                                               \
+  }                                                                            \
+  csp_flatten bool csp_chan_static(try_pop, I)(csp_chan_t(I) *c, T *item) {    \
+    if (!csp_ ## K ## rbq_try_pop(I)(c->rbq, item)) {                          \
+      return false;                                                            \
+    }                                                                          \
+    csp_waitq_signal(&c->sendq, 1);                                            \
+    return true;                                                               \
+  }                                                                            \
+  csp_flatten size_t csp_chan_static(try_popm, I)(                             \
+    csp_chan_t(I) *c, T *items, size_t n                                       \
+  ) {                                                                          \
+    size_t len = csp_ ## K ## rbq_try_popm(I)(c->rbq, items, n);               \
+    csp_waitq_signal(&c->sendq, len);                                          \
+    return len;                                                                \
+  }                                                                            \
+  csp_flatten T *csp_chan_static(try_reserve, I)(                              \
+    csp_chan_t(I) *c, size_t n, csp_rbq_rsv_t *rsv                             \
+  ) {                                                                          \
+    return csp_ ## K ## rbq_try_reserve(I)(c->rbq, n, rsv);                    \
+  }                                                                            \
+  csp_flatten T *csp_chan_static(try_peek, I)(                                 \
+    csp_chan_t(I) *c, size_t n, csp_rbq_rsv_t *rsv                             \
+  ) {                                                                          \
+    return csp_ ## K ## rbq_try_peek(I)(c->rbq, n, rsv);                       \
+  }                                                                            \
+  static inline bool csp_chan_static(push, I)(csp_chan_t(I) *c, T item) {      \
+    return csp_chan_name(push, I)(c, item);                                    \
+  }                                                                            \
+  static inline size_t csp_chan_static(pushm, I)(                              \
+    csp_chan_t(I) *c, T *items, size_t n                                       \
+  ) {                                                                          \
+    return csp_chan_name(pushm, I)(c, items, n);                               \
+  }                                                                            \
+  static inline bool csp_chan_static(pop, I)(csp_chan_t(I) *c, T *item) {      \
+    return csp_chan_name(pop, I)(c, item);                                     \
+  }                                                                            \
+  static inline size_t csp_chan_static(popm, I)(                               \
+    csp_chan_t(I) *c, T *items, size_t n                                       \
+  ) {                                                                          \
+    return csp_chan_name(popm, I)(c, items, n);                                \
+  }                                                                            \
+  static inline T *csp_chan_static(reserve, I)(                                \
+    csp_chan_t(I) *c, size_t n, csp_rbq_rsv_t *rsv                             \
+  ) {                                                                          \
+    return csp_chan_name(reserve, I)(c, n, rsv);                               \
+  }                                                                            \
+  csp_flatten void csp_chan_static(commit, I)(                                 \
+    csp_chan_t(I) *c, csp_rbq_rsv_t *rsv                                       \
+  ) {                                                                          \
+    csp_chan_name(commit, I)(c, rsv);                                          \
+  }                                                                            \
+  static inline T *csp_chan_static(peek, I)(                                   \
+    csp_chan_t(I) *c, size_t n, csp_rbq_rsv_t *rsv                             \
+  ) {                                                                          \
+    return csp_chan_name(peek, I)(c, n, rsv);                                  \
+  }                                                                            \
+  csp_flatten void csp_chan_static(release, I)(                                \
+    csp_chan_t(I) *c, csp_rbq_rsv_t *rsv                                       \
+  ) {                                                                          \
+    csp_chan_name(release, I)(c, rsv);                                         \
+  }                                                                            \
 
-#define csp_chan_define(K, T, I)                                               \
+#define csp_chan_rbq_define(K, T, I)                                           \
   csp_ ## K ## rbq_define(T, I);                                               \
   csp_chan_t(I) *csp_chan_new(I)(size_t cap_exp) {                             \
     csp_chan_t(I) *chan = (csp_chan_t(I) *)malloc(sizeof(csp_chan_t(I)));      \
@@ -65,17 +263,502 @@ extern "C" {
       free(chan);                                                              \
       return NULL;                                                             \
     }                                                                          \
-    chan->try_push  = csp_ ## K ## rbq_try_push(I);                            \
-    chan->try_pushm = csp_ ## K ## rbq_try_pushm(I);                           \
-    chan->try_pop   = csp_ ## K ## rbq_try_pop(I);                             \
-    chan->try_popm  = csp_ ## K ## rbq_try_popm(I);                            \
-    chan->push      = csp_ ## K ## rbq_push(I);                                \
-    chan->pushm     = csp_ ## K ## rbq_pushm(I);                               \
-    chan->pop       = csp_ ## K ## rbq_pop(I);                                 \
-    chan->popm      = csp_ ## K ## rbq_popm(I);                                \
+    csp_waitq_init(&chan->sendq);                                              \
+    csp_waitq_init(&chan->recvq);                                              \
+    atomic_store(&chan->closed, false);                                        \
+    chan->try_push  = csp_chan_name(try_push, I);                              \
+    chan->try_pushm = csp_chan_name(try_pushm, I);                             \
+    chan->try_pop   = csp_chan_name(try_pop, I);                               \
+    chan->try_popm  = csp_chan_name(try_popm, I);                              \
+    chan->push      = csp_chan_name(push, I);                                  \
+    chan->pushm     = csp_chan_name(pushm, I);                                 \
+    chan->pop       = csp_chan_name(pop, I);                                   \
+    chan->popm      = csp_chan_name(popm, I);                                  \
+    chan->try_reserve = csp_ ## K ## rbq_try_reserve(I);                       \
+    chan->reserve   = csp_chan_name(reserve, I);                               \
+    chan->commit    = csp_chan_name(commit, I);                                \
+    chan->try_peek  = csp_ ## K ## rbq_try_peek(I);                            \
+    chan->peek      = csp_chan_name(peek, I);                                  \
+    chan->release   = csp_chan_name(release, I);                               \
     chan->destroy   = csp_ ## K ## rbq_destroy(I);                             \
+    chan->select_send = csp_chan_name(select_send, I);                         \
+    chan->select_recv = csp_chan_name(select_recv, I);                         \
+    return chan;                                                               \
+  }                                                                            \
+                                                                               \
+  bool csp_chan_name(try_push, I)(void *c, T item) {                           \
+    return csp_chan_static(try_push, I)((csp_chan_t(I) *)c, item);             \
+  }                                                                            \
+                                                                               \
+  bool csp_chan_name(try_pushm, I)(void *c, T *items, size_t n) {              \
+    return csp_chan_static(try_pushm, I)((csp_chan_t(I) *)c, items, n);        \
+  }                                                                            \
+                                                                               \
+  bool csp_chan_name(try_pop, I)(void *c, T *item) {                           \
+    return csp_chan_static(try_pop, I)((csp_chan_t(I) *)c, item);              \
+  }                                                                            \
+                                                                               \
+  size_t csp_chan_name(try_popm, I)(void *c, T *items, size_t n) {             \
+    return csp_chan_static(try_popm, I)((csp_chan_t(I) *)c, items, n);         \
+  }                                                                            \
+                                                                               \
+  /* The buffered operations never wake the peers up by themselves, and it's   \
+   * up to `csp_select` to signal the peers. */                                \
+  bool csp_chan_name(select_send, I)(void *c, void *item, csp_proc_t **woken) {\
+    csp_chan_t(I) *chan = (csp_chan_t(I) *)c;                                  \
+    return csp_chan_retry(                                                     \
+      csp_ ## K ## rbq_try_push(I)(chan->rbq, *(T *)item),                     \
+      csp_ ## K ## rbq_is_full(I)(chan->rbq)                                   \
+    );                                                                         \
+  }                                                                            \
+                                                                               \
+  bool csp_chan_name(select_recv, I)(void *c, void *item, csp_proc_t **woken) {\
+    csp_chan_t(I) *chan = (csp_chan_t(I) *)c;                                  \
+    return csp_chan_retry(                                                     \
+      csp_ ## K ## rbq_try_pop(I)(chan->rbq, (T *)item),                       \
+      csp_ ## K ## rbq_is_empty(I)(chan->rbq)                                  \
+    );                                                                         \
+  }                                                                            \
+                                                                               \
+  bool csp_chan_name(push, I)(void *c, T item) {                               \
+    csp_chan_t(I) *chan = (csp_chan_t(I) *)c;                                  \
+    bool ok = false;                                                           \
+    csp_waitq_wait(&chan->sendq, csp_chan_is_closed(chan) ||                   \
+      (ok = csp_chan_name(select_send, I)(chan, &item, NULL))                  \
+    );                                                                         \
+    if (ok) {                                                                  \
+      csp_waitq_signal(&chan->recvq, 1);                                       \
+    }                                                                          \
+    return ok;                                                                 \
+  }                                                                            \
+                                                                               \
+  /* Push as many items as possible with the chunk halved on failure, and      \
+   * return the number of items pushed. */                                     \
+  size_t csp_chan_name(try_pushm_part, I)(void *rbq, T *items, size_t n) {     \
+    size_t cap = csp_rbq_cap((csp_ ## K ## rbq_t(I) *)rbq);                    \
+    size_t chunk = n < cap ? n : cap;                                          \
+    while (!csp_ ## K ## rbq_try_pushm(I)(rbq, items, chunk)) {                \
+      if (chunk > 1) {                                                         \
+        chunk >>= 1;                                                           \
+      } else if (csp_ ## K ## rbq_is_full(I)(rbq)) {                           \
+        return 0;                                                              \
+      }                                                                        \
+    }                                                                          \
+    return chunk;                                                              \
+  }                                                                            \
+                                                                               \
+  /* Return the number of items pushed, which is less than `n` only if the     \
+   * channel is closed. */                                                     \
+  size_t csp_chan_name(pushm, I)(void *c, T *items, size_t n) {                \
+    csp_chan_t(I) *chan = (csp_chan_t(I) *)c;                                  \
+    size_t len, total = 0;                                                     \
+    while (total < n) {                                                        \
+      csp_waitq_wait(&chan->sendq, (len = 0, csp_chan_is_closed(chan)) ||      \
+        (len = csp_chan_name(try_pushm_part, I)(                               \
+          chan->rbq, items + total, n - total                                  \
+        )) > 0                                                                 \
+      );                                                                       \
+      if (len == 0) {                                                          \
+        break;                                                                 \
+      }                                                                        \
+      csp_waitq_signal(&chan->recvq, len);                                     \
+      total += len;                                                            \
+    }                                                                          \
+    return total;                                                              \
+  }                                                                            \
+                                                                               \
+  /* The popping is ready if it gets an item or the channel is closed. It reads\
+   * `closed` first, so that it also gets the items pushed before closing. */  \
+  static bool csp_chan_name(pop_ready, I)(                                     \
+    csp_chan_t(I) *chan, T *item, bool *ok                                     \
+  ) {                                                                          \
+    bool closed = csp_chan_is_closed(chan);                                    \
+    *ok = csp_chan_name(select_recv, I)(chan, item, NULL);                     \
+    return *ok || closed;                                                      \
+  }                                                                            \
+                                                                               \
+  bool csp_chan_name(pop, I)(void *c, T *item) {                               \
+    csp_chan_t(I) *chan = (csp_chan_t(I) *)c;                                  \
+    bool ok;                                                                   \
+    csp_waitq_wait(&chan->recvq, csp_chan_name(pop_ready, I)(chan, item, &ok));\
+    if (ok) {                                                                  \
+      csp_waitq_signal(&chan->sendq, 1);                                       \
+    }                                                                          \
+    return ok;                                                                 \
+  }                                                                            \
+                                                                               \
+  static bool csp_chan_name(popm_ready, I)(                                    \
+    csp_chan_t(I) *chan, T *items, size_t n, size_t *len                       \
+  ) {                                                                          \
+    bool closed = csp_chan_is_closed(chan);                                    \
+    csp_chan_retry(                                                            \
+      (*len = csp_ ## K ## rbq_try_popm(I)(chan->rbq, items, n)) > 0,          \
+      csp_ ## K ## rbq_is_empty(I)(chan->rbq)                                  \
+    );                                                                         \
+    return *len > 0 || closed;                                                 \
+  }                                                                            \
+                                                                               \
+  /* Return the number of items popped, which is less than `n` only if the     \
+   * channel is closed and drained. */                                         \
+  size_t csp_chan_name(popm, I)(void *c, T *items, size_t n) {                 \
+    csp_chan_t(I) *chan = (csp_chan_t(I) *)c;                                  \
+    size_t len, total = 0;                                                     \
+    while (total < n) {                                                        \
+      csp_waitq_wait(&chan->recvq, csp_chan_name(popm_ready, I)(               \
+        chan, items + total, n - total, &len                                   \
+      ));                                                                      \
+      if (len == 0) {                                                          \
+        break;                                                                 \
+      }                                                                        \
+      csp_waitq_signal(&chan->sendq, len);                                     \
+      total += len;                                                            \
+    }                                                                          \
+    return total;                                                              \
+  }                                                                            \
+                                                                               \
+  /* Block until some slots are claimed, and return `NULL` only if the channel \
+   * is closed. */                                                             \
+  T *csp_chan_name(reserve, I)(void *c, size_t n, csp_rbq_rsv_t *rsv) {        \
+    csp_chan_t(I) *chan = (csp_chan_t(I) *)c;                                  \
+    T *items = NULL;                                                           \
+    csp_waitq_wait(&chan->sendq, csp_chan_is_closed(chan) ||                   \
+      csp_chan_retry(                                                          \
+        (items = csp_ ## K ## rbq_try_reserve(I)(chan->rbq, n, rsv)) != NULL,  \
+        csp_ ## K ## rbq_is_full(I)(chan->rbq)                                 \
+      )                                                                        \
+    );                                                                         \
+    return items;                                                              \
+  }                                                                            \
+                                                                               \
+  void csp_chan_name(commit, I)(void *c, csp_rbq_rsv_t *rsv) {                 \
+    csp_chan_t(I) *chan = (csp_chan_t(I) *)c;                                  \
+    csp_ ## K ## rbq_commit(I)(chan->rbq, rsv);                                \
+    csp_waitq_signal(&chan->recvq, rsv->len);                                  \
+  }                                                                            \
+                                                                               \
+  static bool csp_chan_name(peek_ready, I)(                                    \
+    csp_chan_t(I) *chan, size_t n, csp_rbq_rsv_t *rsv, T **items               \
+  ) {                                                                          \
+    bool closed = csp_chan_is_closed(chan);                                    \
+    csp_chan_retry(                                                            \
+      (*items = csp_ ## K ## rbq_try_peek(I)(chan->rbq, n, rsv)) != NULL,      \
+      csp_ ## K ## rbq_is_empty(I)(chan->rbq)                                  \
+    );                                                                         \
+    return *items != NULL || closed;                                           \
+  }                                                                            \
+                                                                               \
+  /* Block until some items are claimed, and return `NULL` only if the channel \
+   * is closed and drained. */                                                 \
+  T *csp_chan_name(peek, I)(void *c, size_t n, csp_rbq_rsv_t *rsv) {           \
+    csp_chan_t(I) *chan = (csp_chan_t(I) *)c;                                  \
+    T *items;                                                                  \
+    csp_waitq_wait(&chan->recvq,                                               \
+      csp_chan_name(peek_ready, I)(chan, n, rsv, &items)                       \
+    );                                                                         \
+    return items;                                                              \
+  }                                                                            \
+                                                                               \
+  void csp_chan_name(release, I)(void *c, csp_rbq_rsv_t *rsv) {                \
+    csp_chan_t(I) *chan = (csp_chan_t(I) *)c;                                  \
+    csp_ ## K ## rbq_release(I)(chan->rbq, rsv);                               \
+    csp_waitq_signal(&chan->sendq, rsv->len);                                  \
+  }                                                                            \
+                                                                               \
+/*----------------------------- unbuffered channel ---------------------------*/
+
+#define csp_chan_un_declare(T, I)                                              \
+  csp_chan_type_declare(T, I)                                                  \
+  bool csp_chan_name(un_try_push, I)(void *chan, T item);                      \
+  bool csp_chan_name(un_try_pushm, I)(void *chan, T *items, size_t n);         \
+  bool csp_chan_name(un_try_pop, I)(void *chan, T *item);                      \
+  size_t csp_chan_name(un_try_popm, I)(void *chan, T *items, size_t n);        \
+  T *csp_chan_name(un_try_claim, I)(void *chan, size_t n, csp_rbq_rsv_t *rsv); \
+  void csp_chan_name(un_destroy, I)(void *chan);                               \
+  csp_flatten bool csp_chan_static(try_push, I)(csp_chan_t(I) *c, T item) {    \
+    return csp_chan_name(un_try_push, I)(c, item);                             \
+  }                                                                            \
+  csp_flatten bool csp_chan_static(try_pushm, I)(                              \
+    csp_chan_t(I) *c, T *items, size_t n                                       \
+  ) {                                                                          \
+    return csp_chan_name(un_try_pushm, I)(c, items, n);                        \
+  }                                                                            \
+  csp_flatten bool csp_chan_static(try_pop, I)(csp_chan_t(I) *c, T *item) {    \
+    return csp_chan_name(un_try_pop, I)(c, item);                              \
+  }                                                                            \
+  csp_flatten size_t csp_chan_static(try_popm, I)(                             \
+    csp_chan_t(I) *c, T *items, size_t n                                       \
+  ) {                                                                          \
+    return csp_chan_name(un_try_popm, I)(c, items, n);                         \
+  }                                                                            \
+  csp_flatten T *csp_chan_static(try_reserve, I)(                              \
+    csp_chan_t(I) *c, size_t n, csp_rbq_rsv_t *rsv                             \
+  ) {                                                                          \
+    return csp_chan_name(un_try_claim, I)(c, n, rsv);                          \
+  }                                                                            \
+  csp_flatten T *csp_chan_static(try_peek, I)(                                 \
+    csp_chan_t(I) *c, size_t n, csp_rbq_rsv_t *rsv                             \
+  ) {                                                                          \
+    return csp_chan_name(un_try_claim, I)(c, n, rsv);                          \
+  }                                                                            \
+  static inline bool csp_chan_static(push, I)(csp_chan_t(I) *c, T item) {      \
+    return csp_chan_name(push, I)(c, item);                                    \
+  }                                                                            \
+  static inline size_t csp_chan_static(pushm, I)(                              \
+    csp_chan_t(I) *c, T *items, size_t n                                       \
+  ) {                                                                          \
+    return csp_chan_name(pushm, I)(c, items, n);                               \
+  }                                                                            \
+  static inline bool csp_chan_static(pop, I)(csp_chan_t(I) *c, T *item) {      \
+    return csp_chan_name(pop, I)(c, item);                                     \
+  }                                                                            \
+  static inline size_t csp_chan_static(popm, I)(                               \
+    csp_chan_t(I) *c, T *items, size_t n                                       \
+  ) {                                                                          \
+    return csp_chan_name(popm, I)(c, items, n);                                \
+  }                                                                            \
+  static inline T *csp_chan_static(reserve, I)(                                \
+    csp_chan_t(I) *c, size_t n, csp_rbq_rsv_t *rsv                             \
+  ) {                                                                          \
+    return csp_chan_name(reserve, I)(c, n, rsv);                               \
+  }                                                                            \
+  csp_flatten void csp_chan_static(commit, I)(                                 \
+    csp_chan_t(I) *c, csp_rbq_rsv_t *rsv                                       \
+  ) {                                                                          \
+    csp_chan_name(commit, I)(c, rsv);                                          \
+  }                                                                            \
+  static inline T *csp_chan_static(peek, I)(                                   \
+    csp_chan_t(I) *c, size_t n, csp_rbq_rsv_t *rsv                             \
+  ) {                                                                          \
+    return csp_chan_name(peek, I)(c, n, rsv);                                  \
+  }                                                                            \
+  csp_flatten void csp_chan_static(release, I)(                                \
+    csp_chan_t(I) *c, csp_rbq_rsv_t *rsv                                       \
+  ) {                                                                          \
+    csp_chan_name(release, I)(c, rsv);                                         \
+  }                                                                            \
+
+#define csp_chan_un_define(T, I)                                               \
+  /* `cap_exp` is ignored since the unbuffered channel has no capacity. */     \
+  csp_chan_t(I) *csp_chan_new(I)(size_t cap_exp) {                             \
+    csp_chan_t(I) *chan = (csp_chan_t(I) *)malloc(sizeof(csp_chan_t(I)));      \
+    if (chan == NULL) {                                                        \
+      return NULL;                                                             \
+    }                                                                          \
+    /* There is no queue, so the operations take the channel itself. */        \
+    chan->rbq = chan;                                                          \
+    csp_waitq_init(&chan->sendq);                                              \
+    csp_waitq_init(&chan->recvq);                                              \
+    atomic_store(&chan->closed, false);                                        \
+    chan->try_push  = csp_chan_name(un_try_push, I);                           \
+    chan->try_pushm = csp_chan_name(un_try_pushm, I);                          \
+    chan->try_pop   = csp_chan_name(un_try_pop, I);                            \
+    chan->try_popm  = csp_chan_name(un_try_popm, I);                           \
+    chan->push      = csp_chan_name(push, I);                                  \
+    chan->pushm     = csp_chan_name(pushm, I);                                 \
+    chan->pop       = csp_chan_name(pop, I);                                   \
+    chan->popm      = csp_chan_name(popm, I);                                  \
+    chan->try_reserve = csp_chan_name(un_try_claim, I);                        \
+    chan->reserve   = csp_chan_name(reserve, I);                               \
+    chan->commit    = csp_chan_name(commit, I);                                \
+    chan->try_peek  = csp_chan_name(un_try_claim, I);                          \
+    chan->peek      = csp_chan_name(peek, I);                                  \
+    chan->release   = csp_chan_name(release, I);                               \
+    chan->destroy   = csp_chan_name(un_destroy, I);                            \
+    chan->select_send = csp_chan_name(select_send, I);                         \
+    chan->select_recv = csp_chan_name(select_recv, I);                         \
     return chan;                                                               \
   }                                                                            \
+                                                                               \
+  /* Write the item to a parked receiver which is returned by `woken`. It must \
+   * be called with the lock held. */                                          \
+  bool csp_chan_name(select_send, I)(void *c, void *item, csp_proc_t **woken) {\
+    csp_chan_t(I) *chan = (csp_chan_t(I) *)c;                                  \
+    csp_waitq_node_t *node = csp_waitq_pop(&chan->recvq);                      \
+    if (node == NULL) {                                                        \
+      return false;                                                            \
+    }                                                                          \
+    *(T *)node->data = *(T *)item;                                             \
+    *woken = node->parked;                                                     \
+    return true;                                                               \
+  }                                                                            \
+                                                                               \
+  /* Read the item from a parked sender which is returned by `woken`. It must  \
+   * be called with the lock held. */                                          \
+  bool csp_chan_name(select_recv, I)(void *c, void *item, csp_proc_t **woken) {\
+    csp_chan_t(I) *chan = (csp_chan_t(I) *)c;                                  \
+    csp_waitq_node_t *node = csp_waitq_pop(&chan->sendq);                      \
+    if (node == NULL) {                                                        \
+      return false;                                                            \
+    }                                                                          \
+    *(T *)item = *(T *)node->data;                                             \
+    *woken = node->parked;                                                     \
+    return true;                                                               \
+  }                                                                            \
+                                                                               \
+  /* Hand the item to a parked receiver and wake it up if there is one. It     \
+   * must be called with the lock held which is released if it succeeds. */    \
+  static bool csp_chan_name(un_send_locked, I)(                                \
+    csp_chan_t(I) *chan, T item, bool handoff                                  \
+  ) {                                                                          \
+    csp_proc_t *woken;                                                         \
+    if (!csp_chan_name(select_send, I)(chan, &item, &woken)) {                 \
+      return false;                                                            \
+    }                                                                          \
+    csp_waitq_unlock(&chan->sendq.lock);                                       \
+    if (handoff) {                                                             \
+      csp_sched_handoff(woken);                                                \
+    } else {                                                                   \
+      csp_sched_put_proc(woken);                                               \
+    }                                                                          \
+    return true;                                                               \
+  }                                                                            \
+                                                                               \
+  /* Take the item from a parked sender and wake it up if there is one. It     \
+   * must be called with the lock held which is released if it succeeds. */    \
+  static bool csp_chan_name(un_recv_locked, I)(csp_chan_t(I) *chan, T *item) { \
+    csp_proc_t *woken;                                                         \
+    if (!csp_chan_name(select_recv, I)(chan, item, &woken)) {                  \
+      return false;                                                            \
+    }                                                                          \
+    csp_waitq_unlock(&chan->sendq.lock);                                       \
+    csp_sched_put_proc(woken);                                                 \
+    return true;                                                               \
+  }                                                                            \
+                                                                               \
+  bool csp_chan_name(un_try_push, I)(void *c, T item) {                        \
+    csp_chan_t(I) *chan = (csp_chan_t(I) *)c;                                  \
+    if (atomic_load(&chan->recvq.len) == 0) {                                  \
+      return false;                                                            \
+    }                                                                          \
+    csp_waitq_lock(&chan->sendq.lock);                                         \
+    if (csp_chan_name(un_send_locked, I)(chan, item, false)) {                 \
+      return true;                                                             \
+    }                                                                          \
+    csp_waitq_unlock(&chan->sendq.lock);                                       \
+    return false;                                                              \
+  }                                                                            \
+                                                                               \
+  /* It's all or nothing as `try_pushm` of the buffered channels. The          \
+   * receivers in `csp_select` are skipped since any of them may be fired by   \
+   * another case in the middle. */                                            \
+  bool csp_chan_name(un_try_pushm, I)(void *c, T *items, size_t n) {           \
+    csp_chan_t(I) *chan = (csp_chan_t(I) *)c;                                  \
+    if (atomic_load(&chan->recvq.len) < n) {                                   \
+      return false;                                                            \
+    }                                                                          \
+    csp_waitq_lock(&chan->sendq.lock);                                         \
+    size_t len = 0;                                                            \
+    csp_waitq_node_t *node = chan->recvq.head, *next;                          \
+    for (; node != NULL && len < n; node = node->next) {                       \
+      len += node->done == NULL;                                               \
+    }                                                                          \
+    if (len < n) {                                                             \
+      csp_waitq_unlock(&chan->sendq.lock);                                     \
+      return false;                                                            \
+    }                                                                          \
+    for (node = chan->recvq.head, len = 0; len < n; node = next) {             \
+      next = node->next;                                                       \
+      if (node->done == NULL) {                                                \
+        csp_waitq_remove(&chan->recvq, node);                                  \
+        *(T *)node->data = items[len++];                                       \
+        csp_sched_put_proc(node->parked);                                      \
+      }                                                                        \
+    }                                                                          \
+    csp_waitq_unlock(&chan->sendq.lock);                                       \
+    return true;                                                               \
+  }                                                                            \
+                                                                               \
+  bool csp_chan_name(un_try_pop, I)(void *c, T *item) {                        \
+    csp_chan_t(I) *chan = (csp_chan_t(I) *)c;                                  \
+    if (atomic_load(&chan->sendq.len) == 0) {                                  \
+      return false;                                                            \
+    }                                                                          \
+    csp_waitq_lock(&chan->sendq.lock);                                         \
+    if (csp_chan_name(un_recv_locked, I)(chan, item)) {                        \
+      return true;                                                             \
+    }                                                                          \
+    csp_waitq_unlock(&chan->sendq.lock);                                       \
+    return false;                                                              \
+  }                                                                            \
+                                                                               \
+  size_t csp_chan_name(un_try_popm, I)(void *c, T *items, size_t n) {          \
+    size_t len = 0;                                                            \
+    while (len < n && csp_chan_name(un_try_pop, I)(c, items + len)) {          \
+      len++;                                                                   \
+    }                                                                          \
+    return len;                                                                \
+  }                                                                            \
+                                                                               \
+  bool csp_chan_name(push, I)(void *c, T item) {                               \
+    csp_chan_t(I) *chan = (csp_chan_t(I) *)c;                                  \
+    csp_waitq_lock(&chan->sendq.lock);                                         \
+    if (csp_chan_is_closed(chan)) {                                            \
+      csp_waitq_unlock(&chan->sendq.lock);                                     \
+      return false;                                                            \
+    }                                                                          \
+    if (csp_chan_name(un_send_locked, I)(chan, item, true)) {                  \
+      return true;                                                             \
+    }                                                                          \
+    /* The receiver will read the item from our stack and wake us up, while    \
+     * `csp_chan_close` resets `data` before waking us up. */                  \
+    csp_waitq_node_t node = {.parked = csp_this_core->running, .data = &item}; \
+    csp_waitq_push(&chan->sendq, &node);                                       \
+    csp_sched_park(&chan->sendq.lock);                                         \
+    return node.data != NULL;                                                  \
+  }                                                                            \
+                                                                               \
+  size_t csp_chan_name(pushm, I)(void *c, T *items, size_t n) {                \
+    size_t i = 0;                                                              \
+    while (i < n && csp_chan_name(push, I)(c, items[i])) {                     \
+      i++;                                                                     \
+    }                                                                          \
+    return i;                                                                  \
+  }                                                                            \
+                                                                               \
+  bool csp_chan_name(pop, I)(void *c, T *item) {                               \
+    csp_chan_t(I) *chan = (csp_chan_t(I) *)c;                                  \
+    csp_waitq_lock(&chan->sendq.lock);                                         \
+    if (csp_chan_name(un_recv_locked, I)(chan, item)) {                        \
+      return true;                                                             \
+    }                                                                          \
+    if (csp_chan_is_closed(chan)) {                                            \
+      csp_waitq_unlock(&chan->sendq.lock);                                     \
+      return false;                                                            \
+    }                                                                          \
+    /* The sender will write the item to `item` and wake us up. */             \
+    csp_waitq_node_t node = {.parked = csp_this_core->running, .data = item};  \
+    csp_waitq_push(&chan->recvq, &node);                                       \
+    csp_sched_park(&chan->sendq.lock);                                         \
+    return node.data != NULL;                                                  \
+  }                                                                            \
+                                                                               \
+  size_t csp_chan_name(popm, I)(void *c, T *items, size_t n) {                 \
+    size_t i = 0;                                                              \
+    while (i < n && csp_chan_name(pop, I)(c, items + i)) {                     \
+      i++;                                                                     \
+    }                                                                          \
+    return i;                                                                  \
+  }                                                                            \
+                                                                               \
+  /* There are no slots to lend, so nothing can be claimed, committed or       \
+   * released. */                                                              \
+  T *csp_chan_name(un_try_claim, I)(void *c, size_t n, csp_rbq_rsv_t *rsv) {   \
+    return NULL;                                                               \
+  }                                                                            \
+                                                                               \
+  T *csp_chan_name(reserve, I)(void *c, size_t n, csp_rbq_rsv_t *rsv) {        \
+    return NULL;                                                               \
+  }                                                                            \
+                                                                               \
+  void csp_chan_name(commit, I)(void *c, csp_rbq_rsv_t *rsv) {}                \
+                                                                               \
+  T *csp_chan_name(peek, I)(void *c, size_t n, csp_rbq_rsv_t *rsv) {           \
+    return NULL;                                                               \
+  }                                                                            \
+                                                                               \
+  void csp_chan_name(release, I)(void *c, csp_rbq_rsv_t *rsv) {}               \
+                                                                               \
+  void csp_chan_name(un_destroy, I)(void *chan) {}                             \
 
 #ifdef __cplusplus
 }
@@ -25,6 +25,15 @@ extern "C" {
 #define csp_likely(x)     __builtin_expect(!!(x), 1)
 #define csp_unlikely(x)   __builtin_expect(!!(x), 0)
 #define csp_soft_mbarr()  __asm__ __volatile__("" ::: "memory")
+#if defined(__aarch64__)
+#define csp_cpu_relax()   __asm__ __volatile__("yield" ::: "memory")
+#else
+#define csp_cpu_relax()   __asm__ __volatile__("pause" ::: "memory")
+#endif
+
+/* Inline the function and everything it calls as long as their bodies are
+ * visible. */
+#define csp_flatten       static inline __attribute__((always_inline, flatten))
 
 #define csp_swap(a, b)                                                         \
   do { typeof(a) tmp = (a); (a) = (b); (b) = tmp; } while (0)
@@ -22,41 +22,129 @@
 extern "C" {
 #endif
 
+#include <errno.h>
+#include <linux/futex.h>
 #include <stdatomic.h>
-#include "timer.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include "common.h"
 
 #define csp_cond_signal_none       0
 #define csp_cond_signal_proc_avail 1
-#define csp_cond_signal_deep_sleep 2
+#define csp_cond_signal_wakeup     2
 
+/* The spins of a waiter are halved every time it has to park, but never below
+ * this value. */
+#define csp_cond_min_spins         16
+
+/* The max number of spins before a waiter parks itself in the kernel, it can be
+ * set with `cspcli analyze --spin-budget`. */
+extern size_t csp_spin_budget;
+
+/*
+ * `csp_cond_t` is a single-waiter condition on which a thread spins for a
+ * while and then parks with futex. The spin count is adaptive: it's doubled up
+ * to `csp_spin_budget` if the signal arrives while spinning, otherwise halved,
+ * so a busy core wakes up in microseconds and an idle one sleeps in the kernel
+ * almost immediately.
+ */
 typedef struct {
+  /* The signal sent to the waiter. It's also the futex word. */
   atomic_int stat;
-  atomic_bool waiting;
-  csp_timer_time_t start;
+
+  /* Whether the waiter is parked or about to park in the kernel. */
+  atomic_bool parked;
+
+  /* Current spin count of the waiter. */
+  size_t spins;
+
+  /* How many times the waiter has parked in the kernel, see `csp_stats_t`. */
+  atomic_uint_fast64_t nsleeps;
 } csp_cond_t;
 
+#define csp_cond_futex(cond, op, val)                                          \
+  csp_cond_futex_timed(cond, op, val, NULL)                                    \
+
+#define csp_cond_futex_timed(cond, op, val, timeout)                           \
+  syscall(SYS_futex, (int *)&(cond)->stat, (op), (val), (timeout), NULL, 0)    \
+
 #define csp_cond_init(cond) do {                                               \
   atomic_store(&(cond)->stat, csp_cond_signal_none);                           \
-  atomic_store(&(cond)->waiting, false);                                       \
-  (cond)->start = 0;                                                           \
+  atomic_store(&(cond)->parked, false);                                        \
+  (cond)->spins = csp_spin_budget;                                             \
+  atomic_store(&(cond)->nsleeps, 0);                                           \
 } while (0)                                                                    \
 
-#define csp_cond_before_wait(cond) do {                                        \
-  (cond)->start = csp_timer_now();                                             \
-} while (0)                                                                    \
+/* Spin until the signal arrives or the spin count runs out, which is adapted
+ * by the result. */
+#define csp_cond_spin(cond) ({                                                 \
+  int spin_signal_;                                                            \
+  size_t spins_ = 0;                                                           \
+  while ((spin_signal_ = atomic_load(&(cond)->stat)) ==                        \
+      csp_cond_signal_none && spins_++ < (cond)->spins) {                      \
+    csp_cpu_relax();                                                           \
+  }                                                                            \
+                                                                               \
+  if (spin_signal_ != csp_cond_signal_none) {                                  \
+    if (((cond)->spins <<= 1) > csp_spin_budget) {                             \
+      (cond)->spins = csp_spin_budget;                                         \
+    }                                                                          \
+  } else {                                                                     \
+    if (((cond)->spins >>= 1) < csp_cond_min_spins) {                          \
+      (cond)->spins = csp_cond_min_spins;                                      \
+    }                                                                          \
+  }                                                                            \
+  spin_signal_;                                                                \
+})                                                                             \
 
 #define csp_cond_wait(cond) ({                                                 \
-  int signal;                                                                  \
-  while ((signal = atomic_load(&(cond)->stat)) == csp_cond_signal_none) {      \
-    atomic_store(&(cond)->waiting, true);                                      \
+  int signal_ = csp_cond_spin(cond);                                           \
+  if (signal_ == csp_cond_signal_none) {                                       \
+    /* The signaler stores `stat` and then loads `parked` while we store       \
+     * `parked` and then load `stat`, so at least one of us sees the other. */ \
+    atomic_store(&(cond)->parked, true);                                       \
+    atomic_store_explicit(&(cond)->nsleeps, atomic_load_explicit(              \
+      &(cond)->nsleeps, memory_order_relaxed) + 1, memory_order_relaxed);      \
+    while ((signal_ = atomic_load(&(cond)->stat)) == csp_cond_signal_none) {   \
+      csp_cond_futex(cond, FUTEX_WAIT_PRIVATE, csp_cond_signal_none);          \
+    }                                                                          \
+    atomic_store(&(cond)->parked, false);                                      \
   }                                                                            \
-  csp_cond_init(cond);                                                         \
-  signal;                                                                      \
+                                                                               \
+  atomic_store(&(cond)->stat, csp_cond_signal_none);                           \
+  signal_;                                                                     \
+})                                                                             \
+
+/* The same as `csp_cond_wait` except that `csp_cond_signal_none` is returned if
+ * no signal arrives in `nanosecs` nanoseconds. A signal sent after the timeout
+ * is kept for the next wait. */
+#define csp_cond_timedwait(cond, nanosecs) ({                                  \
+  int tsignal_ = csp_cond_spin(cond);                                          \
+  if (tsignal_ == csp_cond_signal_none) {                                      \
+    struct timespec timeout_ = {                                               \
+      .tv_sec = (nanosecs) / 1000000000, .tv_nsec = (nanosecs) % 1000000000    \
+    };                                                                         \
+    atomic_store(&(cond)->parked, true);                                       \
+    while ((tsignal_ = atomic_load(&(cond)->stat)) == csp_cond_signal_none &&  \
+        (csp_cond_futex_timed(cond, FUTEX_WAIT_PRIVATE, csp_cond_signal_none,  \
+          &timeout_) == 0 || errno != ETIMEDOUT));                             \
+    atomic_store(&(cond)->parked, false);                                      \
+  }                                                                            \
+                                                                               \
+  if (tsignal_ != csp_cond_signal_none) {                                      \
+    atomic_store(&(cond)->stat, csp_cond_signal_none);                         \
+  }                                                                            \
+  tsignal_;                                                                    \
 })                                                                             \
 
 #define csp_cond_signal(cond, signal) do {                                     \
-  while (!atomic_load(&(cond)->waiting));                                      \
   atomic_store(&(cond)->stat, (signal));                                       \
+  if (atomic_load(&(cond)->parked)) {                                          \
+    csp_cond_futex(cond, FUTEX_WAKE_PRIVATE, 1);                               \
+  }                                                                            \
 } while(0)                                                                     \
 
 #ifdef __cplusplus
@@ -15,10 +15,52 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <link.h>
+#include <linux/membarrier.h>
+#include <sched.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
 #include <time.h>
+#include <ucontext.h>
+#include <unistd.h>
 #include "common.h"
 #include "core.h"
+#include "trace.h"
 
+#if !defined(__aarch64__)
+#include <cpuid.h>
+#endif
+
+/* The signal sent by the monitor to preempt the running process. */
+#define csp_core_preempt_signal       SIGURG
+
+/* The signal handlers run on their own stacks, the process stacks are sized
+ * exactly by libcsp plugin. */
+#define csp_core_preempt_altstack_size  (64 << 10)
+
+/* The stack space reserved by libcsp plugin for a preemption(see
+ * `preempt_reserved` in `plugin/sa.hpp`), in which the registers saved by
+ * `csp_core_preempt_entry` must fit. */
+#define csp_core_preempt_reserved     4096
+
+/* The XSAVE components saved by `csp_core_preempt_entry`, i.e. x87, SSE, AVX
+ * and AVX-512. The ones enabled lazily by the kernel like AMX are excluded. */
+#define csp_core_preempt_xsave_mask   0xe7
+
+/* The thread of a spare core exits if it's not taken in 10 seconds. */
+#define csp_core_spare_idle_timeout   (10 * 1000000000L)
+
+#if defined(__aarch64__)
+#define csp_core_anchor_load(reg)                                              \
+  "ldp x29, x9,  ["reg", #0x00]\n"                                             \
+  "mov sp,  x9\n"                                                              \
+  "ldp x30, x19, ["reg", #0x10]\n"                                             \
+
+#else
 #define csp_core_anchor_load(reg)                                              \
   "mov (%"reg"),     %rbp\n"                                                   \
   "mov 0x08(%"reg"), %rsp\n"                                                   \
@@ -26,55 +68,340 @@
   "mov %rax,         (%rsp)\n"                                                 \
   "mov 0x18(%"reg"), %rbx\n"                                                   \
 
+#endif
+
 extern csp_proc_t *csp_sched_get(csp_core_t *this_core);
-extern void csp_sched_put_proc(csp_proc_t *proc);
+extern csp_proc_t *csp_sched_switch(csp_proc_t *next);
 extern bool csp_core_pools_get(size_t pid, csp_core_t **core);
 extern void csp_core_pools_put(csp_core_t *core);
+extern bool csp_core_pools_remove(csp_core_t *core);
+extern void csp_core_pools_put_retired(csp_core_t *core);
+extern void csp_core_pools_reclaim_put(csp_core_t *core);
+extern void csp_sched_yield(void);
+extern void csp_proc_destroy(csp_proc_t *proc);
+extern bool csp_cpus_pin_attr(pthread_attr_t *attr, size_t pid);
+extern void csp_cpus_pin_self(size_t pid);
+
+/* The time slice in nanoseconds generated by libcsp plugin, 0 means the
+ * processes are never preempted. */
+extern size_t csp_time_slice;
 
 _Thread_local csp_core_t *csp_this_core;
 
-csp_core_t *csp_core_new(size_t pid, csp_lrunq_t *lrunq, csp_grunq_t *grunq) {
-  csp_core_t *core = (csp_core_t *)malloc(sizeof(csp_core_t));
+/* The core running on the main thread, which never retires. */
+static csp_core_t *csp_core_main;
+
+/* Whether the monitor hands off the cores stuck in system calls, it needs
+ * `membarrier` to order its announcement before its checks, see
+ * `csp_core_acquire`. */
+static bool csp_core_handoff_enabled;
+
+csp_core_t *csp_core_new(size_t pid, csp_lrunq_t **lrunqs,
+    csp_grunq_t *grunq, csp_proc_cache_t *proc_caches) {
+  csp_core_t *core = (csp_core_t *)aligned_alloc(
+    _Alignof(csp_core_t), sizeof(csp_core_t)
+  );
   if (core == NULL) {
     return NULL;
   }
 
   core->pid = pid;
-  core->lrunq = lrunq;
+  core->lrunqs = lrunqs;
   core->grunq = grunq;
+  core->proc_caches = proc_caches;
   core->running = NULL;
+  core->park_fn = NULL;
+  atomic_init(&core->nsched, 0x01);
+  atomic_init(&core->nopreempt, 0);
+  core->preempt_nsched = 0x01;
+  core->preempt_since = 0;
+  core->syscall_since = 0;
+  atomic_init(&core->handoff, csp_core_handoff_none);
+  core->reclaim_next = NULL;
+  memset(&core->stats, 0, sizeof(core->stats));
+#ifdef csp_with_latency_stats
+  memset(&core->delay, 0, sizeof(core->delay));
+  memset(&core->slice, 0, sizeof(core->slice));
+  core->run_since = 0;
+#endif
 
   csp_core_state_set(core, csp_core_state_inited);
-  pthread_cond_init(&core->cond, NULL);
-  pthread_mutex_init(&core->mutex, NULL);
-  csp_cond_init(&core->pcond);
+  csp_cond_init(&core->cond);
+
+  /* The cores created in the same second are seeded equally, so mix the
+   * address in to make their random sequences different. */
+  csp_rand_init(&core->rand);
+  core->rand.state[0] ^= (uintptr_t)core;
 
   return core;
 }
 
 __attribute__((naked,used)) static void csp_core_anchor_save(void *anchor) {
   __asm__ __volatile__(
+#if defined(__aarch64__)
+    "mov x9,  sp\n"
+    "stp x29, x9,  [x0, #0x00]\n"
+    "stp x30, x19, [x0, #0x10]\n"
+    "ret\n"
+#else
     "mov %rbp,   (%rdi)\n"
     "mov %rsp,   0x08(%rdi)\n"
     "mov (%rsp), %rax\n"
     "mov %rax,   0x10(%rdi)\n"
     "mov %rbx,   0x18(%rdi)\n"
     "retq\n"
+#endif
   );
 }
 
 __attribute__((naked)) static void csp_core_anchor_restore(void *anchor) {
   __asm__ __volatile__(
+#if defined(__aarch64__)
+    csp_core_anchor_load("x0")
+    "ret\n"
+#else
     csp_core_anchor_load("rdi")
     "retq\n"
+#endif
+  );
+}
+
+/*
+ * The processes running longer than `csp_time_slice` are preempted by the
+ * monitor with `csp_core_preempt_signal`. The handler only preempts the ones
+ * interrupted in the text of the program itself, the shared libraries(e.g.
+ * libcsp and libc) are never interrupted halfway. It makes the process call
+ * `csp_core_preempt_entry` at the interrupted point, which saves all the
+ * registers and yields.
+ *
+ * A process holding the lock of a wait queue, which is inlined from the
+ * channel macros, is not preempted, since the waiters may spin on it in libcsp
+ * (e.g. `csp_select`) and never let it run again on the same core. Neither is
+ * a process between `csp_proc_nchild_set` and the yield of `csp_sync`, whose
+ * extra `nchild` must be released by `csp_sched_settle` only once.
+ */
+static uintptr_t csp_core_preempt_text_start, csp_core_preempt_text_end;
+
+#if !defined(__aarch64__)
+/* The size of the XSAVE area of `csp_core_preempt_xsave_mask`. */
+__attribute__((used)) static uint64_t csp_core_preempt_xsave_size;
+
+__attribute__((naked,used)) static void csp_core_preempt_entry(void) {
+  __asm__ __volatile__(
+    /* The interrupted point is the return address, and the red zone has been
+     * skipped by the handler. */
+    "pushfq\n"
+    "push %rax\n"
+    "push %rcx\n"
+    "push %rdx\n"
+    "push %rsi\n"
+    "push %rdi\n"
+    "push %r8\n"
+    "push %r9\n"
+    "push %r10\n"
+    "push %r11\n"
+    "push %rbp\n"
+    "mov  %rsp, %rbp\n"
+    "sub  csp_core_preempt_xsave_size(%rip), %rsp\n"
+    "and  $-64, %rsp\n"
+
+    /* The reserved bytes of the XSAVE header must be zero for XRSTOR. */
+    "xor  %eax, %eax\n"
+    "mov  %rax, 0x200(%rsp)\n"
+    "mov  %rax, 0x208(%rsp)\n"
+    "mov  %rax, 0x210(%rsp)\n"
+    "mov  %rax, 0x218(%rsp)\n"
+    "mov  %rax, 0x220(%rsp)\n"
+    "mov  %rax, 0x228(%rsp)\n"
+    "mov  %rax, 0x230(%rsp)\n"
+    "mov  %rax, 0x238(%rsp)\n"
+    "mov  $0xe7, %eax\n"
+    "xor  %edx, %edx\n"
+    "xsave64 (%rsp)\n"
+
+    "call csp_sched_yield@plt\n"
+
+    "mov  $0xe7, %eax\n"
+    "xor  %edx, %edx\n"
+    "xrstor64 (%rsp)\n"
+    "mov  %rbp, %rsp\n"
+    "pop  %rbp\n"
+    "pop  %r11\n"
+    "pop  %r10\n"
+    "pop  %r9\n"
+    "pop  %r8\n"
+    "pop  %rdi\n"
+    "pop  %rsi\n"
+    "pop  %rdx\n"
+    "pop  %rcx\n"
+    "pop  %rax\n"
+    "popfq\n"
+    "retq $128\n"
   );
 }
 
+/* Get the size of the XSAVE area, or 0 if XSAVE isn't enabled by the OS. */
+static uint64_t csp_core_preempt_xsave_area(void) {
+  unsigned int eax, ebx, ecx, edx;
+  if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || !(ecx & bit_OSXSAVE)) {
+    return 0;
+  }
+
+  __asm__ __volatile__("xgetbv\n" : "=a"(eax), "=d"(edx) : "c"(0));
+  uint64_t size = 576, enabled = eax & csp_core_preempt_xsave_mask;
+  for (int i = 2; i < 8; i++) {
+    if ((enabled & (1 << i)) && __get_cpuid_count(0x0d, i, &eax, &ebx, &ecx,
+          &edx) && ebx + eax > size) {
+      size = ebx + eax;
+    }
+  }
+  return size;
+}
+
+static void csp_core_preempt_handler(int sig, siginfo_t *info, void *ctx) {
+  csp_core_t *this_core = csp_this_core;
+  greg_t *regs = ((ucontext_t *)ctx)->uc_mcontext.gregs;
+  uintptr_t pc = regs[REG_RIP];
+
+  if (this_core == NULL || (atomic_load_explicit(
+        &this_core->nsched, memory_order_relaxed) & 0x01) ||
+      pc < csp_core_preempt_text_start || pc >= csp_core_preempt_text_end) {
+    return;
+  }
+
+  /* The process holds a runtime spinlock or is spawning in `csp_sync`. */
+  csp_proc_t *running = this_core->running;
+  if (atomic_load_explicit(&this_core->nopreempt, memory_order_relaxed) != 0 ||
+      running == NULL || csp_proc_nchild_get(running) != 0) {
+    return;
+  }
+
+  /* Call `csp_core_preempt_entry` at `pc` beyond the red zone, it returns
+   * with `retq $128`. */
+  uintptr_t sp = regs[REG_RSP] - 128 - 8;
+  *(uintptr_t *)sp = pc;
+  regs[REG_RSP] = sp;
+  regs[REG_RIP] = (uintptr_t)csp_core_preempt_entry;
+}
+#endif
+
+/* Find the executable segments of the program, which is the first object. */
+static int csp_core_preempt_text(struct dl_phdr_info *info, size_t size,
+    void *data) {
+  for (int i = 0; i < info->dlpi_phnum; i++) {
+    const ElfW(Phdr) *phdr = &info->dlpi_phdr[i];
+    if (phdr->p_type != PT_LOAD || !(phdr->p_flags & PF_X)) {
+      continue;
+    }
+
+    uintptr_t start = info->dlpi_addr + phdr->p_vaddr;
+    uintptr_t end = start + phdr->p_memsz;
+    if (csp_core_preempt_text_end == 0 || start < csp_core_preempt_text_start) {
+      csp_core_preempt_text_start = start;
+    }
+    if (end > csp_core_preempt_text_end) {
+      csp_core_preempt_text_end = end;
+    }
+  }
+  return 1;
+}
+
+/* Install the preemption signal handler. The preemption is disabled(i.e.
+ * `csp_time_slice` is set to 0) if it's not supported, e.g. libcsp is linked
+ * statically so that we can't tell the program from the runtime. */
+bool csp_core_preempt_init(void) {
+  if (csp_time_slice == 0) {
+    return true;
+  }
+
+#if defined(__aarch64__)
+  csp_time_slice = 0;
+  return true;
+#else
+  csp_core_preempt_xsave_size = csp_core_preempt_xsave_area();
+  dl_iterate_phdr(csp_core_preempt_text, NULL);
+
+  uintptr_t self = (uintptr_t)csp_core_preempt_init;
+  if (csp_core_preempt_xsave_size == 0 || csp_core_preempt_xsave_size + 512 >
+        csp_core_preempt_reserved ||
+      (self >= csp_core_preempt_text_start &&
+       self < csp_core_preempt_text_end)) {
+    csp_time_slice = 0;
+    return true;
+  }
+
+  struct sigaction act = {0};
+  act.sa_sigaction = csp_core_preempt_handler;
+  act.sa_flags = SA_SIGINFO | SA_ONSTACK | SA_RESTART;
+  sigemptyset(&act.sa_mask);
+  return sigaction(csp_core_preempt_signal, &act, NULL) == 0;
+#endif
+}
+
+/* Ask the thread of `core` to preempt its running process. */
+void csp_core_preempt(csp_core_t *core) {
+  pthread_kill(core->tid, csp_core_preempt_signal);
+}
+
+/* Set up the signal stack of the thread running a core. */
+static void csp_core_preempt_altstack(void) {
+  if (csp_time_slice == 0) {
+    return;
+  }
+
+  stack_t ss = {
+    .ss_sp = malloc(csp_core_preempt_altstack_size),
+    .ss_size = csp_core_preempt_altstack_size,
+    .ss_flags = 0
+  };
+  if (ss.ss_sp == NULL || sigaltstack(&ss, NULL) != 0) {
+    perror("Failed to set the signal stack.");
+    exit(EXIT_FAILURE);
+  }
+}
+
+/* Release the signal stack before the thread exits. */
+static void csp_core_preempt_altstack_free(void) {
+  stack_t ss, disabled = {.ss_flags = SS_DISABLE};
+  if (sigaltstack(NULL, &ss) == 0 && !(ss.ss_flags & SS_DISABLE) &&
+      sigaltstack(&disabled, NULL) == 0) {
+    free(ss.ss_sp);
+  }
+}
+
 __attribute__((noinline)) void *csp_core_run(void *data) {
   csp_core_t *this_core = (csp_core_t *)data;
   csp_core_state_set(this_core, csp_core_state_running);
+  this_core->ktid = syscall(SYS_gettid);
   csp_this_core = this_core;
+  csp_core_preempt_altstack();
+
+  /* The core may have retired in the scheduler, see `csp_sched_get`. */
+  atomic_store_explicit(&this_core->nopreempt, 0, memory_order_relaxed);
+  atomic_store_explicit(&this_core->handoff, csp_core_handoff_none,
+    memory_order_relaxed);
 
+#if defined(__aarch64__)
+  __asm__ __volatile__(
+    /* The same as x86_64 below with this_core in x19. */
+    "mov x19, %0\n"
+    "mov x0,  x19\n"
+    "bl  csp_core_anchor_save\n"
+    "ldr w9,  [x19, %1]\n"
+    "cmp w9,  %2\n"
+    "b.eq 1f\n"
+    "mov x0,  x19\n"
+    "bl  csp_sched_get\n"
+    "str x0,  [x19, #0x20]\n"
+    "bl  csp_proc_restore\n"
+    "1:\n"
+    ::"r"(this_core), "i"(offsetof(csp_core_t, state)),
+      "i"(csp_core_state_retiring)
+    /* Only x19 and x29 are restored when the thread jumps back to retire. */
+    :"x0", "x9", "x19", "x20", "x21", "x22", "x23", "x24", "x25", "x26",
+     "x27", "x28", "x30", "memory"
+  );
+#else
   __asm__ __volatile__(
     /* Save variable this_core to rbx. */
     "mov %0, %%rbx\n"
@@ -84,6 +411,10 @@ __attribute__((noinline)) void *csp_core_run(void *data) {
     "mov %%rbx, %%rdi\n"
     "call csp_core_anchor_save@plt\n"
 
+    /* The thread exits if the core is retiring, see `csp_core_spare_park`. */
+    "cmpl %2, %c1(%%rbx)\n"
+    "je 1f\n"
+
     /* Schedue to get the next process. */
     "mov %%rbx, %%rdi\n"
     "call csp_sched_get@plt\n"
@@ -94,22 +425,27 @@ __attribute__((noinline)) void *csp_core_run(void *data) {
     /* Run the process. */
     "mov %%rax, %%rdi\n"
     "call csp_proc_restore@plt\n"
+    "1:\n"
 
-    ::"r"(this_core) :"rdi", "rbx", "memory"
+    ::"r"(this_core), "i"(offsetof(csp_core_t, state)),
+      "i"(csp_core_state_retiring)
+    /* Only %rbx and %rbp are restored when the thread jumps back to retire. */
+    :"rdi", "rbx", "r12", "r13", "r14", "r15", "memory"
   );
+#endif
 
+  /* The core will run on a new thread the next time it's taken. */
+  csp_core_preempt_altstack_free();
+  csp_core_state_set(this_core, csp_core_state_inited);
+  csp_core_pools_put_retired(this_core);
   return NULL;
 }
 
 /* Initialize the main core(running on the main thread). */
 void csp_core_init_main(csp_core_t *core) {
   core->tid = pthread_self();
-  csp_this_core = core;
-
-  cpu_set_t cpuset;
-  CPU_ZERO(&cpuset);
-  CPU_SET(0, &cpuset);
-  pthread_setaffinity_np(core->tid, sizeof(cpuset), &cpuset);
+  csp_this_core = csp_core_main = core;
+  csp_cpus_pin_self(core->pid);
 }
 
 /* Start the main core(running on the main thread). */
@@ -118,13 +454,9 @@ __attribute__((noinline,used)) void csp_core_start_main(void) {
 }
 
 bool csp_core_start(csp_core_t *core) {
-  cpu_set_t cpuset;
-  CPU_ZERO(&cpuset);
-  CPU_SET(core->pid, &cpuset);
-
   pthread_attr_t attr;
   if (pthread_attr_init(&attr) != 0 ||
-    pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t), &cpuset) != 0 ||
+    !csp_cpus_pin_attr(&attr, core->pid) ||
     pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED) != 0 ||
     pthread_create(&core->tid, &attr, csp_core_run, core) != 0) {
     return false;
@@ -135,16 +467,50 @@ bool csp_core_start(csp_core_t *core) {
 
 __attribute__((naked)) void csp_core_yield(csp_proc_t *proc, void *anchor) {
   __asm__ __volatile__(
+#if defined(__aarch64__)
+    csp_proc_save("x0")
+    "mov x0, x1\n"
+    "b   csp_core_anchor_restore\n"
+#else
     csp_proc_save("rdi")
     "push %rbp\n"
     "mov %rsi, %rdi\n"
     "call csp_core_anchor_restore\n"
+#endif
   );
 }
 
-bool csp_core_block_prologue(csp_core_t *this_core) {
+/* Save `proc` and restore `next` without bouncing through the anchor, `next`
+ * must be a runnable process owned by nobody else. `proc` may be stolen by the
+ * other cores as soon as it's put back to the runq, so we leave its stack and
+ * settle it on the thread stack, the same as `csp_core_proc_exit_and_run`. */
+__attribute__((naked))
+void csp_core_switch_to(csp_proc_t *proc, csp_proc_t *next, void *anchor) {
+  __asm__ __volatile__(
+#if defined(__aarch64__)
+    csp_proc_save("x0")
+    "ldr x9, [x2, #0x08]\n"
+    "mov sp, x9\n"
+    "mov x0, x1\n"
+    "bl  csp_sched_switch\n"
+    "b   csp_proc_restore\n"
+#else
+    csp_proc_save("rdi")
+    "mov 0x08(%rdx), %rsp\n"
+    "and $-16, %rsp\n"
+    "mov %rsi, %rdi\n"
+    "call csp_sched_switch@plt\n"
+    "mov %rax, %rdi\n"
+    "jmp csp_proc_restore@plt\n"
+#endif
+  );
+}
+
+/* Take a spare core from the pool of processor `pid` and run it, a new thread
+ * is started if it has retired. */
+static bool csp_core_spare_run(size_t pid) {
   csp_core_t *next;
-  if (!csp_core_pools_get(this_core->pid, &next)) {
+  if (!csp_core_pools_get(pid, &next)) {
     return false;
   }
 
@@ -157,30 +523,156 @@ bool csp_core_block_prologue(csp_core_t *this_core) {
   return true;
 }
 
-__attribute__((used))
-static void csp_core_block_epilogue_inner(csp_core_t *this_core) {
-  while (!csp_grunq_try_push(this_core->grunq, this_core->running));
-  this_core->running = NULL;
-
-  pthread_mutex_lock(&this_core->mutex);
+/* Park the core in the pool as a spare until it's taken. The thread retires
+ * if it's idle for `csp_core_spare_idle_timeout`, i.e. it jumps back to
+ * `csp_core_run` and exits there. */
+void csp_core_spare_park(csp_core_t *this_core) {
+  csp_core_preempt_off(this_core);
   csp_core_pools_put(this_core);
-  pthread_cond_wait(&this_core->cond, &this_core->mutex);
-  pthread_mutex_unlock(&this_core->mutex);
 
-  /* Re-schedule finally. */
+  while (csp_cond_timedwait(&this_core->cond, csp_core_spare_idle_timeout) ==
+      csp_cond_signal_none) {
+    /* It fails if the core has just been taken, then the signal is coming. */
+    if (this_core != csp_core_main && csp_core_pools_remove(this_core)) {
+      csp_core_state_set(this_core, csp_core_state_retiring);
+      csp_core_anchor_restore(&this_core->anchor);
+    }
+  }
+  atomic_store_explicit(&this_core->handoff, csp_core_handoff_none,
+    memory_order_relaxed);
+}
+
+/* Park the core as a spare and re-schedule once it's taken. */
+void csp_core_spare_resched(csp_core_t *this_core) {
+  /* The signal is kept in `cond` even if it's sent before we wait, so there
+   * is no lost wakeup. */
+  csp_core_spare_park(this_core);
   csp_core_anchor_restore(&this_core->anchor);
   __builtin_unreachable();
 }
 
+void csp_core_handoff_init(void) {
+  csp_core_handoff_enabled = syscall(__NR_membarrier,
+    MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0) == 0;
+}
+
+/*
+ * Let a spare core take the place of `core`, which has been stuck in a system
+ * call since it picked its `nsched`-th process. It's called by the monitor.
+ *
+ * The handoff is announced first and then the core is checked again, while the
+ * core enters the runtime first and then checks the announcement, see
+ * `csp_core_acquire`. So it's cancelled if the core has returned to the
+ * runtime, otherwise the core acks it the next time it enters and waits for
+ * the processor given back.
+ */
+void csp_core_handoff(csp_core_t *core, uint64_t nsched) {
+  int expected = csp_core_handoff_none;
+  if (!csp_core_handoff_enabled || !atomic_compare_exchange_strong(
+        &core->handoff, &expected, csp_core_handoff_pending)) {
+    return;
+  }
+
+  syscall(__NR_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0);
+  if (atomic_load(&core->nsched) == nsched &&
+      atomic_load(&core->nopreempt) == 0 && csp_core_spare_run(core->pid)) {
+    return;
+  }
+
+  /* The core has acked it in between, so it's waiting for a spare core. */
+  expected = csp_core_handoff_pending;
+  if (!atomic_compare_exchange_strong(&core->handoff, &expected,
+        csp_core_handoff_none)) {
+    while (!csp_core_spare_run(core->pid)) {
+      sched_yield();
+    }
+  }
+}
+
+/* Ack the handoff announced by the monitor, false is returned if it has been
+ * cancelled. */
+static bool csp_core_handoff_ack(csp_core_t *this_core) {
+  int expected = csp_core_handoff_pending;
+  return atomic_compare_exchange_strong(&this_core->handoff, &expected,
+    csp_core_handoff_taken);
+}
+
+/* Wait for the processor taken by a spare core while we were stuck in a
+ * system call. The core which gives it back resets `handoff`, so a stale
+ * signal in `cond` is ignored, see `csp_sched_reclaimed`. */
+static void csp_core_reclaim(csp_core_t *this_core) {
+  csp_core_preempt_off(this_core);
+  csp_core_pools_reclaim_put(this_core);
+  while (atomic_load_explicit(&this_core->handoff, memory_order_acquire) !=
+      csp_core_handoff_none) {
+    csp_cond_wait(&this_core->cond);
+  }
+  csp_core_preempt_on(this_core);
+}
+
+/* The slow path of `csp_core_acquire` which sees the handoff announced. It
+ * returns whether the processor is still ours, which it always is if we
+ * `wait` for it. */
+bool csp_core_handoff_settle(csp_core_t *this_core, bool wait) {
+  if (!csp_core_handoff_ack(this_core)) {
+    return true;
+  }
+  if (wait) {
+    csp_core_reclaim(this_core);
+  }
+  return wait;
+}
+
+bool csp_core_block_prologue(csp_core_t *this_core) {
+  /* The thread must not be preempted once the others may take its place, it
+   * blocks until `csp_core_block_epilogue`. If the monitor has handed off the
+   * core, the spare is already running. The monitor sees `nsched` changed or
+   * we see its announcement, see `csp_core_handoff`. */
+  csp_core_preempt_off(this_core);
+  atomic_signal_fence(memory_order_seq_cst);
+  if ((atomic_load_explicit(&this_core->handoff, memory_order_relaxed) ==
+        csp_core_handoff_pending && csp_core_handoff_ack(this_core)) ||
+      csp_core_spare_run(this_core->pid)) {
+    return true;
+  }
+  csp_core_preempt_on(this_core);
+  return false;
+}
+
+__attribute__((used))
+static void csp_core_block_epilogue_inner(csp_core_t *this_core) {
+  csp_stats_latency_queued(this_core->running);
+  csp_grunq_push(this_core->grunq, this_core->running);
+  this_core->running = NULL;
+  csp_core_spare_resched(this_core);
+}
+
 __attribute__((naked))
 void csp_core_block_epilogue(csp_core_t *core, csp_proc_t *proc) {
   __asm__ __volatile__(
+    /* Park on the thread stack, the process may run on the other cores as
+     * soon as it's pushed to the runq. */
+#if defined(__aarch64__)
+    csp_proc_save("x1")
+    "ldr x9, [x0, #0x08]\n"
+    "mov sp, x9\n"
+    "bl csp_core_block_epilogue_inner\n"
+#else
     csp_proc_save("rsi")
-    "push %rbp\n"
+    "mov 0x08(%rdi), %rsp\n"
+    "and $-16, %rsp\n"
     "call csp_core_block_epilogue_inner@plt\n"
+#endif
   );
 }
 
+/* Destroy the exited process on the thread stack, and then leave the runtime
+ * entered before the process is given up. */
+__attribute__((used)) static void csp_core_proc_destroy(csp_proc_t *proc) {
+  csp_proc_destroy(proc);
+  csp_core_leave(csp_this_core);
+}
+
 __attribute__((naked))
 static void csp_core_proc_exit_inner(csp_proc_t *proc, void *anchor) {
   __asm__ __volatile__(
@@ -188,54 +680,88 @@ static void csp_core_proc_exit_inner(csp_proc_t *proc, void *anchor) {
      * new process immediately after we put it in the memory pool and we are
      * still do some cleaning work like `csp_proc_destroy` on that process
      * stack. */
+#if defined(__aarch64__)
+    csp_core_anchor_load("x1")
+    "b csp_core_proc_destroy\n"
+#else
     csp_core_anchor_load("rsi")
-    "call csp_proc_destroy@plt\n"
+    "call csp_core_proc_destroy@plt\n"
     "retq\n"
+#endif
   );
 }
 
+__attribute__((noreturn)) void csp_core_proc_exit_and_run(csp_proc_t *to_run);
+
 /* Called when current process exits. It will clean the process resource and
  * then re-schedule.*/
 void csp_core_proc_exit(void) {
-  csp_proc_t *running = csp_this_core->running, *parent = running->parent;
+  csp_core_t *this_core = csp_this_core;
+  csp_proc_t *running = this_core->running, *parent = running->parent;
+  csp_trace(exit, running);
   if (parent != NULL && csp_proc_nchild_decr(parent) == 0x01) {
-    csp_sched_put_proc(parent);
+    /* We are the last child the parent waits for in `csp_sync`, so run it
+     * right here instead of putting it to the runq. */
+    csp_core_proc_exit_and_run(parent);
   }
-  csp_this_core->running = NULL;
-  csp_core_proc_exit_inner(running, &csp_this_core->anchor);
+
+  /* The process is destroyed to the cache and the heap of the processor. */
+  csp_core_enter(this_core);
+  this_core->running = NULL;
+  csp_core_proc_exit_inner(running, &this_core->anchor);
 }
 
 /* Called when current process exits and we want another specified process to
  * run afterwards.
  *
- * NOTE: The current process should not be waited by other processes. */
+ * NOTE: The current process should not be waited by other processes. The
+ * scheduler is bypassed, see `csp_sched_switch`. */
 __attribute__((noreturn)) void csp_core_proc_exit_and_run(csp_proc_t *to_run) {
   csp_core_t *this_core = csp_this_core;
   csp_proc_t *running = this_core->running;
-  this_core->running = to_run;
+  csp_core_enter(this_core);
+  this_core->running = NULL;
 
+#if defined(__aarch64__)
+  register csp_proc_t *x0 __asm__("x0") = running;
+  __asm__ __volatile__ (
+    "mov x20, %0\n"
+    "mov x29, %1\n"
+    "mov sp,  %2\n"
+    "bl  csp_core_proc_destroy\n"
+    "mov x0,  x20\n"
+    "bl  csp_sched_switch\n"
+    "b   csp_proc_restore\n"
+    :
+    :"r"(to_run), "r"(this_core->anchor.rbp), "r"(this_core->anchor.rsp),
+     "r"(x0)
+    :"x20", "x29", "x30", "memory"
+  );
+#else
   __asm__ __volatile__ (
     "mov %0, %%r12\n"
 
     /* Switch to the system thread stack. */
     "mov %1, %%rbp\n"
     "mov %2, %%rsp\n"
+    "and $-16, %%rsp\n"
 
-    "call csp_proc_destroy@plt\n"
+    "call csp_core_proc_destroy@plt\n"
     "mov %%r12, %%rdi\n"
+    "call csp_sched_switch@plt\n"
+    "mov %%rax, %%rdi\n"
     "call csp_proc_restore@plt\n"
     :
     :"m"(to_run), "r"(this_core->anchor.rbp), "r"(this_core->anchor.rsp),
      "D"(running)
     :"rbp", "rsp", "r12", "memory"
   );
+#endif
   __builtin_unreachable();
 }
 
 void csp_core_destroy(csp_core_t *core) {
   if (core != NULL) {
-    pthread_mutex_destroy(&core->mutex);
-    pthread_cond_destroy(&core->cond);
     free(core);
   }
 }
@@ -26,42 +26,97 @@ extern "C" {
 #include <stdatomic.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <sys/types.h>
 #include "cond.h"
 #include "proc.h"
+#include "rand.h"
 #include "runq.h"
+#include "spinlock.h"
+#include "stats.h"
 
 #define csp_core_state_set(c, s)    atomic_store(&(c)->state, (s))
 #define csp_core_state_get(c)       atomic_load(&(c)->state)
 #define csp_core_state_cas(c, o, n)                                            \
   atomic_compare_exchange_weak(&(c)->state, &(o), n)                           \
 
-#define csp_core_wakeup(core) do {                                             \
-  pthread_mutex_lock(&(core)->mutex);                                          \
-  pthread_cond_signal(&(core)->cond);                                          \
-  pthread_mutex_unlock(&(core)->mutex);                                        \
-} while (0)                                                                    \
+#define csp_core_wakeup(core)                                                  \
+  csp_cond_signal(&(core)->cond, csp_cond_signal_wakeup)                       \
+
+/* Count a newly picked process, after which the core can be preempted. */
+#define csp_core_preempt_on(core)                                              \
+  atomic_store_explicit(&(core)->nsched, (atomic_load_explicit(                \
+    &(core)->nsched, memory_order_relaxed) | 0x01) + 1, memory_order_relaxed)  \
+
+/* The core can't be preempted until it picks the next process, e.g. when it's
+ * idle or blocked in a system call. */
+#define csp_core_preempt_off(core)                                             \
+  atomic_store_explicit(&(core)->nsched, atomic_load_explicit(                 \
+    &(core)->nsched, memory_order_relaxed) | 0x01, memory_order_relaxed)       \
+
+/* The states of `csp_core_t.handoff`. The monitor announces a handoff before
+ * it runs a spare core, and the core acks it the next time it enters the
+ * runtime, see `csp_core_handoff`. */
+#define csp_core_handoff_none         0
+#define csp_core_handoff_pending      1
+#define csp_core_handoff_taken        2
+
+/* Count the running process or the scheduler in the runtime, where the core
+ * can't be preempted, see `csp_waitq_lock`. The outermost entry settles the
+ * pending handoff and it's false if a spare core has taken our place, then the
+ * processor mustn't be touched until it's given back, unless we `wait` for it
+ * here. The monitor orders its announcement and its checks by `membarrier`, so
+ * a compiler barrier is enough here. */
+#define csp_core_acquire_inner(core, wait) ({                                  \
+  csp_core_t *core_ = (core);                                                  \
+  uint_fast32_t n_ = atomic_load_explicit(                                     \
+    &core_->nopreempt, memory_order_relaxed                                    \
+  );                                                                           \
+  atomic_store_explicit(&core_->nopreempt, n_ + 1, memory_order_relaxed);      \
+  atomic_signal_fence(memory_order_seq_cst);                                   \
+  n_ != 0 || csp_likely(atomic_load_explicit(&core_->handoff,                  \
+      memory_order_relaxed) != csp_core_handoff_pending) ||                    \
+    csp_core_handoff_settle(core_, (wait));                                    \
+})                                                                             \
+
+#define csp_core_acquire(core) csp_core_acquire_inner(core, false)
+
+#define csp_core_nopreempt_decr(core)                                          \
+  atomic_store_explicit(&(core)->nopreempt, atomic_load_explicit(              \
+    &(core)->nopreempt, memory_order_relaxed) - 1, memory_order_relaxed)       \
+
+/* Enter the runtime from the running process before touching the states of
+ * the processor, e.g. its runqs, heap and timers. If a spare core has taken
+ * our place, we wait until it gives the processor back, so the process goes
+ * on on the same thread. */
+#define csp_core_enter(core) ((void)csp_core_acquire_inner(core, true))
+
+#define csp_core_leave(core) csp_core_nopreempt_decr(core)
 
 typedef enum {
   csp_core_state_inited,
   csp_core_state_running,
+  csp_core_state_retiring,
 } csp_core_state_t;
 
-typedef struct {
+/* The cores are allocated separately and aligned to the cache line, so the
+ * fields written by a core never share a line with those of the others. */
+typedef struct __attribute__((aligned(64))) csp_core_t {
   /*
    * `anchor` is used to save the the thread context in `csp_core_run`. So when
    * a process finishes or yields, we can switch to this context and find the
    * next process to run.
    *
    * NOTE: This is should be the first field of `csp_core_t` cause we used this
-   * `csp_core_run`.
+   * `csp_core_run`. The fields hold x29, sp, lr and x19 on AArch64.
    */
   struct { int64_t rbp, rsp, rip, rbx; } anchor;
 
   /* Current process running on the core. */
   csp_proc_t *running;
 
-  /* Id of the thread the core runs on. */
+  /* Id of the thread the core runs on, and its id in the kernel. */
   pthread_t tid;
+  pid_t ktid;
 
   /* The id of cpu processor with which the core binds. */
   size_t pid;
@@ -69,23 +124,77 @@ typedef struct {
   /* State of the core. */
   _Atomic csp_core_state_t state;
 
-  /* The local runq used by cores running on the same processor. */
-  csp_lrunq_t *lrunq;
+  /* The local runqs used by cores running on the same processor, one for each
+   * priority class. */
+  csp_lrunq_t **lrunqs;
 
   /* The global runq used by cores running on the same processor. */
   csp_grunq_t *grunq;
 
-  /* `mutex` and `cond` are used to do synchronization operations. */
-  pthread_mutex_t mutex;
-  pthread_cond_t cond;
-
-  /* porc-level conditional variable. */
-  csp_cond_t pcond;
+  /* The caches of the exited processes used by cores running on the same
+   * processor, indexed by the process ids. */
+  csp_proc_cache_t *proc_caches;
+
+  /* The core parks on it when it's starving or spare in the core pool. */
+  csp_cond_t cond;
+
+  /* The callback(e.g. releasing a lock) to run after the parked process has
+   * yielded, see `csp_sched_park_fn`. */
+  void (*park_fn)(void *arg);
+  void *park_arg;
+
+  /* The random number generator used by the processes running on the core,
+   * e.g. to shuffle the cases of `csp_select`. */
+  csp_rand_t rand;
+
+  /* The number of processes picked by the core doubled, with the lowest bit
+   * set if the core can't be preempted. Only the core itself writes it. */
+  atomic_uint_fast64_t nsched;
+
+  /* The number of the runtime entries of the running process or the
+   * scheduler, e.g. the runtime spinlocks held, see `csp_core_acquire`. It's
+   * read by the preemption signal handler on the same thread and the
+   * monitor. */
+  atomic_uint_fast32_t nopreempt;
+
+  /* The `nsched` seen by the monitor and since when it's seen, only the monitor
+   * touches them, see `csp_monitor_preempt`. */
+  uint64_t preempt_nsched;
+  int64_t preempt_since;
+
+  /* When the monitor checked whether the core is stuck in a system call last
+   * time, and whether another core is taking its place, see
+   * `csp_monitor_sysmon` and `csp_core_handoff_none`. */
+  int64_t syscall_since;
+  atomic_int handoff;
+
+  /* The next core waiting for the processor given back, see
+   * `csp_core_pool_t.reclaimers`. */
+  struct csp_core_t *reclaim_next;
+
+  /* The counters of the core, see `csp_stats_t`. */
+  csp_stats_block_t stats;
+
+#ifdef csp_with_latency_stats
+  /* The histograms of the scheduling delays and the time slices of the
+   * processes picked by the core, and since when the running one has run, see
+   * `csp_stats_latency`. */
+  csp_stats_hist_block_t delay, slice;
+  int64_t run_since;
+#endif
 } csp_core_t;
 
 bool csp_core_block_prologue(csp_core_t *core);
 void csp_core_block_epilogue(csp_core_t *core, csp_proc_t *proc)
 __attribute__((naked));
+void csp_core_spare_park(csp_core_t *this_core);
+void csp_core_spare_resched(csp_core_t *this_core) __attribute__((noreturn));
+
+/* It's only reached once the monitor has announced a handoff, which only the
+ * runtime does. So it's weak for the tests which take the inline entries
+ * without the runtime. */
+bool csp_core_handoff_settle(csp_core_t *this_core, bool wait)
+__attribute__((weak));
 
 #ifdef __cplusplus
 }
@@ -15,16 +15,35 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <dirent.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "core.h"
 #include "corepool.h"
 
+#define csp_core_pool_sysfs_cpu       "/sys/devices/system/cpu/cpu%d"
+#define csp_core_pool_sysfs_package                                            \
+  csp_core_pool_sysfs_cpu "/topology/physical_package_id"
+#define csp_core_pool_sysfs_core_id                                            \
+  csp_core_pool_sysfs_cpu "/topology/core_id"
+
+/* The distances between two pools, see `csp_core_pool_distance`. */
+#define csp_core_pool_dist_sibling    0
+#define csp_core_pool_dist_node       1
+#define csp_core_pool_dist_package    2
+#define csp_core_pool_dist_remote     3
+
 extern int csp_sched_np;
 extern size_t csp_max_threads;
 extern size_t csp_max_procs_hint;
+/* Total processes generated by libcsp plugin. */
+extern size_t csp_procs_num;
+extern int csp_cpus_of(size_t pid);
 
 extern csp_core_t *csp_core_new(
-  size_t pid, csp_lrunq_t *lrunq, csp_grunq_t *grunq
+  size_t pid, csp_lrunq_t **lrunqs, csp_grunq_t *grunq,
+  csp_proc_cache_t *proc_caches
 );
 extern void csp_core_destroy(csp_core_t *core);
 static void csp_core_pool_destroy(csp_core_pool_t *pool);
@@ -32,65 +51,242 @@ static void csp_core_pool_destroy(csp_core_pool_t *pool);
 csp_core_pools_t csp_core_pools;
 
 static csp_core_pool_t *
-csp_core_pool_new(int pid, size_t grunq_cap_exp, size_t cores_per_cpu) {
-  csp_core_pool_t *pool = (csp_core_pool_t *)calloc(1, sizeof(csp_core_pool_t));
+csp_core_pool_new(int pid, size_t runq_cap_exp, size_t cores_per_cpu) {
+  csp_core_pool_t *pool = (csp_core_pool_t *)aligned_alloc(
+    _Alignof(csp_core_pool_t), sizeof(csp_core_pool_t)
+  );
   if (pool == NULL) {
     return NULL;
   }
+  memset(pool, 0, sizeof(csp_core_pool_t));
 
-  pool->lrunq = csp_lrunq_new();
-  pool->grunq = csp_grunq_new(grunq_cap_exp);
-  pool->cores = (csp_core_t **)malloc(sizeof(csp_core_t *) * cores_per_cpu);
-  if (pool->lrunq == NULL || pool->grunq == NULL || pool->cores == NULL) {
-    goto failed;
-  }
-
-  /* We should fulfill the pool thus we can get cached core when current core
-   * blocks. */
-  for (size_t i = 0; i < cores_per_cpu; i++) {
-    pool->cores[i] = csp_core_new(pid, pool->lrunq, pool->grunq);
-    if (pool->cores[i] == NULL) {
-      pool->cap = i;
+  for (int i = 0; i < csp_proc_prio_num; i++) {
+    if ((pool->lrunqs[i] = csp_lrunq_new(runq_cap_exp)) == NULL) {
       goto failed;
     }
   }
+  pool->grunq = csp_grunq_new(runq_cap_exp);
+  pool->proc_caches = (csp_proc_cache_t *)calloc(
+    csp_procs_num, sizeof(csp_proc_cache_t)
+  );
+  pool->cores = (csp_core_t **)malloc(sizeof(csp_core_t *) * cores_per_cpu);
+  pool->all = (csp_core_t **)malloc(sizeof(csp_core_t *) * cores_per_cpu);
+  if (pool->grunq == NULL || pool->proc_caches == NULL ||
+      pool->cores == NULL || pool->all == NULL) {
+    goto failed;
+  }
 
-  pool->cap = pool->top = cores_per_cpu;
-  csp_mutex_init(&pool->mutex);
+  pool->pid = pid;
+  pool->cap = cores_per_cpu;
+  pool->top = 0;
+  atomic_init(&pool->len, 0);
+  atomic_init(&pool->reclaimers, NULL);
+  csp_spinlock_init(&pool->mutex);
   return pool;
 
 failed:
   csp_core_pool_destroy(pool);
-  return pool;
+  return NULL;
+}
+
+/* Read a non-negative integer from the sysfs file of the cpu, -1 is returned
+ * if it's not available. */
+static int csp_core_pool_sysfs_read(const char *fmt, int cpu) {
+  char path[128];
+  snprintf(path, sizeof(path), fmt, cpu);
+
+  FILE *file = fopen(path, "r");
+  if (file == NULL) {
+    return -1;
+  }
+  int val;
+  if (fscanf(file, "%d", &val) != 1) {
+    val = -1;
+  }
+  fclose(file);
+  return val;
+}
+
+/* The NUMA node of the cpu is exposed as a `nodeN` link in its sysfs
+ * directory, so we don't have to depend on libnuma. */
+static int csp_core_pool_sysfs_node(int cpu) {
+  char path[128];
+  snprintf(path, sizeof(path), csp_core_pool_sysfs_cpu, cpu);
+
+  DIR *dir = opendir(path);
+  if (dir == NULL) {
+    return -1;
+  }
+  int node = -1, val;
+  struct dirent *entry;
+  while ((entry = readdir(dir)) != NULL) {
+    if (sscanf(entry->d_name, "node%d", &val) == 1) {
+      node = val;
+      break;
+    }
+  }
+  closedir(dir);
+  return node;
+}
+
+static void csp_core_pool_topology_init(csp_core_pool_t *pool, int pid) {
+  int cpu = csp_cpus_of(pid);
+  pool->node = csp_core_pool_sysfs_node(cpu);
+  pool->package = csp_core_pool_sysfs_read(csp_core_pool_sysfs_package, cpu);
+  pool->core_id = csp_core_pool_sysfs_read(csp_core_pool_sysfs_core_id, cpu);
+}
+
+static int csp_core_pool_distance(csp_core_pool_t *a, csp_core_pool_t *b) {
+  if (a->package == b->package && a->core_id == b->core_id) {
+    return csp_core_pool_dist_sibling;
+  }
+  if (a->node == b->node) {
+    return csp_core_pool_dist_node;
+  }
+  if (a->package == b->package) {
+    return csp_core_pool_dist_package;
+  }
+  return csp_core_pool_dist_remote;
+}
+
+/* Sort the other pools by their distances to `pools[pid]`. The pools with the
+ * same distance are ordered from `pid + 1` round-robin so the stealing will
+ * not always start from the same victim. */
+static bool csp_core_pool_victims_init(
+  csp_core_pool_t **pools, int len, int pid
+) {
+  csp_core_pool_t *pool = pools[pid];
+  pool->victims = (int *)malloc(sizeof(int) * len);
+  if (pool->victims == NULL) {
+    return false;
+  }
+
+  int n = 0;
+  for (int dist = 0; dist <= csp_core_pool_dist_remote; dist++) {
+    for (int i = 1; i < len; i++) {
+      int victim = (pid + i) % len;
+      if (csp_core_pool_distance(pool, pools[victim]) == dist) {
+        pool->victims[n++] = victim;
+      }
+    }
+  }
+  return true;
+}
+
+/* Assign the bits of the idle bitmap to the pools, the pools of the same NUMA
+ * node get the consecutive bits starting from a new word. */
+static bool csp_core_pools_idle_init(csp_core_pool_t **pools, int len) {
+  bool assigned[len];
+  size_t nwords = 0;
+  memset(assigned, 0, sizeof(assigned));
+
+  for (int i = 0; i < len; i++) {
+    if (assigned[i]) {
+      continue;
+    }
+    size_t lo = nwords, bit = lo << 6;
+    for (int j = i; j < len; j++) {
+      if (!assigned[j] && pools[j]->node == pools[i]->node) {
+        pools[j]->idle_bit = bit++;
+        assigned[j] = true;
+      }
+    }
+    nwords = (bit + 63) >> 6;
+    for (int j = i; j < len; j++) {
+      if (pools[j]->node == pools[i]->node) {
+        pools[j]->idle_lo = lo;
+        pools[j]->idle_hi = nwords;
+      }
+    }
+  }
+
+  csp_core_pools.nidle = nwords;
+  csp_core_pools.idle = (atomic_uint_fast64_t *)calloc(
+    nwords, sizeof(atomic_uint_fast64_t)
+  );
+  csp_core_pools.idle_pids = (int *)malloc(sizeof(int) * (nwords << 6));
+  if (csp_core_pools.idle == NULL || csp_core_pools.idle_pids == NULL) {
+    return false;
+  }
+  for (int i = 0; i < len; i++) {
+    atomic_init(&pools[i]->idle, NULL);
+    csp_core_pools.idle_pids[pools[i]->idle_bit] = i;
+  }
+  return true;
 }
 
 static void csp_core_pool_push(csp_core_pool_t *pool, csp_core_t *core) {
-  csp_mutex_lock(&pool->mutex);
+  csp_spinlock_lock(&pool->mutex);
   pool->cores[pool->top++] = core;
-  csp_mutex_unlock(&pool->mutex);
+  csp_spinlock_unlock(&pool->mutex);
 }
 
+/* Pop a spare core, a new one is created if there is none and the pool is not
+ * full yet. */
 static bool csp_core_pool_pop(csp_core_pool_t *pool, csp_core_t **core) {
-  csp_mutex_lock(&pool->mutex);
-  if (pool->top == 0) {
-    csp_mutex_unlock(&pool->mutex);
-    return false;
+  bool ok = true;
+  csp_spinlock_lock(&pool->mutex);
+  if (pool->top > 0) {
+    *core = pool->cores[--pool->top];
+  } else {
+    size_t len = atomic_load_explicit(&pool->len, memory_order_relaxed);
+    if (len == pool->cap ||
+        (*core = csp_core_new(pool->pid, pool->lrunqs, pool->grunq,
+          pool->proc_caches)) == NULL) {
+      ok = false;
+    } else {
+      pool->all[len] = *core;
+      atomic_store_explicit(&pool->len, len + 1, memory_order_release);
+    }
   }
-  *core = pool->cores[--pool->top];
-  csp_mutex_unlock(&pool->mutex);
-  return true;
+  csp_spinlock_unlock(&pool->mutex);
+  return ok;
+}
+
+/* Remove the spare core from the pool, false is returned if it has been
+ * taken. */
+static bool csp_core_pool_remove(csp_core_pool_t *pool, csp_core_t *core) {
+  bool found = false;
+  csp_spinlock_lock(&pool->mutex);
+  for (size_t i = 0; i < pool->top; i++) {
+    if (pool->cores[i] == core) {
+      memmove(&pool->cores[i], &pool->cores[i + 1],
+        sizeof(csp_core_t *) * (pool->top - i - 1));
+      pool->top--;
+      found = true;
+      break;
+    }
+  }
+  csp_spinlock_unlock(&pool->mutex);
+  return found;
+}
+
+/* Put the core without a thread at the bottom, so the ones parked recently are
+ * taken first and no thread is started while they are available. */
+static void csp_core_pool_push_bottom(csp_core_pool_t *pool, csp_core_t *core) {
+  csp_spinlock_lock(&pool->mutex);
+  memmove(&pool->cores[1], &pool->cores[0], sizeof(csp_core_t *) * pool->top);
+  pool->cores[0] = core;
+  pool->top++;
+  csp_spinlock_unlock(&pool->mutex);
 }
 
 static void csp_core_pool_destroy(csp_core_pool_t *pool) {
   if (pool == NULL) {
     return;
   }
-  for (size_t i = 0; i < pool->cap; i++) {
-    csp_core_destroy(pool->cores[i]);
+  size_t len = atomic_load(&pool->len);
+  for (size_t i = 0; i < len; i++) {
+    csp_core_destroy(pool->all[i]);
+  }
+  for (int i = 0; i < csp_proc_prio_num; i++) {
+    csp_lrunq_destroy(pool->lrunqs[i]);
   }
-  csp_lrunq_destroy(pool->lrunq);
   csp_grunq_destroy(pool->grunq);
+  free(pool->proc_caches);
   free(pool->cores);
+  free(pool->all);
+  free(pool->victims);
   free(pool);
 }
 
@@ -102,21 +298,38 @@ bool csp_core_pools_init(void) {
     return false;
   }
 
-  size_t grunq_cap_exp = csp_exp(csp_max_procs_hint / csp_sched_np);
+  size_t runq_cap_exp = csp_exp(csp_max_procs_hint / csp_sched_np);
   size_t cores_per_cpu = (csp_max_threads / csp_sched_np) +
     (!!(csp_max_threads % csp_sched_np));
 
   for (int i = 0; i < csp_sched_np; i++) {
     csp_core_pools.pools[i] = csp_core_pool_new(
-      i, grunq_cap_exp, cores_per_cpu
+      i, runq_cap_exp, cores_per_cpu
     );
     if (csp_core_pools.pools[i] == NULL) {
       csp_core_pools.len = i;
       return false;
     }
+    csp_core_pool_topology_init(csp_core_pools.pools[i], i);
   }
   csp_core_pools.len = csp_sched_np;
-  return true;
+
+  csp_core_pools.numa = false;
+  for (int i = 0; i < csp_sched_np; i++) {
+    if (!csp_core_pool_victims_init(csp_core_pools.pools, csp_sched_np, i)) {
+      return false;
+    }
+    if (csp_core_pools.pools[i]->node != csp_core_pools.pools[0]->node) {
+      csp_core_pools.numa = true;
+    }
+  }
+  return csp_core_pools_idle_init(csp_core_pools.pools, csp_sched_np);
+}
+
+/* Return the NUMA node of the pool, -1 is returned if it's unknown or all the
+ * pools are in the same node, i.e. there is no need to bind memory. */
+int csp_core_pools_node(size_t pid) {
+  return csp_core_pools.numa ? csp_core_pools.pools[pid]->node : -1;
 }
 
 bool csp_core_pools_get(size_t pid, csp_core_t **core) {
@@ -127,6 +340,120 @@ void csp_core_pools_put(csp_core_t *core) {
   csp_core_pool_push(csp_core_pools.pools[core->pid], core);
 }
 
+bool csp_core_pools_remove(csp_core_t *core) {
+  return csp_core_pool_remove(csp_core_pools.pools[core->pid], core);
+}
+
+void csp_core_pools_put_retired(csp_core_t *core) {
+  csp_core_pool_push_bottom(csp_core_pools.pools[core->pid], core);
+}
+
+/* Queue `core` to wait for its processor, and wake up the core of the pool
+ * if it's idle so it gives the processor back soon, see `csp_core_reclaim`. */
+void csp_core_pools_reclaim_put(csp_core_t *core) {
+  csp_core_pool_t *pool = csp_core_pools.pools[core->pid];
+  csp_spinlock_lock(&pool->mutex);
+  core->reclaim_next = atomic_load_explicit(
+    &pool->reclaimers, memory_order_relaxed
+  );
+  atomic_store(&pool->reclaimers, core);
+  csp_spinlock_unlock(&pool->mutex);
+
+  csp_core_t *idle = atomic_exchange(&pool->idle, NULL);
+  if (idle != NULL) {
+    csp_cond_signal(&idle->cond, csp_cond_signal_proc_avail);
+  }
+}
+
+/* Pop a core waiting for processor `pid`, false is returned if there is
+ * none. */
+bool csp_core_pools_reclaim_get(size_t pid, csp_core_t **core) {
+  csp_core_pool_t *pool = csp_core_pools.pools[pid];
+  if (atomic_load_explicit(&pool->reclaimers, memory_order_relaxed) == NULL) {
+    return false;
+  }
+
+  csp_spinlock_lock(&pool->mutex);
+  *core = atomic_load_explicit(&pool->reclaimers, memory_order_relaxed);
+  if (*core != NULL) {
+    atomic_store_explicit(&pool->reclaimers, (*core)->reclaim_next,
+      memory_order_relaxed);
+  }
+  csp_spinlock_unlock(&pool->mutex);
+  return *core != NULL;
+}
+
+/* Announce that `core` is idle, false is returned if another core of the pool
+ * has done it, e.g. the spare core which has just taken its place. */
+bool csp_core_pools_idle_put(csp_core_t *core) {
+  csp_core_pool_t *pool = csp_core_pools.pools[core->pid];
+  csp_core_t *expected = NULL;
+  if (!atomic_compare_exchange_strong(&pool->idle, &expected, core)) {
+    return false;
+  }
+  atomic_fetch_or(
+    &csp_core_pools.idle[pool->idle_bit >> 6], 1ULL << (pool->idle_bit & 63)
+  );
+  return true;
+}
+
+/* Withdraw the announcement of `core` if it's not taken by a waker. The bit is
+ * cleared before the core so another core of the pool can't announce itself
+ * in between. */
+void csp_core_pools_idle_del(csp_core_t *core) {
+  csp_core_pool_t *pool = csp_core_pools.pools[core->pid];
+  if (atomic_load_explicit(&pool->idle, memory_order_relaxed) == core) {
+    atomic_fetch_and(&csp_core_pools.idle[pool->idle_bit >> 6],
+      ~(1ULL << (pool->idle_bit & 63)));
+    atomic_compare_exchange_strong(&pool->idle, &core, NULL);
+  }
+}
+
+/* Take the bits of word `idx` in `mask` one by one until an idle core is woken
+ * up. A bit may be stale if its core has withdrawn, so the next is tried. */
+static bool csp_core_pools_idle_take(size_t idx, uint_fast64_t mask) {
+  atomic_uint_fast64_t *word = &csp_core_pools.idle[idx];
+  uint_fast64_t bits;
+
+  while ((bits = atomic_load_explicit(word, memory_order_relaxed) & mask)) {
+    uint_fast64_t bit = bits & -bits;
+    if ((atomic_fetch_and(word, ~bit) & bit) == 0) {
+      continue;
+    }
+    int pid = csp_core_pools.idle_pids[(idx << 6) + __builtin_ctzll(bit)];
+    csp_core_t *core = atomic_exchange(&csp_core_pools.pools[pid]->idle, NULL);
+    if (core != NULL) {
+      csp_cond_signal(&core->cond, csp_cond_signal_proc_avail);
+      return true;
+    }
+  }
+  return false;
+}
+
+/* Wake up the idle core nearest to pool `pid`, i.e. the core of the pool itself
+ * first, then the cores in the same NUMA node and the remote ones last. */
+bool csp_core_pools_idle_wakeup(size_t pid) {
+  csp_core_pool_t *pool = csp_core_pools.pools[pid];
+  size_t own = pool->idle_bit >> 6, nlocal = pool->idle_hi - pool->idle_lo,
+    n = csp_core_pools.nidle;
+
+  if (csp_core_pools_idle_take(own, 1ULL << (pool->idle_bit & 63))) {
+    return true;
+  }
+  for (size_t i = 0; i < nlocal; i++) {
+    size_t idx = pool->idle_lo + (own - pool->idle_lo + i) % nlocal;
+    if (csp_core_pools_idle_take(idx, ~0ULL)) {
+      return true;
+    }
+  }
+  for (size_t i = 0; i < n - nlocal; i++) {
+    if (csp_core_pools_idle_take((pool->idle_hi + i) % n, ~0ULL)) {
+      return true;
+    }
+  }
+  return false;
+}
+
 void csp_core_pools_destroy() {
   if (csp_core_pools.pools == NULL) {
     return;
@@ -136,4 +463,6 @@ void csp_core_pools_destroy() {
     csp_core_pool_destroy(csp_core_pools.pools[i]);
   }
   free(csp_core_pools.pools);
+  free(csp_core_pools.idle);
+  free(csp_core_pools.idle_pids);
 }
@@ -22,23 +22,62 @@
 extern "C" {
 #endif
 
+#include <stdatomic.h>
 #include <stdlib.h>
 #include "core.h"
-#include "mutex.h"
+#include "spinlock.h"
 
 #define csp_core_pool(i) (csp_core_pools.pools[i])
 
-typedef struct {
-  size_t cap, top;
+/* The pool is aligned to the cache line as `idle` and `len` are written by the
+ * cores of the pool while the others read `victims` and the topology. */
+typedef struct __attribute__((aligned(64))) {
+  /* The spare cores are in `cores[0, top)`, the most recently parked on the
+   * top. The cores are created on demand, at most `cap` ones. */
+  size_t pid, cap, top;
   csp_core_t **cores;
-  csp_lrunq_t *lrunq;
+
+  /* All the cores created, which are read by the monitor without the lock. */
+  csp_core_t **all;
+  atomic_size_t len;
+
+  /* The cores which have returned from the system calls they were stuck in
+   * and wait for the spare cores to give the processor back, linked by
+   * `reclaim_next`. It's checked for emptiness without the lock. */
+  _Atomic(csp_core_t *) reclaimers;
+
+  csp_lrunq_t *lrunqs[csp_proc_prio_num];
   csp_grunq_t *grunq;
-  csp_mutex_t mutex;
+  csp_proc_cache_t *proc_caches;
+  csp_spinlock_t mutex;
+
+  /* The topology of the CPU which the pool is bound to, -1 means unknown. */
+  int node, package, core_id;
+
+  /* The pids of the other pools sorted by distance, i.e. the SMT siblings
+   * first, then the cores of the same NUMA node, and the remote ones last. */
+  int *victims;
+
+  /* The core of the pool which is idle and waiting to be woken up, its bit in
+   * `csp_core_pools.idle` is `idle_bit`, and the words of the pools in the same
+   * NUMA node are `idle[idle_lo, idle_hi)`. */
+  _Atomic(csp_core_t *) idle;
+  size_t idle_bit, idle_lo, idle_hi;
 } csp_core_pool_t;
 
 typedef struct {
   size_t len;
   csp_core_pool_t **pools;
+
+  /* Whether the pools spread over more than one NUMA node. */
+  bool numa;
+
+  /* The bitmap of the pools with an idle core, the bits of each NUMA node
+   * start from a new word so the nodes don't share cache lines. The pid of
+   * each bit is in `idle_pids`. */
+  size_t nidle;
+  atomic_uint_fast64_t *idle;
+  int *idle_pids;
 } csp_core_pools_t;
 
 extern csp_core_pools_t csp_core_pools;
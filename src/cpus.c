@@ -0,0 +1,267 @@
+/*
+ * Copyright (c) 2020, Yanhui Shi <lime.syh at gmail dot com>
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * cpus.c decides how many cores libcsp runs and which CPUs their threads are
+ * pinned to when the runtime starts. It's configured by the environment
+ * variables below since the runtime starts before `main`.
+ *
+ *  - `CSP_CPUS`: The CPU list the cores are pinned to in order, e.g. `0-3,8`.
+ *    It defaults to the affinity of the process, so `taskset` and cpusets are
+ *    honoured. The CPUs isolated by `isolcpus` are not in the affinity by
+ *    default but can be listed explicitly.
+ *  - `CSP_CORES`: The number of cores. It defaults to the number of the CPUs,
+ *    capped by the CPU quota of the cgroup and `--cpu-cores` of `cspcli`. The
+ *    cores share the CPUs round-robin if there are more cores than CPUs.
+ *  - `CSP_PIN`: `0` leaves the threads of the cores unpinned.
+ *  - `CSP_MONITOR_CPUS`: The CPU list the monitor and the netpoll thread are
+ *    pinned to, e.g. the housekeeping CPUs. They are unpinned by default.
+ */
+
+#define csp_cpus_cgroup_v2_max      "/sys/fs/cgroup%s/cpu.max"
+#define csp_cpus_cgroup_v1_quota    "/sys/fs/cgroup/cpu%s/cpu.cfs_quota_us"
+#define csp_cpus_cgroup_v1_period   "/sys/fs/cgroup/cpu%s/cpu.cfs_period_us"
+
+extern size_t csp_cpu_cores;
+extern int csp_sched_np;
+
+struct {
+  /* The CPU of each core. */
+  int *cpus;
+  bool pinned;
+
+  /* Whether `monitor` is set by `CSP_MONITOR_CPUS`. */
+  bool monitor_pinned;
+  cpu_set_t monitor;
+} csp_cpus;
+
+/* Parse the CPU list like `0-3,8` to `set`. */
+static bool csp_cpus_parse(const char *list, cpu_set_t *set) {
+  CPU_ZERO(set);
+  while (*list != '\0') {
+    char *end;
+    long lo = strtol(list, &end, 10), hi = lo;
+    if (end == list || lo < 0) {
+      return false;
+    }
+    if (*end == '-') {
+      list = end + 1;
+      hi = strtol(list, &end, 10);
+      if (end == list || hi < lo) {
+        return false;
+      }
+    }
+    if (hi >= CPU_SETSIZE) {
+      return false;
+    }
+    for (long cpu = lo; cpu <= hi; cpu++) {
+      CPU_SET(cpu, set);
+    }
+    if (*end == ',') {
+      end++;
+    } else if (*end != '\0') {
+      return false;
+    }
+    list = end;
+  }
+  return CPU_COUNT(set) > 0;
+}
+
+static bool csp_cpus_read(const char *fmt, const char *cgroup, long *vals,
+    int n) {
+  char path[PATH_MAX + 64];
+  snprintf(path, sizeof(path), fmt, cgroup);
+  FILE *file = fopen(path, "r");
+  if (file == NULL) {
+    return false;
+  }
+  bool ok = n == 1 ? fscanf(file, "%ld", &vals[0]) == 1 :
+    fscanf(file, "%ld %ld", &vals[0], &vals[1]) == 2;
+  fclose(file);
+  return ok;
+}
+
+/* Whether `controller` is in the comma separated `ctrls` of cgroup v1, or
+ * both are empty for cgroup v2. */
+static bool csp_cpus_has_controller(char *ctrls, const char *controller) {
+  if (*ctrls == '\0') {
+    return *controller == '\0';
+  }
+  for (char *save, *ctrl = strtok_r(ctrls, ",", &save); ctrl != NULL;
+      ctrl = strtok_r(NULL, ",", &save)) {
+    if (strcmp(ctrl, controller) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/* The cgroup of the process, which is empty for `/`. */
+static void csp_cpus_cgroup(const char *controller, char *path, size_t len) {
+  path[0] = '\0';
+  FILE *file = fopen("/proc/self/cgroup", "r");
+  if (file == NULL) {
+    return;
+  }
+  char line[PATH_MAX + 64];
+  while (fgets(line, sizeof(line), file) != NULL) {
+    char *ctrls = strchr(line, ':'), *cgroup;
+    if (ctrls == NULL || (cgroup = strchr(++ctrls, ':')) == NULL) {
+      continue;
+    }
+    *cgroup++ = '\0';
+    cgroup[strcspn(cgroup, "\n")] = '\0';
+    if (csp_cpus_has_controller(ctrls, controller)) {
+      snprintf(path, len, "%s", strcmp(cgroup, "/") == 0 ? "" : cgroup);
+      break;
+    }
+  }
+  fclose(file);
+}
+
+/* The number of CPUs the CPU quota of the cgroup allows, 0 if unlimited. The
+ * quota is a budget of CPU time per period, so the threads beyond it only get
+ * throttled. The cgroup is looked up both by its path and at the root of the
+ * hierarchy, which is where the cgroup namespace of a container starts. */
+static int csp_cpus_quota(void) {
+  char cgroup[PATH_MAX];
+  const char *dirs[2] = {cgroup, ""};
+  long vals[2] = {0, 0};
+
+  /* The quota `max` of cgroup v2 fails the scanning since it's unlimited. */
+  csp_cpus_cgroup("", cgroup, sizeof(cgroup));
+  for (int i = 0; i < 2; i++) {
+    if (csp_cpus_read(csp_cpus_cgroup_v2_max, dirs[i], vals, 2)) {
+      goto found;
+    }
+  }
+  csp_cpus_cgroup("cpu", cgroup, sizeof(cgroup));
+  for (int i = 0; i < 2; i++) {
+    if (csp_cpus_read(csp_cpus_cgroup_v1_quota, dirs[i], &vals[0], 1) &&
+        csp_cpus_read(csp_cpus_cgroup_v1_period, dirs[i], &vals[1], 1)) {
+      goto found;
+    }
+  }
+  return 0;
+
+found:
+  if (vals[0] <= 0 || vals[1] <= 0) {
+    return 0;
+  }
+  return (vals[0] + vals[1] - 1) / vals[1];
+}
+
+/* Decide `csp_sched_np` and the CPUs of the cores. */
+bool csp_cpus_init(void) {
+  cpu_set_t set;
+  const char *env = getenv("CSP_CPUS");
+  if (env != NULL) {
+    if (!csp_cpus_parse(env, &set)) {
+      errno = EINVAL;
+      return false;
+    }
+  } else if (sched_getaffinity(0, sizeof(set), &set) != 0) {
+    return false;
+  }
+
+  int ncpus = CPU_COUNT(&set), np = ncpus;
+  if ((env = getenv("CSP_CORES")) != NULL) {
+    np = atoi(env);
+    if (np <= 0) {
+      errno = EINVAL;
+      return false;
+    }
+  } else {
+    int quota = csp_cpus_quota();
+    if (quota > 0 && quota < np) {
+      np = quota;
+    }
+    if (csp_cpu_cores > 0 && csp_cpu_cores < np) {
+      np = csp_cpu_cores;
+    }
+  }
+
+  csp_cpus.pinned = (env = getenv("CSP_PIN")) == NULL || strcmp(env, "0") != 0;
+  if ((env = getenv("CSP_MONITOR_CPUS")) != NULL) {
+    if (!csp_cpus_parse(env, &csp_cpus.monitor)) {
+      errno = EINVAL;
+      return false;
+    }
+    csp_cpus.monitor_pinned = true;
+  }
+
+  csp_cpus.cpus = (int *)malloc(sizeof(int) * np);
+  if (csp_cpus.cpus == NULL) {
+    errno = ENOMEM;
+    return false;
+  }
+  for (int i = 0, cpu = 0; i < np; i++, cpu++) {
+    if (i % ncpus == 0) {
+      cpu = 0;
+    }
+    while (!CPU_ISSET(cpu, &set)) {
+      cpu++;
+    }
+    csp_cpus.cpus[i] = cpu;
+  }
+
+  csp_sched_np = np;
+  return true;
+}
+
+/* The CPU of the core `pid`, which is also where its topology is read. */
+int csp_cpus_of(size_t pid) {
+  return csp_cpus.cpus == NULL ? (int)pid : csp_cpus.cpus[pid];
+}
+
+/* Pin the thread to be created with `attr` for the core `pid`. */
+bool csp_cpus_pin_attr(pthread_attr_t *attr, size_t pid) {
+  if (!csp_cpus.pinned) {
+    return true;
+  }
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(csp_cpus_of(pid), &set);
+  return pthread_attr_setaffinity_np(attr, sizeof(set), &set) == 0;
+}
+
+/* Pin the running thread for the core `pid`, i.e. the main thread. */
+void csp_cpus_pin_self(size_t pid) {
+  if (!csp_cpus.pinned) {
+    return;
+  }
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(csp_cpus_of(pid), &set);
+  pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+/* Pin the thread to be created with `attr` for the monitor or the netpoll. */
+bool csp_cpus_pin_monitor(pthread_attr_t *attr) {
+  return !csp_cpus.monitor_pinned || pthread_attr_setaffinity_np(
+    attr, sizeof(csp_cpus.monitor), &csp_cpus.monitor
+  ) == 0;
+}
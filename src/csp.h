@@ -22,24 +22,53 @@
 extern "C" {
 #endif
 
+#include "bcast.h"
 #include "chan.h"
+#include "future.h"
+#include "io.h"
 #include "mutex.h"
 #include "netpoll.h"
+#include "offload.h"
+#include "rwlock.h"
 #include "sched.h"
+#include "select.h"
+#include "sema.h"
+#include "stats.h"
+#include "stream.h"
 #include "timer.h"
+#include "trace.h"
+#include "waitgroup.h"
 
 #define csp_async   csp_sched_async
 #define csp_sync    csp_sched_sync
 #define csp_block   csp_sched_block
+#define csp_async_prio  csp_sched_async_prio
+#define csp_sync_prio   csp_sched_sync_prio
 #define csp_yield   csp_sched_yield
 #define csp_hangup  csp_sched_hangup
 
+#define csp_prio_latency    csp_proc_prio_latency
+#define csp_prio_normal     csp_proc_prio_normal
+#define csp_prio_background csp_proc_prio_background
+
 /* All */
 #ifdef csp_without_prefix
+#ifndef csp_bcast_without_prefix
+#define csp_bcast_without_prefix
+#endif
+
 #ifndef csp_chan_without_prefix
 #define csp_chan_without_prefix
 #endif
 
+#ifndef csp_future_without_prefix
+#define csp_future_without_prefix
+#endif
+
+#ifndef csp_io_without_prefix
+#define csp_io_without_prefix
+#endif
+
 #ifndef csp_mutex_without_prefix
 #define csp_mutex_without_prefix
 #endif
@@ -48,13 +77,66 @@ extern "C" {
 #define csp_netpoll_without_prefix
 #endif
 
+#ifndef csp_offload_without_prefix
+#define csp_offload_without_prefix
+#endif
+
+#ifndef csp_rwlock_without_prefix
+#define csp_rwlock_without_prefix
+#endif
+
 #ifndef csp_sched_without_prefix
 #define csp_sched_without_prefix
 #endif
 
+#ifndef csp_select_without_prefix
+#define csp_select_without_prefix
+#endif
+
+#ifndef csp_sema_without_prefix
+#define csp_sema_without_prefix
+#endif
+
+#ifndef csp_stats_without_prefix
+#define csp_stats_without_prefix
+#endif
+
+#ifndef csp_stream_without_prefix
+#define csp_stream_without_prefix
+#endif
+
 #ifndef csp_timer_without_prefix
 #define csp_timer_without_prefix
 #endif
+
+#ifndef csp_trace_without_prefix
+#define csp_trace_without_prefix
+#endif
+
+#ifndef csp_waitgroup_without_prefix
+#define csp_waitgroup_without_prefix
+#endif
+#endif
+
+/* Broadcast */
+#ifdef csp_bcast_without_prefix
+#define bcast_t             csp_bcast_t
+#define bcast_sub_t         csp_bcast_sub_t
+#define bcast_new           csp_bcast_new
+#define bcast_try_publish   csp_bcast_try_publish
+#define bcast_publish       csp_bcast_publish
+#define bcast_subscribe     csp_bcast_subscribe
+#define bcast_unsubscribe   csp_bcast_unsubscribe
+#define bcast_try_recv      csp_bcast_try_recv
+#define bcast_recv          csp_bcast_recv
+#define bcast_close         csp_bcast_close
+#define bcast_is_closed     csp_bcast_is_closed
+#define bcast_destroy       csp_bcast_destroy
+#define bcast_declare       csp_bcast_declare
+#define bcast_define        csp_bcast_define
+#define bcast_block         csp_bcast_block
+#define bcast_drop          csp_bcast_drop
+#define bcast_skip          csp_bcast_skip
 #endif
 
 /* Channel */
@@ -69,11 +151,47 @@ extern "C" {
 #define chan_pushm          csp_chan_pushm
 #define chan_try_popm       csp_chan_try_popm
 #define chan_popm           csp_chan_popm
+#define chan_rsv_t          csp_chan_rsv_t
+#define chan_try_reserve    csp_chan_try_reserve
+#define chan_reserve        csp_chan_reserve
+#define chan_commit         csp_chan_commit
+#define chan_try_peek       csp_chan_try_peek
+#define chan_peek           csp_chan_peek
+#define chan_release        csp_chan_release
+#define chan_static         csp_chan_static
 #define chan_destroy        csp_chan_destroy
+#define chan_close          csp_chan_close
+#define chan_is_closed      csp_chan_is_closed
 #define chan_declare        csp_chan_declare
 #define chan_define         csp_chan_define
 #endif
 
+/* Future */
+#ifdef csp_future_without_prefix
+#define future_t            csp_future_t
+#define future_declare      csp_future_declare
+#define future_init         csp_future_init
+#define future_is_ready     csp_future_is_ready
+#define future_set          csp_future_set
+#define await               csp_await
+#define await_all           csp_await_all
+#define await_any           csp_await_any
+#endif
+
+/* IO */
+#ifdef csp_io_without_prefix
+#define io_batch            csp_io_batch
+#define io_fixed_file       csp_io_fixed_file
+#define io_read             csp_io_read
+#define io_write            csp_io_write
+#define io_accept           csp_io_accept
+#define io_connect          csp_io_connect
+#define io_read_fixed       csp_io_read_fixed
+#define io_write_fixed      csp_io_write_fixed
+#define io_register_buffers csp_io_register_buffers
+#define io_register_files   csp_io_register_files
+#endif
+
 /* Mutex */
 #ifdef csp_mutex_without_prefix
 #define mutex_t             csp_mutex_t
@@ -88,9 +206,35 @@ extern "C" {
 #define netpoll_avail       csp_proc_stat_netpoll_avail
 #define netpoll_timeout     csp_proc_stat_netpoll_timeout
 #define netpoll_register    csp_netpoll_register
+#define netpoll_register_oneshot csp_netpoll_register_oneshot
 #define netpoll_wait_read   csp_netpoll_wait_read
 #define netpoll_wait_write  csp_netpoll_wait_write
 #define netpoll_unregister  csp_netpoll_unregister
+#define netpoll_retry       csp_netpoll_retry
+#define netpoll_sendfile    csp_netpoll_sendfile
+#define netpoll_splice      csp_netpoll_splice
+#define netpoll_tee         csp_netpoll_tee
+#define netpoll_zerocopy_enable csp_netpoll_zerocopy_enable
+#define netpoll_send_zerocopy   csp_netpoll_send_zerocopy
+#define netpoll_zerocopy_reap   csp_netpoll_zerocopy_reap
+#endif
+
+/* Offload */
+#ifdef csp_offload_without_prefix
+#define offload             csp_offload
+#endif
+
+/* RWLock */
+#ifdef csp_rwlock_without_prefix
+#define rwlock_t            csp_rwlock_t
+#define rwlock_new          csp_rwlock_new
+#define rwlock_try_rlock    csp_rwlock_try_rlock
+#define rwlock_rlock        csp_rwlock_rlock
+#define rwlock_runlock      csp_rwlock_runlock
+#define rwlock_try_lock     csp_rwlock_try_lock
+#define rwlock_lock         csp_rwlock_lock
+#define rwlock_unlock       csp_rwlock_unlock
+#define rwlock_destroy      csp_rwlock_destroy
 #endif
 
 /* Schedule */
@@ -99,10 +243,58 @@ extern "C" {
 #define async               csp_async
 #define sync                csp_sync
 #define block               csp_block
+#define async_prio          csp_async_prio
+#define sync_prio           csp_sync_prio
 #define yield               csp_yield
 #define hangup              csp_hangup
 #endif
 
+/* Select */
+/* There is no alias of `csp_select` since it conflicts with `select(2)`. */
+#ifdef csp_select_without_prefix
+#define select_send         csp_select_send
+#define select_recv         csp_select_recv
+#define select_send_ok      csp_select_send_ok
+#define select_recv_ok      csp_select_recv_ok
+#define select_block        csp_select_block
+#define select_default      csp_select_default
+#define select_none         csp_select_none
+#endif
+
+/* Semaphore */
+#ifdef csp_sema_without_prefix
+#define sema_t              csp_sema_t
+#define sema_init           csp_sema_init
+#define sema_try_acquire    csp_sema_try_acquire
+#define sema_acquire        csp_sema_acquire
+#define sema_release        csp_sema_release
+#endif
+
+/* Stats */
+#ifdef csp_stats_without_prefix
+#define stats_t                 csp_stats_t
+#define stats_snapshot          csp_stats_snapshot
+#define stats_snapshot_pid      csp_stats_snapshot_pid
+#define stats_hist_t            csp_stats_hist_t
+#define stats_latency           csp_stats_latency
+#define stats_latency_pid       csp_stats_latency_pid
+#define stats_hist_percentile   csp_stats_hist_percentile
+#define stats_hist_value        csp_stats_hist_value
+#endif
+
+/* Stream */
+#ifdef csp_stream_without_prefix
+#define stream_t            csp_stream_t
+#define stream_init         csp_stream_init
+#define stream_read         csp_stream_read
+#define stream_readv        csp_stream_readv
+#define stream_read_full    csp_stream_read_full
+#define stream_write        csp_stream_write
+#define stream_writev       csp_stream_writev
+#define stream_flush        csp_stream_flush
+#define stream_destroy      csp_stream_destroy
+#endif
+
 /* Timer */
 #ifdef csp_timer_without_prefix
 #define timer_nanosecond    csp_timer_nanosecond
@@ -115,11 +307,27 @@ extern "C" {
 #define timer_duration_t    csp_timer_duration_t
 #define timer_t             csp_timer_t
 #define timer_now           csp_timer_now
+#define timer_now_precise   csp_timer_now_precise
+#define timer_now_coarse    csp_timer_now_coarse
 #define timer_at            csp_timer_at
 #define timer_after         csp_timer_after
 #define timer_cancel        csp_timer_cancel
 #endif
 
+/* Trace */
+#ifdef csp_trace_without_prefix
+#define trace_dump          csp_trace_dump
+#endif
+
+/* WaitGroup */
+#ifdef csp_waitgroup_without_prefix
+#define waitgroup_t         csp_waitgroup_t
+#define waitgroup_init      csp_waitgroup_init
+#define waitgroup_add       csp_waitgroup_add
+#define waitgroup_done      csp_waitgroup_done
+#define waitgroup_wait      csp_waitgroup_wait
+#endif
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,554 @@
+/*
+ * Copyright (c) 2020, Yanhui Shi <lime.syh at gmail dot com>
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef LIBCSP_CSP_HPP
+#define LIBCSP_CSP_HPP
+
+#include <atomic>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <new>
+#include <optional>
+#include <type_traits>
+#include <utility>
+
+/* The C headers rely on C11 atomics and can't be included from C++, so only the
+ * few entries used below are declared here. */
+extern "C" {
+void csp_sched_spawn(void (*fn)(void *arg), void *arg);
+void csp_sched_yield(void);
+void csp_sched_hangup(uint64_t nanoseconds);
+int csp_netpoll_wait_read(int fd, int64_t timeout);
+int csp_netpoll_wait_write(int fd, int64_t timeout);
+}
+
+namespace csp {
+
+/* The same values as `csp_netpoll_avail` and `csp_netpoll_timeout`. */
+constexpr int netpoll_avail   = 2;
+constexpr int netpoll_timeout = 3;
+
+constexpr size_t cache_line_size = 64;
+
+namespace detail {
+
+inline void resume_fn(void *addr) {
+  std::coroutine_handle<>::from_address(addr).resume();
+}
+
+/* Resume a suspended coroutine in a new process, so the caller never runs the
+ * body of another coroutine on its own stack. The process runs
+ * `csp_sched_spawn_run`, which the analyzer can't see through, so every body
+ * runs on the default stack(2KB unless `--default-stack-size` says otherwise).
+ * A body that needs more, e.g. with large locals or deep calls, needs a line
+ * `csp_sched_spawn_run size` or `csp_sched_spawn_run elastic` in the extra
+ * stack usage file of `cspcli`. */
+inline void resume(std::coroutine_handle<> handle) {
+  csp_sched_spawn(resume_fn, handle.address());
+}
+
+} // namespace detail
+
+/* A fire-and-forget coroutine. It starts suspended and runs once it's passed
+ * to `go`, its frame is freed when the body returns. */
+class task {
+public:
+  class promise_type {
+  public:
+    task get_return_object() noexcept {
+      return task(std::coroutine_handle<promise_type>::from_promise(*this));
+    }
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_void() noexcept {}
+    void unhandled_exception() noexcept { std::terminate(); }
+  };
+
+  task(const task &) = delete;
+  task &operator=(const task &) = delete;
+  task(task &&other) noexcept: handle(std::exchange(other.handle, nullptr)) {}
+
+  ~task() {
+    if (this->handle) {
+      this->handle.destroy();
+    }
+  }
+
+private:
+  friend void go(task t);
+
+  explicit task(std::coroutine_handle<promise_type> handle): handle(handle) {}
+
+  std::coroutine_handle<promise_type> handle;
+};
+
+inline void go(task t) {
+  detail::resume(std::exchange(t.handle, nullptr));
+}
+
+/* Run a callable in a new process. */
+template <class F>
+requires (!std::is_same_v<std::decay_t<F>, task>)
+void go(F &&fn) {
+  using fn_t = std::decay_t<F>;
+  csp_sched_spawn([](void *arg) {
+    std::unique_ptr<fn_t>(static_cast<fn_t *>(arg))->operator()();
+  }, new fn_t(std::forward<F>(fn)));
+}
+
+/* A coroutine always runs in a process of its own, either the one `go` created
+ * or the one it's resumed in, so the waits on timers and sockets simply park
+ * that process until the runtime wakes it up. */
+class sleep_for {
+public:
+  explicit sleep_for(uint64_t nanoseconds): nanoseconds(nanoseconds) {}
+
+  bool await_ready() const noexcept {
+    csp_sched_hangup(this->nanoseconds);
+    return true;
+  }
+  void await_suspend(std::coroutine_handle<>) const noexcept {}
+  void await_resume() const noexcept {}
+
+private:
+  uint64_t nanoseconds;
+};
+
+class yield {
+public:
+  bool await_ready() const noexcept {
+    csp_sched_yield();
+    return true;
+  }
+  void await_suspend(std::coroutine_handle<>) const noexcept {}
+  void await_resume() const noexcept {}
+};
+
+/* Wait until `fd` is readable or writable, the result is `netpoll_avail`,
+ * `netpoll_timeout` or -1 on error. `fd` must be registered to the netpoll and
+ * a `timeout` not above zero waits forever. */
+template <int (*wait)(int fd, int64_t timeout)>
+class netpoll_waiter {
+public:
+  netpoll_waiter(int fd, int64_t timeout): fd(fd), timeout(timeout) {}
+
+  bool await_ready() noexcept {
+    this->result = wait(this->fd, this->timeout);
+    return true;
+  }
+  void await_suspend(std::coroutine_handle<>) const noexcept {}
+  int await_resume() const noexcept { return this->result; }
+
+private:
+  int fd;
+  int64_t timeout;
+  int result;
+};
+
+using wait_read = netpoll_waiter<csp_netpoll_wait_read>;
+using wait_write = netpoll_waiter<csp_netpoll_wait_write>;
+
+/* The first letter tells whether the channel has a single or multiple senders,
+ * the second one is for the receivers. */
+enum class kind { ss, sm, ms, mm };
+
+/* A bounded channel of `2 ^ cap_exp` items of type `T`. Items are moved in and
+ * out, `try_push` and `try_pop` never block, `co_await ch.push(item)` and
+ * `co_await ch.pop()` suspend the coroutine while the channel is full or empty
+ * instead of parking a process. */
+template <class T, kind K = kind::mm>
+class chan {
+  static_assert(std::is_nothrow_move_constructible_v<T>,
+    "csp::chan requires a nothrow move constructor");
+
+  static constexpr bool single_sender =
+    K == kind::ss || K == kind::sm;
+  static constexpr bool single_receiver =
+    K == kind::ss || K == kind::ms;
+
+  struct slot_t {
+    std::atomic<size_t> seq;
+    alignas(T) unsigned char storage[sizeof(T)];
+
+    T *item() noexcept {
+      return std::launder(reinterpret_cast<T *>(this->storage));
+    }
+  };
+
+  struct waiter_t {
+    std::coroutine_handle<> handle;
+    void *owner;
+    waiter_t *prev, *next;
+  };
+
+  /* The coroutines waiting for room or items. `len` is read without the lock,
+   * so the other side of the channel only takes it when someone is waiting. */
+  class waitq_t {
+  public:
+    void lock() noexcept {
+      while (this->flag.test_and_set(std::memory_order_acquire)) {
+        while (this->flag.test(std::memory_order_relaxed)) {}
+      }
+    }
+
+    void unlock() noexcept {
+      this->flag.clear(std::memory_order_release);
+    }
+
+    bool is_empty() const noexcept {
+      return this->len.load(std::memory_order_seq_cst) == 0;
+    }
+
+    void push_front(waiter_t *w) noexcept {
+      w->prev = nullptr;
+      w->next = this->head;
+      if (this->head == nullptr) {
+        this->tail = w;
+      } else {
+        this->head->prev = w;
+      }
+      this->head = w;
+      this->len.fetch_add(1, std::memory_order_seq_cst);
+    }
+
+    void push_back(waiter_t *w) noexcept {
+      w->next = nullptr;
+      w->prev = this->tail;
+      if (this->tail == nullptr) {
+        this->head = w;
+      } else {
+        this->tail->next = w;
+      }
+      this->tail = w;
+      this->len.fetch_add(1, std::memory_order_seq_cst);
+    }
+
+    void remove(waiter_t *w) noexcept {
+      if (w->prev == nullptr) {
+        this->head = w->next;
+      } else {
+        w->prev->next = w->next;
+      }
+      if (w->next == nullptr) {
+        this->tail = w->prev;
+      } else {
+        w->next->prev = w->prev;
+      }
+      this->len.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    waiter_t *pop() noexcept {
+      waiter_t *w = this->head;
+      if (w != nullptr) {
+        this->remove(w);
+      }
+      return w;
+    }
+
+  private:
+    std::atomic_flag flag = ATOMIC_FLAG_INIT;
+    std::atomic<size_t> len{0};
+    waiter_t *head = nullptr, *tail = nullptr;
+  };
+
+public:
+  class push_waiter;
+  class pop_waiter;
+
+  explicit chan(size_t cap_exp):
+    mask((size_t(1) << cap_exp) - 1),
+    slots(new slot_t[size_t(1) << cap_exp])
+  {
+    for (size_t i = 0; i <= this->mask; i++) {
+      this->slots[i].seq.store(i, std::memory_order_relaxed);
+    }
+  };
+
+  chan(const chan &) = delete;
+  chan &operator=(const chan &) = delete;
+
+  ~chan() {
+    while (this->try_take()) {}
+  }
+
+  size_t cap() const noexcept {
+    return this->mask + 1;
+  }
+
+  bool is_closed() const noexcept {
+    return this->closed.load(std::memory_order_acquire);
+  }
+
+  bool try_push(T &&item) {
+    return this->try_push_ref(item);
+  }
+
+  bool try_push(const T &item) requires std::is_copy_constructible_v<T> {
+    T copy(item);
+    return this->try_push_ref(copy);
+  }
+
+  std::optional<T> try_pop() {
+    std::optional<T> item = this->try_take();
+    if (item) {
+      this->serve_senders();
+    }
+    return item;
+  }
+
+  /* `co_await` it for a bool, false means the channel was closed. */
+  push_waiter push(T item) {
+    return push_waiter(*this, std::move(item));
+  }
+
+  /* `co_await` it for the item, it's empty once the channel is closed and all
+   * the items are consumed. */
+  pop_waiter pop() {
+    return pop_waiter(*this);
+  }
+
+  /* Wake up all the waiting coroutines, later pushes fail and pops fail once
+   * the remaining items are consumed. */
+  void close() {
+    this->closed.store(true, std::memory_order_seq_cst);
+    for (waitq_t *q: {&this->sendq, &this->recvq}) {
+      q->lock();
+      waiter_t *list = nullptr;
+      while (waiter_t *w = q->pop()) {
+        w->next = list;
+        list = w;
+      }
+      q->unlock();
+      while (list != nullptr) {
+        waiter_t *next = list->next;
+        detail::resume(list->handle);
+        list = next;
+      }
+    }
+  }
+
+  class push_waiter {
+  public:
+    push_waiter(chan &ch, T &&item): ch(ch), item(std::move(item)) {}
+
+    bool await_ready() {
+      this->ok = !this->ch.is_closed() && this->ch.try_push_ref(this->item);
+      return this->ok || this->ch.is_closed();
+    }
+
+    bool await_suspend(std::coroutine_handle<> handle) {
+      this->waiter.handle = handle;
+      this->waiter.owner = this;
+      this->ch.sendq.lock();
+      this->ch.sendq.push_back(&this->waiter);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      bool closed = this->ch.is_closed();
+      if (closed || this->ch.try_push_item(this->item)) {
+        this->ok = !closed;
+        this->ch.sendq.remove(&this->waiter);
+        this->ch.sendq.unlock();
+        if (this->ok) {
+          this->ch.serve_receivers();
+        }
+        return false;
+      }
+      /* `this` may be resumed and gone right after the unlock. */
+      this->ch.sendq.unlock();
+      return true;
+    }
+
+    bool await_resume() const noexcept { return this->ok; }
+
+  private:
+    friend class chan;
+
+    chan &ch;
+    T item;
+    bool ok = false;
+    waiter_t waiter;
+  };
+
+  class pop_waiter {
+  public:
+    explicit pop_waiter(chan &ch): ch(ch) {}
+
+    bool await_ready() {
+      this->item = this->ch.try_pop();
+      return this->item.has_value() || this->ch.is_closed();
+    }
+
+    bool await_suspend(std::coroutine_handle<> handle) {
+      this->waiter.handle = handle;
+      this->waiter.owner = this;
+      this->ch.recvq.lock();
+      this->ch.recvq.push_back(&this->waiter);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      this->item = this->ch.try_take();
+      if (this->item || this->ch.is_closed()) {
+        this->ch.recvq.remove(&this->waiter);
+        this->ch.recvq.unlock();
+        if (this->item) {
+          this->ch.serve_senders();
+        } else {
+          /* Items pushed right before the close. */
+          this->item = this->ch.try_pop();
+        }
+        return false;
+      }
+      this->ch.recvq.unlock();
+      return true;
+    }
+
+    std::optional<T> await_resume() noexcept {
+      return std::move(this->item);
+    }
+
+  private:
+    friend class chan;
+
+    chan &ch;
+    std::optional<T> item;
+    waiter_t waiter;
+  };
+
+private:
+  /* Move `item` into the channel, it's left untouched on failure. */
+  bool try_push_item(T &item) {
+    size_t pos = this->tail.load(std::memory_order_relaxed);
+    slot_t *slot;
+    for (;;) {
+      slot = &this->slots[pos & this->mask];
+      size_t seq = slot->seq.load(std::memory_order_acquire);
+      intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+      if (diff == 0) {
+        if constexpr (single_sender) {
+          this->tail.store(pos + 1, std::memory_order_relaxed);
+          break;
+        } else if (this->tail.compare_exchange_weak(pos, pos + 1,
+              std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = this->tail.load(std::memory_order_relaxed);
+      }
+    }
+    ::new (slot->storage) T(std::move(item));
+    slot->seq.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  std::optional<T> try_take() {
+    size_t pos = this->head.load(std::memory_order_relaxed);
+    slot_t *slot;
+    for (;;) {
+      slot = &this->slots[pos & this->mask];
+      size_t seq = slot->seq.load(std::memory_order_acquire);
+      intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+      if (diff == 0) {
+        if constexpr (single_receiver) {
+          this->head.store(pos + 1, std::memory_order_relaxed);
+          break;
+        } else if (this->head.compare_exchange_weak(pos, pos + 1,
+              std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        return std::nullopt;
+      } else {
+        pos = this->head.load(std::memory_order_relaxed);
+      }
+    }
+    std::optional<T> item(std::move(*slot->item()));
+    slot->item()->~T();
+    slot->seq.store(pos + this->mask + 1, std::memory_order_release);
+    return item;
+  }
+
+  bool try_push_ref(T &item) {
+    if (!this->try_push_item(item)) {
+      return false;
+    }
+    this->serve_receivers();
+    return true;
+  }
+
+  /* Hand the item just pushed to a waiting receiver. The receiver is put back
+   * if another one took the item first. */
+  void serve_receivers() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (this->recvq.is_empty()) {
+      return;
+    }
+    this->recvq.lock();
+    waiter_t *w = this->recvq.pop();
+    if (w == nullptr) {
+      this->recvq.unlock();
+      return;
+    }
+    pop_waiter *pw = static_cast<pop_waiter *>(w->owner);
+    pw->item = this->try_take();
+    if (!pw->item) {
+      this->recvq.push_front(w);
+      this->recvq.unlock();
+      return;
+    }
+    this->recvq.unlock();
+    detail::resume(w->handle);
+    this->serve_senders();
+  }
+
+  /* Move the item of a waiting sender into the room just made. */
+  void serve_senders() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (this->sendq.is_empty()) {
+      return;
+    }
+    this->sendq.lock();
+    waiter_t *w = this->sendq.pop();
+    if (w == nullptr) {
+      this->sendq.unlock();
+      return;
+    }
+    push_waiter *pw = static_cast<push_waiter *>(w->owner);
+    if (!this->try_push_item(pw->item)) {
+      this->sendq.push_front(w);
+      this->sendq.unlock();
+      return;
+    }
+    pw->ok = true;
+    this->sendq.unlock();
+    detail::resume(w->handle);
+    this->serve_receivers();
+  }
+
+  const size_t mask;
+  std::unique_ptr<slot_t[]> slots;
+  std::atomic<bool> closed{false};
+  alignas(cache_line_size) std::atomic<size_t> tail{0};
+  alignas(cache_line_size) std::atomic<size_t> head{0};
+  alignas(cache_line_size) waitq_t sendq;
+  alignas(cache_line_size) waitq_t recvq;
+};
+
+} // namespace csp
+
+#endif
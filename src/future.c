@@ -0,0 +1,133 @@
+/*
+ * Copyright (c) 2020, Yanhui Shi <lime.syh at gmail dot com>
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "core.h"
+#include "future.h"
+#include "spinlock.h"
+#include "waitq.h"
+
+extern _Thread_local csp_core_t *csp_this_core;
+extern void csp_sched_put_proc(csp_proc_t *proc);
+extern void csp_sched_park_fn(void (*fn)(void *arg), void *arg);
+
+typedef struct {
+  void **futures;
+
+  /* The indexes of the futures sorted by their addresses, so that the
+   * processes waiting on the same futures always lock them in the same order,
+   * and a future passed twice is locked only once. */
+  uint8_t *order;
+  size_t n;
+} csp_future_locks_t;
+
+#define csp_future_at(locks, i)                                                \
+  ((csp_future_base_t *)(locks)->futures[(locks)->order[i]])                   \
+
+static void csp_future_lock(csp_future_locks_t *locks) {
+  csp_future_base_t *pre = NULL;
+  for (size_t i = 0; i < locks->n; i++) {
+    csp_future_base_t *f = csp_future_at(locks, i);
+    if (f != pre) {
+      csp_waitq_lock(&f->waitq.lock);
+      pre = f;
+    }
+  }
+}
+
+static void csp_future_unlock(void *data) {
+  csp_future_locks_t *locks = (csp_future_locks_t *)data;
+  csp_future_base_t *pre = NULL;
+  for (size_t i = 0; i < locks->n; i++) {
+    csp_future_base_t *f = csp_future_at(locks, i);
+    if (f != pre) {
+      csp_waitq_unlock(&f->waitq.lock);
+      pre = f;
+    }
+  }
+}
+
+/* `ready` is set with the lock held and the waiters are woken up before the
+ * lock is released. The future may live on the stack of a waiter, which
+ * returns only after it has passed through the lock, so the resolver never
+ * touches the future once the waiter may be gone. */
+void csp_future_resolve(csp_future_base_t *f) {
+  csp_waitq_lock(&f->waitq.lock);
+  atomic_store(&f->ready, true);
+  csp_waitq_node_t *node;
+  while ((node = csp_waitq_pop(&f->waitq)) != NULL) {
+    csp_sched_put_proc(node->parked);
+  }
+  csp_waitq_unlock(&f->waitq.lock);
+}
+
+void csp_future_wait(csp_future_base_t *f) {
+  csp_waitq_wait(&f->waitq, atomic_load(&f->ready));
+
+  /* Wait for the resolver to leave, see `csp_future_resolve`. */
+  csp_waitq_lock(&f->waitq.lock);
+  csp_waitq_unlock(&f->waitq.lock);
+}
+
+size_t csp_future_await_any_run(void **futures, csp_waitq_node_t *nodes,
+    size_t n) {
+  uint8_t order[csp_future_await_max];
+  for (size_t i = 0; i < n; i++) {
+    size_t j = i;
+    for (; j > 0 && futures[order[j - 1]] > futures[i]; j--) {
+      order[j] = order[j - 1];
+    }
+    order[j] = i;
+  }
+
+  /* A ready future seen with its lock held has been left by the resolver. */
+  csp_future_locks_t locks = {.futures = futures, .order = order, .n = n};
+  csp_future_lock(&locks);
+  for (size_t i = 0; i < n; i++) {
+    if (atomic_load(&((csp_future_base_t *)futures[i])->ready)) {
+      csp_future_unlock(&locks);
+      return i;
+    }
+  }
+
+  /* All nodes share `done`, so only the first resolver wakes the process up,
+   * see `csp_waitq_claim`. */
+  atomic_int_fast64_t done;
+  atomic_store(&done, 0);
+  for (size_t i = 0; i < n; i++) {
+    nodes[i] = (csp_waitq_node_t){
+      .parked = csp_this_core->running, .done = &done, .idx = i
+    };
+    csp_waitq_push(&((csp_future_base_t *)futures[i])->waitq, &nodes[i]);
+  }
+  csp_sched_park_fn(csp_future_unlock, &locks);
+
+  /* Drop the nodes left in the queues of the other futures. Taking the locks
+   * also waits for the resolver who woke us up to leave. */
+  csp_future_lock(&locks);
+  for (size_t i = 0; i < n; i++) {
+    csp_waitq_t *waitq = &((csp_future_base_t *)futures[i])->waitq;
+    if (csp_waitq_contains(waitq, &nodes[i])) {
+      csp_waitq_remove(waitq, &nodes[i]);
+    }
+  }
+  csp_future_unlock(&locks);
+  return atomic_load(&done) - 1;
+}
@@ -0,0 +1,118 @@
+/*
+ * Copyright (c) 2020, Yanhui Shi <lime.syh at gmail dot com>
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef LIBCSP_FUTURE_H
+#define LIBCSP_FUTURE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "waitq.h"
+
+/*
+ * `csp_future_t(I)` carries the result of a process back to the ones waiting
+ * for it without a channel. The future usually lives on the stack of the
+ * awaiting process, which passes its address to the spawned one, so getting a
+ * value back costs no allocation at all:
+ *
+ *   csp_future_declare(int, int);
+ *
+ *   csp_proc void square(int n, csp_future_t(int) *f) {
+ *     csp_future_set(f, n * n);
+ *   }
+ *
+ *   csp_future_t(int) f;
+ *   csp_future_init(&f);
+ *   csp_async(square(3, &f));
+ *   int n = csp_await(&f);
+ *
+ * A future is set exactly once. All the futures start with `base`, so that
+ * `csp_await_all` and `csp_await_any` accept the ones of different types.
+ */
+typedef struct {
+  atomic_bool ready;
+  csp_waitq_t waitq;
+} csp_future_base_t;
+
+#define csp_future_t(I) csp_future_##I##_t
+
+#define csp_future_declare(T, I)                                               \
+  typedef struct {                                                             \
+    csp_future_base_t base;                                                    \
+    T value;                                                                   \
+  } csp_future_t(I)                                                            \
+
+#define csp_future_init(f) do {                                                \
+  atomic_store(&(f)->base.ready, false);                                       \
+  csp_waitq_init(&(f)->base.waitq);                                            \
+} while (0)                                                                    \
+
+#define csp_future_is_ready(f) atomic_load(&(f)->base.ready)
+
+/* `value` is written before `ready` is set, see `csp_future_resolve`. */
+#define csp_future_set(f, val) do {                                            \
+  __typeof__(f) f_ = (f);                                                      \
+  f_->value = (val);                                                           \
+  csp_future_resolve(&f_->base);                                               \
+} while (0)                                                                    \
+
+/* Park the running process until the future is set and return its value. It
+ * must be called in a process. */
+#define csp_await(f) ({                                                        \
+  __typeof__(f) f_ = (f);                                                      \
+  csp_future_wait(&f_->base);                                                  \
+  f_->value;                                                                   \
+})                                                                             \
+
+/* Wait for all of the futures. */
+#define csp_await_all(...) do {                                                \
+  void *futures_[] = {__VA_ARGS__};                                            \
+  for (size_t i_ = 0; i_ < sizeof(futures_) / sizeof(void *); i_++) {          \
+    csp_future_wait((csp_future_base_t *)futures_[i_]);                        \
+  }                                                                            \
+} while (0)                                                                    \
+
+/* Wait for the first future to be set and return its index. The process
+ * parks in the wait queues of all the futures at once like `csp_select`. */
+#define csp_await_any(...) ({                                                  \
+  void *futures_[] = {__VA_ARGS__};                                            \
+  _Static_assert(                                                              \
+    sizeof(futures_) / sizeof(void *) <= csp_future_await_max,                 \
+    "Too many futures in csp_await_any."                                       \
+  );                                                                           \
+  csp_waitq_node_t nodes_[sizeof(futures_) / sizeof(void *)];                  \
+  csp_future_await_any_run(                                                    \
+    futures_, nodes_, sizeof(futures_) / sizeof(void *)                        \
+  );                                                                           \
+})                                                                             \
+
+#define csp_future_await_max    128
+
+extern void csp_future_resolve(csp_future_base_t *f);
+extern void csp_future_wait(csp_future_base_t *f);
+extern size_t csp_future_await_any_run(void **futures,
+    csp_waitq_node_t *nodes, size_t n);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
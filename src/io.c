@@ -0,0 +1,358 @@
+/*
+ * Copyright (c) 2020, Yanhui Shi <lime.syh at gmail dot com>
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "core.h"
+#include "io.h"
+#include "proc.h"
+#include "spinlock.h"
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifdef csp_with_io_uring
+
+/* The number of SQEs of every core, the CQ is twice as large. */
+#define csp_io_ring_entries       256
+
+#define csp_io_load(ptr)          atomic_load_explicit(                        \
+  (_Atomic unsigned *)(ptr), memory_order_acquire                              \
+)
+#define csp_io_store(ptr, val)    atomic_store_explicit(                       \
+  (_Atomic unsigned *)(ptr), (val), memory_order_release                       \
+)
+
+extern int csp_sched_np;
+extern _Thread_local csp_core_t *csp_this_core;
+extern void csp_sched_park_fn(void (*fn)(void *arg), void *arg);
+extern bool csp_monitor_watch(size_t pid, int fd);
+
+/* The request lives in the stack of the waiting process. */
+typedef struct {
+  csp_proc_t *proc;
+  int32_t res;
+} csp_io_req_t;
+
+typedef struct {
+  int fd;
+
+  /* The submission queue is only touched by its core. `tail` is the local
+   * tail, `pending` is the number of SQEs not submitted yet and `rounds` is
+   * the number of scheduling rounds since the first of them. */
+  unsigned *sq_head, *sq_tail, *sq_array, sq_mask, sq_entries;
+  struct io_uring_sqe *sqes;
+  unsigned tail, pending, rounds;
+
+  /* The completion queue is reaped by its core and the monitor. */
+  unsigned *cq_head, *cq_tail, cq_mask;
+  struct io_uring_cqe *cqes;
+  csp_spinlock_t cq_lock;
+
+  void *sq_ring, *cq_ring;
+  size_t sq_ring_size, cq_ring_size, sqes_size;
+} csp_io_ring_t;
+
+struct { int len; csp_io_ring_t *rings; } csp_io;
+
+static bool csp_io_ring_init(csp_io_ring_t *ring) {
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+
+  ring->fd = syscall(__NR_io_uring_setup, csp_io_ring_entries, &params);
+  if (ring->fd == -1) {
+    return false;
+  }
+
+  /* Completions would be dropped when the CQ overflows without NODROP, and
+   * the waiting processes would never wake up. */
+  if (!(params.features & IORING_FEAT_NODROP)) {
+    close(ring->fd);
+    errno = ENOSYS;
+    return false;
+  }
+
+  ring->sq_ring_size = params.sq_off.array +
+    params.sq_entries * sizeof(unsigned);
+  ring->cq_ring_size = params.cq_off.cqes +
+    params.cq_entries * sizeof(struct io_uring_cqe);
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    if (ring->cq_ring_size > ring->sq_ring_size) {
+      ring->sq_ring_size = ring->cq_ring_size;
+    }
+    ring->cq_ring_size = 0;
+  }
+
+  ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ|PROT_WRITE,
+    MAP_SHARED|MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING
+  );
+  ring->cq_ring = ring->cq_ring_size == 0 ? ring->sq_ring : mmap(
+    NULL, ring->cq_ring_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+    ring->fd, IORING_OFF_CQ_RING
+  );
+  ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+  ring->sqes = (struct io_uring_sqe *)mmap(NULL, ring->sqes_size,
+    PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, ring->fd, IORING_OFF_SQES
+  );
+  if (ring->sq_ring == MAP_FAILED || ring->cq_ring == MAP_FAILED ||
+      ring->sqes == MAP_FAILED) {
+    return false;
+  }
+
+  char *sq = (char *)ring->sq_ring, *cq = (char *)ring->cq_ring;
+  ring->sq_head = (unsigned *)(sq + params.sq_off.head);
+  ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+  ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+  ring->sq_mask = *(unsigned *)(sq + params.sq_off.ring_mask);
+  ring->sq_entries = params.sq_entries;
+  ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+  ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+  ring->cq_mask = *(unsigned *)(cq + params.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+  /* The SQE of slot `i` is always `sqes[i]`. */
+  for (unsigned i = 0; i < ring->sq_entries; i++) {
+    ring->sq_array[i] = i;
+  }
+  ring->tail = *ring->sq_tail;
+  ring->pending = ring->rounds = 0;
+  csp_spinlock_init(&ring->cq_lock);
+  return true;
+}
+
+static void csp_io_ring_destroy(csp_io_ring_t *ring) {
+  if (ring->sqes != MAP_FAILED) {
+    munmap(ring->sqes, ring->sqes_size);
+  }
+  if (ring->cq_ring_size != 0 && ring->cq_ring != MAP_FAILED) {
+    munmap(ring->cq_ring, ring->cq_ring_size);
+  }
+  if (ring->sq_ring != MAP_FAILED) {
+    munmap(ring->sq_ring, ring->sq_ring_size);
+  }
+  close(ring->fd);
+}
+
+bool csp_io_init(void) {
+  csp_io.rings = (csp_io_ring_t *)malloc(sizeof(csp_io_ring_t) * csp_sched_np);
+  if (csp_io.rings == NULL) {
+    return false;
+  }
+
+  for (int i = 0; i < csp_sched_np; i++) {
+    csp_io_ring_t *ring = &csp_io.rings[i];
+    ring->sq_ring = ring->cq_ring = ring->sqes = MAP_FAILED;
+    if (!csp_io_ring_init(ring)) {
+      csp_io.len = ring->fd == -1 ? i : i + 1;
+      return false;
+    }
+
+    /* The ring is readable when it has completions for the poller to reap. */
+    if (!csp_monitor_watch(i, ring->fd)) {
+      csp_io.len = i + 1;
+      return false;
+    }
+  }
+  csp_io.len = csp_sched_np;
+  return true;
+}
+
+void csp_io_destroy(void) {
+  for (int i = 0; i < csp_io.len; i++) {
+    csp_io_ring_destroy(&csp_io.rings[i]);
+  }
+  free(csp_io.rings);
+}
+
+/* Submit the pending SQEs to the kernel. */
+static void csp_io_flush(csp_io_ring_t *ring) {
+  csp_io_store(ring->sq_tail, ring->tail);
+  while (ring->pending > 0) {
+    int n = syscall(
+      __NR_io_uring_enter, ring->fd, ring->pending, 0, 0, NULL, 0
+    );
+    if (n > 0) {
+      ring->pending -= n;
+    } else if (n == 0 || errno != EINTR) {
+      /* Retry in the next round, e.g. the kernel is out of memory(EAGAIN) or
+       * the CQ is going to overflow(EBUSY). */
+      break;
+    }
+  }
+  ring->rounds = 0;
+}
+
+/* Get a free SQE, flush the pending ones if the SQ is full. */
+static struct io_uring_sqe *csp_io_sqe_get(csp_io_ring_t *ring) {
+  while (ring->tail - csp_io_load(ring->sq_head) >= ring->sq_entries) {
+    csp_io_flush(ring);
+  }
+  struct io_uring_sqe *sqe = &ring->sqes[ring->tail & ring->sq_mask];
+  memset(sqe, 0, sizeof(*sqe));
+  ring->tail++;
+  ring->pending++;
+  return sqe;
+}
+
+/* Queue the request and park the running process until it completes. The SQE
+ * is only submitted in `csp_sched_get` of this core, i.e. after the context of
+ * the process has been saved, so it's safe to be woken up by the reaper. */
+static int32_t csp_io_submit(uint8_t opcode, int fd, const void *addr,
+    uint32_t len, uint64_t off, int buf_idx) {
+  csp_core_t *this_core = csp_this_core;
+  csp_io_req_t req = {.proc = this_core->running};
+
+  csp_core_enter(this_core);
+  struct io_uring_sqe *sqe = csp_io_sqe_get(&csp_io.rings[this_core->pid]);
+  sqe->opcode = opcode;
+  if (fd & csp_io_fixed_file_flag) {
+    sqe->fd = fd & ~csp_io_fixed_file_flag;
+    sqe->flags |= IOSQE_FIXED_FILE;
+  } else {
+    sqe->fd = fd;
+  }
+  sqe->addr = (uintptr_t)addr;
+  sqe->len = len;
+  sqe->off = off;
+  sqe->buf_index = buf_idx;
+  sqe->user_data = (uintptr_t)&req;
+  csp_core_leave(this_core);
+
+  csp_sched_park_fn(NULL, NULL);
+  return req.res;
+}
+
+#define csp_io_result(res) ({                                                  \
+  __typeof__(res) res_ = (res);                                                \
+  if (res_ < 0) {                                                              \
+    errno = -res_;                                                             \
+    res_ = -1;                                                                 \
+  }                                                                            \
+  res_;                                                                        \
+})                                                                             \
+
+ssize_t csp_io_read(int fd, void *buf, size_t n) {
+  return csp_io_result(csp_io_submit(IORING_OP_READ, fd, buf, n, -1, 0));
+}
+
+ssize_t csp_io_write(int fd, const void *buf, size_t n) {
+  return csp_io_result(csp_io_submit(IORING_OP_WRITE, fd, buf, n, -1, 0));
+}
+
+ssize_t csp_io_read_fixed(int fd, void *buf, size_t n, int buf_idx) {
+  return csp_io_result(
+    csp_io_submit(IORING_OP_READ_FIXED, fd, buf, n, -1, buf_idx)
+  );
+}
+
+ssize_t csp_io_write_fixed(int fd, const void *buf, size_t n, int buf_idx) {
+  return csp_io_result(
+    csp_io_submit(IORING_OP_WRITE_FIXED, fd, buf, n, -1, buf_idx)
+  );
+}
+
+/* `addrlen` is passed by `off` and `addr2` of the SQE. */
+int csp_io_accept(int fd, struct sockaddr *addr, socklen_t *addrlen) {
+  return csp_io_result(csp_io_submit(
+    IORING_OP_ACCEPT, fd, addr, 0, (uintptr_t)addrlen, 0
+  ));
+}
+
+int csp_io_connect(int fd, const struct sockaddr *addr, socklen_t addrlen) {
+  return csp_io_result(
+    csp_io_submit(IORING_OP_CONNECT, fd, addr, 0, addrlen, 0)
+  );
+}
+
+static bool csp_io_register(unsigned opcode, const void *arg, unsigned n) {
+  for (int i = 0; i < csp_io.len; i++) {
+    if (syscall(__NR_io_uring_register, csp_io.rings[i].fd, opcode, arg, n)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool csp_io_register_buffers(const struct iovec *iovs, unsigned n) {
+  return csp_io_register(IORING_REGISTER_BUFFERS, iovs, n);
+}
+
+bool csp_io_register_files(const int *fds, unsigned n) {
+  return csp_io_register(IORING_REGISTER_FILES, fds, n);
+}
+
+/* Reap the completed requests of the ring. The list of the waiting processes
+ * is appended to `*start` ... `*end`. */
+static int csp_io_reap(csp_io_ring_t *ring, csp_proc_t **start,
+    csp_proc_t **end, int total) {
+  if (csp_io_load(ring->cq_tail) == *ring->cq_head ||
+      !csp_spinlock_try_lock(&ring->cq_lock)) {
+    return 0;
+  }
+
+  int n = 0;
+  unsigned head = *ring->cq_head, tail = csp_io_load(ring->cq_tail);
+
+  for (; head != tail; head++) {
+    struct io_uring_cqe *cqe = &ring->cqes[head & ring->cq_mask];
+    csp_io_req_t *req = (csp_io_req_t *)(uintptr_t)cqe->user_data;
+    csp_proc_t *proc = req->proc;
+    req->res = cqe->res;
+
+    if (total + n > 0) {
+      (*end)->next = proc;
+      proc->pre = *end;
+    } else {
+      *start = proc;
+    }
+    *end = proc;
+    n++;
+  }
+  csp_io_store(ring->cq_head, head);
+
+  csp_spinlock_unlock(&ring->cq_lock);
+  return n;
+}
+
+/* Called by core `pid` every time it schedules. It flushes the pending SQEs
+ * according to the batching policy, or always if `idle` is true. */
+int csp_io_poll_core(size_t pid, bool idle, csp_proc_t **start,
+    csp_proc_t **end) {
+  csp_io_ring_t *ring = &csp_io.rings[pid];
+  if (ring->pending > 0 && (idle || ring->pending >= csp_io_batch ||
+      ++ring->rounds >= csp_io_batch)) {
+    csp_io_flush(ring);
+  }
+  return csp_io_reap(ring, start, end, 0);
+}
+
+/* Called by the poller of core `pid` for its completions while it's busy or
+ * parked. */
+int csp_io_poll(size_t pid, csp_proc_t **start, csp_proc_t **end) {
+  return csp_io_reap(&csp_io.rings[pid], start, end, 0);
+}
+
+#endif
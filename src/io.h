@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) 2020, Yanhui Shi <lime.syh at gmail dot com>
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef LIBCSP_IO_H
+#define LIBCSP_IO_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+/*
+ * `io.h` submits I/O requests to the per-core io_uring instances and parks the
+ * running process until the request completes. It's only available if libcsp
+ * is configured with `--with-io-uring`.
+ *
+ * The requests are submitted in batches: they are flushed to the kernel by the
+ * core when it schedules and has `csp_io_batch` pending requests, has done
+ * `csp_io_batch` rounds since the first pending one, or is going to be idle.
+ *
+ * All the functions return what their syscall counterparts return, i.e. `-1`
+ * with `errno` set on failure.
+ */
+
+#define csp_io_batch              16
+
+/* `csp_io_fixed_file(idx)` refers to the `idx`th file registered with
+ * `csp_io_register_files`, it can be passed as the `fd` of the functions. */
+#define csp_io_fixed_file_flag    (1 << 30)
+#define csp_io_fixed_file(idx)    ((idx) | csp_io_fixed_file_flag)
+
+ssize_t csp_io_read(int fd, void *buf, size_t n);
+ssize_t csp_io_write(int fd, const void *buf, size_t n);
+int csp_io_accept(int fd, struct sockaddr *addr, socklen_t *addrlen);
+int csp_io_connect(int fd, const struct sockaddr *addr, socklen_t addrlen);
+
+/* Read and write with the `buf_idx`th buffer registered with
+ * `csp_io_register_buffers`, `buf` must be in the range of it. */
+ssize_t csp_io_read_fixed(int fd, void *buf, size_t n, int buf_idx);
+ssize_t csp_io_write_fixed(int fd, const void *buf, size_t n, int buf_idx);
+
+/* Register buffers or files to the io_uring instances of all cores. They can
+ * be registered only once. */
+bool csp_io_register_buffers(const struct iovec *iovs, unsigned n);
+bool csp_io_register_files(const int *fds, unsigned n);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
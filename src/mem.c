@@ -18,12 +18,16 @@
 #include <stdint.h>
 #include <string.h>
 #include <strings.h>
+#include <unistd.h>
+#include <linux/mempolicy.h>
 #include <sys/mman.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include "common.h"
 #include "core.h"
 #include "rbq.h"
 #include "rbtree.h"
+#include "stats.h"
 
 /*
  * mem.c implements a virtual memory manager.
@@ -45,6 +49,21 @@
  * +-----------------------------------------------------------+
  * | reversed:16 | user:1 | cpu_id:11 | l1:8 | l2:16 | page:12 |
  * +-----------------------------------------------------------+
+ *
+ * The objects smaller than a page, e.g. the processes with tiny stacks, are
+ * allocated from slabs in front of the pages. A slab is a page split into the
+ * objects of one size class after a header, and every heap keeps a list of the
+ * slabs having free objects for each class. So the common case is popping a
+ * free list, and a slab object is told from a span by not being page aligned.
+ *
+ * The free spans are indexed by their numbers of pages in a red-black tree, or
+ * with `csp_with_mem_bitmap` in segregated lists with a two-level bitmap. The
+ * bitmap takes a fixed 12KB per heap instead of the tree nodes and the node
+ * caches, and finds the best fit with two `tzcnt`s instead of a tree walk.
+ *
+ * The arenas are never unmapped, but an idle core returns its free pages
+ * beyond `csp_mem_retain` bytes to the OS with `madvise`, the spans which have
+ * stayed free longest first.
  */
 
 #define csp_mem_heap_size_exp     36
@@ -78,6 +97,8 @@
       PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_FIXED, -1, 0         \
     );                                                                         \
   } while (arena_ == MAP_FAILED);                                              \
+  csp_mem_arena_bind(heap, arena_);                                            \
+  csp_mem_arena_advise(arena_);                                                \
                                                                                \
   int32_t l1_ = csp_mem_meta_l1_by_addr(heap, arena_);                         \
   if ((heap)->metas[l1_] == NULL && !csp_mem_heap_init_l1(heap, l1_)) {        \
@@ -99,9 +120,54 @@
   arena_;                                                                      \
 })                                                                             \
 
+/* The arenas are aligned to their sizes, so every 2MB in them can be backed
+ * by a transparent huge page, which cuts the TLB misses when switching among
+ * lots of processes. The pages returned by the scavenger split the huge pages
+ * they are in, and `khugepaged` may collapse them back later. */
+#ifdef csp_with_hugepages
+#define csp_mem_arena_advise(arena)                                            \
+  madvise((arena), csp_mem_arena_size, MADV_HUGEPAGE)
+#else
+#define csp_mem_arena_advise(arena)
+#endif
+
+/* Prefer the NUMA node of the heap for the pages of the arena which are not
+ * faulted in yet. It's only a hint so the failure is ignored, and we use
+ * `MPOL_PREFERRED` rather than `MPOL_BIND` so the allocation can fall back to
+ * other nodes instead of OOM when the node is exhausted. */
+#define csp_mem_arena_bind(heap, arena) do {                                   \
+  if ((heap)->node >= 0) {                                                     \
+    size_t bits_ = sizeof(unsigned long) * 8;                                  \
+    size_t len_ = (heap)->node / bits_ + 1;                                    \
+    unsigned long mask_[len_];                                                 \
+    memset(mask_, 0, sizeof(mask_));                                           \
+    mask_[(heap)->node / bits_] = 1UL << ((heap)->node % bits_);               \
+    syscall(SYS_mbind, arena, csp_mem_arena_size, MPOL_PREFERRED, mask_,       \
+      len_ * bits_ + 1, 0                                                      \
+    );                                                                         \
+  }                                                                            \
+} while (0)
+
 #define csp_mem_page_size_exp      12
 #define csp_mem_page_size          (1 << csp_mem_page_size_exp)
 
+#define csp_mem_slab_header_size   64
+#define csp_mem_slab_nclasses      8
+#define csp_mem_slab_max_size      1984
+#define csp_mem_slab_nobjs(cls)                                                \
+  ((csp_mem_page_size - csp_mem_slab_header_size) / csp_mem_slab_sizes[cls])
+#define csp_mem_slab_by_obj(obj)                                               \
+  ((csp_mem_slab_t *)((uintptr_t)(obj) & ~(uintptr_t)(csp_mem_page_size - 1)))
+
+#define csp_mem_batch_cap          16
+
+/* The states of a free span. The pages of a released span are given back to
+ * the OS, an old span has stayed free across a scavenging and a young one is
+ * freed after it. Joining spans makes the youngest state of them. */
+#define csp_mem_span_released      0
+#define csp_mem_span_old           1
+#define csp_mem_span_young         2
+
 #define csp_mem_meta_l1_num_exp    8
 #define csp_mem_meta_l1_num        (1 << csp_mem_meta_l1_num_exp)
 #define csp_mem_meta_l1_size       (csp_mem_heap_size / csp_mem_meta_l1_num)
@@ -179,11 +245,15 @@
 #define csp_mem_span_is_free(heap, span)                                       \
   (((span) != NULL) && !csp_mem_meta_taken_bit_by_index((heap), (span)->index))
 #define csp_mem_span_remove(heap, span, total) ({                              \
-  int npages_ = csp_mem_span_npages_get(span);                                 \
-  csp_rbtree_node_t *node_ = csp_mem_tree_node_get(heap, npages_);             \
-  (total) += npages_;                                                          \
-  csp_mem_tree_node_del_span(heap, node_, span);                               \
-})                                                                             \
+  (total) += csp_mem_span_npages_get(span);                                    \
+  csp_mem_free_del(heap, span);                                                \
+})
+/* The released spans are only joined with the released ones, so that the
+ * resident pages are counted exactly. */
+#define csp_mem_span_is_joinable(heap, span, other)                            \
+  (csp_mem_span_is_free(heap, span) &&                                         \
+   ((span)->state == csp_mem_span_released) ==                                 \
+   ((other)->state == csp_mem_span_released))                                  \
 
 #define csp_mem_meta_index_set(index, value) do {                              \
   (index)[0] = (value)[0];                                                     \
@@ -201,6 +271,19 @@
 #define csp_mem_meta_index_is_zero(index)                                      \
   (!((index)[0] | (index)[1] | (index)[2]))
 
+/*
+ * The index of the free spans. Both the implementations provide,
+ *
+ *  - `csp_mem_free_get_gte(heap, npages)`: a free span of the fewest pages not
+ *    less than `npages`, or NULL if there is none.
+ *  - `csp_mem_free_head(heap, npages)`: the first free span of `npages`.
+ *  - `csp_mem_free_put(heap, span, npages)`: index the free span.
+ *  - `csp_mem_free_del(heap, span)`: unindex the span and return the next one
+ *    of the same size.
+ *  - `csp_mem_free_last(heap)` and `csp_mem_free_prev(heap, npages)`: the
+ *    sizes having free spans from the largest down, 0 means there is no more.
+ */
+#ifndef csp_with_mem_bitmap
 #define csp_mem_tree_node_num (csp_mem_arena_size / csp_mem_page_size)
 #define csp_mem_tree_node_cache_get(heap, npages) ((heap)->cache_nodes[npages])
 #define csp_mem_tree_node_cache_set(heap, npages, node)                        \
@@ -254,10 +337,146 @@
     }                                                                          \
   }                                                                            \
   next_;                                                                       \
-})                                                                             \
+})
+#define csp_mem_free_init(heap) ({                                             \
+  memset((heap)->cache_nodes, 0, sizeof((heap)->cache_nodes));                 \
+  (heap)->tree = csp_rbtree_new();                                             \
+  (heap)->tree != NULL;                                                        \
+})
+#define csp_mem_free_destroy(heap)                                             \
+  csp_rbtree_destroy((heap)->tree, (heap)->all_nodes)
+#define csp_mem_free_value(node) ({                                            \
+  csp_rbtree_node_t *vnode_ = (node);                                          \
+  vnode_ == NULL ? NULL : (csp_mem_span_t *)vnode_->value;                     \
+})
+#define csp_mem_free_key(node) ({                                              \
+  csp_rbtree_node_t *knode_ = (node);                                          \
+  knode_ == NULL ? 0 : knode_->key;                                            \
+})
+#define csp_mem_free_get_gte(heap, npages)                                     \
+  csp_mem_free_value(csp_mem_tree_node_get_gte(heap, npages))
+#define csp_mem_free_head(heap, npages)                                        \
+  csp_mem_free_value(csp_mem_tree_node_get(heap, npages))
+#define csp_mem_free_put(heap, span, npages) do {                              \
+  csp_rbtree_node_t *pnode_ = csp_rbtree_insert((heap)->tree, (npages));       \
+  csp_mem_tree_node_put_span(heap, pnode_, span);                              \
+} while (0)
+#define csp_mem_free_del(heap, span) ({                                        \
+  csp_rbtree_node_t *dnode_ = csp_mem_tree_node_get(                           \
+    heap, csp_mem_span_npages_get(span)                                        \
+  );                                                                           \
+  csp_mem_tree_node_del_span(heap, dnode_, span);                              \
+})
+#define csp_mem_free_last(heap)                                                \
+  csp_mem_free_key(csp_rbtree_find_lte((heap)->tree, INT_MAX))
+#define csp_mem_free_prev(heap, npages)                                        \
+  csp_mem_free_key(csp_rbtree_find_lte((heap)->tree, (npages) - 1))
+#else
+/*
+ * The free spans of `n` pages are linked from `free_heads[n - 1]`, and the bit
+ * `n - 1` of `free_l2` is set iff the list is not empty. A bit of `free_l1` is
+ * set iff any of the 64 bits it covers in `free_l2` is set.
+ */
+#define csp_mem_free_nwords       (csp_mem_arena_npages / 64)
+#define csp_mem_free_bit_set(heap, i) do {                                     \
+  (heap)->free_l2[(i) >> 6] |= 1ULL << ((i) & 63);                             \
+  (heap)->free_l1 |= 1ULL << ((i) >> 6);                                       \
+} while (0)
+#define csp_mem_free_bit_clear(heap, i) do {                                   \
+  if (((heap)->free_l2[(i) >> 6] &= ~(1ULL << ((i) & 63))) == 0) {             \
+    (heap)->free_l1 &= ~(1ULL << ((i) >> 6));                                  \
+  }                                                                            \
+} while (0)
+/* The smallest set bit not less than `from`, or -1. */
+#define csp_mem_free_bit_find(heap, from) ({                                   \
+  int w_ = (from) >> 6, i_ = -1;                                               \
+  uint64_t m_ = (heap)->free_l2[w_] & (~0ULL << ((from) & 63));                \
+  if (m_ == 0) {                                                               \
+    uint64_t l1_ = w_ == csp_mem_free_nwords - 1 ? 0 :                         \
+      (heap)->free_l1 & (~0ULL << (w_ + 1));                                   \
+    if (l1_ != 0) {                                                            \
+      w_ = __builtin_ctzll(l1_);                                               \
+      m_ = (heap)->free_l2[w_];                                                \
+    }                                                                          \
+  }                                                                            \
+  if (m_ != 0) {                                                               \
+    i_ = (w_ << 6) | __builtin_ctzll(m_);                                      \
+  }                                                                            \
+  i_;                                                                          \
+})
+/* The largest set bit less than `to`, or -1. */
+#define csp_mem_free_bit_rfind(heap, to) ({                                    \
+  int i_ = -1;                                                                 \
+  if ((to) > 0) {                                                              \
+    int w_ = ((to) - 1) >> 6;                                                  \
+    uint64_t m_ = (heap)->free_l2[w_] & (~0ULL >> (63 - (((to) - 1) & 63)));   \
+    if (m_ == 0) {                                                             \
+      uint64_t l1_ = (heap)->free_l1 & ((1ULL << w_) - 1);                     \
+      if (l1_ != 0) {                                                          \
+        w_ = 63 - __builtin_clzll(l1_);                                        \
+        m_ = (heap)->free_l2[w_];                                              \
+      }                                                                        \
+    }                                                                          \
+    if (m_ != 0) {                                                             \
+      i_ = (w_ << 6) | (63 - __builtin_clzll(m_));                             \
+    }                                                                          \
+  }                                                                            \
+  i_;                                                                          \
+})
+#define csp_mem_free_init(heap) ({                                             \
+  memset((heap)->free_heads, 0, sizeof((heap)->free_heads));                   \
+  memset((heap)->free_l2, 0, sizeof((heap)->free_l2));                         \
+  (heap)->free_l1 = 0;                                                         \
+  true;                                                                        \
+})
+#define csp_mem_free_destroy(heap)
+#define csp_mem_free_get_gte(heap, npages) ({                                  \
+  int i_ = csp_mem_free_bit_find(heap, (npages) - 1);                          \
+  i_ < 0 ? NULL : csp_mem_meta_span_by_index(heap, (heap)->free_heads[i_]);    \
+})
+#define csp_mem_free_head(heap, npages)                                        \
+  csp_mem_meta_span_by_index(heap, (heap)->free_heads[(npages) - 1])
+#define csp_mem_free_put(heap, span, npages) do {                              \
+  uint8_t *head_ = (heap)->free_heads[(npages) - 1];                           \
+  csp_mem_span_t *next_ = csp_mem_meta_span_by_index(heap, head_);             \
+  if (next_ != NULL) {                                                         \
+    csp_mem_meta_index_set((span)->fp_next, next_->index);                     \
+    csp_mem_meta_index_set(next_->fp_pre, (span)->index);                      \
+  } else {                                                                     \
+    csp_mem_meta_index_set_zero((span)->fp_next);                              \
+    csp_mem_free_bit_set(heap, (npages) - 1);                                  \
+  }                                                                            \
+  csp_mem_meta_index_set(head_, (span)->index);                                \
+} while (0)
+#define csp_mem_free_del(heap, span) ({                                        \
+  int i_ = csp_mem_span_npages_get(span) - 1;                                  \
+  csp_mem_span_t                                                               \
+    *pre_ = csp_mem_meta_span_by_index(heap, (span)->fp_pre),                  \
+    *next_ = csp_mem_meta_span_by_index(heap, (span)->fp_next);                \
+  uint8_t *link_ = pre_ != NULL ? pre_->fp_next : (heap)->free_heads[i_];      \
+  if (next_ != NULL) {                                                         \
+    csp_mem_meta_index_set(link_, next_->index);                               \
+    csp_mem_meta_index_set(next_->fp_pre, (span)->fp_pre);                     \
+  } else {                                                                     \
+    csp_mem_meta_index_set_zero(link_);                                        \
+    if (pre_ == NULL) {                                                        \
+      csp_mem_free_bit_clear(heap, i_);                                        \
+    }                                                                          \
+  }                                                                            \
+  csp_mem_meta_index_set_zero((span)->fp_pre);                                 \
+  csp_mem_meta_index_set_zero((span)->fp_next);                                \
+  next_;                                                                       \
+})
+#define csp_mem_free_last(heap)                                                \
+  (csp_mem_free_bit_rfind(heap, csp_mem_arena_npages) + 1)
+#define csp_mem_free_prev(heap, npages)                                        \
+  (csp_mem_free_bit_rfind(heap, (npages) - 1) + 1)
+#endif
 
 extern int csp_sched_np;
 extern _Thread_local csp_core_t *csp_this_core;
+extern int csp_core_pools_node(size_t pid);
+extern size_t csp_mem_retain;
 
 csp_msrbq_declare(uintptr_t, obj);
 csp_msrbq_define(uintptr_t, obj);
@@ -265,7 +484,7 @@ csp_msrbq_define(uintptr_t, obj);
 typedef uint8_t csp_mem_meta_index_t[3];
 
 typedef struct {
-  uint8_t npages[3];
+  uint8_t npages[3], state;
   csp_mem_meta_index_t index, mt_pre, mt_next, fp_pre, fp_next;
 } csp_mem_span_t;
 
@@ -274,6 +493,33 @@ typedef struct {
   uint8_t taken_bits[csp_mem_meta_l2_num / sizeof(uint8_t)];
 } csp_mem_meta_t;
 
+/* The sizes are multiples of 64 so that the objects are cache line aligned,
+ * which keeps the `csp_proc_t` at the top of a process in one cache line, and
+ * they are chosen to fill a page with as little waste as possible. */
+static const uint32_t csp_mem_slab_sizes[csp_mem_slab_nclasses] = {
+  256, 320, 448, 576, 640, 960, 1344, 1984
+};
+
+/* The header at the beginning of a slab page. */
+typedef struct csp_mem_slab_t {
+  /* Link the slabs having free objects of the same class. */
+  struct csp_mem_slab_t *pre, *next;
+
+  /* The freed objects, each of which stores the next one in its first word. */
+  void *free;
+
+  /* `ncarved` objects have been carved, the others are never touched. */
+  uint32_t cls, nfree, ncarved;
+} csp_mem_slab_t;
+
+/* The objects freed to the heap of another core, which are pushed to its
+ * mailbox of `l1` together once the batch is full or the core is idle. */
+typedef struct {
+  int l1;
+  size_t len;
+  uintptr_t objs[csp_mem_batch_cap];
+} csp_mem_batch_t;
+
 typedef struct csp_mem_arena_link_t {
   void *addr;
   struct csp_mem_arena_link_t *next;
@@ -283,9 +529,15 @@ typedef struct {
   /* The range of heap memory space is [start, end). */
   uintptr_t start, end;
 
+  /* The NUMA node the arenas are bound to, -1 means no binding. */
+  int node;
+
   /* The pointer approaching to the end. */
   uintptr_t curr;
 
+  /* The number of free pages which are not released to the OS. */
+  size_t nresident;
+
   /* Store the mmapped arenas. */
   csp_mem_arena_link_t *arenas;
 
@@ -295,6 +547,13 @@ typedef struct {
   /* Store the objects returned from other cores. */
   csp_msrbq_t(obj) *mailboxes[csp_mem_meta_l1_num];
 
+  /* The objects this core frees to the other heaps, indexed by their pids. */
+  csp_mem_batch_t *batches;
+
+  /* The slabs having free objects of each class. */
+  csp_mem_slab_t *slabs[csp_mem_slab_nclasses];
+
+#ifndef csp_with_mem_bitmap
   /* Store free pages. The key is the pages number and the value is the free
    * span list */
   csp_rbtree_t *tree;
@@ -304,25 +563,38 @@ typedef struct {
 
   /* Store all nodes in the red-black tree temporarily. */
   csp_rbtree_node_t *all_nodes[csp_mem_tree_node_num];
-
-  /* Store all keys in the red-black tree temporarily. */
-  int all_keys[csp_mem_tree_node_num];
+#else
+  /* The free span lists of every number of pages and their bitmaps. */
+  csp_mem_meta_index_t free_heads[csp_mem_arena_npages];
+  uint64_t free_l1, free_l2[csp_mem_free_nwords];
+#endif
 } csp_mem_heap_t;
 
-static bool csp_mem_heap_init(csp_mem_heap_t *heap, uintptr_t start) {
+static bool csp_mem_heap_init(
+  csp_mem_heap_t *heap, uintptr_t start, int numa_node
+) {
   memset(heap->metas, 0, sizeof(heap->metas));
   memset(heap->mailboxes, 0, sizeof(heap->mailboxes));
-  memset(heap->cache_nodes, 0, sizeof(heap->cache_nodes));
+  memset(heap->slabs, 0, sizeof(heap->slabs));
 
   heap->arenas = NULL;
+  heap->nresident = 0;
 
-  heap->tree = csp_rbtree_new();
-  if (heap->tree == NULL) {
+  heap->batches = (csp_mem_batch_t *)calloc(
+    csp_sched_np, sizeof(csp_mem_batch_t)
+  );
+  if (heap->batches == NULL) {
+    return false;
+  }
+
+  if (!csp_mem_free_init(heap)) {
+    free(heap->batches);
     return false;
   }
 
   heap->start = start;
   heap->end = start + csp_mem_heap_size;
+  heap->node = numa_node;
 
   /* We will add `csp_mem_arena_size` to the `heap->curr` first and then mmap
    * memory from the OS in `csp_mem_arena_new`, so we need to subtract
@@ -339,51 +611,38 @@ static bool csp_mem_heap_init(csp_mem_heap_t *heap, uintptr_t start) {
     n--;
   }
 
-  csp_rbtree_node_t *node = csp_rbtree_insert(heap->tree, n);
   csp_mem_span_t *span = csp_mem_meta_span_by_addr(heap, mem);
   csp_mem_span_npages_set(span, n);
-  csp_mem_tree_node_put_span(heap, node, span);
+  span->state = csp_mem_span_released;
+  csp_mem_free_put(heap, span, n);
 
   return true;
 }
 
 /* Merge all adjacent spans. */
 static void csp_mem_heap_merge(csp_mem_heap_t *heap) {
-  csp_rbtree_node_t *node;
-
-  int n = csp_rbtree_all_nodes(heap->tree, heap->all_nodes);
-  for (int i = 0; i < n; i++) {
-    node = heap->all_nodes[i];
-    heap->all_keys[i] = node->key;
-    csp_mem_tree_node_cache_set(heap, node->key, node);
-  }
-
-  /* We merge the spans in the reversed order of node key(i.e. pages number)
-   * thus we won't try to merge the new merged span again. */
-  for (int i = n - 1; i >= 0; i--) {
-    node = csp_mem_tree_node_cache_get(heap, heap->all_keys[i]);
-
-    /* `NULL` means the node has beed deleted. */
-    if (node == NULL) {
-      continue;
-    }
-
-    csp_mem_span_t *span = (csp_mem_span_t *)node->value;
+  /* We merge the spans in the reversed order of pages number thus we won't
+   * try to merge the new merged span again. */
+  for (int key = csp_mem_free_last(heap); key > 0;
+      key = csp_mem_free_prev(heap, key)) {
+    csp_mem_span_t *span = csp_mem_free_head(heap, key);
     while (span != NULL) {
-      int total = 0;
+      int total = 0, state = span->state;
 
       csp_mem_span_t
         *pre = csp_mem_meta_span_by_index(heap, span->mt_pre),
         *next = csp_mem_meta_span_by_index(heap, span->mt_next),
         *start = span, *end = span;
 
-      while (csp_mem_span_is_free(heap, pre)) {
+      while (csp_mem_span_is_joinable(heap, pre, span)) {
+        state = pre->state > state ? pre->state : state;
         csp_mem_span_remove(heap, pre, total);
         start = pre;
         pre = csp_mem_meta_span_by_index(heap, pre->mt_pre);
       }
 
-      while (csp_mem_span_is_free(heap, next)) {
+      while (csp_mem_span_is_joinable(heap, next, span)) {
+        state = next->state > state ? next->state : state;
         csp_mem_span_remove(heap, next, total);
         end = next;
         next = csp_mem_meta_span_by_index(heap, next->mt_next);
@@ -396,9 +655,9 @@ static void csp_mem_heap_merge(csp_mem_heap_t *heap) {
 
       span = csp_mem_span_remove(heap, span, total);
 
-      node = csp_rbtree_insert(heap->tree, total);
       csp_mem_span_npages_set(start, total);
-      csp_mem_tree_node_put_span(heap, node, start);
+      start->state = state;
+      csp_mem_free_put(heap, start, total);
 
       if (next) {
         csp_mem_meta_index_set(start->mt_next, next->index);
@@ -417,10 +676,36 @@ static void csp_mem_heap_free(csp_mem_heap_t *heap, void *obj) {
   csp_mem_meta_taken_bit_clear(heap, l1, l2);
 
   csp_mem_span_t *curr = csp_mem_meta_span_by_l1l2(heap, l1, l2);
-  csp_rbtree_node_t *node = csp_rbtree_insert(
-    heap->tree, csp_mem_span_npages_get(curr)
-  );
-  csp_mem_tree_node_put_span(heap, node, curr);
+  int npages = csp_mem_span_npages_get(curr);
+  curr->state = csp_mem_span_young;
+  heap->nresident += npages;
+  csp_mem_free_put(heap, curr, npages);
+}
+
+static void csp_mem_heap_release(csp_mem_heap_t *heap, void *obj);
+
+/* Free the objects returned by other cores. It returns `true` if there is any
+ * object freed. */
+static bool csp_mem_heap_collect(csp_mem_heap_t *heap) {
+  bool is_freed = false;
+  for (int i = 0; i < csp_mem_meta_l1_num; i++) {
+    csp_msrbq_t(obj) *mailbox = heap->mailboxes[i];
+    if (mailbox == NULL) {
+      break;
+    }
+    size_t n;
+    uintptr_t objs[16];
+    while ((n = csp_msrbq_try_popm(obj)(mailbox, objs, 16)) > 0) {
+      is_freed = true;
+      for (size_t j = 0; j < n; j++) {
+        csp_mem_heap_release(heap, (void *)objs[j]);
+      }
+      if (n < 16) {
+        break;
+      }
+    }
+  }
+  return is_freed;
 }
 
 /* Allocate n pages from the heap. `size` is guaranteed to 4KB alignment.*/
@@ -433,45 +718,29 @@ static void *csp_mem_heap_alloc(csp_mem_heap_t *heap, size_t size) {
   void *result;
   int npages = size >> csp_mem_page_size_exp;
 
-  csp_rbtree_node_t *node = csp_mem_tree_node_get_gte(heap, npages);
-  if (node == NULL) {
+  csp_mem_span_t *span = csp_mem_free_get_gte(heap, npages);
+  if (span == NULL) {
     /* Try to collect free pages returned by other prcessors. */
-    bool is_freed = false;
-    for (int i = 0; i < csp_mem_meta_l1_num; i++) {
-      csp_msrbq_t(obj) *mailbox = heap->mailboxes[i];
-      if (mailbox == NULL) {
-        break;
-      }
-      size_t n;
-      uintptr_t objs[16];
-      while ((n = csp_msrbq_try_popm(obj)(mailbox, objs, 16)) > 0) {
-        is_freed = true;
-        for (size_t j = 0; j < n; j++) {
-          csp_mem_heap_free(heap, (void *)objs[j]);
-        }
-        if (n < 16) {
-          break;
-        }
-      }
-    }
-    if (is_freed) {
-      node = csp_mem_tree_node_get_gte(heap, npages);
+    if (csp_mem_heap_collect(heap)) {
+      span = csp_mem_free_get_gte(heap, npages);
     }
 
     /* Try to merge adjacent free spans. */
-    if (node == NULL && npages > 1) {
+    if (span == NULL && npages > 1) {
       csp_mem_heap_merge(heap);
-      node = csp_mem_tree_node_get_gte(heap, npages);
+      span = csp_mem_free_get_gte(heap, npages);
     }
   }
 
   /* Free pages found. */
-  if (node != NULL) {
-    int key = node->key;
-    csp_mem_span_t *span = (csp_mem_span_t *)node->value;
+  if (span != NULL) {
+    int key = csp_mem_span_npages_get(span);
 
     /* Delete it from the free list. */
-    csp_mem_tree_node_del_span(heap, node, span);
+    csp_mem_free_del(heap, span);
+    if (span->state != csp_mem_span_released) {
+      heap->nresident -= npages;
+    }
 
     int32_t l1 = csp_mem_meta_l1_by_index(span->index);
     int32_t l2 = csp_mem_meta_l2_by_index(span->index);
@@ -503,6 +772,7 @@ static void *csp_mem_heap_alloc(csp_mem_heap_t *heap, size_t size) {
       );
       csp_mem_span_npages_set(new_span, key - npages);
       csp_mem_meta_taken_bit_clear(heap, new_l1, new_l2);
+      new_span->state = span->state;
 
       /* Insert the new span to the metadata list. */
       csp_mem_span_t *next = csp_mem_meta_span_by_index(heap, span->mt_next);
@@ -514,8 +784,7 @@ static void *csp_mem_heap_alloc(csp_mem_heap_t *heap, size_t size) {
       }
 
       /* Insert the new span to the free pages list. */
-      node = csp_rbtree_insert(heap->tree, key - npages);
-      csp_mem_tree_node_put_span(heap, node, new_span);
+      csp_mem_free_put(heap, new_span, key - npages);
     }
 
     return result;
@@ -527,7 +796,7 @@ static void *csp_mem_heap_alloc(csp_mem_heap_t *heap, size_t size) {
   /* Initialize the span. */
   int32_t l1 = csp_mem_meta_l1_by_addr(heap, result);
   int32_t l2 = csp_mem_meta_l2_by_addr(heap, result);
-  csp_mem_span_t *span = csp_mem_meta_span_by_l1l2(heap, l1, l2);
+  span = csp_mem_meta_span_by_l1l2(heap, l1, l2);
   csp_mem_span_npages_set(span, npages);
   csp_mem_meta_taken_bit_set(heap, l1, l2);
 
@@ -536,19 +805,142 @@ static void *csp_mem_heap_alloc(csp_mem_heap_t *heap, size_t size) {
     uintptr_t addr = (uintptr_t)result + size;
     csp_mem_span_t *new_span = csp_mem_meta_span_by_addr(heap, addr);
     csp_mem_span_npages_set(new_span, csp_mem_arena_npages - npages);
+    new_span->state = csp_mem_span_released;
 
     /* Link the two parts in metadata list. */
     csp_mem_meta_index_set(span->mt_next, new_span->index);
     csp_mem_meta_index_set(new_span->mt_pre, span->index);
 
     /* Put to the free pages list. */
-    node = csp_rbtree_insert(heap->tree, csp_mem_arena_npages - npages);
-    csp_mem_tree_node_put_span(heap, node, new_span);
+    csp_mem_free_put(heap, new_span, csp_mem_arena_npages - npages);
   }
 
   return result;
 }
 
+static void csp_mem_slab_link(csp_mem_heap_t *heap, csp_mem_slab_t *slab) {
+  csp_mem_slab_t *head = heap->slabs[slab->cls];
+  slab->pre = NULL;
+  slab->next = head;
+  if (head != NULL) {
+    head->pre = slab;
+  }
+  heap->slabs[slab->cls] = slab;
+}
+
+static void csp_mem_slab_unlink(csp_mem_heap_t *heap, csp_mem_slab_t *slab) {
+  if (slab->pre != NULL) {
+    slab->pre->next = slab->next;
+  } else {
+    heap->slabs[slab->cls] = slab->next;
+  }
+  if (slab->next != NULL) {
+    slab->next->pre = slab->pre;
+  }
+  slab->pre = slab->next = NULL;
+}
+
+/* Allocate an object of class `cls` from the slabs of the heap. */
+static void *csp_mem_slab_alloc(csp_mem_heap_t *heap, int cls) {
+  csp_mem_slab_t *slab = heap->slabs[cls];
+  if (csp_unlikely(slab == NULL)) {
+    /* The objects returned by other cores may refill the slabs. */
+    if (!csp_mem_heap_collect(heap) || (slab = heap->slabs[cls]) == NULL) {
+      slab = (csp_mem_slab_t *)csp_mem_heap_alloc(heap, csp_mem_page_size);
+      if (csp_unlikely(slab == NULL)) {
+        return NULL;
+      }
+      slab->cls = cls;
+      slab->free = NULL;
+      slab->nfree = csp_mem_slab_nobjs(cls);
+      slab->ncarved = 0;
+      csp_mem_slab_link(heap, slab);
+    }
+  }
+
+  void *obj = slab->free;
+  if (obj != NULL) {
+    slab->free = *(void **)obj;
+  } else {
+    obj = (void *)((uintptr_t)slab + csp_mem_slab_header_size +
+      (uintptr_t)slab->ncarved++ * csp_mem_slab_sizes[cls]);
+  }
+
+  /* The full slab leaves the list until one of its objects is freed. */
+  if (--slab->nfree == 0) {
+    csp_mem_slab_unlink(heap, slab);
+  }
+  return obj;
+}
+
+/* Free an object to its slab. The slab is given back to the heap if all its
+ * objects are freed, unless it's the only one of its class. */
+static void csp_mem_slab_free(csp_mem_heap_t *heap, void *obj) {
+  csp_mem_slab_t *slab = csp_mem_slab_by_obj(obj);
+  *(void **)obj = slab->free;
+  slab->free = obj;
+
+  if (slab->nfree++ == 0) {
+    csp_mem_slab_link(heap, slab);
+  } else if (slab->nfree == csp_mem_slab_nobjs(slab->cls) &&
+      (slab->pre != NULL || slab->next != NULL)) {
+    csp_mem_slab_unlink(heap, slab);
+    csp_mem_heap_free(heap, slab);
+  }
+}
+
+/* Free an object which is either a slab object or a span. */
+static void csp_mem_heap_release(csp_mem_heap_t *heap, void *obj) {
+  if ((uintptr_t)obj & (csp_mem_page_size - 1)) {
+    csp_mem_slab_free(heap, obj);
+  } else {
+    csp_mem_heap_free(heap, obj);
+  }
+}
+
+/* Give the free pages beyond `csp_mem_retain` back to the OS. The old spans
+ * are released before the young ones and the large spans before the small
+ * ones. It goes down to 3/4 of the target so that a heap hovering around the
+ * target doesn't scavenge on every idle. The survivors get old afterwards. */
+static void csp_mem_heap_scavenge(csp_mem_heap_t *heap) {
+  size_t target = (csp_mem_retain >> csp_mem_page_size_exp) / 4 * 3;
+
+  for (int state = csp_mem_span_old; state <= csp_mem_span_young; state++) {
+    for (int key = csp_mem_free_last(heap);
+        key > 0 && heap->nresident > target;
+        key = csp_mem_free_prev(heap, key)) {
+      csp_mem_span_t *span = csp_mem_free_head(heap, key);
+      for (; span != NULL && heap->nresident > target;
+          span = csp_mem_meta_span_by_index(heap, span->fp_next)) {
+        if (span->state != state) {
+          continue;
+        }
+        int32_t l1 = csp_mem_meta_l1_by_index(span->index);
+        int32_t l2 = csp_mem_meta_l2_by_index(span->index);
+        int npages = csp_mem_span_npages_get(span);
+
+        /* The pages will be zero-filled when they are touched again. */
+        madvise((void *)csp_mem_meta_l1l2_to_addr(heap, l1, l2),
+          (size_t)npages << csp_mem_page_size_exp, MADV_DONTNEED
+        );
+        span->state = csp_mem_span_released;
+        heap->nresident -= npages;
+      }
+    }
+  }
+
+  for (int key = csp_mem_free_last(heap); key > 0;
+      key = csp_mem_free_prev(heap, key)) {
+    csp_mem_span_t *span = csp_mem_free_head(heap, key);
+    for (; span != NULL;
+        span = csp_mem_meta_span_by_index(heap, span->fp_next)) {
+      if (span->state == csp_mem_span_young) {
+        span->state = csp_mem_span_old;
+      }
+    }
+  }
+}
+
 static void csp_mem_heap_destroy(csp_mem_heap_t *heap) {
   for (int i = 0; i < csp_mem_meta_l1_num; i++) {
     csp_mem_heap_destroy_l1(heap, i);
@@ -562,7 +954,8 @@ static void csp_mem_heap_destroy(csp_mem_heap_t *heap) {
     link = next;
   }
 
-  csp_rbtree_destroy(heap->tree, heap->all_nodes);
+  csp_mem_free_destroy(heap);
+  free(heap->batches);
 }
 
 static struct { size_t len; csp_mem_heap_t *heaps; } csp_mem;
@@ -577,7 +970,8 @@ bool csp_mem_init(void) {
 
   for (int i = 0; i < csp_sched_np; i++) {
     uintptr_t start = (uintptr_t)(i + 1) << csp_mem_heap_size_exp;
-    if (!csp_mem_heap_init(&csp_mem.heaps[i], start)) {
+    int node = csp_core_pools_node(i);
+    if (!csp_mem_heap_init(&csp_mem.heaps[i], start, node)) {
       csp_mem.len = i;
       return false;
     }
@@ -588,11 +982,31 @@ bool csp_mem_init(void) {
 }
 
 void *csp_mem_alloc(size_t pid, size_t size) {
-  return csp_mem_heap_alloc(&csp_mem.heaps[pid], size);
+  csp_mem_heap_t *heap = &csp_mem.heaps[pid];
+  if (size <= csp_mem_slab_max_size) {
+    int cls = 0;
+    while (csp_mem_slab_sizes[cls] < size) {
+      cls++;
+    }
+    return csp_mem_slab_alloc(heap, cls);
+  }
+
+  size_t page_mask = csp_mem_page_size - 1;
+  return csp_mem_heap_alloc(heap, (size + page_mask) & ~page_mask);
+}
+
+/* Push the batched objects to the mailbox of their heap. */
+static void csp_mem_batch_flush(csp_mem_heap_t *heap, csp_mem_batch_t *batch) {
+  if (batch->len > 0) {
+    csp_msrbq_pushm(obj)(heap->mailboxes[batch->l1], batch->objs, batch->len);
+    csp_stats_incr(&csp_this_core->stats, mem_mailbox_pushes);
+    batch->len = 0;
+  }
 }
 
 void csp_mem_free(size_t pid, void *obj) {
   csp_mem_heap_t *heap = &csp_mem.heaps[pid];
+  int l1 = csp_mem_meta_l1_by_addr(heap, obj);
 
   /*
    * The condition check `csp_this_core == NULL` matters here cause it may be
@@ -606,14 +1020,65 @@ void csp_mem_free(size_t pid, void *obj) {
    *  csp_timer_cancel()
    *  csp_proc_destroy()
    *  csp_mem_free()
+   *
+   * The monitor has no batches since nobody flushes them when it sleeps.
    */
-  if (csp_this_core == NULL || csp_this_core->pid != pid) {
-    csp_msrbq_push(obj)(
-      heap->mailboxes[csp_mem_meta_l1_by_addr(heap, obj)], (uintptr_t)obj
-    );
-  } else {
-    csp_mem_heap_free(heap, obj);
+  if (csp_this_core == NULL) {
+    csp_msrbq_push(obj)(heap->mailboxes[l1], (uintptr_t)obj);
+    csp_stats_shared_add(mem_mailbox_pushes, 1);
+    return;
+  }
+
+  size_t this_pid = csp_this_core->pid;
+  if (this_pid == pid) {
+    csp_mem_heap_release(heap, obj);
+    return;
+  }
+
+  /* Batch the objects to the other heaps so the mailbox is contended once
+   * per `csp_mem_batch_cap` objects instead of per object. */
+  csp_mem_batch_t *batch = &csp_mem.heaps[this_pid].batches[pid];
+  if (batch->len > 0 && batch->l1 != l1) {
+    csp_mem_batch_flush(heap, batch);
+  }
+  batch->l1 = l1;
+  batch->objs[batch->len++] = (uintptr_t)obj;
+  if (batch->len == csp_mem_batch_cap) {
+    csp_mem_batch_flush(heap, batch);
+  }
+}
+
+/* Called by the core `pid` when it runs out of processes. It hands the
+ * batched objects over to their heaps and takes the objects returned to its
+ * own heap, so that no memory gets stuck while the cores are idle. Then it
+ * returns the free pages to the OS if there are more than `csp_mem_retain`
+ * bytes of them, so the RSS shrinks back after a spike. */
+void csp_mem_idle(size_t pid) {
+  csp_mem_heap_t *heap = &csp_mem.heaps[pid];
+  for (int i = 0; i < csp_mem.len; i++) {
+    csp_mem_batch_flush(&csp_mem.heaps[i], &heap->batches[i]);
+  }
+  csp_mem_heap_collect(heap);
+
+  if (heap->nresident > csp_mem_retain >> csp_mem_page_size_exp) {
+    csp_mem_heap_scavenge(heap);
+  }
+}
+
+/* Return how many objects are waiting in the mailboxes of the heap `pid`. It
+ * can be called from any thread and the result is only a snapshot. */
+size_t csp_mem_mailbox_len(size_t pid) {
+  csp_mem_heap_t *heap = &csp_mem.heaps[pid];
+  size_t len = 0;
+  for (int i = 0; i < csp_mem_meta_l1_num; i++) {
+    csp_msrbq_t(obj) *mailbox = heap->mailboxes[i];
+    if (mailbox == NULL) {
+      break;
+    }
+    len += csp_rbq_mptr_next_get(mailbox->fast) -
+      csp_rbq_sptr_barr_get(mailbox->slow);
   }
+  return len;
 }
 
 void csp_mem_destroy(void) {
@@ -15,49 +15,151 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <errno.h>
+#include <poll.h>
 #include <pthread.h>
 #include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
 #include <unistd.h>
 #include "core.h"
 #include "corepool.h"
 #include "netpoll.h"
 #include "proc.h"
-#include "rand.h"
+#include "stats.h"
 #include "timer.h"
+#include "trace.h"
 
-/* 10ms */
-#define csp_monitor_max_sleep_microsecs 10000
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
 
-/* Libcsp can support at most 2048 cores. */
-#define csp_monitor_cores_len 2048
+/* A poller sleeps 1us at first and doubles it up to 10ms while some of its
+ * cores are running processes, so they are still preempted or handed off in
+ * time. Otherwise it sleeps until the next timer's deadline. */
+#define csp_monitor_min_sleep         csp_timer_microsecond
+#define csp_monitor_max_sleep         (10 * csp_timer_millisecond)
 
-/* The length of csp_monitor_procs. */
-#define csp_monitor_procs_len 16
+/* The max number of processes pushed to a core in one batch. */
+#define csp_monitor_batch_len 16
 
-/* Put the porcesses in the link list to the array and return the number of
- * processes put. */
-#define csp_monitor_procs_put_list(start, max_len) ({                          \
-  size_t num = 0;                                                              \
-  csp_proc_t *next;                                                            \
-  while ((start) != NULL && num < max_len) {                                   \
-    csp_monitor_procs[num++] = (start);                                        \
-    next = (start)->next;                                                      \
-    (start)->next = (start)->pre = NULL;                                       \
-    (start) = next;                                                            \
-  }                                                                            \
-  num;                                                                         \
-})                                                                             \
-
-csp_mmrbq_declare(csp_core_t *, core);
+/* A core which hasn't picked another process for 1ms is checked whether it's
+ * stuck in a system call. */
+#define csp_monitor_syscall_threshold csp_timer_millisecond
 
 extern int csp_sched_np;
-extern csp_mmrbq_t(core) *csp_sched_starving_threads, *csp_sched_starving_procs;
-extern int csp_netpoll_poll(csp_proc_t **start, csp_proc_t **end);
-extern int csp_timer_poll(csp_proc_t **start, csp_proc_t **end);
+extern _Thread_local csp_core_t *csp_this_core;
+extern bool csp_core_pools_idle_wakeup(size_t pid);
+extern int csp_core_pools_node(size_t pid);
+extern int csp_netpoll_poll(size_t pid, csp_proc_t **start, csp_proc_t **end);
+extern int csp_timer_poll_core(size_t pid, csp_proc_t **start,
+    csp_proc_t **end);
+extern void csp_timer_coarse_update(void);
+extern csp_timer_time_t csp_timer_next_core(size_t pid);
+extern bool csp_timer_pending_core(size_t pid);
+extern void csp_core_preempt(csp_core_t *core);
+extern void csp_core_handoff(csp_core_t *core, uint64_t nsched);
+extern size_t csp_time_slice;
+extern bool csp_cpus_pin_monitor(pthread_attr_t *attr);
+
+#ifdef csp_with_io_uring
+extern int csp_io_poll(size_t pid, csp_proc_t **start, csp_proc_t **end);
+#endif
+
+/* Whether the current thread is a poller of the monitor. */
+_Thread_local bool csp_monitor_self;
+
+/*
+ * The duties of the monitor are split among the pollers, one thread for each
+ * group of cores. By default every NUMA node is a group, or the cores are split
+ * evenly into `CSP_POLLERS` groups, the ones in the same node together. A
+ * poller polls the netpoll instances, the io_uring rings and the timer queues
+ * of its cores, and preempts or hands them off. The idle cores also expire
+ * their own timers, see `csp_sched_timers`.
+ */
+typedef struct __attribute__((aligned(64))) {
+  /* The time until which the poller sleeps, 0 if it's awake. */
+  atomic_int_fast64_t wake_at;
+
+  /* The pids of its cores. */
+  int npids, *pids;
+
+  /* The fds whose readiness wakes up the poller, e.g. the epoll instances.
+   * The first one is the eventfd written by `csp_monitor_wakeup`. */
+  int nfds;
+  struct pollfd *fds;
+} csp_monitor_shard_t;
+
+static struct {
+  int len;
+  csp_monitor_shard_t *shards;
+
+  /* The shard of every core, indexed by pid. */
+  int *of;
+} csp_monitor_shards;
+
+/* The fds watched by the poller of core `pid`, see `csp_monitor_watch`. */
+typedef struct { size_t pid; int fd; } csp_monitor_watched_t;
+
+static struct { int len; csp_monitor_watched_t *fds; } csp_monitor_watched;
+
+/* The woken processes waiting to be pushed to core `pid`. */
+typedef struct {
+  size_t len;
+  csp_proc_t *procs[csp_monitor_batch_len];
+} csp_monitor_batch_t;
+
+/* The monitor and the netpoll thread push processes with their own batches,
+ * one for each core. */
+static _Thread_local csp_monitor_batch_t *csp_monitor_batches;
+
+/* Push the batch to the grunq of core `pid`. If it's full, i.e. the core is
+ * saturated, the batch overflows to the nearest cores, and spills to the grunq
+ * of `pid` if all of them are full, so the monitor never stalls. The nearest
+ * idle core, which is `pid` itself if it's idle, is woken up to run them. */
+static void csp_monitor_batch_flush(int pid) {
+  csp_monitor_batch_t *batch = &csp_monitor_batches[pid];
+  if (batch->len == 0) {
+    return;
+  }
 
-static csp_rand_t csp_monitor_rand;
-static csp_proc_t *csp_monitor_procs[csp_monitor_procs_len];
-static csp_core_t *csp_monitor_cores[csp_monitor_cores_len];
+  csp_core_pool_t *pool = csp_core_pool(pid);
+  if (!csp_grunq_try_pushm(pool->grunq, batch->procs, batch->len)) {
+    int i = 0;
+    for (; i < csp_sched_np - 1; i++) {
+      if (csp_grunq_try_pushm(csp_core_pool(pool->victims[i])->grunq,
+            batch->procs, batch->len)) {
+        break;
+      }
+    }
+    if (i == csp_sched_np - 1) {
+      csp_grunq_pushm(pool->grunq, batch->procs, batch->len);
+    }
+  }
+  batch->len = 0;
+  csp_core_pools_idle_wakeup(pid);
+}
+
+/* Send every process back to the core it ran on last time, where its stack is
+ * likely still in the cache. The batches are flushed by the caller. */
+static void csp_monitor_collect(csp_proc_t *start, int n) {
+  for (int i = 0; i < n; i++) {
+    csp_proc_t *proc = start;
+    start = proc->next;
+    proc->next = proc->pre = NULL;
+    csp_stats_latency_queued(proc);
+    csp_trace(wake, proc);
+
+    int pid = proc->last_pid;
+    csp_monitor_batch_t *batch = &csp_monitor_batches[pid];
+    batch->procs[batch->len++] = proc;
+    if (batch->len == csp_monitor_batch_len) {
+      csp_monitor_batch_flush(pid);
+    }
+  }
+}
 
 bool csp_monitor_poll(int (*poll)(csp_proc_t **, csp_proc_t **)) {
   csp_proc_t *start, *end;
@@ -67,91 +169,360 @@ bool csp_monitor_poll(int (*poll)(csp_proc_t **, csp_proc_t **)) {
     return false;
   }
 
-  csp_core_t *core;
-  if (csp_mmrbq_try_pop(core)(csp_sched_starving_procs, &core)) {
-    csp_lrunq_set(core->lrunq, n, start, end);
-    csp_cond_signal(&core->pcond, csp_cond_signal_proc_avail);
-    return true;
+  csp_monitor_collect(start, n);
+  for (int pid = 0; pid < csp_sched_np; pid++) {
+    csp_monitor_batch_flush(pid);
   }
+  return true;
+}
 
-  while (true) {
-    size_t num = csp_monitor_procs_put_list(start, csp_monitor_procs_len);
-    if (num == 0) {
-      break;
-    }
-    int pid = csp_rand(&csp_monitor_rand) % csp_sched_np;
-    while (!csp_grunq_try_pushm(csp_core_pool(pid)->grunq,
-        csp_monitor_procs, num)) {
-      if (csp_unlikely(++pid >= csp_sched_np)) {
-        pid = 0;
+/* Poll every core of the shard with `poll`, which collects the processes woken
+ * for core `pid`. */
+static bool csp_monitor_poll_shard(csp_monitor_shard_t *shard,
+    int (*poll)(size_t pid, csp_proc_t **, csp_proc_t **)) {
+  bool woken = false;
+  for (int i = 0; i < shard->npids; i++) {
+    csp_proc_t *start, *end;
+    int n = poll(shard->pids[i], &start, &end);
+    if (n > 0) {
+      csp_monitor_collect(start, n);
+      woken = true;
+    }
+  }
+
+  if (woken) {
+    for (int pid = 0; pid < csp_sched_np; pid++) {
+      csp_monitor_batch_flush(pid);
+    }
+  }
+  return woken;
+}
+
+/* Initialize the thread which calls `csp_monitor_poll`. */
+void csp_monitor_poller_init(void) {
+  csp_monitor_batches = (csp_monitor_batch_t *)calloc(
+    csp_sched_np, sizeof(csp_monitor_batch_t)
+  );
+  if (csp_monitor_batches == NULL) {
+    perror("libcsp failed to alloc the monitor batches.");
+    exit(EXIT_FAILURE);
+  }
+}
+
+/* Release the batches before the thread exits, they must have been flushed. */
+void csp_monitor_poller_destroy(void) {
+  free(csp_monitor_batches);
+  csp_monitor_batches = NULL;
+}
+
+/* Whether the thread is sleeping in the kernel, i.e. its state in
+ * `/proc/self/task/<tid>/stat` is `S` or `D`. */
+static bool csp_monitor_in_syscall(pid_t tid) {
+  char path[64], buff[256];
+  snprintf(path, sizeof(path), "/proc/self/task/%d/stat", tid);
+
+  FILE *file = fopen(path, "r");
+  if (file == NULL) {
+    return false;
+  }
+  size_t n = fread(buff, 1, sizeof(buff) - 1, file);
+  fclose(file);
+  buff[n] = '\0';
+
+  /* The state follows the command name in parentheses, which may contain
+   * spaces and parentheses itself. */
+  char *state = strrchr(buff, ')');
+  return state != NULL && state[1] == ' ' &&
+    (state[2] == 'S' || state[2] == 'D');
+}
+
+/*
+ * Check the cores which haven't picked another process for a while, like the
+ * sysmon of golang:
+ *
+ * - The processes running longer than `csp_time_slice` are preempted. A core
+ *   is preempted again if it's still stuck after another time slice.
+ * - The cores stuck in a system call not wrapped by `csp_block` longer than
+ *   `csp_monitor_syscall_threshold` are handed off to spare cores, so the
+ *   processes in their runqs still get run.
+ */
+static void csp_monitor_sysmon(csp_monitor_shard_t *shard) {
+  csp_timer_time_t now = csp_timer_now();
+
+  for (int j = 0; j < shard->npids; j++) {
+    csp_core_pool_t *pool = csp_core_pool(shard->pids[j]);
+    size_t len = atomic_load_explicit(&pool->len, memory_order_acquire);
+    for (size_t i = 0; i < len; i++) {
+      csp_core_t *core = pool->all[i];
+      uint64_t nsched = atomic_load_explicit(
+        &core->nsched, memory_order_relaxed
+      );
+
+      if (nsched != core->preempt_nsched) {
+        core->preempt_nsched = nsched;
+        core->preempt_since = core->syscall_since = now;
+        continue;
+      }
+      if ((nsched & 0x01) != 0) {
+        continue;
+      }
+
+      if (csp_time_slice > 0 &&
+          now - core->preempt_since >= (csp_timer_duration_t)csp_time_slice) {
+        csp_core_preempt(core);
+        core->preempt_since = now;
+      }
+      if (now - core->syscall_since >= csp_monitor_syscall_threshold &&
+          atomic_load_explicit(&core->handoff, memory_order_relaxed) ==
+            csp_core_handoff_none) {
+        if (csp_monitor_in_syscall(core->ktid)) {
+          csp_core_handoff(core, nsched);
+        }
+        core->syscall_since = now;
       }
     }
   }
+}
 
-  if (csp_mmrbq_try_pop(core)(csp_sched_starving_threads, &core)) {
-    csp_core_wakeup(core);
+/* Whether some cores of the shard are running processes. */
+static bool csp_monitor_busy(csp_monitor_shard_t *shard) {
+  for (int j = 0; j < shard->npids; j++) {
+    csp_core_pool_t *pool = csp_core_pool(shard->pids[j]);
+    size_t len = atomic_load_explicit(&pool->len, memory_order_acquire);
+    for (size_t i = 0; i < len; i++) {
+      if ((atomic_load(&pool->all[i]->nsched) & 0x01) == 0) {
+        return true;
+      }
+    }
   }
+  return false;
+}
+
+/* Watch `fd` in the sleep of the poller of core `pid`. It must be called
+ * before `csp_monitor_init`. */
+bool csp_monitor_watch(size_t pid, int fd) {
+  csp_monitor_watched_t *fds = (csp_monitor_watched_t *)realloc(
+    csp_monitor_watched.fds,
+    sizeof(csp_monitor_watched_t) * (csp_monitor_watched.len + 1)
+  );
+  if (fds == NULL) {
+    return false;
+  }
+  fds[csp_monitor_watched.len++] = (csp_monitor_watched_t){pid, fd};
+  csp_monitor_watched.fds = fds;
   return true;
 }
 
+/* Make sure the poller of the current core wakes up before `when`, e.g. a
+ * timer is set or the core has something to run. The poller publishes
+ * `wake_at` and then checks the timers and the cores while we update them and
+ * then check it, so at least one of us sees the other. */
+void csp_monitor_wakeup(csp_timer_time_t when) {
+  csp_monitor_shard_t *shard = &csp_monitor_shards.shards[
+    csp_this_core != NULL ? csp_monitor_shards.of[csp_this_core->pid] : 0
+  ];
+
+  atomic_thread_fence(memory_order_seq_cst);
+  int64_t wake_at = atomic_load_explicit(&shard->wake_at, memory_order_relaxed);
+  while (when < wake_at) {
+    if (atomic_compare_exchange_weak(&shard->wake_at, &wake_at, 0)) {
+      uint64_t one = 1;
+      write(shard->fds[0].fd, &one, sizeof(one));
+      return;
+    }
+  }
+}
+
+/* Sleep until `deadline` unless a watched fd is ready or someone wakes us up
+ * earlier. */
+static void csp_monitor_sleep(csp_monitor_shard_t *shard,
+    csp_timer_time_t deadline) {
+  struct timespec ts, *timeout = NULL;
+  if (deadline != INT64_MAX) {
+    csp_timer_duration_t duration = deadline - csp_timer_now();
+    if (duration <= 0) {
+      return;
+    }
+    ts.tv_sec = duration / csp_timer_second;
+    ts.tv_nsec = duration % csp_timer_second;
+    timeout = &ts;
+  }
+
+  if (ppoll(shard->fds, shard->nfds, timeout, NULL) > 0 &&
+      (shard->fds[0].revents & POLLIN)) {
+    uint64_t val;
+    read(shard->fds[0].fd, &val, sizeof(val));
+  }
+}
+
+/* The earliest deadline of the timers of the shard. */
+static csp_timer_time_t csp_monitor_next(csp_monitor_shard_t *shard) {
+  csp_timer_time_t next = INT64_MAX;
+  for (int i = 0; i < shard->npids; i++) {
+    csp_timer_time_t when = csp_timer_next_core(shard->pids[i]);
+    if (when < next) {
+      next = when;
+    }
+  }
+  return next;
+}
+
+/* Whether the shard has timer requests not applied yet. */
+static bool csp_monitor_pending(csp_monitor_shard_t *shard) {
+  for (int i = 0; i < shard->npids; i++) {
+    if (csp_timer_pending_core(shard->pids[i])) {
+      return true;
+    }
+  }
+  return false;
+}
+
 void *csp_monitor(void *data) {
-  int64_t duration = 1, since_last_checked = 0;
+  csp_monitor_shard_t *shard = (csp_monitor_shard_t *)data;
+  csp_timer_duration_t duration = csp_monitor_min_sleep;
+
+  csp_monitor_self = true;
+  csp_monitor_poller_init();
   while (true) {
-    if (!csp_monitor_poll(csp_netpoll_poll) &&
-        !csp_monitor_poll(csp_timer_poll)) {
-      since_last_checked += duration;
-      usleep(duration);
-
-      duration <<= 1;
-      if (duration > csp_monitor_max_sleep_microsecs) {
-        duration = csp_monitor_max_sleep_microsecs;
+    csp_timer_coarse_update();
+    csp_monitor_sysmon(shard);
+    if (csp_monitor_poll_shard(shard, csp_netpoll_poll) |
+#ifdef csp_with_io_uring
+        csp_monitor_poll_shard(shard, csp_io_poll) |
+#endif
+        csp_monitor_poll_shard(shard, csp_timer_poll_core)) {
+      duration = csp_monitor_min_sleep;
+      continue;
+    }
+
+    csp_timer_time_t deadline = csp_monitor_next(shard);
+    bool busy = csp_monitor_busy(shard);
+    if (busy) {
+      csp_timer_time_t until = csp_timer_now() + duration;
+      if (until < deadline) {
+        deadline = until;
+      }
+      if ((duration <<= 1) > csp_monitor_max_sleep) {
+        duration = csp_monitor_max_sleep;
       }
-    } else {
-      duration = 1;
-      /* We consider that the mointer spent `csp_monitor_max_sleep_microsecs`
-       * to poll. */
-      since_last_checked += csp_monitor_max_sleep_microsecs;
     }
 
-    if (since_last_checked < csp_timer_second / 1000) {
-      continue;
+    atomic_store(&shard->wake_at, deadline);
+    if (!csp_monitor_pending(shard) && (busy || !csp_monitor_busy(shard))) {
+      csp_monitor_sleep(shard, deadline);
+    }
+    atomic_store(&shard->wake_at, 0);
+  }
+}
+
+/* Split the cores into the shards. The pids are ordered by their NUMA nodes,
+ * so a shard spans as few nodes as possible. */
+static bool csp_monitor_shards_init(void) {
+  int np = csp_sched_np, n = 0;
+  const char *env = getenv("CSP_POLLERS");
+  if (env != NULL && (n = atoi(env)) <= 0) {
+    errno = EINVAL;
+    return false;
+  }
+  if (n > np) {
+    n = np;
+  }
+
+  int *order = (int *)malloc(sizeof(int) * np);
+  csp_monitor_shards.of = (int *)malloc(sizeof(int) * np);
+  if (order == NULL || csp_monitor_shards.of == NULL) {
+    free(order);
+    return false;
+  }
+  for (int i = 0; i < np; i++) {
+    int j = i, node = csp_core_pools_node(i);
+    for (; j > 0 && csp_core_pools_node(order[j - 1]) > node; j--) {
+      order[j] = order[j - 1];
+    }
+    order[j] = i;
+  }
+
+  /* One shard for each node by default. */
+  if (n == 0) {
+    for (int i = 0; i < np; i++) {
+      int node = csp_core_pools_node(order[i]);
+      n += i == 0 || node != csp_core_pools_node(order[i - 1]);
+      csp_monitor_shards.of[order[i]] = n - 1;
+    }
+  } else {
+    for (int i = 0; i < np; i++) {
+      csp_monitor_shards.of[order[i]] = (int)((int64_t)i * n / np);
     }
+  }
+  free(order);
 
-    size_t n = csp_mmrbq_try_popm(core)(
-      csp_sched_starving_procs, csp_monitor_cores, csp_monitor_cores_len
-    ), len = 0;
+  csp_monitor_shards.shards = (csp_monitor_shard_t *)aligned_alloc(
+    _Alignof(csp_monitor_shard_t), sizeof(csp_monitor_shard_t) * n
+  );
+  if (csp_monitor_shards.shards == NULL) {
+    return false;
+  }
+  csp_monitor_shards.len = n;
 
-    if (n > 0) {
-      csp_timer_time_t now = csp_timer_now();
-      for (size_t i = 0; i < n; i++) {
-        csp_core_t *core = csp_monitor_cores[i];
-        if (now - core->pcond.start > csp_timer_second) {
-          /* Tell the core to go to deep sleep. */
-          csp_cond_signal(&core->pcond, csp_cond_signal_deep_sleep);
-        } else {
-          csp_monitor_cores[len++] = core;
-        }
-      }
-      while(!csp_mmrbq_try_pushm(core)(
-        csp_sched_starving_procs, csp_monitor_cores, len
-      ));
+  for (int s = 0; s < n; s++) {
+    csp_monitor_shard_t *shard = &csp_monitor_shards.shards[s];
+    atomic_init(&shard->wake_at, 0);
+    shard->npids = 0;
+    shard->nfds = 1;
+    for (int i = 0; i < np; i++) {
+      shard->npids += csp_monitor_shards.of[i] == s;
     }
+    for (int i = 0; i < csp_monitor_watched.len; i++) {
+      shard->nfds += csp_monitor_shards.of[csp_monitor_watched.fds[i].pid] == s;
+    }
+
+    /* The first fd is the eventfd. */
+    shard->pids = (int *)malloc(sizeof(int) * shard->npids);
+    shard->fds = (struct pollfd *)malloc(sizeof(struct pollfd) * shard->nfds);
+    int efd = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC);
+    if (shard->pids == NULL || shard->fds == NULL || efd == -1) {
+      return false;
+    }
+    shard->fds[0] = (struct pollfd){.fd = efd, .events = POLLIN};
 
-    since_last_checked = 0;
+    for (int i = 0, j = 0; i < np; i++) {
+      if (csp_monitor_shards.of[i] == s) {
+        shard->pids[j++] = i;
+      }
+    }
+    for (int i = 0, j = 1; i < csp_monitor_watched.len; i++) {
+      csp_monitor_watched_t *w = &csp_monitor_watched.fds[i];
+      if (csp_monitor_shards.of[w->pid] == s) {
+        shard->fds[j++] = (struct pollfd){.fd = w->fd, .events = POLLIN};
+      }
+    }
   }
+
+  free(csp_monitor_watched.fds);
+  csp_monitor_watched.fds = NULL;
+  csp_monitor_watched.len = 0;
+  return true;
 }
 
 bool csp_monitor_init(void) {
   pthread_t tid;
   pthread_attr_t attr;
 
+  if (!csp_monitor_shards_init()) {
+    return false;
+  }
+
   if (pthread_attr_init(&attr) != 0 ||
-    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED) != 0 ||
-    pthread_create(&tid, &attr, csp_monitor, NULL) != 0) {
+    !csp_cpus_pin_monitor(&attr) ||
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED) != 0) {
     return false;
   }
+  for (int i = 0; i < csp_monitor_shards.len; i++) {
+    if (pthread_create(&tid, &attr, csp_monitor,
+          &csp_monitor_shards.shards[i]) != 0) {
+      return false;
+    }
+  }
   pthread_attr_destroy(&attr);
-
-  csp_rand_init(&csp_monitor_rand);
   return true;
 }
@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) 2020, Yanhui Shi <lime.syh at gmail dot com>
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include "common.h"
+#include "core.h"
+#include "mutex.h"
+#include "spinlock.h"
+#include "waitq.h"
+
+extern _Thread_local csp_core_t *csp_this_core;
+extern void csp_sched_park(csp_spinlock_t *lock);
+extern void csp_sched_put_proc(csp_proc_t *proc);
+
+void csp_mutex_lock_slow(csp_mutex_t *mutex) {
+  for (int i = 0; i < csp_mutex_spins; i++) {
+    csp_cpu_relax();
+    if (!atomic_load_explicit(&mutex->locked, memory_order_relaxed) &&
+        csp_mutex_try_lock(mutex)) {
+      return;
+    }
+  }
+
+  csp_waitq_t *q = &mutex->waitq;
+  csp_waitq_node_t node = {.parked = csp_this_core->running};
+  csp_waitq_lock(&q->lock);
+  csp_waitq_push(q, &node);
+  if (csp_mutex_try_lock(mutex)) {
+    csp_waitq_remove(q, &node);
+    csp_waitq_unlock(&q->lock);
+    return;
+  }
+
+  /* We own the mutex once we are woken up. */
+  csp_sched_park(&q->lock);
+}
+
+/* Wake the first waiter up as the new owner. If the unlocker has released the
+ * mutex(i.e. `held` is false), it takes the mutex back on behalf of the waiter
+ * first, or leaves the waiters to the newcomer which has taken it. */
+void csp_mutex_unlock_slow(csp_mutex_t *mutex, bool held) {
+  csp_waitq_t *q = &mutex->waitq;
+  csp_waitq_lock(&q->lock);
+  if (!held && !csp_mutex_try_lock(mutex)) {
+    csp_waitq_unlock(&q->lock);
+    return;
+  }
+
+  csp_waitq_node_t *node = csp_waitq_pop(q);
+  if (node == NULL) {
+    atomic_store(&mutex->locked, false);
+    csp_waitq_unlock(&q->lock);
+    return;
+  }
+  csp_proc_t *proc = node->parked;
+  csp_waitq_unlock(&q->lock);
+  csp_sched_put_proc(proc);
+}
@@ -23,13 +23,60 @@ extern "C" {
 #endif
 
 #include <stdatomic.h>
+#include <stdbool.h>
+#include "waitq.h"
 
-#define csp_mutex_t                atomic_flag
-#define csp_mutex_try_lock(mutex)  (!atomic_flag_test_and_set(mutex))
-#define csp_mutex_lock(mutex)      while (!csp_mutex_try_lock(mutex)) {}
-#define csp_mutex_unlock(mutex)    atomic_flag_clear(mutex)
-#define csp_mutex_init(mutex)                                                  \
-  do { *(mutex) = (atomic_flag)ATOMIC_FLAG_INIT; } while (0)                   \
+/*
+ * `csp_mutex_t` is the mutual exclusion lock for the processes. A contender
+ * spins for `csp_mutex_spins` rounds and then parks itself in `waitq`, so a
+ * holder which is preempted or waiting in the runq doesn't make the others
+ * burn their cores.
+ *
+ * The ownership is handed off directly: an unlocker which sees a waiter leaves
+ * `locked` set and wakes the first waiter up as the new owner. Newcomers may
+ * take the mutex only while nobody waits, thus no waiter starves. It must be
+ * used by the processes only, see `csp_spinlock_t` for the threads.
+ */
+#define csp_mutex_spins 64
+
+typedef struct {
+  atomic_bool locked;
+  csp_waitq_t waitq;
+} csp_mutex_t;
+
+#define csp_mutex_init(mutex) do {                                             \
+  atomic_store(&(mutex)->locked, false);                                       \
+  csp_waitq_init(&(mutex)->waitq);                                             \
+} while (0)                                                                    \
+
+#define csp_mutex_try_lock(mutex) ({                                           \
+  bool unlocked_ = false;                                                      \
+  atomic_compare_exchange_strong(&(mutex)->locked, &unlocked_, true);          \
+})                                                                             \
+
+#define csp_mutex_lock(mutex) do {                                             \
+  csp_mutex_t *mutex_ = (mutex);                                               \
+  if (!csp_mutex_try_lock(mutex_)) {                                           \
+    csp_mutex_lock_slow(mutex_);                                               \
+  }                                                                            \
+} while (0)                                                                    \
+
+/* `locked` is cleared before `waitq.len` is read again while a waiter
+ * increases `len` before trying to lock, so one of them sees the other. */
+#define csp_mutex_unlock(mutex) do {                                           \
+  csp_mutex_t *mutex_ = (mutex);                                               \
+  if (atomic_load(&mutex_->waitq.len) > 0) {                                   \
+    csp_mutex_unlock_slow(mutex_, true);                                       \
+  } else {                                                                     \
+    atomic_store(&mutex_->locked, false);                                      \
+    if (atomic_load(&mutex_->waitq.len) > 0) {                                 \
+      csp_mutex_unlock_slow(mutex_, false);                                    \
+    }                                                                          \
+  }                                                                            \
+} while (0)                                                                    \
+
+void csp_mutex_lock_slow(csp_mutex_t *mutex);
+void csp_mutex_unlock_slow(csp_mutex_t *mutex, bool held);
 
 #ifdef __cplusplus
 }
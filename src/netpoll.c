@@ -17,96 +17,222 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <linux/errqueue.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
 #include <stdatomic.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <sys/epoll.h>
 #include <sys/resource.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
 #include <unistd.h>
 #include "core.h"
 #include "netpoll.h"
 #include "proc.h"
 #include "runq.h"
+#include "spinlock.h"
+#include "stats.h"
 #include "timer.h"
 
-#define csp_netpoll_waiter_proc_get(w)    atomic_load(&(w)->proc)
-#define csp_netpoll_waiter_proc_set(w, p) atomic_store(&(w)->proc, (p))
-
-#define csp_netpoll_wait(fd, timeout, evt) ({                                  \
-  csp_core_t *this_core = csp_this_core;                                       \
-                                                                               \
-  csp_proc_t *running = this_core->running;                                    \
-  csp_proc_stat_set(running, csp_proc_stat_netpoll_waiting);                   \
-                                                                               \
-  /* Set waiter to tell netpoll we are waiting the evt. */                     \
-  csp_netpoll_waiter_t *waiter = &csp_netpoll.waiters[fd];                     \
-  csp_netpoll_waiter_proc_set(waiter, running);                                \
-  waiter->waiting_evt = (evt);                                                 \
-                                                                               \
-  if ((timeout) > 0) {                                                         \
-    csp_timer_t timer = csp_timer_after(                                       \
-      (timeout), csp_netpoll_on_timeout((fd), running)                         \
-    );                                                                         \
-    csp_soft_mbarr();                                                          \
-    waiter->timer = &timer;                                                    \
-  } else {                                                                     \
-    /* Tell the netpoll there is no timer. */                                  \
-    waiter->timer = NULL;                                                      \
-  }                                                                            \
-                                                                               \
-  /* Set this_core->running to NULL to prevent this process being scheduled    \
-   * twice. */                                                                 \
-  this_core->running = NULL;                                                   \
-  csp_core_yield(running, &this_core->anchor);                                 \
-                                                                               \
-  csp_netpoll_waiter_proc_set(waiter, NULL);                                   \
-  csp_proc_stat_get(running);                                                  \
-})                                                                             \
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#define csp_netpoll_evts_len              128
+
+/* The waiter table is split into chunks of `csp_netpoll_chunk_len` waiters
+ * which are allocated when the first fd in them is registered, so the memory
+ * grows with the largest fd in use instead of the limit of open files. */
+#define csp_netpoll_chunk_exp             10
+#define csp_netpoll_chunk_len             (1 << csp_netpoll_chunk_exp)
+#define csp_netpoll_chunk_mask            (csp_netpoll_chunk_len - 1)
+#define csp_netpoll_chunks_max            (1 << 14)
+
+/* The two directions of a fd. */
+#define csp_netpoll_reader                0
+#define csp_netpoll_writer                1
+
+/* Special values of `csp_netpoll_slot_t.proc` besides the waiting process. */
+#define csp_netpoll_nil                   ((uintptr_t)0)
+#define csp_netpoll_ready                 ((uintptr_t)1)
 
 extern _Thread_local csp_core_t *csp_this_core;
 extern void csp_core_proc_exit_and_run(csp_proc_t *to_run);
-extern void csp_core_yield(csp_proc_t *proc, void *anchor);
+extern void csp_sched_put_proc(csp_proc_t *proc);
+extern void csp_sched_park_fn(void (*fn)(void *arg), void *arg);
+extern int csp_sched_np;
+
+#ifdef csp_with_netpoll_thread
+extern bool csp_monitor_poll(int (*poll)(csp_proc_t **, csp_proc_t **));
+extern void csp_monitor_poller_init(void);
+extern bool csp_cpus_pin_monitor(pthread_attr_t *attr);
+#else
+extern bool csp_monitor_watch(size_t pid, int fd);
+#endif
+
+typedef struct {
+  /* `csp_netpoll_nil`, `csp_netpoll_ready` if the event arrived while there
+   * was no waiting process, or the waiting process. */
+  atomic_uintptr_t proc;
+
+  /* The timer if timeout is set. */
+  csp_timer_t *timer;
+} csp_netpoll_slot_t;
 
 typedef struct {
   /* Whether is fd is registered to the netpoll. */
   bool registered;
 
-  /* The event(EPOLLIN or EPOLLOUT) we are waiting. */
-  int waiting_evt;
+  /* Whether the fd is registered with `EPOLLONESHOT` and armed only for the
+   * directions having waiting processes. */
+  bool oneshot;
 
-  /* The process waiting for the event. `NULL` means there is no waiting
-   * process. */
-  csp_proc_t *proc;
+  /* The epoll instance the fd is registered to. */
+  int epfd;
 
-  /* The timer if timeout is set. */
-  csp_timer_t *timer;
+  /* Serializes re-arming the oneshot registration. */
+  csp_spinlock_t lock;
+
+  /* The reader and the writer, each fd can have one of both at a time. */
+  csp_netpoll_slot_t slots[2];
 } csp_netpoll_waiter_t;
 
+/* The argument of `csp_netpoll_commit`. */
+typedef struct {
+  int fd, dir;
+  csp_proc_t *proc;
+  csp_netpoll_waiter_t *waiter;
+} csp_netpoll_commit_t;
+
+static const uint32_t csp_netpoll_dir_evts[2] = {EPOLLIN, EPOLLOUT};
+
+/* By default the poller of core 0 polls the only epoll instance without
+ * blocking. If libcsp is configured with `--with-netpoll=thread`, a dedicated
+ * thread blocks on it instead. With `--with-netpoll=core`, every core has its
+ * own epoll instance which it polls before parking, and the pollers of the
+ * monitor poll them for the busy or parked cores. */
 struct {
-  int epfd, waiters_cap;
-  csp_netpoll_waiter_t *waiters;
-  struct epoll_event evts[128];
+  int nchunks, nepfds;
+  _Atomic(csp_netpoll_waiter_t *) *chunks;
+  int *epfds;
 } csp_netpoll;
 
+#ifdef csp_with_netpoll_thread
+static int csp_netpoll_poll_blocking(csp_proc_t **start, csp_proc_t **end);
+
+static void *csp_netpoll_thread(void *data) {
+  csp_monitor_poller_init();
+  while (true) {
+    csp_monitor_poll(csp_netpoll_poll_blocking);
+  }
+  return NULL;
+}
+
+static bool csp_netpoll_thread_start(void) {
+  pthread_t tid;
+  pthread_attr_t attr;
+
+  if (pthread_attr_init(&attr) != 0 ||
+    !csp_cpus_pin_monitor(&attr) ||
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED) != 0 ||
+    pthread_create(&tid, &attr, csp_netpoll_thread, NULL) != 0) {
+    return false;
+  }
+  pthread_attr_destroy(&attr);
+  return true;
+}
+#endif
+
 bool csp_netpoll_init(void) {
   struct rlimit r;
   if (getrlimit(RLIMIT_NOFILE, &r) == -1 || r.rlim_max <= 0) {
     return false;
   }
 
-  csp_netpoll.waiters_cap = r.rlim_max;
-  csp_netpoll.waiters = (csp_netpoll_waiter_t *)calloc(
-     csp_netpoll.waiters_cap, sizeof(csp_netpoll_waiter_t)
+  size_t nchunks = (r.rlim_max >> csp_netpoll_chunk_exp) + 1;
+  csp_netpoll.nchunks = nchunks < csp_netpoll_chunks_max ?
+    nchunks : csp_netpoll_chunks_max;
+  csp_netpoll.chunks = (_Atomic(csp_netpoll_waiter_t *) *)calloc(
+    csp_netpoll.nchunks, sizeof(_Atomic(csp_netpoll_waiter_t *))
   );
-  if (csp_netpoll.waiters == NULL) {
+  if (csp_netpoll.chunks == NULL) {
     return false;
   }
 
-  csp_netpoll.epfd = epoll_create1(0);
-  return csp_netpoll.epfd != -1;
+#ifdef csp_with_netpoll_per_core
+  csp_netpoll.nepfds = csp_sched_np;
+#else
+  csp_netpoll.nepfds = 1;
+#endif
+  csp_netpoll.epfds = (int *)malloc(sizeof(int) * csp_netpoll.nepfds);
+  if (csp_netpoll.epfds == NULL) {
+    return false;
+  }
+  for (int i = 0; i < csp_netpoll.nepfds; i++) {
+    if ((csp_netpoll.epfds[i] = epoll_create1(0)) == -1) {
+      return false;
+    }
+#ifndef csp_with_netpoll_thread
+    /* The poller of core `i` polls it, so wake it up when it's ready. */
+    if (!csp_monitor_watch(i, csp_netpoll.epfds[i])) {
+      return false;
+    }
+#endif
+  }
+
+#ifdef csp_with_netpoll_thread
+  return csp_netpoll_thread_start();
+#else
+  return true;
+#endif
 }
 
-bool csp_netpoll_register(int fd) {
+/* Get the waiter of `fd`, `NULL` if its chunk is not allocated yet. */
+static inline csp_netpoll_waiter_t *csp_netpoll_waiter(int fd) {
+  int idx = fd >> csp_netpoll_chunk_exp;
+  if (fd < 0 || idx >= csp_netpoll.nchunks) {
+    return NULL;
+  }
+  csp_netpoll_waiter_t *chunk = atomic_load_explicit(
+    &csp_netpoll.chunks[idx], memory_order_acquire
+  );
+  return chunk == NULL ? NULL : &chunk[fd & csp_netpoll_chunk_mask];
+}
+
+/* Get the waiter of `fd` and allocate its chunk if necessary. */
+static csp_netpoll_waiter_t *csp_netpoll_waiter_alloc(int fd) {
+  csp_netpoll_waiter_t *waiter = csp_netpoll_waiter(fd);
+  if (waiter != NULL || fd < 0 ||
+      (fd >> csp_netpoll_chunk_exp) >= csp_netpoll.nchunks) {
+    return waiter;
+  }
+
+  csp_netpoll_waiter_t *chunk = (csp_netpoll_waiter_t *)calloc(
+    csp_netpoll_chunk_len, sizeof(csp_netpoll_waiter_t)
+  );
+  if (chunk == NULL) {
+    return NULL;
+  }
+
+  /* Someone else may install the chunk at the same time. */
+  csp_netpoll_waiter_t *expected = NULL;
+  if (!atomic_compare_exchange_strong(
+        &csp_netpoll.chunks[fd >> csp_netpoll_chunk_exp], &expected, chunk)) {
+    free(chunk);
+  }
+  return csp_netpoll_waiter(fd);
+}
+
+static bool csp_netpoll_add(int fd, bool oneshot) {
+  csp_netpoll_waiter_t *waiter = csp_netpoll_waiter_alloc(fd);
+  if (waiter == NULL) {
+    errno = EMFILE;
+    return false;
+  }
+
   /* Set the socket to be non-blocking. */
   int flags = fcntl(fd, F_GETFL, 0);
   if (flags != -1) {
@@ -116,38 +242,291 @@ bool csp_netpoll_register(int fd) {
     return false;
   }
 
+  /* Register the fd to the epoll instance of the current core, so that the
+   * events are likely handled by the core which will wait for them. */
+  int epfd = csp_netpoll.epfds[0];
+#ifdef csp_with_netpoll_per_core
+  if (csp_this_core != NULL) {
+    epfd = csp_netpoll.epfds[csp_this_core->pid];
+  }
+#endif
+
+  for (int i = 0; i < 2; i++) {
+    atomic_store(&waiter->slots[i].proc, csp_netpoll_nil);
+    waiter->slots[i].timer = NULL;
+  }
+  csp_spinlock_init(&waiter->lock);
+  waiter->oneshot = oneshot;
+  waiter->epfd = epfd;
+
+  /* A oneshot fd is not armed for any direction until someone waits for it. */
   struct epoll_event evt = {
-    .events = EPOLLET|EPOLLIN|EPOLLOUT,
+    .events = oneshot ? EPOLLONESHOT : EPOLLET|EPOLLIN|EPOLLOUT,
     .data = {.fd = fd}
   };
-  if (epoll_ctl(csp_netpoll.epfd, EPOLL_CTL_ADD, fd, &evt) == -1) {
+  if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &evt) == -1) {
     return false;
   }
 
-  csp_netpoll.waiters[fd].registered = true;
+  waiter->registered = true;
   return true;
 }
 
+bool csp_netpoll_register(int fd) {
+  return csp_netpoll_add(fd, false);
+}
+
+bool csp_netpoll_register_oneshot(int fd) {
+  return csp_netpoll_add(fd, true);
+}
+
+/* Arm the oneshot fd for the directions having waiting processes. */
+static void csp_netpoll_rearm(int fd, csp_netpoll_waiter_t *waiter) {
+  csp_spinlock_lock(&waiter->lock);
+
+  uint32_t evts = 0;
+  for (int i = 0; i < 2; i++) {
+    if (atomic_load(&waiter->slots[i].proc) > csp_netpoll_ready) {
+      evts |= csp_netpoll_dir_evts[i];
+    }
+  }
+  if (evts != 0) {
+    struct epoll_event evt = {.events = evts|EPOLLONESHOT, .data = {.fd = fd}};
+    epoll_ctl(waiter->epfd, EPOLL_CTL_MOD, fd, &evt);
+  }
+
+  csp_spinlock_unlock(&waiter->lock);
+}
+
+/* Publish the waiting process after it has yielded, so that whoever takes it
+ * from the slot can run it right away. */
+static void csp_netpoll_commit(void *arg) {
+  /* The process may be woken up as soon as it's published, copy what we need
+   * off its stack first. */
+  csp_netpoll_commit_t commit = *(csp_netpoll_commit_t *)arg;
+  csp_netpoll_slot_t *slot = &commit.waiter->slots[commit.dir];
+  csp_timer_t *timer = slot->timer;
+
+  uintptr_t nil = csp_netpoll_nil;
+  if (atomic_compare_exchange_strong(&slot->proc, &nil,
+        (uintptr_t)commit.proc)) {
+    /* Don't leave the process in the slot if the timer has fired before it
+     * was published. */
+    if (csp_proc_stat_get(commit.proc) != csp_proc_stat_netpoll_waiting) {
+      uintptr_t waiting = (uintptr_t)commit.proc;
+      atomic_compare_exchange_strong(&slot->proc, &waiting, csp_netpoll_nil);
+    } else if (commit.waiter->oneshot) {
+      csp_netpoll_rearm(commit.fd, commit.waiter);
+    }
+    return;
+  }
+
+  /* The event arrived after the process checked the slot. */
+  atomic_store(&slot->proc, csp_netpoll_nil);
+  uint64_t stat = csp_proc_stat_netpoll_waiting;
+  if (csp_proc_stat_cas(commit.proc, stat, csp_proc_stat_netpoll_avail)) {
+    if (timer != NULL) {
+      csp_timer_cancel(*timer);
+    }
+    csp_sched_put_proc(commit.proc);
+  } else {
+    /* The timer has fired and will run the process, keep the event for the
+     * next wait. */
+    atomic_store(&slot->proc, csp_netpoll_ready);
+  }
+}
+
 /* The timeout handler. */
-csp_proc static void csp_netpoll_on_timeout(int fd, csp_proc_t *proc) {
+csp_proc static void csp_netpoll_on_timeout(int fd, int dir,
+    csp_proc_t *proc) {
   uint64_t stat = csp_proc_stat_netpoll_waiting;
   if (csp_proc_stat_cas(proc, stat, csp_proc_stat_netpoll_timeout)) {
+    uintptr_t waiting = (uintptr_t)proc;
+    atomic_compare_exchange_strong(
+      &csp_netpoll_waiter(fd)->slots[dir].proc, &waiting, csp_netpoll_nil
+    );
     csp_core_proc_exit_and_run(proc);
   }
 }
 
+static int csp_netpoll_wait(int fd, csp_timer_duration_t timeout, int dir) {
+  csp_netpoll_waiter_t *waiter = csp_netpoll_waiter(fd);
+  if (waiter == NULL || !waiter->registered) {
+    errno = EBADF;
+    return -1;
+  }
+  csp_netpoll_slot_t *slot = &waiter->slots[dir];
+
+  /* Consume the event which arrived while nobody was waiting. */
+  uintptr_t ready = csp_netpoll_ready;
+  if (atomic_compare_exchange_strong(&slot->proc, &ready, csp_netpoll_nil)) {
+    return csp_netpoll_avail;
+  }
+
+  csp_proc_t *running = csp_this_core->running;
+  csp_proc_stat_set(running, csp_proc_stat_netpoll_waiting);
+
+  csp_timer_t timer;
+  if (timeout > 0) {
+    timer = csp_timer_after(
+      timeout, csp_netpoll_on_timeout(fd, dir, running)
+    );
+    slot->timer = &timer;
+  } else {
+    /* Tell the netpoll there is no timer. */
+    slot->timer = NULL;
+  }
+
+  csp_netpoll_commit_t commit = {
+    .fd = fd, .dir = dir, .proc = running, .waiter = waiter
+  };
+  csp_sched_park_fn(csp_netpoll_commit, &commit);
+
+  return csp_proc_stat_get(running);
+}
+
 int csp_netpoll_wait_read(int fd, csp_timer_duration_t timeout) {
-  return csp_netpoll_wait(fd, timeout, EPOLLIN);
+  return csp_netpoll_wait(fd, timeout, csp_netpoll_reader);
 }
 
 int csp_netpoll_wait_write(int fd, csp_timer_duration_t timeout) {
-  return csp_netpoll_wait(fd, timeout, EPOLLOUT);
+  return csp_netpoll_wait(fd, timeout, csp_netpoll_writer);
+}
+
+/* A transfer between two fds fails with `EAGAIN` if either of them is not
+ * ready, so ask the kernel which one blocks it and wait for that one. */
+static int csp_netpoll_wait_pair(int fd_in, int fd_out,
+    csp_timer_duration_t timeout) {
+  struct pollfd fds[2] = {
+    {.fd = fd_in, .events = POLLIN}, {.fd = fd_out, .events = POLLOUT}
+  };
+  if (poll(fds, 2, 0) == -1) {
+    return -1;
+  }
+  if (!(fds[0].revents & (POLLIN|POLLERR|POLLHUP))) {
+    return csp_netpoll_wait_read(fd_in, timeout);
+  }
+  if (!(fds[1].revents & (POLLOUT|POLLERR|POLLHUP))) {
+    return csp_netpoll_wait_write(fd_out, timeout);
+  }
+  return csp_netpoll_avail;
+}
+
+/* `in_fd` must support mmap, i.e. it's a regular file which never blocks, so
+ * only `out_fd` is waited for. */
+ssize_t csp_netpoll_sendfile(int out_fd, int in_fd, off_t *offset, size_t n,
+    csp_timer_duration_t timeout) {
+  return csp_netpoll_retry(
+    sendfile(out_fd, in_fd, offset, n),
+    csp_netpoll_wait_write(out_fd, timeout)
+  );
+}
+
+ssize_t csp_netpoll_splice(int fd_in, off_t *off_in, int fd_out,
+    off_t *off_out, size_t n, unsigned flags, csp_timer_duration_t timeout) {
+  return csp_netpoll_retry(
+    splice(fd_in, off_in, fd_out, off_out, n, flags|SPLICE_F_NONBLOCK),
+    csp_netpoll_wait_pair(fd_in, fd_out, timeout)
+  );
+}
+
+ssize_t csp_netpoll_tee(int fd_in, int fd_out, size_t n, unsigned flags,
+    csp_timer_duration_t timeout) {
+  return csp_netpoll_retry(
+    tee(fd_in, fd_out, n, flags|SPLICE_F_NONBLOCK),
+    csp_netpoll_wait_pair(fd_in, fd_out, timeout)
+  );
+}
+
+bool csp_netpoll_zerocopy_enable(int fd) {
+  int one = 1;
+  return setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == 0;
 }
 
-int csp_netpoll_poll(csp_proc_t **start, csp_proc_t **end) {
-  int n = epoll_wait(csp_netpoll.epfd, csp_netpoll.evts,
-    sizeof(csp_netpoll.evts)/sizeof(struct epoll_event), 0
+ssize_t csp_netpoll_send_zerocopy(int fd, const void *buf, size_t n,
+    csp_timer_duration_t timeout) {
+  return csp_netpoll_retry(
+    send(fd, buf, n, MSG_ZEROCOPY),
+    csp_netpoll_wait_write(fd, timeout)
   );
+}
+
+/* The completions are queued in the error queue of the socket which raises
+ * `EPOLLERR`, and the netpoll regards it as ready for both directions. They
+ * are reaped in the writer slot, since it's usually the sending process which
+ * waits for its buffers back. */
+int csp_netpoll_zerocopy_reap(int fd, uint32_t *lo, uint32_t *hi,
+    csp_timer_duration_t timeout) {
+  char control[CMSG_SPACE(sizeof(struct sock_extended_err))];
+  struct msghdr msg = {
+    .msg_control = control, .msg_controllen = sizeof(control)
+  };
+
+  if (csp_netpoll_retry(
+        recvmsg(fd, &msg, MSG_ERRQUEUE),
+        csp_netpoll_wait_write(fd, timeout)) == -1) {
+    return -1;
+  }
+
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  if (cmsg == NULL ||
+      !((cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) ||
+        (cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR))) {
+    errno = ENOMSG;
+    return -1;
+  }
+
+  struct sock_extended_err *err = (struct sock_extended_err *)CMSG_DATA(cmsg);
+  if (err->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+    errno = err->ee_errno != 0 ? err->ee_errno : ENOMSG;
+    return -1;
+  }
+
+  *lo = err->ee_info;
+  *hi = err->ee_data;
+  return (err->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) ? 1 : 0;
+}
+
+/* Take the process waiting in `slot` for an event, or remember the event if
+ * there is no waiting process. */
+static csp_proc_t *csp_netpoll_unblock(csp_netpoll_slot_t *slot) {
+  uintptr_t val = atomic_load(&slot->proc);
+  while (true) {
+    if (val == csp_netpoll_ready) {
+      return NULL;
+    }
+    uintptr_t next = val == csp_netpoll_nil ?
+      csp_netpoll_ready : csp_netpoll_nil;
+    if (atomic_compare_exchange_weak(&slot->proc, &val, next)) {
+      break;
+    }
+  }
+  if (val == csp_netpoll_nil) {
+    return NULL;
+  }
+
+  csp_proc_t *proc = (csp_proc_t *)val;
+  uint64_t stat = csp_proc_stat_netpoll_waiting;
+  if (csp_proc_stat_cas(proc, stat, csp_proc_stat_netpoll_avail)) {
+    if (slot->timer != NULL) {
+      csp_timer_cancel(*slot->timer);
+    }
+    return proc;
+  }
+
+  /* The process has timed out, keep the event for the next wait. */
+  uintptr_t nil = csp_netpoll_nil;
+  atomic_compare_exchange_strong(&slot->proc, &nil, csp_netpoll_ready);
+  return NULL;
+}
+
+/* Wait for the events of `epfd` and collect the processes waiting for them.
+ * The list of the collected processes is appended to `*start` ... `*end`. */
+static int csp_netpoll_epoll(int epfd, int timeout, csp_proc_t **start,
+    csp_proc_t **end, int total) {
+  struct epoll_event evts[csp_netpoll_evts_len];
+
+  int n = epoll_wait(epfd, evts, csp_netpoll_evts_len, timeout);
   if (n <= 0) {
     return 0;
   }
@@ -156,33 +535,26 @@ int csp_netpoll_poll(csp_proc_t **start, csp_proc_t **end) {
   csp_proc_t *head = NULL, *tail = NULL;
 
   for (int i = 0; i < n; i++) {
-    csp_netpoll_waiter_t *waiter = &csp_netpoll.waiters[
-      csp_netpoll.evts[i].data.fd
-    ];
-
-    csp_proc_t *proc = csp_netpoll_waiter_proc_get(waiter);
-    if (proc == NULL) {
+    int fd = evts[i].data.fd;
+    csp_netpoll_waiter_t *waiter = csp_netpoll_waiter(fd);
+    if (waiter == NULL || !waiter->registered) {
       continue;
     }
 
-    uint32_t mask = 0;
-    if (csp_netpoll.evts[i].events & EPOLLIN) {
-      mask |= EPOLLIN;
-    }
-    if (csp_netpoll.evts[i].events & EPOLLOUT) {
-      mask |= EPOLLOUT;
-    }
-    /* Regard EPOLLERR and EPOLLHUP as success. The caller should handle the
-     * error in the following read or write. */
-    if (csp_netpoll.evts[i].events & (EPOLLERR|EPOLLHUP)) {
+    /* Regard EPOLLERR and EPOLLHUP as success for both directions. The caller
+     * should handle the error in the following read or write. */
+    uint32_t mask = evts[i].events;
+    if (mask & (EPOLLERR|EPOLLHUP)) {
       mask |= EPOLLIN|EPOLLOUT;
     }
 
-    uint64_t stat = csp_proc_stat_netpoll_waiting;
-    if ((mask & waiter->waiting_evt) &&
-        csp_proc_stat_cas(proc, stat, csp_proc_stat_netpoll_avail)) {
-      if (waiter->timer != NULL) {
-        csp_timer_cancel(*waiter->timer);
+    for (int dir = 0; dir < 2; dir++) {
+      if (!(mask & csp_netpoll_dir_evts[dir])) {
+        continue;
+      }
+      csp_proc_t *proc = csp_netpoll_unblock(&waiter->slots[dir]);
+      if (proc == NULL) {
+        continue;
       }
 
       if (tail != NULL) {
@@ -194,30 +566,86 @@ int csp_netpoll_poll(csp_proc_t **start, csp_proc_t **end) {
       }
       len++;
     }
+
+    /* The oneshot fd is disarmed for both directions after an event. */
+    if (waiter->oneshot) {
+      csp_netpoll_rearm(fd, waiter);
+    }
   }
 
   if (len > 0) {
-    *start = head;
+    if (total > 0) {
+      (*end)->next = head;
+      head->pre = *end;
+    } else {
+      *start = head;
+    }
     *end = tail;
   }
 
   return len;
 }
 
+/* Poll the epoll instance of core `pid` for its poller, if it has one. */
+int csp_netpoll_poll(size_t pid, csp_proc_t **start, csp_proc_t **end) {
+  int n = 0;
+#ifndef csp_with_netpoll_thread
+  if (pid < csp_netpoll.nepfds) {
+    n = csp_netpoll_epoll(csp_netpoll.epfds[pid], 0, start, end, 0);
+  }
+#endif
+  if (n > 0) {
+    csp_stats_shared_add(netpoll_wakeups, n);
+  }
+  return n;
+}
+
+#ifdef csp_with_netpoll_thread
+static int csp_netpoll_poll_blocking(csp_proc_t **start, csp_proc_t **end) {
+  int n = csp_netpoll_epoll(csp_netpoll.epfds[0], -1, start, end, 0);
+  if (n > 0) {
+    csp_stats_shared_add(netpoll_wakeups, n);
+  }
+  return n;
+}
+#endif
+
+#ifdef csp_with_netpoll_per_core
+/* Poll the epoll instance of core `pid` without blocking. */
+int csp_netpoll_poll_core(size_t pid, csp_proc_t **start, csp_proc_t **end) {
+  return csp_netpoll_epoll(csp_netpoll.epfds[pid], 0, start, end, 0);
+}
+#endif
+
 bool csp_netpoll_unregister(int fd) {
-  if (epoll_ctl(csp_netpoll.epfd, EPOLL_CTL_DEL, fd, NULL) == -1) {
+  csp_netpoll_waiter_t *waiter = csp_netpoll_waiter(fd);
+  if (waiter == NULL || !waiter->registered) {
+    errno = EBADF;
+    return false;
+  }
+  if (epoll_ctl(waiter->epfd, EPOLL_CTL_DEL, fd, NULL) == -1) {
     return false;
   }
-  csp_netpoll.waiters[fd].registered = false;
+  waiter->registered = false;
   return true;
 }
 
 void csp_netpoll_destroy() {
-  for (int i = 0; i < csp_netpoll.waiters_cap; i++) {
-    if (csp_netpoll.waiters[i].registered) {
-      csp_netpoll_unregister(i);
+  for (int i = 0; i < csp_netpoll.nchunks; i++) {
+    csp_netpoll_waiter_t *chunk = atomic_load(&csp_netpoll.chunks[i]);
+    if (chunk == NULL) {
+      continue;
+    }
+    for (int j = 0; j < csp_netpoll_chunk_len; j++) {
+      if (chunk[j].registered) {
+        csp_netpoll_unregister((i << csp_netpoll_chunk_exp) + j);
+      }
     }
+    free(chunk);
+  }
+  free(csp_netpoll.chunks);
+  for (int i = 0; i < csp_netpoll.nepfds; i++) {
+    close(csp_netpoll.epfds[i]);
   }
-  free(csp_netpoll.waiters);
-  close(csp_netpoll.epfd);
+  free(csp_netpoll.epfds);
 }
@@ -22,7 +22,10 @@
 extern "C" {
 #endif
 
+#include <errno.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
 #include "proc.h"
 #include "timer.h"
 
@@ -30,10 +33,57 @@ extern "C" {
 #define csp_netpoll_timeout   csp_proc_stat_netpoll_timeout
 
 bool csp_netpoll_register(int fd);
+bool csp_netpoll_register_oneshot(int fd);
 int csp_netpoll_wait_read(int fd,  csp_timer_duration_t timeout);
 int csp_netpoll_wait_write(int fd, csp_timer_duration_t timeout);
 bool csp_netpoll_unregister(int fd);
 
+/* Retry `call`, which returns `-1` with `errno` set on failure, as long as it
+ * fails with `EAGAIN` and `wait`, usually `csp_netpoll_wait_read/write`, says
+ * the fd may be ready now. It fails with `ETIMEDOUT` if `wait` times out. */
+#define csp_netpoll_retry(call, wait) ({                                       \
+  ssize_t ret_;                                                                \
+  while ((ret_ = (call)) == -1 && (errno == EAGAIN || errno == EINTR)) {       \
+    if (errno == EINTR) {                                                      \
+      continue;                                                                \
+    }                                                                          \
+    int stat_ = (wait);                                                        \
+    if (stat_ == -1) {                                                         \
+      break;                                                                   \
+    }                                                                          \
+    if (stat_ == csp_netpoll_timeout) {                                        \
+      errno = ETIMEDOUT;                                                       \
+      break;                                                                   \
+    }                                                                          \
+  }                                                                            \
+  ret_;                                                                        \
+})                                                                             \
+
+/*
+ * The transfers below move the data inside the kernel. They return what their
+ * syscall counterparts return, but park the running process in the netpoll
+ * instead of failing with `EAGAIN`, and fail with `ETIMEDOUT` if the fd is not
+ * ready after `timeout` nanoseconds. The fds which may block must have been
+ * registered to the netpoll.
+ */
+ssize_t csp_netpoll_sendfile(int out_fd, int in_fd, off_t *offset, size_t n,
+    csp_timer_duration_t timeout);
+ssize_t csp_netpoll_splice(int fd_in, off_t *off_in, int fd_out,
+    off_t *off_out, size_t n, unsigned flags, csp_timer_duration_t timeout);
+ssize_t csp_netpoll_tee(int fd_in, int fd_out, size_t n, unsigned flags,
+    csp_timer_duration_t timeout);
+
+/* Send with `MSG_ZEROCOPY` once it's enabled for the socket. `buf` must not be
+ * modified until `csp_netpoll_zerocopy_reap` reports the send is completed.
+ * The reap returns `0` if the sends numbered `*lo` ... `*hi` have completed
+ * without copying, `1` if the kernel has copied them after all, or `-1` on
+ * failure. */
+bool csp_netpoll_zerocopy_enable(int fd);
+ssize_t csp_netpoll_send_zerocopy(int fd, const void *buf, size_t n,
+    csp_timer_duration_t timeout);
+int csp_netpoll_zerocopy_reap(int fd, uint32_t *lo, uint32_t *hi,
+    csp_timer_duration_t timeout);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,158 @@
+/*
+ * Copyright (c) 2020, Yanhui Shi <lime.syh at gmail dot com>
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "core.h"
+#include "offload.h"
+#include "proc.h"
+
+extern _Thread_local csp_core_t *csp_this_core;
+extern void csp_sched_park_fn(void (*fn)(void *arg), void *arg);
+extern bool csp_monitor_poll(int (*poll)(csp_proc_t **, csp_proc_t **));
+extern void csp_monitor_poller_init(void);
+extern void csp_monitor_poller_destroy(void);
+
+/* The request lives in the stack of the waiting process. */
+typedef struct csp_offload_req_t {
+  void (*fn)(void *arg);
+  void *arg;
+  csp_proc_t *proc;
+  struct csp_offload_req_t *next;
+} csp_offload_req_t;
+
+/* The requests are queued in FIFO order. `nidle` workers are waiting on
+ * `cond` while `nqueued` requests are waiting for them. */
+static struct {
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  csp_offload_req_t *head, *tail;
+  size_t nworkers, nidle, nqueued;
+} csp_offload_pool = {
+  .lock = PTHREAD_MUTEX_INITIALIZER,
+  .cond = PTHREAD_COND_INITIALIZER,
+};
+
+/* The process whose work has just been done by the worker. */
+static _Thread_local csp_proc_t *csp_offload_done_proc;
+
+/* Hand the process over to `csp_monitor_poll`, which pushes it back to its
+ * core and wakes up the nearest idle one. */
+static int csp_offload_done(csp_proc_t **start, csp_proc_t **end) {
+  *start = *end = csp_offload_done_proc;
+  return 1;
+}
+
+/* Pop a request, or return NULL if the worker has been idle for
+ * `csp_offload_idle_timeout` seconds. It's called with the lock held. */
+static csp_offload_req_t *csp_offload_pop(void) {
+  while (csp_offload_pool.head == NULL) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += csp_offload_idle_timeout;
+
+    csp_offload_pool.nidle++;
+    int err = pthread_cond_timedwait(
+      &csp_offload_pool.cond, &csp_offload_pool.lock, &deadline
+    );
+    csp_offload_pool.nidle--;
+    if (err == ETIMEDOUT && csp_offload_pool.head == NULL) {
+      return NULL;
+    }
+  }
+
+  csp_offload_req_t *req = csp_offload_pool.head;
+  if ((csp_offload_pool.head = req->next) == NULL) {
+    csp_offload_pool.tail = NULL;
+  }
+  csp_offload_pool.nqueued--;
+  return req;
+}
+
+static void *csp_offload_worker(void *data) {
+  (void)data;
+  csp_monitor_poller_init();
+
+  pthread_mutex_lock(&csp_offload_pool.lock);
+  csp_offload_req_t *req;
+  while ((req = csp_offload_pop()) != NULL) {
+    pthread_mutex_unlock(&csp_offload_pool.lock);
+
+    /* Read the process first, the request is gone once it runs again. */
+    csp_offload_done_proc = req->proc;
+    req->fn(req->arg);
+    csp_monitor_poll(csp_offload_done);
+
+    pthread_mutex_lock(&csp_offload_pool.lock);
+  }
+  csp_offload_pool.nworkers--;
+  pthread_mutex_unlock(&csp_offload_pool.lock);
+
+  csp_monitor_poller_destroy();
+  return NULL;
+}
+
+static bool csp_offload_worker_start(void) {
+  pthread_t tid;
+  pthread_attr_t attr;
+
+  if (pthread_attr_init(&attr) != 0 ||
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED) != 0 ||
+    pthread_create(&tid, &attr, csp_offload_worker, NULL) != 0) {
+    return false;
+  }
+  pthread_attr_destroy(&attr);
+  return true;
+}
+
+/* Queue the request after the process has yielded, a new worker is started if
+ * all of them are busy. */
+static void csp_offload_submit(void *data) {
+  csp_offload_req_t *req = (csp_offload_req_t *)data;
+
+  pthread_mutex_lock(&csp_offload_pool.lock);
+  if (csp_offload_pool.tail == NULL) {
+    csp_offload_pool.head = req;
+  } else {
+    csp_offload_pool.tail->next = req;
+  }
+  csp_offload_pool.tail = req;
+  csp_offload_pool.nqueued++;
+
+  if (csp_offload_pool.nidle >= csp_offload_pool.nqueued) {
+    pthread_cond_signal(&csp_offload_pool.cond);
+  } else if (csp_offload_pool.nworkers < csp_offload_max_workers) {
+    if (csp_offload_worker_start()) {
+      csp_offload_pool.nworkers++;
+    } else if (csp_offload_pool.nworkers == 0) {
+      perror("libcsp failed to start the offload worker.");
+      exit(EXIT_FAILURE);
+    }
+  }
+  pthread_mutex_unlock(&csp_offload_pool.lock);
+}
+
+void csp_offload(void (*fn)(void *arg), void *arg) {
+  csp_offload_req_t req = {
+    .fn = fn, .arg = arg, .proc = csp_this_core->running, .next = NULL
+  };
+  csp_sched_park_fn(csp_offload_submit, &req);
+}
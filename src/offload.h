@@ -0,0 +1,47 @@
+/*
+ * Copyright (c) 2020, Yanhui Shi <lime.syh at gmail dot com>
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef LIBCSP_OFFLOAD_H
+#define LIBCSP_OFFLOAD_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * `offload.h` runs the blocking work which the netpoll can't help with(e.g.
+ * reading regular files and `getaddrinfo`) on a pool of worker threads. The
+ * calling process is parked meanwhile so its core keeps running the others,
+ * and it's pushed back to the core it ran on last time when the work is done.
+ *
+ * The workers are started on demand, at most `csp_offload_max_workers` ones,
+ * and the idle ones exit after `csp_offload_idle_timeout` seconds.
+ */
+
+#define csp_offload_max_workers   64
+#define csp_offload_idle_timeout  10
+
+/* Call `fn(arg)` on a worker thread and park the running process until it
+ * returns. `fn` runs outside of libcsp, so it must not use any scheduling
+ * method or channel. */
+void csp_offload(void (*fn)(void *arg), void *arg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -16,16 +16,87 @@
  */
 
 #include <errno.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/mman.h>
 #include "core.h"
 #include "proc.h"
+#include "trace.h"
 
 /* Total processes generated by libcsp plugin. */
 extern size_t csp_procs_num;
-/* Process size generated by libcsp plugin which is guaranteed to be 4k-bytes
- * alignment. */
-extern size_t csp_procs_size[];
+/* The sizes and the flags of the processes generated by libcsp plugin. */
+extern csp_proc_meta_t csp_procs_meta[];
+/* The size of the elastic stacks generated by libcsp plugin. */
+extern size_t csp_elastic_stack_size;
+
+#ifdef csp_with_default_fenv
+#if !defined(__aarch64__)
+__attribute__((visibility("hidden")))
+const uint32_t csp_proc_fenv_default[2] = {0x1f80, 0x037f};
+#endif
+#endif
+
+/*
+ * The processes whose stack usages can't be bounded statically, e.g. the
+ * recursive ones, have the size 0 in `csp_procs_meta` when `cspcli analyze
+ * --elastic-stack-size` is set. They get their own mappings instead, which
+ * are only reserved and faulted in by the kernel as the stacks grow. The
+ * lowest page is a guard page, so an overflow crashes rather than corrupting
+ * the memory of other processes.
+ */
+#define csp_proc_guard_size 4096
+#define csp_proc_elastic_new(size) ({                                          \
+  uintptr_t base_ = (uintptr_t)NULL;                                           \
+  void *addr_ = mmap(NULL, (size), PROT_READ|PROT_WRITE,                       \
+    MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE|MAP_STACK, -1, 0                   \
+  );                                                                           \
+  if (addr_ != MAP_FAILED) {                                                   \
+    if (mprotect(addr_, csp_proc_guard_size, PROT_NONE) == 0) {                \
+      base_ = (uintptr_t)addr_;                                                \
+    } else {                                                                   \
+      munmap(addr_, (size));                                                   \
+    }                                                                          \
+  }                                                                            \
+  base_;                                                                       \
+})
+
+#define csp_proc_size(id) ({                                                   \
+  size_t size_ = csp_procs_meta[id].size;                                      \
+  size_ == 0 ? csp_elastic_stack_size : size_;                                 \
+})                                                                             \
+
+/*
+ * The exited processes are kept in the per-core caches indexed by their ids,
+ * so spawning the same function again and again takes the memory back with a
+ * pop instead of going through the allocator. A cache keeps at most
+ * `csp_proc_cache_cap` processes or `csp_proc_cache_max_size` bytes, but at
+ * least one process. Only the cores of the processor a process was born on
+ * cache it, so the memory still goes back to its heap at last. The caches are
+ * shared by the cores of a processor like the runqs, so they follow the
+ * processor when a spare core takes over it, see `csp_core_t.proc_caches`.
+ *
+ * The bytes bound all the processes, and the flags only choose how many of
+ * them are kept within it. The processes which may block live long and exit
+ * one by one, so `csp_proc_cache_blocking_cap` of them are enough. Those which
+ * never block are usually spawned in bursts for short work and all of them
+ * exit within a round of the scheduler, so they take as many as the bytes
+ * allow.
+ */
+#define csp_proc_cache_cap           64
+#define csp_proc_cache_blocking_cap  16
+#define csp_proc_cache_max_size      (1 << 20)
+#define csp_proc_cache_len_max(size) ({                                        \
+  size_t len_ = csp_proc_cache_max_size / (size);                              \
+  len_ == 0 ? 1 : (len_ > csp_proc_cache_cap ? csp_proc_cache_cap : len_);     \
+})
+
+#define csp_proc_cache_len(id) ({                                              \
+  size_t max_ = csp_proc_cache_len_max(csp_proc_size(id));                     \
+  (csp_procs_meta[id].flags & csp_proc_meta_nonblocking) ||                    \
+    max_ < csp_proc_cache_blocking_cap ? max_ : csp_proc_cache_blocking_cap;   \
+})
 
 extern _Thread_local csp_core_t *csp_this_core;
 
@@ -34,26 +105,88 @@ extern void *csp_mem_alloc(size_t pid, size_t size);
 extern void csp_mem_free(size_t pid, void *obj);
 #endif
 
+/* Return the cached process of `id` or NULL if there is none. */
+static inline csp_proc_t *csp_proc_cache_get(csp_core_t *this_core, int id) {
+  csp_proc_cache_t *caches = this_core->proc_caches;
+  if (caches == NULL || caches[id].len == 0) {
+    return NULL;
+  }
+  csp_proc_t *proc = caches[id].procs;
+  caches[id].procs = proc->next;
+  caches[id].len--;
+  return proc;
+}
+
+/* Cache the exited process. It returns `false` if the cache is full. */
+static inline bool csp_proc_cache_put(csp_core_t *this_core,
+    csp_proc_t *proc) {
+  csp_proc_cache_t *caches = this_core->proc_caches;
+  if (csp_unlikely(caches == NULL)) {
+    return false;
+  }
+
+  csp_proc_cache_t *cache = &caches[proc->id];
+  if (cache->len >= csp_proc_cache_len(proc->id)) {
+    return false;
+  }
+  proc->next = cache->procs;
+  cache->procs = proc;
+  cache->len++;
+  return true;
+}
+
+/* The offsets hard-coded in the assembly code. */
+_Static_assert(offsetof(csp_proc_t, is_new) == 0x10, "is_new");
+_Static_assert(offsetof(csp_proc_t, fenv) == 0x14, "fenv");
+_Static_assert(offsetof(csp_proc_t, registers) == 0x18, "registers");
+#if defined(__aarch64__)
+_Static_assert(offsetof(csp_proc_t, registers.callee_saved.lr) == 0x68, "lr");
+_Static_assert(offsetof(csp_proc_t, registers.caller_saved.lr) == 0x68, "lr");
+_Static_assert(offsetof(csp_proc_t, fpcr) == 0xb0, "fpcr");
+_Static_assert(offsetof(csp_proc_t, timer) == 0xb8, "timer");
+_Static_assert(sizeof(csp_proc_t) == 40 << 3, "csp_proc_t_size of sa.hpp");
+#else
+_Static_assert(offsetof(csp_proc_t, mxcsr) == 0x48, "mxcsr");
+_Static_assert(offsetof(csp_proc_t, timer) == 0x50, "timer");
+_Static_assert(sizeof(csp_proc_t) == 24 << 3, "csp_proc_t_size of sa.hpp");
+#endif
+
 csp_proc_t *csp_proc_new(int id, bool waited_by_parent) {
   csp_core_t *this_core = csp_this_core;
-  size_t size = csp_procs_size[id];
+  csp_core_enter(this_core);
+  csp_proc_t *proc = csp_proc_cache_get(this_core, id);
+
+  if (proc == NULL) {
+    size_t size = csp_proc_size(id);
+    uintptr_t base;
 
+    if (csp_unlikely(csp_procs_meta[id].size == 0)) {
+      base = csp_proc_elastic_new(size);
+    } else {
 #ifdef csp_with_sysmalloc
-  uintptr_t base = (uintptr_t)malloc(size);
+      base = (uintptr_t)aligned_alloc(64, size);
 #else
-  uintptr_t base = (uintptr_t)csp_mem_alloc(this_core->pid, size);
+      base = (uintptr_t)csp_mem_alloc(this_core->pid, size);
 #endif
+    }
 
-  if (base == (uintptr_t)NULL) {
-    errno = ENOMEM;
-    perror("libcsp failed to alloc new proc.");
-    exit(EXIT_FAILURE);
+    if (base == (uintptr_t)NULL) {
+      errno = ENOMEM;
+      perror("libcsp failed to alloc new proc.");
+      exit(EXIT_FAILURE);
+    }
+
+    proc = (csp_proc_t *)(base + size - sizeof(csp_proc_t));
+    proc->base = base;
+    proc->id = id;
+    proc->borned_pid = this_core->pid;
+#ifdef csp_with_default_fenv
+    proc->fenv = csp_procs_meta[id].flags & csp_proc_meta_fenv;
+#endif
   }
 
-  csp_proc_t *proc = (csp_proc_t *)(base + size - sizeof(csp_proc_t));
-  proc->base = base;
   proc->is_new = true;
-  proc->borned_pid = this_core->pid;
+  proc->last_pid = this_core->pid;
   atomic_store(&proc->stat, csp_proc_stat_none);
 
   /* We should make sure %rbp is 16-bytes alignment. */
@@ -67,55 +200,108 @@ csp_proc_t *csp_proc_new(int id, bool waited_by_parent) {
   }
   proc->pre = proc->next = NULL;
 
+  /* The children inherit the priority class of the creator by default. */
+  csp_proc_t *creator = this_core->running;
+  proc->prio = proc->spawn_prio = creator != NULL ?
+    creator->spawn_prio : csp_proc_prio_normal;
+
 #ifdef csp_enable_valgrind
   proc->valgrind_stack = VALGRIND_STACK_REGISTER(proc->base, proc);
 #endif
+  csp_trace(create, proc);
+  csp_core_leave(this_core);
   return proc;
 }
 
+/* The extra one is released by the scheduler after the process yields. See
+ * `csp_sched_get`. */
 __attribute__((noinline,used)) void csp_proc_nchild_set(size_t nchild) {
-  atomic_store(&csp_this_core->running->nchild, nchild);
+  atomic_store(&csp_this_core->running->nchild, nchild + 1);
 }
 
+#if defined(__aarch64__)
 __attribute__((naked)) void csp_proc_restore(csp_proc_t *proc) {
   __asm__ __volatile__(
-    "ldmxcsr 0x18(%rdi)\n"
-    "fldcw   0x1c(%rdi)\n"
-    "mov     0x20(%rdi), %rsp\n"
-    "mov     0x28(%rdi), %rbp\n"
-
-    /* Load `is_new` and check it. */
-    "mov  0x10(%rdi), %rax\n"
-    "test %eax, %eax\n"
+    csp_proc_restore_fenv("x0")
+    "ldp x9, x29, [x0, #0x00]\n"
+    "mov sp, x9\n"
+    "ldr x30, [x0, #0x68]\n"
+
+    /* Check `is_new`, the same as x86_64. */
+    "ldr w9, [x0, #0x10]\n"
+    "cbnz w9, 1f\n"
+
+    "ldp x19, x20, [x0, #0x18]\n"
+    "ldp x21, x22, [x0, #0x28]\n"
+    "ldp x23, x24, [x0, #0x38]\n"
+    "ldp x25, x26, [x0, #0x48]\n"
+    "ldp x27, x28, [x0, #0x58]\n"
+    "ldp d8,  d9,  [x0, #0x70]\n"
+    "ldp d10, d11, [x0, #0x80]\n"
+    "ldp d12, d13, [x0, #0x90]\n"
+    "ldp d14, d15, [x0, #0xa0]\n"
+    "ret\n"
+
+    /* Otherwise, restore the arguments and jump to the entry in the link
+     * register. */
+    "1: str wzr, [x0, #0x10]\n" // Set `is_new` to 0.
+    "ldp x6, x7, [x0, #0x48]\n"
+    "ldp x4, x5, [x0, #0x38]\n"
+    "ldp x2, x3, [x0, #0x28]\n"
+    "ldp x0, x1, [x0, #0x18]\n" // Restore x0 at the last step.
+    "ret\n"
+  );
+}
+#else
+__attribute__((naked)) void csp_proc_restore(csp_proc_t *proc) {
+  __asm__ __volatile__(
+    csp_proc_restore_fenv("rdi")
+    "mov     0x00(%rdi), %rsp\n"
+    "mov     0x08(%rdi), %rbp\n"
+
+    /* Check `is_new`. */
+    "cmpl $0, 0x10(%rdi)\n"
     "jne  1f\n"
 
     /* If it's 0, restore remain callee-saved registers. At most cases, we are
      * likely to yield many times in a process, so we put this code ahead to
      * achieve better performance according to the Branch Prediction model. */
-    "mov 0x30(%rdi), %rbx\n"
-    "mov 0x38(%rdi), %r12\n"
-    "mov 0x40(%rdi), %r13\n"
-    "mov 0x48(%rdi), %r14\n"
-    "mov 0x50(%rdi), %r15\n"
+    "mov 0x18(%rdi), %rbx\n"
+    "mov 0x20(%rdi), %r12\n"
+    "mov 0x28(%rdi), %r13\n"
+    "mov 0x30(%rdi), %r14\n"
+    "mov 0x38(%rdi), %r15\n"
     "retq\n"
 
     /* Otherwise, restore caller-saved registers. */
-    "1: movq $0, 0x10(%rdi)\n" // Set `is_new` to 0.
-    "mov 0x38(%rdi), %rsi\n"
-    "mov 0x40(%rdi), %rdx\n"
-    "mov 0x48(%rdi), %rcx\n"
-    "mov 0x50(%rdi), %r8\n"
-    "mov 0x58(%rdi), %r9\n"
-    "mov 0x30(%rdi), %rdi\n" // Restore %rdi at the last step.
+    "1: movl $0, 0x10(%rdi)\n" // Set `is_new` to 0.
+    "mov 0x20(%rdi), %rsi\n"
+    "mov 0x28(%rdi), %rdx\n"
+    "mov 0x30(%rdi), %rcx\n"
+    "mov 0x38(%rdi), %r8\n"
+    "mov 0x40(%rdi), %r9\n"
+    "mov 0x18(%rdi), %rdi\n" // Restore %rdi at the last step.
     "retq\n"
   );
 }
+#endif
 
 __attribute__((noinline)) void csp_proc_destroy(csp_proc_t *proc) {
 #ifdef csp_enable_valgrind
   VALGRIND_STACK_DEREGISTER(proc->valgrind_stack);
 #endif
 
+  csp_core_t *this_core = csp_this_core;
+  if (this_core != NULL && this_core->pid == proc->borned_pid &&
+      csp_proc_cache_put(this_core, proc)) {
+    return;
+  }
+
+  if (csp_unlikely(csp_procs_meta[proc->id].size == 0)) {
+    munmap((void *)proc->base, csp_elastic_stack_size);
+    return;
+  }
+
 #ifdef csp_with_sysmalloc
   free((void *)proc->base);
 #else
@@ -43,6 +43,13 @@ extern "C" {
 #define csp_proc_timer_token_cas(p, old, new)                                  \
   atomic_compare_exchange_weak(&((p)->timer.token), &old, new)
 
+/* The priority classes of processes. A class is scheduled before the lower
+ * ones, see `csp_sched_pop_local`. */
+#define csp_proc_prio_latency           0
+#define csp_proc_prio_normal            1
+#define csp_proc_prio_background        2
+#define csp_proc_prio_num               3
+
 #define csp_proc_stat_none              0
 #define csp_proc_stat_netpoll_waiting   1
 #define csp_proc_stat_netpoll_avail     2
@@ -52,16 +59,111 @@ extern "C" {
 #define csp_proc_stat_cas(proc, oval, nval)                                    \
   atomic_compare_exchange_weak(&(proc)->stat, &(oval), nval)
 
+/*
+ * The metadata of the processes generated by `cspcli analyze` to `config.c`,
+ * indexed by the ids assigned by libcsp plugin. `size` is the stack size which
+ * is 4k-bytes aligned, or 64-bytes aligned if it's smaller than a page, and 0
+ * means an elastic stack. The flags are,
+ *
+ *  - `csp_proc_meta_fenv`: the process may change its FP environment.
+ *  - `csp_proc_meta_nonblocking`: the process never parks itself, e.g. on a
+ *    channel or a timer, though it may still be preempted.
+ */
+#define csp_proc_meta_fenv              0x01
+#define csp_proc_meta_nonblocking       0x02
+
+typedef struct {
+  size_t size, flags;
+} csp_proc_meta_t;
+
+/*
+ * The MXCSR register and the x87 control word(the FPCR register on AArch64)
+ * are saved and restored on every switch by default, which is slow since
+ * `ldmxcsr`, `fldcw` and `msr fpcr` serialize the pipeline. With
+ * `csp_with_default_fenv` all processes are assumed to run in the default
+ * floating-point environment, except the ones calling the `fe*` functions of
+ * <fenv.h> which are flagged with `csp_proc_meta_fenv` by `cspcli`. Only
+ * they switch the environment, and they put the default one back when they
+ * are switched out.
+ */
+#if defined(__aarch64__)
+/* The default FPCR is 0 on Linux. */
+#ifdef csp_with_default_fenv
+#define csp_proc_save_fenv(reg)                                                \
+  "ldr     w9, ["reg", #0x14]\n"                                               \
+  "cbz     w9, 9f\n"                                                           \
+  "mrs     x9, fpcr\n"                                                         \
+  "str     w9, ["reg", #0xb0]\n"                                               \
+  "msr     fpcr, xzr\n"                                                        \
+  "9:\n"
+#define csp_proc_restore_fenv(reg)                                             \
+  "ldr     w9, ["reg", #0x14]\n"                                               \
+  "cbz     w9, 9f\n"                                                           \
+  "ldr     w9, ["reg", #0xb0]\n"                                               \
+  "msr     fpcr, x9\n"                                                         \
+  "9:\n"
+#else
+#define csp_proc_save_fenv(reg)                                                \
+  "mrs     x9, fpcr\n"                                                         \
+  "str     w9, ["reg", #0xb0]\n"
+#define csp_proc_restore_fenv(reg)                                             \
+  "ldr     w9, ["reg", #0xb0]\n"                                               \
+  "msr     fpcr, x9\n"
+#endif
+
+/* Save the callee-saved registers x19-x28 and d8-d15 of AAPCS64, and the link
+ * register to which `csp_proc_restore` returns. */
+#define csp_proc_save(reg)                                                     \
+  "mov     x9, sp\n"                                                           \
+  "stp     x9,  x29, ["reg", #0x00]\n"                                         \
+  "stp     x19, x20, ["reg", #0x18]\n"                                         \
+  "stp     x21, x22, ["reg", #0x28]\n"                                         \
+  "stp     x23, x24, ["reg", #0x38]\n"                                         \
+  "stp     x25, x26, ["reg", #0x48]\n"                                         \
+  "stp     x27, x28, ["reg", #0x58]\n"                                         \
+  "str     x30,      ["reg", #0x68]\n"                                         \
+  "stp     d8,  d9,  ["reg", #0x70]\n"                                         \
+  "stp     d10, d11, ["reg", #0x80]\n"                                         \
+  "stp     d12, d13, ["reg", #0x90]\n"                                         \
+  "stp     d14, d15, ["reg", #0xa0]\n"                                         \
+  csp_proc_save_fenv(reg)                                                      \
+
+#else
+#ifdef csp_with_default_fenv
+#define csp_proc_save_fenv(reg)                                                \
+  "cmpl    $0, 0x14(%"reg")\n"                                                 \
+  "je      9f\n"                                                               \
+  "stmxcsr 0x48(%"reg")\n"                                                     \
+  "fstcw   0x4c(%"reg")\n"                                                     \
+  "ldmxcsr csp_proc_fenv_default(%rip)\n"                                      \
+  "fldcw   csp_proc_fenv_default+4(%rip)\n"                                    \
+  "9:\n"
+#define csp_proc_restore_fenv(reg)                                             \
+  "cmpl    $0, 0x14(%"reg")\n"                                                 \
+  "je      9f\n"                                                               \
+  "ldmxcsr 0x48(%"reg")\n"                                                     \
+  "fldcw   0x4c(%"reg")\n"                                                     \
+  "9:\n"
+#else
+#define csp_proc_save_fenv(reg)                                                \
+  "stmxcsr 0x48(%"reg")\n"                                                     \
+  "fstcw   0x4c(%"reg")\n"
+#define csp_proc_restore_fenv(reg)                                             \
+  "ldmxcsr 0x48(%"reg")\n"                                                     \
+  "fldcw   0x4c(%"reg")\n"
+#endif
+
 #define csp_proc_save(reg)                                                     \
-  "stmxcsr   0x18(%"reg")\n"                                                   \
-  "fstcw     0x1c(%"reg")\n"                                                   \
-  "mov %rsp, 0x20(%"reg")\n"                                                   \
-  "mov %rbp, 0x28(%"reg")\n"                                                   \
-  "mov %rbx, 0x30(%"reg")\n"                                                   \
-  "mov %r12, 0x38(%"reg")\n"                                                   \
-  "mov %r13, 0x40(%"reg")\n"                                                   \
-  "mov %r14, 0x48(%"reg")\n"                                                   \
-  "mov %r15, 0x50(%"reg")\n"                                                   \
+  "mov %rsp, 0x00(%"reg")\n"                                                   \
+  "mov %rbp, 0x08(%"reg")\n"                                                   \
+  "mov %rbx, 0x18(%"reg")\n"                                                   \
+  "mov %r12, 0x20(%"reg")\n"                                                   \
+  "mov %r13, 0x28(%"reg")\n"                                                   \
+  "mov %r14, 0x30(%"reg")\n"                                                   \
+  "mov %r15, 0x38(%"reg")\n"                                                   \
+  csp_proc_save_fenv(reg)                                                      \
+
+#endif
 
 /*
  * Memory layout of the process is:
@@ -93,6 +195,11 @@ extern "C" {
  *
  *  - Stack: The stack of the process.
  *
+ *  On AArch64 the return address is kept in the link register instead of the
+ *  stack, and AAPCS64 requires `sp mod 16 = 0` at all times, so the reserved
+ *  space only holds the memory arguments(in the increasing order starting at
+ *  `sp`) rounded up to 16 bytes.
+ *
  *  NOTE:
  *
  *  - Actually `Return Address` and `Memory Arguments` is a part of the stack
@@ -101,13 +208,19 @@ extern "C" {
  *    `plugin/sa.hpp`, so if we add fields to or remove fields from the struct
  *    `csp_proc_t`, DO NOT forget to modify the variable `csp_proc_t_size`
  *    in `stack_analyzer_t.analyze()` manually.
+ *  - The fields touched by a switch come first, and the struct is aligned to
+ *    64 bytes, so resuming a process which has ran reads one cache line(plus
+ *    the FP environment at 0x48 without `csp_with_default_fenv`; the AArch64
+ *    context spans three lines). The offsets are hard-coded in
+ *    `csp_proc_save`, `csp_proc_restore` and the wrappers generated by
+ *    `plugin/proc.hpp`.
  */
-typedef struct csp_proc_t {
-  /* The address malloced from operating system. */
-  uint64_t base;
+typedef struct __attribute__((aligned(64))) csp_proc_t {
+  /* The rsp register(sp on AArch64). */
+  uint64_t rsp;
 
-  /* The id of CPU processor on which this process is created. */
-  uint64_t borned_pid;
+  /* The rbp register(the frame pointer x29 on AArch64). */
+  uint64_t rbp;
 
   /* Whether the process is a new proces.
    *
@@ -116,20 +229,30 @@ typedef struct csp_proc_t {
    *
    * When it is 0, it means the process has ran at least once, and the scheduler
    * should restore the callee-saved registers. */
-  uint64_t is_new;
-
-  /* The MXCSR register. */
-  uint32_t mxcsr;
-
-  /* The x87 FPU Control Word. */
-  uint32_t x87cw;
+  uint32_t is_new;
 
-  /* The rsp register. */
-  uint64_t rsp;
+  /* Whether the process switches its own FP environment. It's only used with
+   * `csp_with_default_fenv`. */
+  uint32_t fenv;
 
-  /* The rbp register. */
-  uint64_t rbp;
+#if defined(__aarch64__)
+  /* Callee-saved or caller-saved registers depending on `is_new`. The link
+   * register is at the same offset in both, it's the entry of a new process.
+   * The lower 64 bits of v8-v15 are saved as d8-d15. */
+  union {
+    struct {
+      uint64_t x19, x20, x21, x22, x23, x24, x25, x26, x27, x28, lr;
+      uint64_t d8, d9, d10, d11, d12, d13, d14, d15;
+    } callee_saved;
+    struct {
+      uint64_t x0, x1, x2, x3, x4, x5, x6, x7, reserved[2], lr;
+    } caller_saved;
+  } registers;
 
+  /* The FPCR register. */
+  uint32_t fpcr;
+  uint32_t reserved;
+#else
   /* Callee-saved or caller-saved registers depending on `is_new`. */
   union {
     struct { uint64_t rbx, r12, r13, r14, r15; } callee_saved;
@@ -138,9 +261,22 @@ typedef struct csp_proc_t {
     struct { uint64_t rdi, rsi, rdx, rcx, r8, r9; } caller_saved;
   } registers;
 
+  /* The MXCSR register. */
+  uint32_t mxcsr;
+
+  /* The x87 FPU Control Word. */
+  uint32_t x87cw;
+#endif
+
   /* The Timer information. */
   struct { int64_t when, idx; atomic_int_fast64_t token; } timer;
 
+  /* The address malloced from operating system. */
+  uint64_t base;
+
+  /* The id of CPU processor on which this process is created. */
+  uint64_t borned_pid;
+
   /* The waiting parent process. */
   struct csp_proc_t *parent;
 
@@ -153,12 +289,39 @@ typedef struct csp_proc_t {
   /* The state of process. */
   atomic_uint_fast64_t stat;
 
+  /* The id of CPU processor on which this process ran last time. */
+  uint64_t last_pid;
+
+  /* The id assigned by libcsp plugin, i.e. the index in `csp_procs_meta`. */
+  uint64_t id;
+
+  /* The priority class of the process, and the one of the processes created
+   * by it, see `csp_sched_spawn_prio_set`. */
+  uint32_t prio, spawn_prio;
+
+#ifdef csp_with_latency_stats
+  /* When the process was put to a runq, see `csp_stats_latency`. */
+  int64_t queued_at;
+#endif
+
 #ifdef csp_enable_valgrind
   /* The id returned by VALGRIND_STACK_REGISTER. */
   uint64_t valgrind_stack;
 #endif
 } csp_proc_t;
 
+/* The exited processes of a process id kept for reuse, see
+ * `csp_proc_cache_put`. */
+typedef struct {
+  size_t len;
+  csp_proc_t *procs;
+} csp_proc_cache_t;
+
+#if defined(csp_with_default_fenv) && !defined(__aarch64__)
+/* The default MXCSR and x87 control word. */
+extern const uint32_t csp_proc_fenv_default[2];
+#endif
+
 void csp_proc_nchild_set(size_t nchild);
 
 #ifdef __cplusplus
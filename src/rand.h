@@ -19,7 +19,7 @@
 #define LIBCSP_RAND_H
 
 #include <stdint.h>
-#include "mutex.h"
+#include "spinlock.h"
 
 /*
  * `csp_rand_t` implements the `xoshiro256**` algorithm.
@@ -27,7 +27,7 @@
  */
 typedef struct {
   uint64_t state[4];
-  csp_mutex_t mutex;
+  csp_spinlock_t mutex;
 } csp_rand_t;
 
 /* `csp_rand_init` initializes the random number generator. It is NOT
@@ -28,21 +28,49 @@ extern "C" {
 #include <stdlib.h>
 #include <string.h>
 #include "common.h"
+#include "spinlock.h"
 
 /*
  * `rbq.h` implements a high performance lock-freed ring buffer queue inspired
  * by Disruptor.
  *
- * It implements five kinds of ring buffer queue. i.e,
+ * It implements seven kinds of ring buffer queue. i.e,
  * - rrbq:  Raw                               Ring Buffer Queue.
  * - ssrbq: Single   writer  Single   reader  Ring Buffer Queue.
  * - smrbq: Single   writer  Multiple readers Ring Buffer Queue.
  * - msrbq: Multiple writers Single   reader  Ring Buffer Queue.
  * - mmrbq: Multiple writers Multiple readers Ring Buffer Queue.
+ * - elrbq: Elastic  writers and     readers  Ring Buffer Queue.
+ * - fcrbq: Flat     Combining                 Ring Buffer Queue.
  *
  * `rrbq` is just a traditional ring buffer and it's not thread-safe.
  * `ssrbq`, `smrbq`, `msrbq` and `mmrbq` are thread-safe, you can use them in
  * different processes.
+ *
+ * `elrbq` is an `rrbq` guarded by a spinlock for any writers and readers. Its
+ * ring starts small and doubles when a push doesn't fit, up to `2^cap_exp`
+ * slots, and halves back when it stays mostly empty, so a queue sized for the
+ * worst burst only takes the memory it needs. The ring is never resized while
+ * some slots are claimed, and the claim of a writer or reader holds back the
+ * other writers or readers until it's committed or released.
+ *
+ * `fcrbq` is an `mmrbq` with flat combining in front of `try_push` and
+ * `try_pop`. A writer posts its item in a publication record and one of the
+ * writers, the combiner, pushes the items of all the posted records with one
+ * claim, while the others spin on their own records. The readers are combined
+ * in the same way. So under heavy contention the shared sequences are touched
+ * once per batch instead of once per item, at the cost of scanning the records
+ * by the combiner, which is why it has to be chosen explicitly.
+ *
+ * Besides copying items in and out, the thread-safe queues can hand out the
+ * slots themselves as Disruptor does. `try_reserve` claims up to `n` slots for
+ * a writer to fill in place and `commit` publishes them, while `try_peek`
+ * claims up to `n` items for a reader to use in place and `release` gives the
+ * slots back to the writers. The slots handed out are always contiguous, so
+ * fewer than `n` are claimed near the end of the ring. A queue with a single
+ * writer or reader must commit or release a claim before making the next one,
+ * and a claim held by one of multiple writers or readers holds back the claims
+ * made after it.
  */
 
 #define csp_ssrbq_declare(T, I)     csp_rbq_declare(ss, T, I, s, s)
@@ -57,6 +85,12 @@ extern "C" {
 #define csp_ssrbq_pushm(I)          csp_rbq_name(ss, pushm, I)
 #define csp_ssrbq_try_popm(I)       csp_rbq_name(ss, try_popm, I)
 #define csp_ssrbq_popm(I)           csp_rbq_name(ss, popm, I)
+#define csp_ssrbq_try_reserve(I)    csp_rbq_name(ss, try_reserve, I)
+#define csp_ssrbq_commit(I)         csp_rbq_name(ss, commit, I)
+#define csp_ssrbq_try_peek(I)       csp_rbq_name(ss, try_peek, I)
+#define csp_ssrbq_release(I)        csp_rbq_name(ss, release, I)
+#define csp_ssrbq_is_full(I)        csp_rbq_name(ss, is_full, I)
+#define csp_ssrbq_is_empty(I)       csp_rbq_name(ss, is_empty, I)
 #define csp_ssrbq_destroy(I)        csp_rbq_name(ss, destroy, I)
 
 #define csp_smrbq_declare(T, I)     csp_rbq_declare(sm, T, I, s, m)
@@ -71,6 +105,12 @@ extern "C" {
 #define csp_smrbq_pushm(I)          csp_rbq_name(sm, pushm, I)
 #define csp_smrbq_try_popm(I)       csp_rbq_name(sm, try_popm, I)
 #define csp_smrbq_popm(I)           csp_rbq_name(sm, popm, I)
+#define csp_smrbq_try_reserve(I)    csp_rbq_name(sm, try_reserve, I)
+#define csp_smrbq_commit(I)         csp_rbq_name(sm, commit, I)
+#define csp_smrbq_try_peek(I)       csp_rbq_name(sm, try_peek, I)
+#define csp_smrbq_release(I)        csp_rbq_name(sm, release, I)
+#define csp_smrbq_is_full(I)        csp_rbq_name(sm, is_full, I)
+#define csp_smrbq_is_empty(I)       csp_rbq_name(sm, is_empty, I)
 #define csp_smrbq_destroy(I)        csp_rbq_name(sm, destroy, I)
 
 #define csp_msrbq_declare(T, I)     csp_rbq_declare(ms, T, I, m, s)
@@ -85,6 +125,12 @@ extern "C" {
 #define csp_msrbq_pushm(I)          csp_rbq_name(ms, pushm, I)
 #define csp_msrbq_try_popm(I)       csp_rbq_name(ms, try_popm, I)
 #define csp_msrbq_popm(I)           csp_rbq_name(ms, popm, I)
+#define csp_msrbq_try_reserve(I)    csp_rbq_name(ms, try_reserve, I)
+#define csp_msrbq_commit(I)         csp_rbq_name(ms, commit, I)
+#define csp_msrbq_try_peek(I)       csp_rbq_name(ms, try_peek, I)
+#define csp_msrbq_release(I)        csp_rbq_name(ms, release, I)
+#define csp_msrbq_is_full(I)        csp_rbq_name(ms, is_full, I)
+#define csp_msrbq_is_empty(I)       csp_rbq_name(ms, is_empty, I)
 #define csp_msrbq_destroy(I)        csp_rbq_name(ms, destroy, I)
 
 #define csp_mmrbq_declare(T, I)     csp_rbq_declare(mm, T, I, m, m)
@@ -99,6 +145,12 @@ extern "C" {
 #define csp_mmrbq_pushm(I)          csp_rbq_name(mm, pushm, I)
 #define csp_mmrbq_try_popm(I)       csp_rbq_name(mm, try_popm, I)
 #define csp_mmrbq_popm(I)           csp_rbq_name(mm, popm, I)
+#define csp_mmrbq_try_reserve(I)    csp_rbq_name(mm, try_reserve, I)
+#define csp_mmrbq_commit(I)         csp_rbq_name(mm, commit, I)
+#define csp_mmrbq_try_peek(I)       csp_rbq_name(mm, try_peek, I)
+#define csp_mmrbq_release(I)        csp_rbq_name(mm, release, I)
+#define csp_mmrbq_is_full(I)        csp_rbq_name(mm, is_full, I)
+#define csp_mmrbq_is_empty(I)       csp_rbq_name(mm, is_empty, I)
 #define csp_mmrbq_destroy(I)        csp_rbq_name(mm, destroy, I)
 
 #define csp_rrbq_declare(T, I)      csp_rrbq_declare_inner(T, I)
@@ -110,10 +162,62 @@ extern "C" {
 #define csp_rrbq_try_push_front(I)  csp_rbq_name(r, try_push_front, I)
 #define csp_rrbq_try_pop(I)         csp_rbq_name(r, try_pop, I)
 #define csp_rrbq_try_grow(I)        csp_rbq_name(r, try_grow, I)
+#define csp_rrbq_try_shrink(I)      csp_rbq_name(r, try_shrink, I)
 #define csp_rrbq_destroy(I)         csp_rbq_name(r, destroy, I)
 
+#define csp_elrbq_declare(T, I)     csp_elrbq_declare_inner(T, I)
+#define csp_elrbq_define(T, I)      csp_elrbq_define_inner(T, I)
+#define csp_elrbq_t(I)              csp_rbq_name(el, t, I)
+#define csp_elrbq_new(I)            csp_rbq_name(el, new, I)
+#define csp_elrbq_try_push(I)       csp_rbq_name(el, try_push, I)
+#define csp_elrbq_try_pop(I)        csp_rbq_name(el, try_pop, I)
+#define csp_elrbq_try_pushm(I)      csp_rbq_name(el, try_pushm, I)
+#define csp_elrbq_try_popm(I)       csp_rbq_name(el, try_popm, I)
+#define csp_elrbq_try_reserve(I)    csp_rbq_name(el, try_reserve, I)
+#define csp_elrbq_commit(I)         csp_rbq_name(el, commit, I)
+#define csp_elrbq_try_peek(I)       csp_rbq_name(el, try_peek, I)
+#define csp_elrbq_release(I)        csp_rbq_name(el, release, I)
+#define csp_elrbq_is_full(I)        csp_rbq_name(el, is_full, I)
+#define csp_elrbq_is_empty(I)       csp_rbq_name(el, is_empty, I)
+#define csp_elrbq_destroy(I)        csp_rbq_name(el, destroy, I)
+
+#define csp_fcrbq_declare(T, I)     csp_fcrbq_declare_inner(T, I)
+#define csp_fcrbq_define(T, I)      csp_fcrbq_define_inner(T, I)
+#define csp_fcrbq_t(I)              csp_rbq_name(fc, t, I)
+#define csp_fcrbq_new(I)            csp_rbq_name(fc, new, I)
+#define csp_fcrbq_try_push(I)       csp_rbq_name(fc, try_push, I)
+#define csp_fcrbq_try_pop(I)        csp_rbq_name(fc, try_pop, I)
+#define csp_fcrbq_try_pushm(I)      csp_rbq_name(fc, try_pushm, I)
+#define csp_fcrbq_try_popm(I)       csp_rbq_name(fc, try_popm, I)
+#define csp_fcrbq_try_reserve(I)    csp_rbq_name(fc, try_reserve, I)
+#define csp_fcrbq_commit(I)         csp_rbq_name(fc, commit, I)
+#define csp_fcrbq_try_peek(I)       csp_rbq_name(fc, try_peek, I)
+#define csp_fcrbq_release(I)        csp_rbq_name(fc, release, I)
+#define csp_fcrbq_is_full(I)        csp_rbq_name(fc, is_full, I)
+#define csp_fcrbq_is_empty(I)       csp_rbq_name(fc, is_empty, I)
+#define csp_fcrbq_destroy(I)        csp_rbq_name(fc, destroy, I)
+
+/* A combining queue has `2^csp_fcrbq_records_exp` publication records, and a
+ * request spins `csp_fcrbq_spins` times for a combiner before it's withdrawn
+ * and made on the ring directly. */
+#ifndef csp_fcrbq_records_exp
+#define csp_fcrbq_records_exp       6
+#endif
+#define csp_fcrbq_records           (1 << csp_fcrbq_records_exp)
+#define csp_fcrbq_spins             128
+
+/* The initial ring of an elastic queue has at most 2^3 slots, and it's only
+ * shrunk after `cap` pops in a row with at most a quarter of it in use. */
+#define csp_elrbq_min_cap_exp       3
+
 #define csp_rbq_cap(rbq)            ((rbq)->cap)
 
+/* The claim made by `try_reserve` or `try_peek`. */
+typedef struct {
+  uint_fast64_t seq;
+  size_t len;
+} csp_rbq_rsv_t;
+
 /*-------------------------------- csp_rbq_seq -------------------------------*/
 
 typedef char csp_rbq_padding_t[56];
@@ -142,7 +246,8 @@ typedef struct {
 #define csp_rbq_sptr_mark_avail(ptr, seqv, mask)                               \
   csp_rbq_sptr_barr_set(ptr, csp_rbq_sptr_next_get(ptr))
 #define csp_rbq_sptr_markm_avail(ptr, start, end, mask)                        \
-  csp_rbq_sptr_barr_set(ptr, csp_rbq_sptr_next_get(ptr))
+  ((void)(start), (void)(end),                                                 \
+   csp_rbq_sptr_barr_set(ptr, csp_rbq_sptr_next_get(ptr)))
 #define csp_rbq_sptr_next_rsv(ptr, curr, n)                                    \
   ({ csp_rbq_sptr_next_set((ptr), (curr) + (n)); true; })
 #define csp_rbq_sptr_next_get(ptr)        ((ptr).next)
@@ -154,30 +259,68 @@ typedef struct {
 
 /*-------------------------------- csp_rbq_mptr ------------------------------*/
 
+/*
+ * `stats` holds a flag per slot telling the sequence last published in it. The
+ * flags are `2^csp_rbq_stats_stride_exp` words apart in a cache line aligned
+ * array, by default a line per flag so that the writers publishing neighbouring
+ * slots never write the same line. A smaller stride saves the memory of large
+ * rings, and then `csp_rbq_stats_shuffle` swaps the lowest bits of the index
+ * with the next ones, so that the consecutive sequences still land on different
+ * lines as long as the ring has at least as many lines as flags per line.
+ */
+#ifndef csp_rbq_stats_stride_exp
+#define csp_rbq_stats_stride_exp    3
+#endif
+
+#ifndef csp_rbq_stats_shuffle
+#define csp_rbq_stats_shuffle       1
+#endif
+
+/* The number of flags per cache line is `2^csp_rbq_stats_line_exp`. */
+#define csp_rbq_stats_line_exp      (3 - csp_rbq_stats_stride_exp)
+#define csp_rbq_stats_line_mask     ((1 << csp_rbq_stats_line_exp) - 1)
+
 typedef struct {
   csp_rbq_seq_t next, barr;
   csp_rbq_padding_t _;
-  csp_rbq_seq_t *stats;
+  atomic_uint_fast64_t *stats;
 } csp_rbq_mptr_t;
 
+/* The index in `stats` of the flag of `seqv`. */
+#define csp_rbq_mptr_idx(seqv, mask) ({                                        \
+  uint_fast64_t slot = (seqv) & (mask);                                        \
+  if (csp_rbq_stats_shuffle && csp_rbq_stats_line_exp > 0 &&                   \
+      (mask) + 1 >= (1 << (csp_rbq_stats_line_exp << 1))) {                    \
+    slot = (slot & ~(uint_fast64_t)((csp_rbq_stats_line_mask <<                \
+      csp_rbq_stats_line_exp) | csp_rbq_stats_line_mask)) |                    \
+      ((slot & csp_rbq_stats_line_mask) << csp_rbq_stats_line_exp) |           \
+      ((slot >> csp_rbq_stats_line_exp) & csp_rbq_stats_line_mask);            \
+  }                                                                            \
+  slot << csp_rbq_stats_stride_exp;                                            \
+})
+
 #define csp_rbq_mptr_init(ptr, cap) ({                                         \
   bool ok = false;                                                             \
   csp_rbq_seq_init((ptr).next, 0);                                             \
   csp_rbq_seq_init((ptr).barr, 0);                                             \
-  /* The last one is for padding. */                                           \
-  (ptr).stats = (csp_rbq_seq_t *)malloc(sizeof(csp_rbq_seq_t) * ((cap) + 1));  \
+  /* Round up to whole lines so that no other data shares the last one. */     \
+  size_t words = (((size_t)(cap) << csp_rbq_stats_stride_exp) + 7) & ~7UL;     \
+  (ptr).stats = (atomic_uint_fast64_t *)aligned_alloc(                         \
+    64, sizeof(atomic_uint_fast64_t) * words                                   \
+  );                                                                           \
   if ((ptr).stats != NULL) {                                                   \
     for (size_t i = 0; i < cap; i++) {                                         \
-      csp_rbq_seq_init((ptr).stats[i], -1);                                    \
+      atomic_init(&(ptr).stats[csp_rbq_mptr_idx(i, (cap) - 1)], -1);           \
     }                                                                          \
     ok = true;                                                                 \
   }                                                                            \
   ok;                                                                          \
 })
 #define csp_rbq_mptr_is_avail(ptr, seqv, mask)                                 \
-  (csp_rbq_seq_get((ptr).stats[(seqv) & (mask)]) == (seqv))
-#define csp_rbq_mptr_mark_avail(ptr, seqv, mask)                               \
-  do { csp_rbq_seq_set((ptr).stats[(seqv) & (mask)], (seqv)); } while (0)
+  (atomic_load(&(ptr).stats[csp_rbq_mptr_idx(seqv, mask)]) == (seqv))
+#define csp_rbq_mptr_mark_avail(ptr, seqv, mask) do {                          \
+  atomic_store(&(ptr).stats[csp_rbq_mptr_idx(seqv, mask)], (seqv));            \
+} while (0)
 /* The range is [start, end) with end excluded. */
 #define csp_rbq_mptr_markm_avail(ptr, start, end, mask) do {                   \
   for (uint64_t i = start; i < end; i++) {                                     \
@@ -259,6 +402,13 @@ typedef struct {
   void csp_rbq_name(rbqt, pushm, I)(void *rbq, T *items, size_t n);            \
   size_t csp_rbq_name(rbqt, try_popm, I)(void *rbq, T *items, size_t n);       \
   void csp_rbq_name(rbqt, popm, I)(void *rbq, T *items, size_t n);             \
+  T *csp_rbq_name(rbqt, try_reserve, I)(void *rbq, size_t n,                   \
+    csp_rbq_rsv_t *rsv);                                                       \
+  void csp_rbq_name(rbqt, commit, I)(void *rbq, csp_rbq_rsv_t *rsv);           \
+  T *csp_rbq_name(rbqt, try_peek, I)(void *rbq, size_t n, csp_rbq_rsv_t *rsv); \
+  void csp_rbq_name(rbqt, release, I)(void *rbq, csp_rbq_rsv_t *rsv);          \
+  bool csp_rbq_name(rbqt, is_full, I)(void *rbq);                              \
+  bool csp_rbq_name(rbqt, is_empty, I)(void *rbq);                             \
   void csp_rbq_name(rbqt, destroy, I)(void *rbq);                              \
 
 #define csp_rbq_define(rbqt, T, I, fast_ptr_t, slow_ptr_t)                     \
@@ -555,6 +705,104 @@ typedef struct {
     }                                                                          \
   }                                                                            \
                                                                                \
+  /* Claim at most `n` contiguous slots to write in place. It returns the      \
+   * first slot, or `NULL` if there is no room. */                             \
+  T *csp_rbq_name(rbqt, try_reserve, I)(void *rbq, size_t n,                   \
+    csp_rbq_rsv_t *rsv) {                                                      \
+    csp_rbq_name(rbqt, t, I) *q = (csp_rbq_name(rbqt, t, I) *)rbq;             \
+                                                                               \
+    uint_fast64_t                                                              \
+      sbarr = csp_rbq_ptr_name(slow_ptr_t, barr_get)(q->slow),                 \
+      fnext = csp_rbq_ptr_name(fast_ptr_t, next_get)(q->fast);                 \
+                                                                               \
+    size_t idx = fnext & q->mask, len = q->cap - idx;                          \
+    if (n < len) {                                                             \
+      len = n;                                                                 \
+    }                                                                          \
+    if (csp_unlikely(sbarr + q->cap < fnext + len)) {                          \
+      sbarr = csp_rbq_ptr_name(slow_ptr_t, barr_update)(q->slow, q->mask);     \
+      if (csp_unlikely(sbarr + q->cap < fnext + len)) {                        \
+        len = sbarr + q->cap - fnext;                                          \
+      }                                                                        \
+    }                                                                          \
+                                                                               \
+    if (csp_likely(len > 0 &&                                                  \
+        csp_rbq_ptr_name(fast_ptr_t, next_rsv)(q->fast, fnext, len))) {        \
+      rsv->seq = fnext;                                                        \
+      rsv->len = len;                                                          \
+      return q->items + idx;                                                   \
+    }                                                                          \
+    return NULL;                                                               \
+  }                                                                            \
+                                                                               \
+  /* Publish the slots claimed by `try_reserve` to the readers. */             \
+  void csp_rbq_name(rbqt, commit, I)(void *rbq, csp_rbq_rsv_t *rsv) {          \
+    csp_rbq_name(rbqt, t, I) *q = (csp_rbq_name(rbqt, t, I) *)rbq;             \
+    csp_rbq_ptr_name(fast_ptr_t, markm_avail)(                                 \
+      q->fast, rsv->seq, rsv->seq + rsv->len, q->mask                          \
+    );                                                                         \
+  }                                                                            \
+                                                                               \
+  /* Claim at most `n` contiguous items to read in place. It returns the first \
+   * item, or `NULL` if there is no item. */                                   \
+  T *csp_rbq_name(rbqt, try_peek, I)(void *rbq, size_t n, csp_rbq_rsv_t *rsv) {\
+    csp_rbq_name(rbqt, t, I) *q = (csp_rbq_name(rbqt, t, I) *)rbq;             \
+                                                                               \
+    uint_fast64_t                                                              \
+      snext = csp_rbq_ptr_name(slow_ptr_t, next_get)(q->slow),                 \
+      fbarr = csp_rbq_ptr_name(fast_ptr_t, barr_get)(q->fast);                 \
+                                                                               \
+    if (csp_unlikely(snext >= fbarr)) {                                        \
+      fbarr = csp_rbq_ptr_name(fast_ptr_t, barr_update)(q->fast, q->mask);     \
+      if (csp_unlikely(snext >= fbarr)) {                                      \
+        return NULL;                                                           \
+      }                                                                        \
+    }                                                                          \
+                                                                               \
+    size_t idx = snext & q->mask, len = fbarr - snext;                         \
+    if (q->cap - idx < len) {                                                  \
+      len = q->cap - idx;                                                      \
+    }                                                                          \
+    if (n < len) {                                                             \
+      len = n;                                                                 \
+    }                                                                          \
+                                                                               \
+    if (csp_likely(len > 0 &&                                                  \
+        csp_rbq_ptr_name(slow_ptr_t, next_rsv)(q->slow, snext, len))) {        \
+      rsv->seq = snext;                                                        \
+      rsv->len = len;                                                          \
+      return q->items + idx;                                                   \
+    }                                                                          \
+    return NULL;                                                               \
+  }                                                                            \
+                                                                               \
+  /* Give the slots claimed by `try_peek` back to the writers. */              \
+  void csp_rbq_name(rbqt, release, I)(void *rbq, csp_rbq_rsv_t *rsv) {         \
+    csp_rbq_name(rbqt, t, I) *q = (csp_rbq_name(rbqt, t, I) *)rbq;             \
+    csp_rbq_ptr_name(slow_ptr_t, markm_avail)(                                 \
+      q->slow, rsv->seq, rsv->seq + rsv->len, q->mask                          \
+    );                                                                         \
+  }                                                                            \
+                                                                               \
+  /* Unlike `try_push` and `try_pop` which may fail spuriously when there are  \
+   * concurrent writers or readers, `is_full` and `is_empty` tell whether     \
+   * there is no room or no item at all. */                                   \
+  bool csp_rbq_name(rbqt, is_full, I)(void *rbq) {                             \
+    csp_rbq_name(rbqt, t, I) *q = (csp_rbq_name(rbqt, t, I) *)rbq;             \
+    uint_fast64_t                                                              \
+      sbarr = csp_rbq_ptr_name(slow_ptr_t, barr_update)(q->slow, q->mask),     \
+      fnext = csp_rbq_ptr_name(fast_ptr_t, next_get)(q->fast);                 \
+    return sbarr + q->cap <= fnext;                                            \
+  }                                                                            \
+                                                                               \
+  bool csp_rbq_name(rbqt, is_empty, I)(void *rbq) {                            \
+    csp_rbq_name(rbqt, t, I) *q = (csp_rbq_name(rbqt, t, I) *)rbq;             \
+    uint_fast64_t                                                              \
+      snext = csp_rbq_ptr_name(slow_ptr_t, next_get)(q->slow),                 \
+      fbarr = csp_rbq_ptr_name(fast_ptr_t, barr_update)(q->fast, q->mask);     \
+    return snext >= fbarr;                                                     \
+  }                                                                            \
+                                                                               \
   void csp_rbq_name(rbqt, destroy, I)(void *rbq) {                             \
     if (rbq == NULL) { return; }                                               \
     csp_rbq_name(rbqt, t, I) *q = (csp_rbq_name(rbqt, t, I) *)rbq;             \
@@ -578,6 +826,7 @@ typedef struct {
   bool csp_rrbq_try_push_front(I)(csp_rrbq_t(I) *q, T item);                   \
   bool csp_rrbq_try_pop(I)(csp_rrbq_t(I) *q, T *item);                         \
   bool csp_rrbq_try_grow(I)(csp_rrbq_t(I) *q);                                 \
+  bool csp_rrbq_try_shrink(I)(csp_rrbq_t(I) *q);                               \
   void csp_rrbq_destroy(I)(csp_rrbq_t(I) *q);                                  \
 
 #define csp_rrbq_define_inner(T, I)                                            \
@@ -624,15 +873,44 @@ typedef struct {
     return false;                                                              \
   }                                                                            \
                                                                                \
+  /* Double the ring. The items wrapped to the front of the old ring are moved \
+   * to the new half where their sequences belong now. */                      \
   bool csp_rrbq_try_grow(I)(csp_rrbq_t(I) *q) {                                \
     size_t cap = q->cap << 1;                                                  \
     T *items = (T *)realloc(q->items, sizeof(T) * cap);                        \
+    if (items == NULL) {                                                       \
+      return false;                                                            \
+    }                                                                          \
+    for (uint64_t seq = q->slow; seq != q->fast; seq++) {                      \
+      if ((seq & q->cap) != 0) {                                               \
+        items[(seq & q->mask) + q->cap] = items[seq & q->mask];                \
+      }                                                                        \
+    }                                                                          \
+    q->items = items;                                                          \
+    q->cap = cap;                                                              \
+    q->mask = cap - 1;                                                         \
+    return true;                                                               \
+  }                                                                            \
+                                                                               \
+  /* Halve the ring if the items fit in. The items in the back half are moved  \
+   * to the front, where no other item belongs since they are consecutive. */  \
+  bool csp_rrbq_try_shrink(I)(csp_rrbq_t(I) *q) {                              \
+    size_t cap = q->cap >> 1;                                                  \
+    if (cap == 0 || csp_rrbq_len(I)(q) > cap) {                                \
+      return false;                                                            \
+    }                                                                          \
+    for (uint64_t seq = q->slow; seq != q->fast; seq++) {                      \
+      if ((seq & cap) != 0) {                                                  \
+        q->items[seq & (cap - 1)] = q->items[seq & q->mask];                   \
+      }                                                                        \
+    }                                                                          \
+    T *items = (T *)realloc(q->items, sizeof(T) * cap);                        \
     if (items != NULL) {                                                       \
       q->items = items;                                                        \
-      q->cap = cap;                                                            \
-      return true;                                                             \
     }                                                                          \
-    return false;                                                              \
+    q->cap = cap;                                                              \
+    q->mask = cap - 1;                                                         \
+    return true;                                                               \
   }                                                                            \
                                                                                \
   void csp_rrbq_destroy(I)(csp_rrbq_t(I) *q) {                                 \
@@ -643,6 +921,487 @@ typedef struct {
 
 #define csp_rrbq_len_inner(q) ((size_t)((q)->fast - (q)->slow))
 
+/*------------------------- elastic rbq implementation -----------------------*/
+
+#define csp_elrbq_declare_inner(T, I)                                          \
+  csp_rrbq_declare_inner(T, I)                                                 \
+                                                                               \
+  typedef struct {                                                             \
+    csp_spinlock_t lock;                                                       \
+    csp_rrbq_t(I) *ring;                                                       \
+                                                                               \
+    /* The max number of items, and the cap of the ring when it's created. */  \
+    size_t cap, min_cap;                                                       \
+                                                                               \
+    /* The pops in a row with at most a quarter of the ring in use. */         \
+    size_t lows;                                                               \
+                                                                               \
+    /* Whether some slots are claimed by a writer or a reader. */              \
+    bool writing, reading;                                                     \
+  } csp_elrbq_t(I);                                                            \
+                                                                               \
+  csp_elrbq_t(I) *csp_elrbq_new(I)(size_t cap_exp);                            \
+  bool csp_elrbq_try_push(I)(void *rbq, T item);                               \
+  bool csp_elrbq_try_pop(I)(void *rbq, T *item);                               \
+  bool csp_elrbq_try_pushm(I)(void *rbq, T *items, size_t n);                  \
+  size_t csp_elrbq_try_popm(I)(void *rbq, T *items, size_t n);                 \
+  T *csp_elrbq_try_reserve(I)(void *rbq, size_t n, csp_rbq_rsv_t *rsv);        \
+  void csp_elrbq_commit(I)(void *rbq, csp_rbq_rsv_t *rsv);                     \
+  T *csp_elrbq_try_peek(I)(void *rbq, size_t n, csp_rbq_rsv_t *rsv);           \
+  void csp_elrbq_release(I)(void *rbq, csp_rbq_rsv_t *rsv);                    \
+  bool csp_elrbq_is_full(I)(void *rbq);                                        \
+  bool csp_elrbq_is_empty(I)(void *rbq);                                       \
+  void csp_elrbq_destroy(I)(void *rbq);                                        \
+
+#define csp_elrbq_define_inner(T, I)                                           \
+  csp_rrbq_define_inner(T, I)                                                  \
+                                                                               \
+  csp_elrbq_t(I) *csp_elrbq_new(I)(size_t cap_exp) {                           \
+    csp_elrbq_t(I) *q = (csp_elrbq_t(I) *)malloc(sizeof(csp_elrbq_t(I)));      \
+    if (q == NULL) {                                                           \
+      return NULL;                                                             \
+    }                                                                          \
+                                                                               \
+    q->ring = csp_rrbq_new(I)(                                                 \
+      cap_exp < csp_elrbq_min_cap_exp ? cap_exp : csp_elrbq_min_cap_exp        \
+    );                                                                         \
+    if (q->ring == NULL) {                                                     \
+      free(q);                                                                 \
+      return NULL;                                                             \
+    }                                                                          \
+                                                                               \
+    csp_spinlock_init(&q->lock);                                               \
+    q->cap = 1 << cap_exp;                                                     \
+    q->min_cap = q->ring->cap;                                                 \
+    q->lows = 0;                                                               \
+    q->writing = q->reading = false;                                           \
+    return q;                                                                  \
+  }                                                                            \
+                                                                               \
+  /* Make room for `n` more items, it must be called with the lock held. */    \
+  static bool csp_rbq_name(el, fit, I)(csp_elrbq_t(I) *q, size_t n) {          \
+    csp_rrbq_t(I) *ring = q->ring;                                             \
+    size_t len = csp_rrbq_len(I)(ring);                                        \
+    if (csp_likely(len + n <= ring->cap)) {                                    \
+      return true;                                                             \
+    }                                                                          \
+    if (len + n > q->cap || q->writing || q->reading) {                        \
+      return false;                                                            \
+    }                                                                          \
+    while (len + n > ring->cap) {                                              \
+      if (!csp_rrbq_try_grow(I)(ring)) {                                       \
+        return false;                                                          \
+      }                                                                        \
+    }                                                                          \
+    q->lows = 0;                                                               \
+    return true;                                                               \
+  }                                                                            \
+                                                                               \
+  /* Count a pop and halve the ring once it has stayed mostly empty for a      \
+   * while, it must be called with the lock held. */                           \
+  static void csp_rbq_name(el, settle, I)(csp_elrbq_t(I) *q) {                 \
+    csp_rrbq_t(I) *ring = q->ring;                                             \
+    if (ring->cap <= q->min_cap || csp_rrbq_len(I)(ring) > (ring->cap >> 2)) { \
+      q->lows = 0;                                                             \
+    } else if (++q->lows >= ring->cap && !q->writing && !q->reading) {         \
+      csp_rrbq_try_shrink(I)(ring);                                            \
+      q->lows = 0;                                                             \
+    }                                                                          \
+  }                                                                            \
+                                                                               \
+  bool csp_elrbq_try_push(I)(void *rbq, T item) {                              \
+    return csp_elrbq_try_pushm(I)(rbq, &item, 1);                              \
+  }                                                                            \
+                                                                               \
+  bool csp_elrbq_try_pop(I)(void *rbq, T *item) {                              \
+    return csp_elrbq_try_popm(I)(rbq, item, 1) == 1;                           \
+  }                                                                            \
+                                                                               \
+  bool csp_elrbq_try_pushm(I)(void *rbq, T *items, size_t n) {                 \
+    csp_elrbq_t(I) *q = (csp_elrbq_t(I) *)rbq;                                 \
+    csp_spinlock_lock(&q->lock);                                               \
+    bool ok = !q->writing && csp_rbq_name(el, fit, I)(q, n);                   \
+    if (ok) {                                                                  \
+      csp_rbq_items_setm(q->ring, q->ring->fast, items, n, T);                 \
+      q->ring->fast += n;                                                      \
+    }                                                                          \
+    csp_spinlock_unlock(&q->lock);                                             \
+    return ok;                                                                 \
+  }                                                                            \
+                                                                               \
+  size_t csp_elrbq_try_popm(I)(void *rbq, T *items, size_t n) {                \
+    csp_elrbq_t(I) *q = (csp_elrbq_t(I) *)rbq;                                 \
+    csp_spinlock_lock(&q->lock);                                               \
+    size_t len = q->reading ? 0 : csp_rrbq_len(I)(q->ring);                    \
+    if (len > n) {                                                             \
+      len = n;                                                                 \
+    }                                                                          \
+    if (len > 0) {                                                             \
+      csp_rbq_items_getm(q->ring, q->ring->slow, items, len, T);               \
+      q->ring->slow += len;                                                    \
+      csp_rbq_name(el, settle, I)(q);                                          \
+    }                                                                          \
+    csp_spinlock_unlock(&q->lock);                                             \
+    return len;                                                                \
+  }                                                                            \
+                                                                               \
+  T *csp_elrbq_try_reserve(I)(void *rbq, size_t n, csp_rbq_rsv_t *rsv) {       \
+    csp_elrbq_t(I) *q = (csp_elrbq_t(I) *)rbq;                                 \
+    T *items = NULL;                                                           \
+    csp_spinlock_lock(&q->lock);                                               \
+    if (!q->writing) {                                                         \
+      csp_rrbq_t(I) *ring = q->ring;                                           \
+      size_t room = q->cap - csp_rrbq_len(I)(ring);                            \
+      if (n > room) {                                                          \
+        n = room;                                                              \
+      }                                                                        \
+      if (!csp_rbq_name(el, fit, I)(q, n)) {                                   \
+        n = ring->cap - csp_rrbq_len(I)(ring);                                 \
+      }                                                                        \
+      if (n > 0) {                                                             \
+        size_t idx = ring->fast & ring->mask;                                  \
+        rsv->seq = ring->fast;                                                 \
+        rsv->len = n < ring->cap - idx ? n : ring->cap - idx;                  \
+        q->writing = true;                                                     \
+        items = ring->items + idx;                                             \
+      }                                                                        \
+    }                                                                          \
+    csp_spinlock_unlock(&q->lock);                                             \
+    return items;                                                              \
+  }                                                                            \
+                                                                               \
+  void csp_elrbq_commit(I)(void *rbq, csp_rbq_rsv_t *rsv) {                    \
+    csp_elrbq_t(I) *q = (csp_elrbq_t(I) *)rbq;                                 \
+    csp_spinlock_lock(&q->lock);                                               \
+    q->ring->fast += rsv->len;                                                 \
+    q->writing = false;                                                        \
+    csp_spinlock_unlock(&q->lock);                                             \
+  }                                                                            \
+                                                                               \
+  T *csp_elrbq_try_peek(I)(void *rbq, size_t n, csp_rbq_rsv_t *rsv) {          \
+    csp_elrbq_t(I) *q = (csp_elrbq_t(I) *)rbq;                                 \
+    T *items = NULL;                                                           \
+    csp_spinlock_lock(&q->lock);                                               \
+    csp_rrbq_t(I) *ring = q->ring;                                             \
+    size_t len = csp_rrbq_len(I)(ring);                                        \
+    if (!q->reading && len > 0) {                                              \
+      size_t idx = ring->slow & ring->mask;                                    \
+      if (n > len) {                                                           \
+        n = len;                                                               \
+      }                                                                        \
+      rsv->seq = ring->slow;                                                   \
+      rsv->len = n < ring->cap - idx ? n : ring->cap - idx;                    \
+      q->reading = true;                                                       \
+      items = ring->items + idx;                                               \
+    }                                                                          \
+    csp_spinlock_unlock(&q->lock);                                             \
+    return items;                                                              \
+  }                                                                            \
+                                                                               \
+  void csp_elrbq_release(I)(void *rbq, csp_rbq_rsv_t *rsv) {                   \
+    csp_elrbq_t(I) *q = (csp_elrbq_t(I) *)rbq;                                 \
+    csp_spinlock_lock(&q->lock);                                               \
+    q->ring->slow += rsv->len;                                                 \
+    q->reading = false;                                                        \
+    csp_rbq_name(el, settle, I)(q);                                            \
+    csp_spinlock_unlock(&q->lock);                                             \
+  }                                                                            \
+                                                                               \
+  bool csp_elrbq_is_full(I)(void *rbq) {                                       \
+    csp_elrbq_t(I) *q = (csp_elrbq_t(I) *)rbq;                                 \
+    csp_spinlock_lock(&q->lock);                                               \
+    bool full = csp_rrbq_len(I)(q->ring) >= q->cap;                            \
+    csp_spinlock_unlock(&q->lock);                                             \
+    return full;                                                               \
+  }                                                                            \
+                                                                               \
+  bool csp_elrbq_is_empty(I)(void *rbq) {                                      \
+    csp_elrbq_t(I) *q = (csp_elrbq_t(I) *)rbq;                                 \
+    csp_spinlock_lock(&q->lock);                                               \
+    bool empty = csp_rrbq_len(I)(q->ring) == 0;                                \
+    csp_spinlock_unlock(&q->lock);                                             \
+    return empty;                                                              \
+  }                                                                            \
+                                                                               \
+  void csp_elrbq_destroy(I)(void *rbq) {                                       \
+    if (rbq == NULL) { return; }                                               \
+    csp_elrbq_t(I) *q = (csp_elrbq_t(I) *)rbq;                                 \
+    csp_rrbq_destroy(I)(q->ring);                                              \
+    free(q);                                                                   \
+  }                                                                            \
+
+/*------------------------ combining rbq implementation ----------------------*/
+
+/* The states of a publication record. A requester claims a free record, posts
+ * its request, and frees the record after a combiner has marked it done or
+ * failed. A combiner takes a posted request by marking it busy, so that the
+ * requester can only withdraw the requests which haven't been taken. */
+#define csp_fcrbq_free              0
+#define csp_fcrbq_claimed           1
+#define csp_fcrbq_push              2
+#define csp_fcrbq_pop               3
+#define csp_fcrbq_busy              4
+#define csp_fcrbq_done              5
+#define csp_fcrbq_failed            6
+
+/* The record of the running thread, i.e. of the core, is picked by hashing the
+ * address of a thread local variable, which is stable for the thread and
+ * spreads the threads over the records. Two threads may pick the same record,
+ * then the one coming later goes to the ring directly. */
+static _Thread_local char csp_fcrbq_anchor __attribute__((unused));
+#define csp_fcrbq_record_idx()                                                 \
+  ((size_t)((((uintptr_t)&csp_fcrbq_anchor >> 6) * 0x9e3779b97f4a7c15ULL) >>  \
+    (64 - csp_fcrbq_records_exp)))
+
+#define csp_fcrbq_declare_inner(T, I)                                          \
+  csp_mmrbq_declare(T, I);                                                     \
+                                                                               \
+  typedef struct __attribute__((aligned(64))) {                                \
+    atomic_int state;                                                          \
+    T item;                                                                    \
+  } csp_rbq_name(fc, record, I);                                               \
+                                                                               \
+  typedef struct __attribute__((aligned(64))) {                                \
+    csp_mmrbq_t(I) *ring;                                                      \
+    size_t cap;                                                                \
+                                                                               \
+    /* Whether a combiner is pushing or popping for the others. */             \
+    csp_rbq_padding_t _0;                                                      \
+    atomic_bool pushing;                                                       \
+    csp_rbq_padding_t _1;                                                      \
+    atomic_bool popping;                                                       \
+                                                                               \
+    csp_rbq_name(fc, record, I) records[csp_fcrbq_records];                    \
+  } csp_fcrbq_t(I);                                                            \
+                                                                               \
+  csp_fcrbq_t(I) *csp_fcrbq_new(I)(size_t cap_exp);                            \
+  bool csp_fcrbq_try_push(I)(void *rbq, T item);                               \
+  bool csp_fcrbq_try_pop(I)(void *rbq, T *item);                               \
+  bool csp_fcrbq_try_pushm(I)(void *rbq, T *items, size_t n);                  \
+  size_t csp_fcrbq_try_popm(I)(void *rbq, T *items, size_t n);                 \
+  T *csp_fcrbq_try_reserve(I)(void *rbq, size_t n, csp_rbq_rsv_t *rsv);        \
+  void csp_fcrbq_commit(I)(void *rbq, csp_rbq_rsv_t *rsv);                     \
+  T *csp_fcrbq_try_peek(I)(void *rbq, size_t n, csp_rbq_rsv_t *rsv);           \
+  void csp_fcrbq_release(I)(void *rbq, csp_rbq_rsv_t *rsv);                    \
+  bool csp_fcrbq_is_full(I)(void *rbq);                                        \
+  bool csp_fcrbq_is_empty(I)(void *rbq);                                       \
+  void csp_fcrbq_destroy(I)(void *rbq);                                        \
+
+#define csp_fcrbq_define_inner(T, I)                                           \
+  csp_mmrbq_define(T, I);                                                      \
+                                                                               \
+  csp_fcrbq_t(I) *csp_fcrbq_new(I)(size_t cap_exp) {                           \
+    csp_fcrbq_t(I) *q = (csp_fcrbq_t(I) *)aligned_alloc(                       \
+      _Alignof(csp_fcrbq_t(I)), sizeof(csp_fcrbq_t(I))                         \
+    );                                                                         \
+    if (q == NULL) {                                                           \
+      return NULL;                                                             \
+    }                                                                          \
+    if ((q->ring = csp_mmrbq_new(I)(cap_exp)) == NULL) {                       \
+      free(q);                                                                 \
+      return NULL;                                                             \
+    }                                                                          \
+                                                                               \
+    q->cap = q->ring->cap;                                                     \
+    atomic_init(&q->pushing, false);                                           \
+    atomic_init(&q->popping, false);                                           \
+    for (size_t i = 0; i < csp_fcrbq_records; i++) {                           \
+      atomic_init(&q->records[i].state, csp_fcrbq_free);                       \
+    }                                                                          \
+    return q;                                                                  \
+  }                                                                            \
+                                                                               \
+  /* Take the posted requests of `op`, it must be called by the combiner. */   \
+  static size_t csp_rbq_name(fc, take, I)(                                     \
+    csp_fcrbq_t(I) *q, int op, size_t *idx                                     \
+  ) {                                                                          \
+    size_t n = 0;                                                              \
+    for (size_t i = 0; i < csp_fcrbq_records; i++) {                           \
+      atomic_int *state = &q->records[i].state;                                \
+      int expected = op;                                                       \
+      if (atomic_load_explicit(state, memory_order_relaxed) == op &&           \
+          atomic_compare_exchange_strong_explicit(state, &expected,            \
+            csp_fcrbq_busy, memory_order_acquire, memory_order_relaxed)) {     \
+        idx[n++] = i;                                                          \
+      }                                                                        \
+    }                                                                          \
+    return n;                                                                  \
+  }                                                                            \
+                                                                               \
+  /* Mark the first `done` taken requests done and the others failed. */       \
+  static void csp_rbq_name(fc, finish, I)(                                     \
+    csp_fcrbq_t(I) *q, size_t *idx, size_t n, size_t done                      \
+  ) {                                                                          \
+    for (size_t i = 0; i < n; i++) {                                           \
+      atomic_store_explicit(&q->records[idx[i]].state,                         \
+        i < done ? csp_fcrbq_done : csp_fcrbq_failed, memory_order_release     \
+      );                                                                       \
+    }                                                                          \
+  }                                                                            \
+                                                                               \
+  /* Push the items of all the posted pushes with as few claims as possible,   \
+   * i.e. one in most cases. */                                                \
+  static void csp_rbq_name(fc, combine_push, I)(csp_fcrbq_t(I) *q) {           \
+    size_t idx[csp_fcrbq_records];                                             \
+    size_t n = csp_rbq_name(fc, take, I)(q, csp_fcrbq_push, idx), done = 0;    \
+    while (done < n) {                                                         \
+      csp_rbq_rsv_t rsv;                                                       \
+      T *slots = csp_mmrbq_try_reserve(I)(q->ring, n - done, &rsv);            \
+      if (slots == NULL) {                                                     \
+        if (csp_mmrbq_is_full(I)(q->ring)) {                                   \
+          break;                                                               \
+        }                                                                      \
+        continue;                                                              \
+      }                                                                        \
+      for (size_t i = 0; i < rsv.len; i++) {                                   \
+        slots[i] = q->records[idx[done + i]].item;                             \
+      }                                                                        \
+      csp_mmrbq_commit(I)(q->ring, &rsv);                                      \
+      done += rsv.len;                                                         \
+    }                                                                          \
+    csp_rbq_name(fc, finish, I)(q, idx, n, done);                              \
+  }                                                                            \
+                                                                               \
+  /* Pop the items for all the posted pops in the same way. */                 \
+  static void csp_rbq_name(fc, combine_pop, I)(csp_fcrbq_t(I) *q) {            \
+    size_t idx[csp_fcrbq_records];                                             \
+    size_t n = csp_rbq_name(fc, take, I)(q, csp_fcrbq_pop, idx), done = 0;     \
+    while (done < n) {                                                         \
+      csp_rbq_rsv_t rsv;                                                       \
+      T *items = csp_mmrbq_try_peek(I)(q->ring, n - done, &rsv);               \
+      if (items == NULL) {                                                     \
+        if (csp_mmrbq_is_empty(I)(q->ring)) {                                  \
+          break;                                                               \
+        }                                                                      \
+        continue;                                                              \
+      }                                                                        \
+      for (size_t i = 0; i < rsv.len; i++) {                                   \
+        q->records[idx[done + i]].item = items[i];                             \
+      }                                                                        \
+      csp_mmrbq_release(I)(q->ring, &rsv);                                     \
+      done += rsv.len;                                                         \
+    }                                                                          \
+    csp_rbq_name(fc, finish, I)(q, idx, n, done);                              \
+  }                                                                            \
+                                                                               \
+  /* Wait for the posted request to be combined, and become the combiner       \
+   * whenever there is none. It returns `false` if the request is withdrawn    \
+   * after spinning for too long, e.g. the combiner has been preempted, and    \
+   * then the caller goes to the ring directly. */                             \
+  static bool csp_rbq_name(fc, wait, I)(csp_fcrbq_t(I) *q,                     \
+    csp_rbq_name(fc, record, I) *record, int op, bool *ok) {                   \
+    atomic_bool *combining = op == csp_fcrbq_push ? &q->pushing : &q->popping; \
+    for (size_t i = 0; ; i++) {                                                \
+      if (!atomic_load_explicit(combining, memory_order_relaxed) &&            \
+          !atomic_exchange_explicit(combining, true, memory_order_acquire)) {  \
+        if (op == csp_fcrbq_push) {                                            \
+          csp_rbq_name(fc, combine_push, I)(q);                                \
+        } else {                                                               \
+          csp_rbq_name(fc, combine_pop, I)(q);                                 \
+        }                                                                      \
+        atomic_store_explicit(combining, false, memory_order_release);         \
+      }                                                                        \
+                                                                               \
+      int state = atomic_load_explicit(&record->state, memory_order_acquire);  \
+      if (state == csp_fcrbq_done || state == csp_fcrbq_failed) {              \
+        *ok = state == csp_fcrbq_done;                                         \
+        return true;                                                           \
+      }                                                                        \
+      if (i >= csp_fcrbq_spins && state == op &&                               \
+          atomic_compare_exchange_strong_explicit(&record->state, &state,      \
+            csp_fcrbq_claimed, memory_order_relaxed, memory_order_relaxed)) {  \
+        return false;                                                          \
+      }                                                                        \
+      csp_cpu_relax();                                                         \
+    }                                                                          \
+  }                                                                            \
+                                                                               \
+  bool csp_fcrbq_try_push(I)(void *rbq, T item) {                              \
+    csp_fcrbq_t(I) *q = (csp_fcrbq_t(I) *)rbq;                                 \
+    csp_rbq_name(fc, record, I) *record =                                      \
+      &q->records[csp_fcrbq_record_idx()];                                     \
+    int state = csp_fcrbq_free;                                                \
+    if (!atomic_compare_exchange_strong_explicit(&record->state, &state,       \
+          csp_fcrbq_claimed, memory_order_acquire, memory_order_relaxed)) {    \
+      return csp_mmrbq_try_push(I)(q->ring, item);                             \
+    }                                                                          \
+                                                                               \
+    record->item = item;                                                       \
+    atomic_store_explicit(&record->state, csp_fcrbq_push,                      \
+      memory_order_release);                                                   \
+    bool ok;                                                                   \
+    if (!csp_rbq_name(fc, wait, I)(q, record, csp_fcrbq_push, &ok)) {          \
+      ok = csp_mmrbq_try_push(I)(q->ring, item);                               \
+    }                                                                          \
+    atomic_store_explicit(&record->state, csp_fcrbq_free,                      \
+      memory_order_release);                                                   \
+    return ok;                                                                 \
+  }                                                                            \
+                                                                               \
+  bool csp_fcrbq_try_pop(I)(void *rbq, T *item) {                              \
+    csp_fcrbq_t(I) *q = (csp_fcrbq_t(I) *)rbq;                                 \
+    csp_rbq_name(fc, record, I) *record =                                      \
+      &q->records[csp_fcrbq_record_idx()];                                     \
+    int state = csp_fcrbq_free;                                                \
+    if (!atomic_compare_exchange_strong_explicit(&record->state, &state,       \
+          csp_fcrbq_claimed, memory_order_acquire, memory_order_relaxed)) {    \
+      return csp_mmrbq_try_pop(I)(q->ring, item);                              \
+    }                                                                          \
+                                                                               \
+    atomic_store_explicit(&record->state, csp_fcrbq_pop,                       \
+      memory_order_release);                                                   \
+    bool ok;                                                                   \
+    if (!csp_rbq_name(fc, wait, I)(q, record, csp_fcrbq_pop, &ok)) {           \
+      ok = csp_mmrbq_try_pop(I)(q->ring, item);                                \
+    } else if (ok) {                                                           \
+      *item = record->item;                                                    \
+    }                                                                          \
+    atomic_store_explicit(&record->state, csp_fcrbq_free,                      \
+      memory_order_release);                                                   \
+    return ok;                                                                 \
+  }                                                                            \
+                                                                               \
+  /* The batched operations claim ranges by themselves, so they go to the ring \
+   * directly. */                                                              \
+  bool csp_fcrbq_try_pushm(I)(void *rbq, T *items, size_t n) {                 \
+    return csp_mmrbq_try_pushm(I)(((csp_fcrbq_t(I) *)rbq)->ring, items, n);    \
+  }                                                                            \
+                                                                               \
+  size_t csp_fcrbq_try_popm(I)(void *rbq, T *items, size_t n) {                \
+    return csp_mmrbq_try_popm(I)(((csp_fcrbq_t(I) *)rbq)->ring, items, n);     \
+  }                                                                            \
+                                                                               \
+  T *csp_fcrbq_try_reserve(I)(void *rbq, size_t n, csp_rbq_rsv_t *rsv) {       \
+    return csp_mmrbq_try_reserve(I)(((csp_fcrbq_t(I) *)rbq)->ring, n, rsv);    \
+  }                                                                            \
+                                                                               \
+  void csp_fcrbq_commit(I)(void *rbq, csp_rbq_rsv_t *rsv) {                    \
+    csp_mmrbq_commit(I)(((csp_fcrbq_t(I) *)rbq)->ring, rsv);                   \
+  }                                                                            \
+                                                                               \
+  T *csp_fcrbq_try_peek(I)(void *rbq, size_t n, csp_rbq_rsv_t *rsv) {          \
+    return csp_mmrbq_try_peek(I)(((csp_fcrbq_t(I) *)rbq)->ring, n, rsv);       \
+  }                                                                            \
+                                                                               \
+  void csp_fcrbq_release(I)(void *rbq, csp_rbq_rsv_t *rsv) {                   \
+    csp_mmrbq_release(I)(((csp_fcrbq_t(I) *)rbq)->ring, rsv);                  \
+  }                                                                            \
+                                                                               \
+  bool csp_fcrbq_is_full(I)(void *rbq) {                                       \
+    return csp_mmrbq_is_full(I)(((csp_fcrbq_t(I) *)rbq)->ring);                \
+  }                                                                            \
+                                                                               \
+  bool csp_fcrbq_is_empty(I)(void *rbq) {                                      \
+    return csp_mmrbq_is_empty(I)(((csp_fcrbq_t(I) *)rbq)->ring);               \
+  }                                                                            \
+                                                                               \
+  void csp_fcrbq_destroy(I)(void *rbq) {                                       \
+    if (rbq == NULL) { return; }                                               \
+    csp_fcrbq_t(I) *q = (csp_fcrbq_t(I) *)rbq;                                 \
+    csp_mmrbq_destroy(I)(q->ring);                                             \
+    free(q);                                                                   \
+  }                                                                            \
+
 extern void csp_sched_yield(void);
 
 #ifdef __cplusplus
@@ -142,6 +142,23 @@ csp_rbtree_node_t *csp_rbtree_find_gte(csp_rbtree_t *tree, int key) {
   return greater;
 }
 
+/* Find a node the key of which is less than or equal to the `key`. */
+csp_rbtree_node_t *csp_rbtree_find_lte(csp_rbtree_t *tree, int key) {
+  csp_rbtree_node_t *node = tree->root, *less = NULL;
+  while (node != tree->sentry) {
+    if (csp_unlikely(key == node->key)) {
+      return node;
+    }
+    if (key > node->key) {
+      less = node;
+      node = node->right;
+    } else {
+      node = node->left;
+    }
+  }
+  return less;
+}
+
 /* Insert a key to the tree. It returns the inserted or existing node. */
 csp_rbtree_node_t *csp_rbtree_insert(csp_rbtree_t *tree, int key) {
   csp_rbtree_node_t **node = &tree->root, *father = tree->sentry, *curr,
@@ -20,84 +20,253 @@
 
 csp_mmrbq_define(csp_proc_t *, proc);
 
-csp_lrunq_t *csp_lrunq_new() {
-  csp_lrunq_t *lrunq = (csp_lrunq_t *)malloc(sizeof(csp_lrunq_t));
+csp_lrunq_t *csp_lrunq_new(size_t cap_exp) {
+  csp_lrunq_t *lrunq = (csp_lrunq_t *)aligned_alloc(
+    _Alignof(csp_lrunq_t), sizeof(csp_lrunq_t)
+  );
   if (lrunq == NULL) {
     return NULL;
   }
-  lrunq->len = 0;
-  lrunq->head = lrunq->tail = NULL;
+
+  lrunq->cap = 1 << cap_exp;
+  lrunq->mask = lrunq->cap - 1;
+  lrunq->procs = (_Atomic(csp_proc_t *) *)malloc(
+    sizeof(_Atomic(csp_proc_t *)) * lrunq->cap
+  );
+  if (lrunq->procs == NULL) {
+    free(lrunq);
+    return NULL;
+  }
+
+  csp_rbq_seq_init(lrunq->head, 0);
+  csp_rbq_seq_init(lrunq->tail, 0);
   lrunq->poped_times = 0;
   return lrunq;
 }
 
-void csp_lrunq_push(csp_lrunq_t *lrunq, csp_proc_t *proc) {
-  if (lrunq->tail != NULL) {
-    lrunq->tail->next = proc;
-    proc->pre = lrunq->tail;
-    lrunq->tail = proc;
-  } else {
-    lrunq->head = lrunq->tail = proc;
-  }
-  lrunq->len++;
-}
+/* Push a process to the tail. It should only be called by the owner. */
+bool csp_lrunq_try_push(csp_lrunq_t *lrunq, csp_proc_t *proc) {
+  uint_fast64_t
+    head = csp_rbq_seq_get(lrunq->head),
+    tail = csp_rbq_seq_get(lrunq->tail);
 
-void csp_lrunq_push_front(csp_lrunq_t *lrunq, csp_proc_t *proc) {
-  if (lrunq->head != NULL) {
-    proc->next = lrunq->head;
-    lrunq->head->pre = proc;
-    lrunq->head = proc;
-  } else {
-    lrunq->head = lrunq->tail = proc;
+  if (csp_unlikely(tail - head >= lrunq->cap)) {
+    return false;
   }
-  lrunq->len++;
+
+  atomic_store_explicit(
+    &lrunq->procs[tail & lrunq->mask], proc, memory_order_relaxed
+  );
+  csp_rbq_seq_set(lrunq->tail, tail + 1);
+  return true;
 }
 
-int csp_lrunq_try_pop_front(csp_lrunq_t *lrunq, csp_proc_t **proc) {
+/* Pop a process from the head. It should only be called by the owner. */
+int csp_lrunq_try_pop(csp_lrunq_t *lrunq, csp_proc_t **proc) {
   if (csp_unlikely((lrunq->poped_times & 0x1f) == 0x1f)) {
     lrunq->poped_times++;
     return csp_lrunq_missed;
   }
 
-  if (csp_unlikely(lrunq->head == NULL)) {
-    return csp_lrunq_failed;
+  uint_fast64_t
+    head = csp_rbq_seq_get(lrunq->head),
+    tail = csp_rbq_seq_get(lrunq->tail);
+
+  while (head != tail) {
+    csp_proc_t *top = atomic_load_explicit(
+      &lrunq->procs[head & lrunq->mask], memory_order_relaxed
+    );
+    /* The head may be moved by thieves, we must retry if the CAS fails. */
+    if (csp_likely(csp_rbq_seq_cas(lrunq->head, head, head + 1))) {
+      *proc = top;
+      lrunq->poped_times++;
+      return csp_lrunq_ok;
+    }
+  }
+  return csp_lrunq_failed;
+}
+
+/*
+ * Steal half of the processes in `src` to `dst` and return the last one stolen
+ * for running directly. Return `NULL` if there is nothing to steal.
+ *
+ * It should only be called by the owner of `dst`.
+ */
+csp_proc_t *csp_lrunq_steal(csp_lrunq_t *dst, csp_lrunq_t *src) {
+  uint_fast64_t n, head,
+    dtail = csp_rbq_seq_get(dst->tail),
+    dfree = dst->cap - (dtail - csp_rbq_seq_get(dst->head));
+
+  while (true) {
+    head = csp_rbq_seq_get(src->head);
+    uint_fast64_t tail = csp_rbq_seq_get(src->tail);
+
+    n = tail - head;
+    n -= n >> 1;
+    if (n == 0) {
+      return NULL;
+    }
+
+    /* `head` and `tail` are not loaded atomically as a whole, so they may be
+     * inconsistent if `src` is updated between the two loads. */
+    if (csp_unlikely(n > ((src->cap + 1) >> 1))) {
+      continue;
+    }
+    if (n > dfree) {
+      n = dfree;
+      if (csp_unlikely(n == 0)) {
+        return NULL;
+      }
+    }
+
+    /* Copy the processes before the CAS, cause once the head passes them, the
+     * owner of `src` may overwrite their slots. */
+    for (uint_fast64_t i = 0; i < n; i++) {
+      atomic_store_explicit(
+        &dst->procs[(dtail + i) & dst->mask],
+        atomic_load_explicit(
+          &src->procs[(head + i) & src->mask], memory_order_relaxed
+        ),
+        memory_order_relaxed
+      );
+    }
+
+    if (csp_rbq_seq_cas(src->head, head, head + n)) {
+      break;
+    }
+  }
+
+  n--;
+  csp_proc_t *proc = atomic_load_explicit(
+    &dst->procs[(dtail + n) & dst->mask], memory_order_relaxed
+  );
+  if (n > 0) {
+    csp_rbq_seq_set(dst->tail, dtail + n);
+  }
+  return proc;
+}
+
+void csp_lrunq_destroy(csp_lrunq_t *lrunq) {
+  if (lrunq != NULL) {
+    free(lrunq->procs);
+    free(lrunq);
+  }
+}
+
+csp_grunq_t *csp_grunq_new(size_t cap_exp) {
+  csp_grunq_t *grunq = (csp_grunq_t *)aligned_alloc(
+    _Alignof(csp_grunq_t), sizeof(csp_grunq_t)
+  );
+  if (grunq == NULL) {
+    return NULL;
   }
 
-  *proc = lrunq->head;
-  if (lrunq->head != lrunq->tail) {
-    lrunq->head = (*proc)->next;
-    lrunq->head->pre = NULL;
-    (*proc)->next = NULL;
-  } else {
-    lrunq->head = lrunq->tail = NULL;
+  if ((grunq->ring = csp_mmrbq_new(proc)(cap_exp)) == NULL) {
+    free(grunq);
+    return NULL;
   }
+  atomic_init(&grunq->spill, NULL);
+  atomic_init(&grunq->nspilled, 0);
+  return grunq;
+}
+
+static bool csp_grunq_spilled(csp_grunq_t *grunq) {
+  return atomic_load_explicit(&grunq->spill, memory_order_relaxed) != NULL;
+}
 
-  lrunq->len--;
-  lrunq->poped_times++;
-  return csp_lrunq_ok;
+/* Push the chain `first` ... `last` to the spill stack. The callers increase
+ * `nspilled` before it so that the counter never underflows for the poppers. */
+static void csp_grunq_spill(csp_grunq_t *grunq,
+    csp_proc_t *first, csp_proc_t *last) {
+  csp_proc_t *top = atomic_load_explicit(&grunq->spill, memory_order_relaxed);
+  do {
+    last->next = top;
+  } while (!atomic_compare_exchange_weak_explicit(&grunq->spill, &top, first,
+        memory_order_release, memory_order_relaxed));
 }
 
-/* `n` should be guaranteed by caller to be `0 < n <= lrunq->len`. */
-void csp_lrunq_popm_front(
-    csp_lrunq_t *lrunq, size_t n, csp_proc_t **start, csp_proc_t **end) {
-  lrunq->len -= n;
+/* Push a process to the ring, fail if the ring is full or there are spilled
+ * processes waiting. */
+bool csp_grunq_try_push(csp_grunq_t *grunq, csp_proc_t *proc) {
+  return !csp_grunq_spilled(grunq) && csp_mmrbq_try_push(proc)(
+    grunq->ring, proc
+  );
+}
+
+bool csp_grunq_try_pushm(csp_grunq_t *grunq, csp_proc_t **procs, size_t n) {
+  return !csp_grunq_spilled(grunq) && csp_mmrbq_try_pushm(proc)(
+    grunq->ring, procs, n
+  );
+}
+
+/* Push a process to the ring, or the spill stack if the ring is full. */
+void csp_grunq_push(csp_grunq_t *grunq, csp_proc_t *proc) {
+  if (csp_unlikely(!csp_grunq_try_push(grunq, proc))) {
+    atomic_fetch_add_explicit(&grunq->nspilled, 1, memory_order_relaxed);
+    csp_grunq_spill(grunq, proc, proc);
+  }
+}
 
-  if (csp_unlikely(lrunq->len == 0)) {
-    *start = lrunq->head;
-    *end = lrunq->tail;
-    lrunq->head = lrunq->tail = NULL;
+void csp_grunq_pushm(csp_grunq_t *grunq, csp_proc_t **procs, size_t n) {
+  if (csp_likely(n == 0 || csp_grunq_try_pushm(grunq, procs, n))) {
     return;
   }
+  for (size_t i = 0; i + 1 < n; i++) {
+    procs[i]->next = procs[i + 1];
+  }
+  atomic_fetch_add_explicit(&grunq->nspilled, n, memory_order_relaxed);
+  csp_grunq_spill(grunq, procs[0], procs[n - 1]);
+}
+
+/*
+ * Pop a process from the ring. If the ring is empty, take the whole spill
+ * stack back, return its top and move the rest to the ring, those that still
+ * don't fit are spilled again.
+ */
+bool csp_grunq_try_pop(csp_grunq_t *grunq, csp_proc_t **proc) {
+  if (csp_likely(csp_mmrbq_try_pop(proc)(grunq->ring, proc))) {
+    return true;
+  }
+  if (csp_likely(!csp_grunq_spilled(grunq))) {
+    return false;
+  }
 
-  *start = lrunq->head;
-  for (int i = 0; i < n; i++) {
-    lrunq->head = lrunq->head->next;
+  csp_proc_t *top = atomic_exchange_explicit(
+    &grunq->spill, NULL, memory_order_acquire
+  );
+  if (top == NULL) {
+    return false;
   }
-  *end = lrunq->head->pre;
-  lrunq->head->pre = NULL;
-  (*end)->next = NULL;
+  *proc = top;
+
+  size_t n = 1;
+  csp_proc_t *next = top->next;
+  top->next = NULL;
+  for (; next != NULL; n++) {
+    csp_proc_t *curr = next;
+    next = curr->next;
+    curr->next = NULL;
+    if (!csp_mmrbq_try_push(proc)(grunq->ring, curr)) {
+      /* Spill the rest again as a whole, they are still counted. */
+      csp_proc_t *last = curr;
+      for (curr->next = next; last->next != NULL; last = last->next);
+      csp_grunq_spill(grunq, curr, last);
+      break;
+    }
+  }
+  atomic_fetch_sub_explicit(&grunq->nspilled, n, memory_order_relaxed);
+  return true;
 }
 
-void csp_lrunq_destroy(csp_lrunq_t *lrunq) {
-  free(lrunq);
+/* Whether there is no process in the ring or the spill stack, it may be stale
+ * once it returns. */
+bool csp_grunq_is_empty(csp_grunq_t *grunq) {
+  return csp_mmrbq_is_empty(proc)(grunq->ring) && !csp_grunq_spilled(grunq);
+}
+
+void csp_grunq_destroy(csp_grunq_t *grunq) {
+  if (grunq != NULL) {
+    csp_mmrbq_destroy(proc)(grunq->ring);
+    free(grunq);
+  }
 }
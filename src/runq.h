@@ -22,43 +22,69 @@
 extern "C" {
 #endif
 
+#include <stdatomic.h>
+#include <stdbool.h>
 #include <stdlib.h>
 #include "proc.h"
 #include "rbq.h"
-#include "mutex.h"
-
-#define csp_grunq_t          csp_mmrbq_t(proc)
-#define csp_grunq_new        csp_mmrbq_new(proc)
-#define csp_grunq_try_push   csp_mmrbq_try_push(proc)
-#define csp_grunq_try_pushm  csp_mmrbq_try_pushm(proc)
-#define csp_grunq_try_pop    csp_mmrbq_try_pop(proc)
-#define csp_grunq_destroy    csp_mmrbq_destroy(proc)
+#include "spinlock.h"
 
 #define csp_lrunq_ok         0
 #define csp_lrunq_failed     -1
 #define csp_lrunq_missed     1
-#define csp_lrunq_len(lrunq) ((lrunq)->len)
-#define csp_lrunq_set(lrunq, n, start, end) do {                               \
-  (lrunq)->head = (start);                                                     \
-  (lrunq)->tail = (end);                                                       \
-  (lrunq)->len = (n);                                                          \
-} while (0)                                                                    \
+#define csp_lrunq_len(lrunq)                                                   \
+  ((size_t)(csp_rbq_seq_get((lrunq)->tail) - csp_rbq_seq_get((lrunq)->head)))
 
 csp_mmrbq_declare(csp_proc_t *, proc);
 
-typedef struct {
-  csp_proc_t *head, *tail;
-  size_t len;
+/*
+ * `csp_grunq_t` is the global run queue of the processor, it's shared by the
+ * monitor, the netpoll thread and all the cores. The `ring` is bounded, once
+ * it's full the processes overflow to `spill`, a lock-free stack linked with
+ * `csp_proc_t.next`, so the capacity is only a hint and the pushers never spin.
+ *
+ * The stack is only popped as a whole with `atomic_exchange`, so it's free of
+ * the ABA problem. A push goes to the stack as long as it's not empty, and the
+ * stack is taken back only when the ring is drained, so the spilled processes
+ * are not starved by the new ones.
+ *
+ * It's aligned to the cache line since `spill` is written by all of them.
+ */
+typedef struct __attribute__((aligned(64))) {
+  csp_mmrbq_t(proc) *ring;
+  _Atomic(csp_proc_t *) spill;
+  atomic_size_t nspilled;
+} csp_grunq_t;
+
+csp_grunq_t *csp_grunq_new(size_t cap_exp);
+bool csp_grunq_try_push(csp_grunq_t *grunq, csp_proc_t *proc);
+bool csp_grunq_try_pushm(csp_grunq_t *grunq, csp_proc_t **procs, size_t n);
+void csp_grunq_push(csp_grunq_t *grunq, csp_proc_t *proc);
+void csp_grunq_pushm(csp_grunq_t *grunq, csp_proc_t **procs, size_t n);
+bool csp_grunq_try_pop(csp_grunq_t *grunq, csp_proc_t **proc);
+bool csp_grunq_is_empty(csp_grunq_t *grunq);
+void csp_grunq_destroy(csp_grunq_t *grunq);
+
+/*
+ * `csp_lrunq_t` is the work-stealing run queue of the processor. It's a bounded
+ * ring buffer in which only the owner core pushes processes at the `tail`,
+ * while the owner and the thieves(i.e. other idle cores) take processes from
+ * the `head` with CAS. The owner takes processes in FIFO order so yielded
+ * processes are scheduled round-robin, and a thief steals half of the queue at
+ * once so a burst of `csp_async` spreads across cores quickly.
+ */
+typedef struct __attribute__((aligned(64))) {
+  csp_rbq_seq_t head, tail;
+  csp_rbq_padding_t _;
+  size_t cap, mask;
   int64_t poped_times;
+  _Atomic(csp_proc_t *) *procs;
 } csp_lrunq_t;
 
-csp_lrunq_t *csp_lrunq_new();
-void csp_lrunq_push(csp_lrunq_t *lrunq, csp_proc_t *proc);
-void csp_lrunq_push_front(csp_lrunq_t *lrunq, csp_proc_t *proc);
-int csp_lrunq_try_pop_front(csp_lrunq_t *lrunq, csp_proc_t **proc);
-void csp_lrunq_popm_front(csp_lrunq_t *lrunq, size_t n, csp_proc_t **start,
-  csp_proc_t **end
-);
+csp_lrunq_t *csp_lrunq_new(size_t cap_exp);
+bool csp_lrunq_try_push(csp_lrunq_t *lrunq, csp_proc_t *proc);
+int csp_lrunq_try_pop(csp_lrunq_t *lrunq, csp_proc_t **proc);
+csp_proc_t *csp_lrunq_steal(csp_lrunq_t *dst, csp_lrunq_t *src);
 void csp_lrunq_destroy(csp_lrunq_t *lrunq);
 
 #ifdef __cplusplus
@@ -0,0 +1,129 @@
+/*
+ * Copyright (c) 2020, Yanhui Shi <lime.syh at gmail dot com>
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "core.h"
+#include "mutex.h"
+#include "rwlock.h"
+#include "waitq.h"
+
+extern int csp_sched_np;
+extern _Thread_local csp_core_t *csp_this_core;
+
+csp_rwlock_t *csp_rwlock_new(void) {
+  csp_rwlock_t *rwlock = (csp_rwlock_t *)malloc(sizeof(csp_rwlock_t));
+  if (rwlock == NULL) {
+    return NULL;
+  }
+  rwlock->nreaders = csp_sched_np;
+  rwlock->readers = (csp_rwlock_reader_t *)aligned_alloc(
+    sizeof(csp_rwlock_reader_t),
+    sizeof(csp_rwlock_reader_t) * rwlock->nreaders
+  );
+  if (rwlock->readers == NULL) {
+    free(rwlock);
+    return NULL;
+  }
+  for (size_t i = 0; i < rwlock->nreaders; i++) {
+    atomic_store(&rwlock->readers[i].n, 0);
+  }
+  atomic_store(&rwlock->writing, false);
+  csp_mutex_init(&rwlock->wmutex);
+  csp_waitq_init(&rwlock->readq);
+  csp_waitq_init(&rwlock->writeq);
+  return rwlock;
+}
+
+static inline atomic_int_fast64_t *csp_rwlock_this_reader(
+  csp_rwlock_t *rwlock
+) {
+  return &rwlock->readers[csp_this_core->pid % rwlock->nreaders].n;
+}
+
+static int_fast64_t csp_rwlock_sum_readers(csp_rwlock_t *rwlock) {
+  int_fast64_t sum = 0;
+  for (size_t i = 0; i < rwlock->nreaders; i++) {
+    sum += atomic_load(&rwlock->readers[i].n);
+  }
+  return sum;
+}
+
+/* A reader increases its counter before reading `writing`, while a writer sets
+ * `writing` before summing up the counters, so at least one of them sees the
+ * other. The reader which sees the writer undoes the increment and wakes the
+ * writer up in case the writer has seen the increment and parked. */
+bool csp_rwlock_try_rlock(csp_rwlock_t *rwlock) {
+  atomic_int_fast64_t *reader = csp_rwlock_this_reader(rwlock);
+  atomic_fetch_add(reader, 1);
+  if (csp_likely(!atomic_load(&rwlock->writing))) {
+    return true;
+  }
+  atomic_fetch_sub(reader, 1);
+  csp_waitq_signal(&rwlock->writeq, 1);
+  return false;
+}
+
+void csp_rwlock_rlock(csp_rwlock_t *rwlock) {
+  while (!csp_rwlock_try_rlock(rwlock)) {
+    csp_waitq_wait(&rwlock->readq, !atomic_load(&rwlock->writing));
+  }
+}
+
+void csp_rwlock_runlock(csp_rwlock_t *rwlock) {
+  atomic_fetch_sub(csp_rwlock_this_reader(rwlock), 1);
+  if (csp_unlikely(atomic_load(&rwlock->writing))) {
+    csp_waitq_signal(&rwlock->writeq, 1);
+  }
+}
+
+static void csp_rwlock_release(csp_rwlock_t *rwlock) {
+  atomic_store(&rwlock->writing, false);
+  if (atomic_load(&rwlock->readq.len) > 0) {
+    csp_waitq_broadcast(&rwlock->readq, &rwlock->readq.lock);
+  }
+  csp_mutex_unlock(&rwlock->wmutex);
+}
+
+bool csp_rwlock_try_lock(csp_rwlock_t *rwlock) {
+  if (!csp_mutex_try_lock(&rwlock->wmutex)) {
+    return false;
+  }
+  atomic_store(&rwlock->writing, true);
+  if (csp_rwlock_sum_readers(rwlock) == 0) {
+    return true;
+  }
+  csp_rwlock_release(rwlock);
+  return false;
+}
+
+void csp_rwlock_lock(csp_rwlock_t *rwlock) {
+  csp_mutex_lock(&rwlock->wmutex);
+  atomic_store(&rwlock->writing, true);
+  csp_waitq_wait(&rwlock->writeq, csp_rwlock_sum_readers(rwlock) == 0);
+}
+
+void csp_rwlock_unlock(csp_rwlock_t *rwlock) {
+  csp_rwlock_release(rwlock);
+}
+
+void csp_rwlock_destroy(csp_rwlock_t *rwlock) {
+  free(rwlock->readers);
+  free(rwlock);
+}
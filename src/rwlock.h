@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) 2020, Yanhui Shi <lime.syh at gmail dot com>
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef LIBCSP_RWLOCK_H
+#define LIBCSP_RWLOCK_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "mutex.h"
+#include "waitq.h"
+
+/*
+ * `csp_rwlock_t` is the readers-writer lock for the processes, which is biased
+ * towards the readers for the read-mostly data like configurations.
+ *
+ * A reader only increases the counter of its core in `readers`, each of which
+ * takes a cache line, so the readers on different cores never contend. It
+ * backs off and parks in `readq` if it sees `writing`. A writer is the one
+ * which pays: it holds `wmutex` against the other writers, sets `writing`,
+ * and then waits in `writeq` until the sum of the counters drops to zero. The
+ * counter a reader decreases may belong to another core if the reader has
+ * been migrated, only the sum matters.
+ */
+typedef struct __attribute__((aligned(64))) {
+  atomic_int_fast64_t n;
+} csp_rwlock_reader_t;
+
+typedef struct {
+  csp_rwlock_reader_t *readers;
+  size_t nreaders;
+  atomic_bool writing;
+  csp_mutex_t wmutex;
+  csp_waitq_t readq, writeq;
+} csp_rwlock_t;
+
+csp_rwlock_t *csp_rwlock_new(void);
+bool csp_rwlock_try_rlock(csp_rwlock_t *rwlock);
+void csp_rwlock_rlock(csp_rwlock_t *rwlock);
+void csp_rwlock_runlock(csp_rwlock_t *rwlock);
+bool csp_rwlock_try_lock(csp_rwlock_t *rwlock);
+void csp_rwlock_lock(csp_rwlock_t *rwlock);
+void csp_rwlock_unlock(csp_rwlock_t *rwlock);
+void csp_rwlock_destroy(csp_rwlock_t *rwlock);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -24,60 +24,78 @@
 #include "rbq.h"
 #include "runq.h"
 #include "sched.h"
+#include "stats.h"
 #include "timer.h"
+#include "trace.h"
+#include "waitq.h"
 
 #ifdef HAVE_CONFIG_H
 #include "config.h"
 #endif
 
-extern size_t csp_cpu_cores;
 extern _Thread_local csp_core_t *csp_this_core;
 
 extern void csp_core_init_main(csp_core_t *core);
 extern bool csp_core_start(csp_core_t *core);
+extern bool csp_cpus_init(void);
 extern bool csp_core_pools_init(void);
 extern bool csp_core_pools_get(size_t pid, csp_core_t **core);
+extern bool csp_core_pools_idle_put(csp_core_t *core);
+extern void csp_core_pools_idle_del(csp_core_t *core);
+extern bool csp_core_pools_idle_wakeup(size_t pid);
 extern void csp_core_pools_destroy(void);
 extern void csp_core_yield(csp_proc_t *proc, void *anchor);
+extern void csp_core_switch_to(csp_proc_t *proc, csp_proc_t *next,
+    void *anchor);
+extern bool csp_core_preempt_init(void);
+extern void csp_core_handoff_init(void);
+extern bool csp_core_pools_reclaim_get(size_t pid, csp_core_t **core);
 extern bool csp_monitor_init(void);
+extern void csp_monitor_wakeup(csp_timer_time_t when);
 extern bool csp_netpoll_init(void);
-extern bool csp_timer_heaps_init(void);
-extern void csp_timer_heaps_destroy(void);
+extern bool csp_timer_queues_init(void);
+extern void csp_timer_queues_destroy(void);
 extern void csp_timer_put(size_t pid, csp_proc_t *proc);
+extern int csp_timer_poll_core(size_t pid, csp_proc_t **start,
+    csp_proc_t **end);
+
+#ifdef csp_with_netpoll_per_core
+extern int csp_netpoll_poll_core(size_t pid, csp_proc_t **start,
+    csp_proc_t **end);
+#endif
+
+#ifdef csp_with_io_uring
+extern bool csp_io_init(void);
+extern int csp_io_poll_core(size_t pid, bool idle, csp_proc_t **start,
+    csp_proc_t **end);
+#endif
 
 #ifndef csp_with_sysmalloc
 extern bool csp_mem_init(void);
 extern void csp_mem_destroy(void);
+extern void csp_mem_idle(size_t pid);
 #endif
 
-csp_mmrbq_declare(csp_core_t *, core);
-csp_mmrbq_define(csp_core_t *, core);
+/* A backlogged priority class is tried first once every 8(normal) or 64
+ * (background) picks, so the lower classes age into the front and are never
+ * starved by the higher ones. */
+#define csp_sched_age_normal      0x07
+#define csp_sched_age_background  0x3f
 
-int csp_sched_np;
-csp_mmrbq_t(core) *csp_sched_starving_threads, *csp_sched_starving_procs;
+/* The max number of processes moved from the grunq to the local runqs at a
+ * time, see `csp_sched_drain`. */
+#define csp_sched_drain_len       16
 
-__attribute__((constructor)) static void csp_sched_start() {
-  /* Get the number of processores. */
-  csp_sched_np = sysconf(_SC_NPROCESSORS_ONLN);
-  if (csp_sched_np  <= 0) {
-    csp_sched_np = 1;
-  }
-
-  if (csp_cpu_cores > 0 && csp_cpu_cores < csp_sched_np) {
-    csp_sched_np = csp_cpu_cores;
-  }
+/* The max time the monitor sleeps while the cores are running, see
+ * `csp_monitor_max_sleep`. */
+#define csp_sched_monitor_period  (10 * csp_timer_millisecond)
 
-  csp_sched_starving_threads = csp_mmrbq_new(core)(csp_exp(csp_sched_np));
-  if (csp_sched_starving_threads == NULL) {
-    errno = ENOMEM;
-    perror("Failed to initialize starving queue.");
-    exit(EXIT_FAILURE);
-  }
+int csp_sched_np;
 
-  csp_sched_starving_procs = csp_mmrbq_new(core)(csp_exp(csp_sched_np));
-  if (csp_sched_starving_procs == NULL) {
-    errno = ENOMEM;
-    perror("Failed to initialize starving queue.");
+__attribute__((constructor)) static void csp_sched_start() {
+  /* Get the number of cores and their CPUs. */
+  if (!csp_cpus_init()) {
+    perror("Failed to initialize cpus.");
     exit(EXIT_FAILURE);
   }
 
@@ -100,12 +118,25 @@ __attribute__((constructor)) static void csp_sched_start() {
     exit(EXIT_FAILURE);
   }
 
-  if (!csp_timer_heaps_init()) {
+#ifdef csp_with_io_uring
+  if (!csp_io_init()) {
+    perror("Failed to initialize io_uring.");
+    exit(EXIT_FAILURE);
+  }
+#endif
+
+  if (!csp_timer_queues_init()) {
     errno = ENOMEM;
     perror("Failed to initialize timer heaps.");
     exit(EXIT_FAILURE);
   }
 
+  if (!csp_core_preempt_init()) {
+    perror("Failed to initialize preemption.");
+    exit(EXIT_FAILURE);
+  }
+  csp_core_handoff_init();
+
   if (!csp_monitor_init()) {
     perror("Failed to initialize monitor.");
     exit(EXIT_FAILURE);
@@ -123,74 +154,365 @@ __attribute__((constructor)) static void csp_sched_start() {
   }
 }
 
+/* Push the process to the local runq of the core. If the local runq is full,
+ * the process will be pushed to the global runqs, the nearest first, and it's
+ * spilled to the grunq of the core if all of them are full. */
+static void csp_sched_push(csp_core_t *core, csp_proc_t *proc) {
+  csp_stats_latency_queued(proc);
+
+  /* A spare core has taken our place, see `csp_sched_get`. */
+  if (csp_unlikely(atomic_load_explicit(&core->handoff, memory_order_relaxed)
+        == csp_core_handoff_taken)) {
+    csp_grunq_push(core->grunq, proc);
+    return;
+  }
+  if (csp_likely(csp_lrunq_try_push(core->lrunqs[proc->prio], proc))) {
+    return;
+  }
+
+  csp_core_pool_t *pool = csp_core_pool(core->pid);
+  if (csp_grunq_try_push(pool->grunq, proc)) {
+    return;
+  }
+  for (int i = 0; i < csp_sched_np - 1; i++) {
+    if (csp_grunq_try_push(csp_core_pool(pool->victims[i])->grunq, proc)) {
+      return;
+    }
+  }
+  csp_grunq_push(pool->grunq, proc);
+}
+
 void csp_sched_put_proc(csp_proc_t *proc) {
-  csp_lrunq_push_front(csp_this_core->lrunq, proc);
+  csp_core_t *this_core = csp_this_core;
+  csp_trace(wake, proc);
+  csp_core_enter(this_core);
+  csp_sched_push(this_core, proc);
+  csp_core_leave(this_core);
 }
 
 /* We must return the proc cause we may use it in `csp_timer_cancel`. */
 csp_proc_t *csp_sched_put_timer(csp_proc_t *proc) {
-  csp_timer_put(csp_this_core->pid, proc);
+  csp_core_t *this_core = csp_this_core;
+  csp_core_enter(this_core);
+  csp_timer_put(this_core->pid, proc);
+  csp_core_leave(this_core);
+  return proc;
+}
+
+/* Push the `n` processes in the list started with `start` except the first one
+ * to the runqs and return the first one, or NULL if `n` is 0. */
+static csp_proc_t *csp_sched_push_list(csp_core_t *this_core,
+    csp_proc_t *start, int n) {
+  if (n == 0) {
+    return NULL;
+  }
+
+  /* Read the next one before pushing a process, it may run on other cores
+   * just after being pushed. */
+  csp_proc_t *next = start->next;
+  csp_trace(wake, start);
+  for (int i = 1; i < n; i++) {
+    csp_proc_t *proc = next;
+    if (i + 1 < n) {
+      next = proc->next;
+    }
+    csp_trace(wake, proc);
+    csp_sched_push(this_core, proc);
+  }
+  return start;
+}
+
+/* Expire the timers of the core before parking instead of waiting for its
+ * poller, which may be busy with the other cores. The queue is skipped if the
+ * poller is polling it right now. */
+static csp_proc_t *csp_sched_timers(csp_core_t *this_core) {
+  csp_proc_t *start, *end;
+  int n = csp_timer_poll_core(this_core->pid, &start, &end);
+  return csp_sched_push_list(this_core, start, n);
+}
+
+#ifdef csp_with_netpoll_per_core
+/* Poll the epoll instance of the core. Return the first ready process and push
+ * the others to the runqs. */
+static csp_proc_t *csp_sched_netpoll(csp_core_t *this_core) {
+  csp_proc_t *start, *end;
+  int n = csp_netpoll_poll_core(this_core->pid, &start, &end);
+  if (n > 0) {
+    csp_stats_add(&this_core->stats, netpoll_wakeups, n);
+  }
+  return csp_sched_push_list(this_core, start, n);
+}
+#endif
+
+#ifdef csp_with_io_uring
+/* Flush the I/O requests of the core and reap the completed ones. Return the
+ * first woken process and push the others to the runqs. */
+static csp_proc_t *csp_sched_io(csp_core_t *this_core, bool idle) {
+  csp_proc_t *start, *end;
+  int n = csp_io_poll_core(this_core->pid, idle, &start, &end);
+  return csp_sched_push_list(this_core, start, n);
+}
+#endif
+
+/* Settle the process which has just yielded on `this_core`. It must be called
+ * after its context has been saved and we have left its stack. */
+static void csp_sched_settle(csp_core_t *this_core) {
+  csp_proc_t *running = this_core->running;
+  csp_stats_latency_leave(this_core);
+
+  /* The context of the parked process has been saved, so it's safe to let the
+   * others wake it up now. */
+  if (this_core->park_fn != NULL) {
+    this_core->park_fn(this_core->park_arg);
+    this_core->park_fn = NULL;
+  }
+
+  /* Put the yielded process to the tail first, so all runnable processes will
+   * be scheduled round-robin.
+   *
+   * A process waiting in `csp_sync` holds one extra `nchild` for itself which
+   * is released here, i.e. after its context has been saved. Otherwise its
+   * children stolen by other cores may exit and wake it up before it yields. */
+  if (running != NULL) {
+    csp_trace(yield, running);
+    if (csp_proc_nchild_get(running) == 0 ||
+        csp_proc_nchild_decr(running) == 0x01) {
+      csp_sched_push(this_core, running);
+    }
+  }
+}
+
+/* Pop a process from the local runqs, the higher priority classes first except
+ * when a lower one ages, see `csp_sched_age_normal`. It returns
+ * `csp_lrunq_missed` as `csp_lrunq_try_pop` does when it's time to check the
+ * grunq. */
+static int csp_sched_pop_local(csp_core_t *this_core, csp_proc_t **proc) {
+  uint64_t picks = atomic_load_explicit(
+    &this_core->nsched, memory_order_relaxed
+  ) >> 1;
+  int start = (picks & csp_sched_age_background) == 0 ?
+    csp_proc_prio_background : (picks & csp_sched_age_normal) == 0 ?
+    csp_proc_prio_normal : csp_proc_prio_latency;
+
+  for (int i = 0; i < csp_proc_prio_num; i++) {
+    int prio = (start + i) % csp_proc_prio_num;
+    int code = csp_lrunq_try_pop(this_core->lrunqs[prio], proc);
+    if (code != csp_lrunq_failed) {
+      return code;
+    }
+  }
+  return csp_lrunq_failed;
+}
+
+/* Move the processes in the grunq to the local runqs, so that the woken ones
+ * are ordered by their priority classes as well. */
+static void csp_sched_drain(csp_core_t *this_core) {
+  csp_proc_t *proc;
+  for (int i = 0; i < csp_sched_drain_len &&
+      csp_grunq_try_pop(this_core->grunq, &proc); i++) {
+    csp_sched_push(this_core, proc);
+  }
+}
+
+/* Whether there are processes in the local runqs. */
+static bool csp_sched_has_local(csp_core_t *this_core) {
+  for (int i = 0; i < csp_proc_prio_num; i++) {
+    if (csp_lrunq_len(this_core->lrunqs[i]) > 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/* Whether there is something to run which was put after we looked for it but
+ * before we announced ourselves idle, see `csp_core_pools_idle_put`. */
+static bool csp_sched_has_work(csp_core_t *this_core) {
+  if (csp_sched_has_local(this_core) || !csp_grunq_is_empty(this_core->grunq)) {
+    return true;
+  }
+
+  int *victims = csp_core_pool(this_core->pid)->victims;
+  for (int i = 0; i < csp_sched_np - 1; i++) {
+    if (!csp_grunq_is_empty(csp_core_pool(victims[i])->grunq)) {
+      return true;
+    }
+  }
+
+  /* A core waiting for the processor may have missed our announcement as
+   * well, see `csp_core_pools_reclaim_put`. */
+  return atomic_load(&csp_core_pool(this_core->pid)->reclaimers) != NULL;
+}
+
+/* Give the processor back to the cores which have returned from the system
+ * calls they were stuck in, and park as a spare instead, see
+ * `csp_core_reclaim`. */
+static void csp_sched_reclaimed(csp_core_t *this_core) {
+  csp_core_t *core;
+  while (csp_unlikely(csp_core_pools_reclaim_get(this_core->pid, &core))) {
+    atomic_store_explicit(&core->handoff, csp_core_handoff_none,
+      memory_order_release);
+    csp_core_wakeup(core);
+    csp_core_spare_park(this_core);
+  }
+}
+
+/* Mark `proc` as picked by `this_core` and return it, the scheduler leaves
+ * the runtime entered in `csp_sched_get` or `csp_sched_switch`. */
+static csp_proc_t *csp_sched_found(csp_core_t *this_core, csp_proc_t *proc) {
+  /* The monitor sends the process back here when it's woken up. */
+  proc->last_pid = this_core->pid;
+  csp_core_leave(this_core);
+  csp_core_preempt_on(this_core);
+  csp_stats_incr(&this_core->stats, switches);
+  csp_stats_latency_run(this_core, proc);
+  csp_trace(run, proc);
+
+  /* Wake up the nearest idle core to steal from us if we have more
+   * processes. */
+  if (csp_sched_has_local(this_core)) {
+    csp_core_pools_idle_wakeup(this_core->pid);
+  }
   return proc;
 }
 
 csp_proc_t *csp_sched_get(csp_core_t *this_core) {
-  int pid, code;
-  csp_proc_t *running = this_core->running, *proc;
+  int code;
+  bool idled = false;
+  csp_proc_t *proc;
+  csp_lrunq_t **lrunqs = this_core->lrunqs;
+  int *victims = csp_core_pool(this_core->pid)->victims;
+
+  /* A spare core has taken our place while we're stuck in a system call, so
+   * the yielded process goes to the grunq and we become a spare instead. */
+  bool owned = csp_core_acquire(this_core);
+  csp_sched_settle(this_core);
+  if (csp_unlikely(!owned)) {
+    csp_core_spare_park(this_core);
+  }
+  csp_sched_reclaimed(this_core);
+
+#ifdef csp_with_io_uring
+  if ((proc = csp_sched_io(this_core, false)) != NULL) {
+    csp_sched_push(this_core, proc);
+  }
+#endif
 
   while (true) {
-    code = csp_lrunq_try_pop_front(this_core->lrunq, &proc);
-    if (code == csp_lrunq_ok || (code == csp_lrunq_missed && (
-        csp_grunq_try_pop(csp_core_pool(this_core->pid)->grunq, &proc) ||
-        csp_lrunq_try_pop_front(this_core->lrunq, &proc) == csp_lrunq_ok))) {
+    code = csp_sched_pop_local(this_core, &proc);
+    if (code == csp_lrunq_ok) {
+      goto local;
+    }
+    if (code == csp_lrunq_missed) {
+      csp_sched_drain(this_core);
+      if (csp_sched_pop_local(this_core, &proc) == csp_lrunq_ok) {
+        goto local;
+      }
+    } else if (csp_grunq_try_pop(this_core->grunq, &proc)) {
+      csp_stats_incr(&this_core->stats, grunq_pops);
       goto found;
     }
 
-    pid = this_core->pid;
-    for (int i = 0; i < csp_sched_np; i++) {
-      if (csp_grunq_try_pop(csp_core_pool(pid)->grunq, &proc)) {
-        goto found;
+    /* Steal from other cores directly, the higher priority classes first. The
+     * victims are sorted by distance, so the siblings and the cores in the
+     * same NUMA node are tried first. */
+    csp_stats_incr(&this_core->stats, steal_tries);
+    for (int prio = 0; prio < csp_proc_prio_num; prio++) {
+      for (int i = 0; i < csp_sched_np - 1; i++) {
+        csp_core_pool_t *pool = csp_core_pool(victims[i]);
+        proc = csp_lrunq_steal(lrunqs[prio], pool->lrunqs[prio]);
+        if (proc != NULL) {
+          goto stolen;
+        }
       }
-      if (++pid == csp_sched_np) {
-        pid = 0;
+    }
+    for (int i = 0; i < csp_sched_np - 1; i++) {
+      if (csp_grunq_try_pop(csp_core_pool(victims[i])->grunq, &proc)) {
+        goto stolen;
       }
     }
 
-    /* If stealing failed, we continue to run current proc if it's valid. */
-    if (running != NULL && csp_proc_nchild_get(running) == 0) {
-      return running;
+#ifdef csp_with_io_uring
+    if ((proc = csp_sched_io(this_core, true)) != NULL) {
+      goto found;
     }
+#endif
 
-    /* We must call this before push it to the starving queue, otherwise there
-     * will be data race with monitor. */
-    csp_cond_before_wait(&this_core->pcond);
+#ifdef csp_with_netpoll_per_core
+    if ((proc = csp_sched_netpoll(this_core)) != NULL) {
+      goto found;
+    }
+#endif
 
-    while(!csp_mmrbq_try_push(core)(csp_sched_starving_procs, this_core));
-    if (csp_cond_wait(&this_core->pcond) == csp_cond_signal_deep_sleep) {
-      pthread_mutex_lock(&this_core->mutex);
-      while(!csp_mmrbq_try_push(core)(csp_sched_starving_threads, this_core));
-      pthread_cond_wait(&this_core->cond, &this_core->mutex);
-      pthread_mutex_unlock(&this_core->mutex);
+    if ((proc = csp_sched_timers(this_core)) != NULL) {
+      goto found;
     }
+
+    csp_core_preempt_off(this_core);
+
+#ifndef csp_with_sysmalloc
+    /* Nothing to run, so it's a good time to settle the remote frees. */
+    csp_mem_idle(this_core->pid);
+#endif
+
+    /* Spin for a while and then park in the kernel until someone takes our bit
+     * in the idle bitmap and signals us. If another core of the processor has
+     * announced itself, e.g. the spare core which has just taken our place,
+     * we just check again after a while. */
+    csp_stats_incr(&this_core->stats, starvings);
+    if (csp_likely(csp_core_pools_idle_put(this_core))) {
+      /* The wakers may have missed our announcement, so we check once more
+       * before parking and withdraw it to run what's found. */
+      if (!csp_sched_has_work(this_core)) {
+        csp_cond_wait(&this_core->cond);
+      }
+      csp_core_pools_idle_del(this_core);
+    } else {
+      csp_cond_timedwait(&this_core->cond, csp_sched_monitor_period);
+    }
+    csp_sched_reclaimed(this_core);
+    idled = true;
   }
 
+local:
+  csp_stats_incr(&this_core->stats, lrunq_pops);
+  goto found;
+stolen:
+  csp_stats_incr(&this_core->stats, steals);
+  csp_trace(steal, proc);
 found:
-  if (running != NULL && csp_proc_nchild_get(running) == 0) {
-    csp_lrunq_push(this_core->lrunq, running);
-  }
+  proc = csp_sched_found(this_core, proc);
 
-  size_t half = (csp_lrunq_len(this_core->lrunq) + 1) >> 1;
-  if (half == 0) {
-    return proc;
+  /* The monitor may be sleeping for long if all the cores were idle, wake it
+   * up to watch us. */
+  if (csp_unlikely(idled)) {
+    csp_monitor_wakeup(csp_timer_now() + csp_sched_monitor_period);
   }
+  return proc;
+}
 
-  csp_core_t *starving_core;
-  if (csp_mmrbq_try_pop(core)(csp_sched_starving_procs, &starving_core)) {
-    csp_proc_t *start = NULL, *end = NULL;
-    csp_lrunq_popm_front(this_core->lrunq, half, &start, &end);
-    csp_lrunq_set(starving_core->lrunq, half, start, end);
-    csp_cond_signal(&starving_core->pcond, csp_cond_signal_proc_avail);
+/* Settle the yielded process and make `next` the running one, it's called by
+ * `csp_core_switch_to` on the thread stack instead of `csp_sched_get` when the
+ * next process is already known. */
+csp_proc_t *csp_sched_switch(csp_proc_t *next) {
+  csp_core_t *this_core = csp_this_core;
+  bool owned = csp_core_acquire(this_core);
+  csp_sched_settle(this_core);
+
+  /* `next` goes to the runqs as well if the processor is no longer ours or is
+   * to be given back, see `csp_sched_get`. */
+  if (csp_unlikely(!owned || atomic_load_explicit(
+          &csp_core_pool(this_core->pid)->reclaimers,
+          memory_order_relaxed) != NULL)) {
+    csp_sched_push(this_core, next);
+    this_core->running = NULL;
+    csp_core_leave(this_core);
+    if (!owned) {
+      csp_core_spare_resched(this_core);
+    }
+    return this_core->running = csp_sched_get(this_core);
   }
-  return proc;
+  this_core->running = next;
+  return csp_sched_found(this_core, next);
 }
 
 void csp_sched_yield(void) {
@@ -198,6 +520,38 @@ void csp_sched_yield(void) {
   csp_core_yield(this_core->running, &this_core->anchor);
 }
 
+/* Park the running process until someone puts it back to a runq. `fn(arg)`,
+ * which usually releases the locks protecting the places where the process is
+ * registered, is called after the process has yielded. */
+void csp_sched_park_fn(void (*fn)(void *arg), void *arg) {
+  csp_core_t *this_core = csp_this_core;
+  csp_proc_t *running = this_core->running;
+  csp_trace(park, running);
+
+  this_core->park_fn = fn;
+  this_core->park_arg = arg;
+  this_core->running = NULL;
+  csp_core_yield(running, &this_core->anchor);
+}
+
+static void csp_sched_park_unlock(void *lock) {
+  csp_waitq_unlock((csp_spinlock_t *)lock);
+}
+
+/* Park the running process and release `lock` after it has yielded, it must
+ * have been taken by `csp_waitq_lock`. */
+void csp_sched_park(csp_spinlock_t *lock) {
+  csp_sched_park_fn(csp_sched_park_unlock, lock);
+}
+
+/* Yield the CPU to `proc` which will run right after the running process is
+ * put back to the runq. We switch to it directly so that the scheduler is not
+ * involved at all. */
+void csp_sched_handoff(csp_proc_t *proc) {
+  csp_core_t *this_core = csp_this_core;
+  csp_core_switch_to(this_core->running, proc, &this_core->anchor);
+}
+
 void csp_sched_hangup(uint64_t nanoseconds) {
   if (csp_unlikely(nanoseconds == 0)) {
     return;
@@ -205,14 +559,38 @@ void csp_sched_hangup(uint64_t nanoseconds) {
 
   csp_core_t *this_core = csp_this_core;
   csp_proc_t *running = this_core->running;
+  csp_trace(park, running);
   running->timer.when = csp_timer_now() + nanoseconds;
+  csp_core_enter(this_core);
   csp_timer_put(this_core->pid, running);
+  csp_core_leave(this_core);
 
   // Set `this_core->running` to zero to prevent it be scheduled.
   this_core->running = NULL;
   csp_core_yield(running, &this_core->anchor);
 }
 
+/* Set the priority class of the processes spawned by the running process and
+ * return the old one. */
+uint32_t csp_sched_spawn_prio_set(uint32_t prio) {
+  csp_proc_t *running = csp_this_core->running;
+  uint32_t old = running->spawn_prio;
+  running->spawn_prio = prio < csp_proc_prio_num ? prio : csp_proc_prio_normal;
+  return old;
+}
+
+csp_proc static void csp_sched_spawn_run(void (*fn)(void *arg), void *arg) {
+  fn(arg);
+}
+
+/* Run `fn(arg)` in a new process, e.g. to resume a C++ coroutine. The analyzer
+ * can't see through `fn`, so the process gets the default stack size or the
+ * elastic stack, or the one given to `csp_sched_spawn_run` in the extra stack
+ * usage file of `cspcli`. */
+void csp_sched_spawn(void (*fn)(void *arg), void *arg) {
+  csp_sched_async(csp_sched_spawn_run(fn, arg));
+}
+
 __attribute__((noinline)) void csp_sched_proc_anchor(bool need_sync) {};
 
 __attribute__((noinline))
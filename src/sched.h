@@ -30,6 +30,9 @@ extern "C" {
 #define csp_sched_async(tasks)  csp_sched_run(false, tasks)
 #define csp_sched_sync(tasks)   csp_sched_run(true, tasks)
 
+#define csp_sched_async_prio(prio, tasks) csp_sched_run_prio(false, prio, tasks)
+#define csp_sched_sync_prio(prio, tasks)  csp_sched_run_prio(true, prio, tasks)
+
 #define csp_sched_run(is_sync, tasks) do {                                     \
   csp_sched_proc_anchor(is_sync);                                              \
   csp_proc_nchild_set(0);                                                      \
@@ -37,6 +40,14 @@ extern "C" {
   csp_sched_yield();                                                           \
 } while (0)                                                                    \
 
+/* The processes spawned in `tasks` are in the priority class `prio`, see
+ * `csp_proc_prio_latency`. */
+#define csp_sched_run_prio(is_sync, prio, tasks) do {                          \
+  uint32_t csp_sched_saved_prio = csp_sched_spawn_prio_set(prio);              \
+  csp_sched_run(is_sync, tasks);                                               \
+  csp_sched_spawn_prio_set(csp_sched_saved_prio);                              \
+} while (0)                                                                    \
+
 #define csp_sched_block(tasks) do {                                            \
   csp_core_t *this_core = csp_this_core;                                       \
   if (csp_core_block_prologue(this_core)) {                                    \
@@ -48,7 +59,12 @@ extern "C" {
 } while (0)                                                                    \
 
 void csp_sched_yield(void);
+void csp_sched_park(csp_spinlock_t *lock);
+void csp_sched_park_fn(void (*fn)(void *arg), void *arg);
+void csp_sched_handoff(csp_proc_t *proc);
 void csp_sched_hangup(uint64_t nanoseconds);
+uint32_t csp_sched_spawn_prio_set(uint32_t prio);
+void csp_sched_spawn(void (*fn)(void *arg), void *arg);
 void csp_sched_proc_anchor(bool need_sync) __attribute__((noinline));
 void csp_shced_atomic_incr(atomic_uint_fast64_t *cnt) __attribute__((noinline));
 
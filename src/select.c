@@ -0,0 +1,275 @@
+/*
+ * Copyright (c) 2020, Yanhui Shi <lime.syh at gmail dot com>
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "core.h"
+#include "rand.h"
+#include "select.h"
+#include "timer.h"
+#include "waitq.h"
+
+/* The value of `done` when the timer fires before any case. */
+#define csp_select_timeout_fired  (-1)
+
+extern _Thread_local csp_core_t *csp_this_core;
+extern void csp_sched_yield(void);
+extern void csp_sched_hangup(uint64_t nanoseconds);
+extern void csp_sched_put_proc(csp_proc_t *proc);
+extern void csp_sched_park_fn(void (*fn)(void *arg), void *arg);
+
+typedef struct {
+  csp_select_case_t *cases;
+
+  /* The indexes of the cases sorted by the addresses of their locks, so that
+   * the selects sharing channels always lock them in the same order. */
+  uint8_t *order;
+  size_t n;
+} csp_select_locks_t;
+
+typedef struct {
+  csp_proc_t *proc;
+
+  /* The fired case shared by the nodes of all cases. */
+  atomic_int_fast64_t done;
+
+  /* The timeout handler holds `lock` while firing, which is released only
+   * after the select process has been parked. */
+  csp_spinlock_t *lock;
+
+  /* Whether the timeout handler has finished touching this struct. */
+  atomic_bool finished;
+} csp_select_waiter_t;
+
+static void csp_select_lock(csp_select_locks_t *locks) {
+  csp_spinlock_t *pre = NULL;
+  for (size_t i = 0; i < locks->n; i++) {
+    csp_spinlock_t *lock = locks->cases[locks->order[i]].lock;
+    if (lock != pre) {
+      csp_waitq_lock(lock);
+      pre = lock;
+    }
+  }
+}
+
+static void csp_select_unlock(void *data) {
+  csp_select_locks_t *locks = (csp_select_locks_t *)data;
+  csp_spinlock_t *pre = NULL;
+  for (size_t i = 0; i < locks->n; i++) {
+    csp_spinlock_t *lock = locks->cases[locks->order[i]].lock;
+    if (lock != pre) {
+      csp_waitq_unlock(lock);
+      pre = lock;
+    }
+  }
+}
+
+/* Run the operation of the case. A closed channel makes the case ready too
+ * with `*ok` set to false. The receiving case reads `closed` first, so that it
+ * still gets the items pushed before closing. */
+static bool csp_select_poll(csp_select_case_t *c, bool *ok,
+    csp_proc_t **woken) {
+  bool closed = atomic_load(c->closed);
+  *ok = !(c->send && closed) && c->op(c->chan, c->item, woken);
+  return *ok || closed;
+}
+
+/* Report the fired case and wake the peer up. */
+static void csp_select_fire(csp_select_case_t *c, bool ok, csp_proc_t *woken) {
+  if (c->ok != NULL) {
+    *c->ok = ok;
+  }
+  if (!ok) {
+    return;
+  }
+  if (c->direct) {
+    csp_sched_put_proc(woken);
+  } else {
+    csp_waitq_signal(c->peerq, 1);
+  }
+}
+
+/* Try the case without queueing. */
+static bool csp_select_try(csp_select_case_t *c) {
+  bool ok, ready;
+  csp_proc_t *woken = NULL;
+  if (!c->direct) {
+    ready = csp_select_poll(c, &ok, &woken);
+  } else if (atomic_load(&c->peerq->len) == 0 && !atomic_load(c->closed)) {
+    return false;
+  } else {
+    csp_waitq_lock(c->lock);
+    ready = csp_select_poll(c, &ok, &woken);
+    csp_waitq_unlock(c->lock);
+  }
+  if (ready) {
+    csp_select_fire(c, ok, woken);
+  }
+  return ready;
+}
+
+/* The timeout handler. */
+csp_proc static void csp_select_on_timeout(csp_select_waiter_t *waiter) {
+  csp_proc_t *proc = waiter->proc;
+  int_fast64_t none = 0;
+
+  csp_waitq_lock(waiter->lock);
+  bool fired = atomic_compare_exchange_strong(
+    &waiter->done, &none, csp_select_timeout_fired
+  );
+  csp_waitq_unlock(waiter->lock);
+
+  /* The waiter lives on the stack of the select process, so it must not be
+   * touched once the process may return. */
+  atomic_store(&waiter->finished, true);
+  if (fired) {
+    csp_sched_put_proc(proc);
+  }
+}
+
+int csp_select_run(csp_select_case_t *cases, size_t n,
+    csp_timer_duration_t timeout) {
+  if (n == 0) {
+    if (timeout > 0) {
+      csp_sched_hangup(timeout);
+    }
+    return csp_select_none;
+  }
+
+  csp_core_t *this_core = csp_this_core;
+  uint8_t pollorder[csp_select_max_cases], lockorder[csp_select_max_cases];
+
+  /* Shuffle the cases by the Fisher-Yates algorithm. */
+  for (size_t i = 0; i < n; i++) {
+    size_t j = csp_rand(&this_core->rand) % (i + 1);
+    pollorder[i] = pollorder[j];
+    pollorder[j] = i;
+  }
+
+  /* There are usually only a few cases, so the insertion sort is enough. */
+  for (size_t i = 0; i < n; i++) {
+    size_t j = i;
+    for (; j > 0 && cases[lockorder[j - 1]].lock > cases[i].lock; j--) {
+      lockorder[j] = lockorder[j - 1];
+    }
+    lockorder[j] = i;
+  }
+
+  csp_select_locks_t locks = {.cases = cases, .order = lockorder, .n = n};
+  csp_timer_time_t deadline = timeout > 0 ? csp_timer_now() + timeout : 0;
+
+  while (true) {
+    for (size_t i = 0; i < n; i++) {
+      if (csp_select_try(&cases[pollorder[i]])) {
+        return pollorder[i];
+      }
+    }
+    if (timeout == 0 || (timeout > 0 && csp_timer_now() >= deadline)) {
+      return csp_select_none;
+    }
+
+    csp_select_waiter_t waiter = {
+      .proc = this_core->running,
+      .lock = cases[lockorder[0]].lock
+    };
+    atomic_store(&waiter.done, 0);
+    atomic_store(&waiter.finished, false);
+    for (size_t i = 0; i < n; i++) {
+      cases[i].node = (csp_waitq_node_t){
+        .parked = waiter.proc, .data = cases[i].item,
+        .done = &waiter.done, .idx = i
+      };
+    }
+
+    /* Queue the buffered cases before trying them once more, since their peers
+     * check `len` of the wait queues without locks, see `csp_waitq_wait`. The
+     * direct cases are queued after that, otherwise they may meet themselves in
+     * the queues of the same channel. */
+    csp_select_lock(&locks);
+    for (size_t i = 0; i < n; i++) {
+      if (!cases[i].direct) {
+        csp_waitq_push(cases[i].waitq, &cases[i].node);
+      }
+    }
+
+    int fired = csp_select_none;
+    bool ok;
+    csp_proc_t *woken = NULL;
+    for (size_t i = 0; i < n; i++) {
+      if (csp_select_poll(&cases[pollorder[i]], &ok, &woken)) {
+        fired = pollorder[i];
+        break;
+      }
+    }
+
+    if (fired != csp_select_none) {
+      for (size_t i = 0; i < n; i++) {
+        if (!cases[i].direct) {
+          csp_waitq_remove(cases[i].waitq, &cases[i].node);
+        }
+      }
+      csp_select_unlock(&locks);
+      csp_select_fire(&cases[fired], ok, woken);
+      return fired;
+    }
+
+    for (size_t i = 0; i < n; i++) {
+      if (cases[i].direct) {
+        csp_waitq_push(cases[i].waitq, &cases[i].node);
+      }
+    }
+
+    csp_timer_t timer;
+    if (timeout > 0) {
+      timer = csp_timer_at(deadline, csp_select_on_timeout(&waiter));
+    }
+    csp_sched_park_fn(csp_select_unlock, &locks);
+
+    /* Someone has fired the select, so drop the nodes left in the queues. */
+    csp_select_lock(&locks);
+    for (size_t i = 0; i < n; i++) {
+      if (csp_waitq_contains(cases[i].waitq, &cases[i].node)) {
+        csp_waitq_remove(cases[i].waitq, &cases[i].node);
+      }
+    }
+    csp_select_unlock(&locks);
+
+    int64_t done = atomic_load(&waiter.done);
+    if (timeout > 0 && done != csp_select_timeout_fired &&
+        !csp_timer_cancel(timer)) {
+      /* The timer is firing, wait for it to leave `waiter`. */
+      while (!atomic_load(&waiter.finished)) {
+        csp_sched_yield();
+      }
+    }
+    if (done == csp_select_timeout_fired) {
+      return csp_select_none;
+    }
+
+    /* The peer of a direct case has finished the operation for us unless it
+     * closes the channel, while the peer of a buffered case only tells us that
+     * it may be ready now. */
+    csp_select_case_t *c = &cases[done - 1];
+    if (c->direct) {
+      if (c->ok != NULL) {
+        *c->ok = c->node.data != NULL;
+      }
+      return done - 1;
+    }
+  }
+}
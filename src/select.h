@@ -0,0 +1,140 @@
+/*
+ * Copyright (c) 2020, Yanhui Shi <lime.syh at gmail dot com>
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef LIBCSP_SELECT_H
+#define LIBCSP_SELECT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "chan.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "timer.h"
+#include "waitq.h"
+
+/*
+ * `csp_select` waits on several channels at once like `select` in Go. It runs
+ * the first ready case and returns its index. If no case is ready, the running
+ * process is queued in the wait queues of all channels and parked, so it takes
+ * no CPU until the first ready channel wakes it up.
+ *
+ * The cases are tried in a random order each time, so none of them starves.
+ *
+ * `timeout` is one of the following,
+ *
+ *  - `csp_select_block`: wait until a case is ready.
+ *  - `csp_select_default`: return `csp_select_none` immediately if no case is
+ *    ready, i.e. the `default` case of Go.
+ *  - A positive duration: return `csp_select_none` if no case is ready after
+ *    `timeout` nanoseconds. The timeout is fired by the timer subsystem.
+ *
+ * Example:
+ *
+ *   int num;
+ *   char chr = 'a';
+ *   switch (csp_select(csp_select_block,
+ *       csp_select_recv(chn1, &num), csp_select_send(chn2, &chr))) {
+ *     case 0: printf("received %d\n", num); break;
+ *     case 1: printf("sent %c\n", chr); break;
+ *   }
+ */
+#define csp_select(timeout, ...) ({                                            \
+  csp_select_case_t cases_[] = {__VA_ARGS__};                                  \
+  _Static_assert(                                                              \
+    sizeof(cases_) / sizeof(csp_select_case_t) <= csp_select_max_cases,        \
+    "Too many cases in csp_select."                                            \
+  );                                                                           \
+  csp_select_run(                                                              \
+    cases_, sizeof(cases_) / sizeof(csp_select_case_t), (timeout)              \
+  );                                                                           \
+})                                                                             \
+
+#define csp_select_send(c, ptr)         csp_select_send_ok(c, ptr, NULL)
+#define csp_select_recv(c, ptr)         csp_select_recv_ok(c, ptr, NULL)
+
+/* The case to push `*ptr` to the channel `c`. `*ok` is set to false if the case
+ * is fired because the channel is closed. `ok` can be `NULL`. */
+#define csp_select_send_ok(c, ptr, ok_) ((csp_select_case_t){                  \
+  .chan = (c),                                                                 \
+  .item = (ptr),                                                               \
+  .op = (c)->select_send,                                                      \
+  .send = true,                                                                \
+  .direct = csp_chan_is_unbuffered(c),                                         \
+  .closed = &(c)->closed,                                                      \
+  .ok = (ok_),                                                                 \
+  .waitq = &(c)->sendq,                                                        \
+  .peerq = &(c)->recvq,                                                        \
+  .lock = &(c)->sendq.lock                                                     \
+})                                                                             \
+
+/* The case to pop an item from the channel `c` to `*ptr`. `*ok` is set to false
+ * if the case is fired because the channel is closed and drained. */
+#define csp_select_recv_ok(c, ptr, ok_) ((csp_select_case_t){                  \
+  .chan = (c),                                                                 \
+  .item = (ptr),                                                               \
+  .op = (c)->select_recv,                                                      \
+  .send = false,                                                               \
+  .direct = csp_chan_is_unbuffered(c),                                         \
+  .closed = &(c)->closed,                                                      \
+  .ok = (ok_),                                                                 \
+  .waitq = &(c)->recvq,                                                        \
+  .peerq = &(c)->sendq,                                                        \
+  .lock = csp_chan_is_unbuffered(c) ? &(c)->sendq.lock : &(c)->recvq.lock      \
+})                                                                             \
+
+#define csp_select_block        ((csp_timer_duration_t)-1)
+#define csp_select_default      ((csp_timer_duration_t)0)
+#define csp_select_none         (-1)
+#define csp_select_max_cases    128
+
+typedef struct {
+  /* The channel and the item to send or the place to put the received one. */
+  void *chan, *item;
+
+  /* The non-blocking operation of the case. It's called with `lock` held if
+   * `direct` is true, otherwise it's lock-free. */
+  bool (*op)(void *chan, void *item, csp_proc_t **woken);
+
+  /* Whether it's a sending case, and whether the item is handed over between
+   * the peers directly, i.e. the channel is unbuffered. */
+  bool send, direct;
+
+  /* `closed` of the channel and where to tell whether the case is fired by the
+   * item or by closing. */
+  atomic_bool *closed;
+  bool *ok;
+
+  /* The queue to park in, the queue of the peers and the lock of `waitq`. */
+  csp_waitq_t *waitq, *peerq;
+  csp_spinlock_t *lock;
+
+  csp_waitq_node_t node;
+} csp_select_case_t;
+
+int csp_select_run(csp_select_case_t *cases, size_t n,
+    csp_timer_duration_t timeout);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) 2020, Yanhui Shi <lime.syh at gmail dot com>
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef LIBCSP_SEMA_H
+#define LIBCSP_SEMA_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "waitq.h"
+
+/*
+ * `csp_sema_t` is the counting semaphore for the processes. A process which
+ * can't acquire it is parked in `waitq` until a release, and then it competes
+ * with the others for the count again.
+ */
+typedef struct {
+  atomic_int_fast64_t count;
+  csp_waitq_t waitq;
+} csp_sema_t;
+
+#define csp_sema_init(sema, n) do {                                            \
+  atomic_store(&(sema)->count, (n));                                           \
+  csp_waitq_init(&(sema)->waitq);                                              \
+} while (0)                                                                    \
+
+#define csp_sema_try_acquire(sema) ({                                          \
+  atomic_int_fast64_t *count_ = &(sema)->count;                                \
+  int_fast64_t n_ = atomic_load(count_);                                       \
+  while (n_ > 0 && !atomic_compare_exchange_weak(count_, &n_, n_ - 1)) {}      \
+  n_ > 0;                                                                      \
+})                                                                             \
+
+#define csp_sema_acquire(sema) do {                                            \
+  csp_sema_t *sema_ = (sema);                                                  \
+  csp_waitq_wait(&sema_->waitq, csp_sema_try_acquire(sema_));                  \
+} while (0)                                                                    \
+
+/* The count is increased before `waitq.len` is read, see `csp_waitq_wait`. */
+#define csp_sema_release(sema) do {                                            \
+  csp_sema_t *sema_ = (sema);                                                  \
+  atomic_fetch_add(&sema_->count, 1);                                          \
+  csp_waitq_signal(&sema_->waitq, 1);                                          \
+} while (0)                                                                    \
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
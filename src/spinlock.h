@@ -0,0 +1,45 @@
+/*
+ * Copyright (c) 2020, Yanhui Shi <lime.syh at gmail dot com>
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef LIBCSP_SPINLOCK_H
+#define LIBCSP_SPINLOCK_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdatomic.h>
+#include "common.h"
+
+/* `csp_spinlock_t` guards the short internal critical sections, e.g. the wait
+ * queues of the channels. It never parks, so it's also usable on the threads
+ * which are not running any process. See `csp_mutex_t` for the proc-aware
+ * one. */
+#define csp_spinlock_t                atomic_flag
+#define csp_spinlock_try_lock(lock)   (!atomic_flag_test_and_set(lock))
+#define csp_spinlock_lock(lock)                                                \
+  while (!csp_spinlock_try_lock(lock)) { csp_cpu_relax(); }                    \
+
+#define csp_spinlock_unlock(lock)     atomic_flag_clear(lock)
+#define csp_spinlock_init(lock)                                                \
+  do { *(lock) = (atomic_flag)ATOMIC_FLAG_INIT; } while (0)                    \
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
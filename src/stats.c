@@ -0,0 +1,172 @@
+/*
+ * Copyright (c) 2020, Yanhui Shi <lime.syh at gmail dot com>
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <string.h>
+#include "core.h"
+#include "corepool.h"
+#include "runq.h"
+#include "stats.h"
+
+extern int csp_sched_np;
+
+csp_stats_block_t csp_stats_shared;
+
+#define csp_stats_sum_field(name)                                              \
+  stats->name += atomic_load_explicit(&block->name, memory_order_relaxed);     \
+
+static void csp_stats_sum(csp_stats_t *stats, csp_stats_block_t *block) {
+  csp_stats_each_counter(csp_stats_sum_field)
+}
+
+/* The processes in the grunq including the spilled ones, the consumer's cursor
+ * is read first so that the difference never underflows. */
+static size_t csp_stats_grunq_len(csp_grunq_t *grunq) {
+  uint_fast64_t slow = csp_rbq_mptr_next_get(grunq->ring->slow);
+  return csp_rbq_mptr_next_get(grunq->ring->fast) - slow +
+    atomic_load_explicit(&grunq->nspilled, memory_order_relaxed);
+}
+
+static void csp_stats_add_pool(csp_stats_t *stats, csp_core_pool_t *pool) {
+  size_t len = atomic_load_explicit(&pool->len, memory_order_acquire);
+  for (size_t i = 0; i < len; i++) {
+    csp_core_t *core = pool->all[i];
+    csp_stats_sum(stats, &core->stats);
+    stats->deep_sleeps += atomic_load_explicit(
+      &core->cond.nsleeps, memory_order_relaxed
+    );
+  }
+  for (int i = 0; i < csp_proc_prio_num; i++) {
+    stats->lrunq_len += csp_lrunq_len(pool->lrunqs[i]);
+  }
+  stats->grunq_len += csp_stats_grunq_len(pool->grunq);
+  stats->cores += len;
+}
+
+/* Sum up the counters of all the cores and `csp_stats_shared`. */
+void csp_stats_snapshot(csp_stats_t *stats) {
+  memset(stats, 0, sizeof(csp_stats_t));
+  for (int pid = 0; pid < csp_sched_np; pid++) {
+    csp_stats_add_pool(stats, csp_core_pool(pid));
+  }
+  csp_stats_sum(stats, &csp_stats_shared);
+}
+
+/* Sum up the counters of the cores running on the processor `pid`, the ones
+ * counted by the other threads are not included. */
+bool csp_stats_snapshot_pid(size_t pid, csp_stats_t *stats) {
+  if (pid >= (size_t)csp_sched_np) {
+    return false;
+  }
+  memset(stats, 0, sizeof(csp_stats_t));
+  csp_stats_add_pool(stats, csp_core_pool(pid));
+  return true;
+}
+
+#ifdef csp_with_latency_stats
+static void csp_stats_hist_sum(
+  csp_stats_hist_t *hist, csp_stats_hist_block_t *block
+) {
+  for (size_t i = 0; i < csp_stats_hist_len; i++) {
+    uint64_t cnt = atomic_load_explicit(
+      &block->counts[i], memory_order_relaxed
+    );
+    hist->counts[i] += cnt;
+    hist->total += cnt;
+  }
+}
+
+static void csp_stats_latency_add_pool(
+  csp_stats_hist_t *delay, csp_stats_hist_t *slice, csp_core_pool_t *pool
+) {
+  size_t len = atomic_load_explicit(&pool->len, memory_order_acquire);
+  for (size_t i = 0; i < len; i++) {
+    csp_core_t *core = pool->all[i];
+    if (delay != NULL) {
+      csp_stats_hist_sum(delay, &core->delay);
+    }
+    if (slice != NULL) {
+      csp_stats_hist_sum(slice, &core->slice);
+    }
+  }
+}
+#endif
+
+static bool csp_stats_latency_init(
+  csp_stats_hist_t *delay, csp_stats_hist_t *slice
+) {
+#ifdef csp_with_latency_stats
+  if (delay != NULL) {
+    memset(delay, 0, sizeof(csp_stats_hist_t));
+  }
+  if (slice != NULL) {
+    memset(slice, 0, sizeof(csp_stats_hist_t));
+  }
+  return true;
+#else
+  return false;
+#endif
+}
+
+/* Sum up the histograms of the scheduling delays and the time slices of all
+ * the cores, either of them can be NULL. It fails if the library isn't built
+ * with `csp_with_latency_stats`. */
+bool csp_stats_latency(csp_stats_hist_t *delay, csp_stats_hist_t *slice) {
+  if (!csp_stats_latency_init(delay, slice)) {
+    return false;
+  }
+#ifdef csp_with_latency_stats
+  for (int pid = 0; pid < csp_sched_np; pid++) {
+    csp_stats_latency_add_pool(delay, slice, csp_core_pool(pid));
+  }
+#endif
+  return true;
+}
+
+bool csp_stats_latency_pid(
+  size_t pid, csp_stats_hist_t *delay, csp_stats_hist_t *slice
+) {
+  if (pid >= (size_t)csp_sched_np || !csp_stats_latency_init(delay, slice)) {
+    return false;
+  }
+#ifdef csp_with_latency_stats
+  csp_stats_latency_add_pool(delay, slice, csp_core_pool(pid));
+#endif
+  return true;
+}
+
+/* The lower bound of the bucket where the `p`(in [0, 1]) quantile is, e.g.
+ * `csp_stats_hist_percentile(hist, 0.99)` is the p99 latency in nanoseconds. */
+uint64_t csp_stats_hist_percentile(const csp_stats_hist_t *hist, double p) {
+  if (hist->total == 0) {
+    return 0;
+  }
+  p = p < 0 ? 0 : (p > 1 ? 1 : p);
+  uint64_t rank = (uint64_t)(p * (double)hist->total);
+  if (rank == 0) {
+    rank = 1;
+  }
+  uint64_t seen = 0;
+  for (size_t i = 0; i < csp_stats_hist_len; i++) {
+    seen += hist->counts[i];
+    if (seen >= rank) {
+      return csp_stats_hist_value(i);
+    }
+  }
+  return csp_stats_hist_value(csp_stats_hist_len - 1);
+}
@@ -0,0 +1,197 @@
+/*
+ * Copyright (c) 2020, Yanhui Shi <lime.syh at gmail dot com>
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef LIBCSP_STATS_H
+#define LIBCSP_STATS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "proc.h"
+#include "timer.h"
+
+/*
+ * `stats.h` counts what the scheduler is doing. Every core has its own block of
+ * counters in a separate cache line, which only the core itself writes, so
+ * counting is a plain load and store. The threads which are not cores(e.g. the
+ * monitor and the offload workers) count on `csp_stats_shared` atomically.
+ * `csp_stats_snapshot` sums up all the blocks without any lock, the counters
+ * may be a bit behind but never go backwards.
+ */
+#define csp_stats_each_counter(X)                                              \
+  X(switches)                                                                  \
+  X(lrunq_pops)                                                                \
+  X(grunq_pops)                                                                \
+  X(steal_tries)                                                               \
+  X(steals)                                                                    \
+  X(starvings)                                                                 \
+  X(timer_fires)                                                               \
+  X(netpoll_wakeups)                                                           \
+  X(mem_mailbox_pushes)                                                        \
+
+#define csp_stats_counter_field(name) atomic_uint_fast64_t name;
+
+typedef struct __attribute__((aligned(64))) {
+  csp_stats_each_counter(csp_stats_counter_field)
+} csp_stats_block_t;
+
+/* Count on a block of a core, only the core itself may call it. */
+#define csp_stats_add(block, name, n) do {                                     \
+  atomic_uint_fast64_t *cnt_ = &(block)->name;                                 \
+  atomic_store_explicit(cnt_, atomic_load_explicit(cnt_,                       \
+    memory_order_relaxed) + (n), memory_order_relaxed);                        \
+} while (0)                                                                    \
+
+#define csp_stats_incr(block, name) csp_stats_add(block, name, 1)
+
+/* Count on `csp_stats_shared`, it's for the threads which are not cores. */
+#define csp_stats_shared_add(name, n)                                          \
+  atomic_fetch_add_explicit(&csp_stats_shared.name, (n), memory_order_relaxed) \
+
+#define csp_stats_value_field(name) uint64_t name;
+
+/*
+ * `csp_stats_t` is a snapshot of the counters:
+ *   - `switches`: the processes picked to run.
+ *   - `lrunq_pops` and `grunq_pops`: the processes picked from the local runqs
+ *     and the global runq of the core itself.
+ *   - `steal_tries` and `steals`: the rounds of stealing from the other cores
+ *     and the ones which got a process.
+ *   - `starvings`: how many times a core found nothing to run and announced
+ *     itself in the idle bitmap, and `deep_sleeps` the times it parked in the
+ *     kernel.
+ *   - `timer_fires` and `netpoll_wakeups`: the processes woken up by the timers
+ *     and the netpoll.
+ *   - `mem_mailbox_pushes`: the pushes of the freed objects to the mailboxes of
+ *     the other heaps.
+ * and the gauges at the time of the snapshot: `lrunq_len` and `grunq_len` are
+ * the processes waiting in the runqs, and `cores` is the number of threads
+ * created.
+ */
+typedef struct {
+  csp_stats_each_counter(csp_stats_value_field)
+  uint64_t deep_sleeps;
+  uint64_t lrunq_len, grunq_len, cores;
+} csp_stats_t;
+
+/*
+ * The latency histograms are log-linear like the HDR histograms. The values
+ * below `1 << csp_stats_hist_sub_exp` nanoseconds have their own buckets, and
+ * every power of two above is split into `1 << csp_stats_hist_sub_exp` ones,
+ * so a value is off by at most 1/16 from the lower bound of its bucket. The
+ * values are saturated at `2 << csp_stats_hist_max_exp` nanoseconds, i.e. about
+ * 36 minutes.
+ */
+#define csp_stats_hist_sub_exp  4
+#define csp_stats_hist_max_exp  40
+#define csp_stats_hist_len                                                     \
+  ((csp_stats_hist_max_exp - csp_stats_hist_sub_exp + 2) <<                    \
+   csp_stats_hist_sub_exp)                                                     \
+
+typedef struct __attribute__((aligned(64))) {
+  atomic_uint_fast64_t counts[csp_stats_hist_len];
+} csp_stats_hist_block_t;
+
+/* `counts[i]` is the number of values in the bucket `i`, whose lower bound is
+ * `csp_stats_hist_value(i)`. */
+typedef struct {
+  uint64_t counts[csp_stats_hist_len];
+  uint64_t total;
+} csp_stats_hist_t;
+
+static inline size_t csp_stats_hist_index(uint64_t val) {
+  size_t sub = (size_t)1 << csp_stats_hist_sub_exp;
+  if (val < sub) {
+    return val;
+  }
+  if (val >> (csp_stats_hist_max_exp + 1) != 0) {
+    val = ((uint64_t)2 << csp_stats_hist_max_exp) - 1;
+  }
+  int exp = 63 - __builtin_clzll(val);
+  return ((size_t)(exp - csp_stats_hist_sub_exp + 1) << csp_stats_hist_sub_exp)
+    + (size_t)(val >> (exp - csp_stats_hist_sub_exp)) - sub;
+}
+
+static inline uint64_t csp_stats_hist_value(size_t idx) {
+  size_t sub = (size_t)1 << csp_stats_hist_sub_exp;
+  if (idx < sub) {
+    return idx;
+  }
+  int shift = (int)(idx >> csp_stats_hist_sub_exp) - 1;
+  return (uint64_t)((idx & (sub - 1)) + sub) << shift;
+}
+
+/*
+ * With `csp_with_latency_stats`, a process is stamped when it's put to a runq,
+ * and a core records how long the process waited when it picks the process,
+ * and how long the process ran when it leaves, so we know whether the
+ * processes wait for the cores. A process switched to directly(e.g. by
+ * `csp_sched_handoff`) has no scheduling delay.
+ */
+#ifdef csp_with_latency_stats
+#define csp_stats_hist_record(block, val) do {                                 \
+  atomic_uint_fast64_t *cnt_ = &(block)->counts[csp_stats_hist_index(val)];    \
+  atomic_store_explicit(cnt_, atomic_load_explicit(cnt_,                       \
+    memory_order_relaxed) + 1, memory_order_relaxed);                          \
+} while (0)                                                                    \
+
+#define csp_stats_latency_queued(proc)                                         \
+  do { (proc)->queued_at = csp_timer_now(); } while (0)                        \
+
+#define csp_stats_latency_run(core, proc) do {                                 \
+  csp_timer_time_t now_ = csp_timer_now();                                     \
+  if ((proc)->queued_at != 0) {                                                \
+    csp_stats_hist_record(&(core)->delay, now_ - (proc)->queued_at);           \
+    (proc)->queued_at = 0;                                                     \
+  }                                                                            \
+  (core)->run_since = now_;                                                    \
+} while (0)                                                                    \
+
+#define csp_stats_latency_leave(core) do {                                     \
+  if ((core)->run_since != 0) {                                                \
+    csp_stats_hist_record(&(core)->slice,                                      \
+      csp_timer_now() - (core)->run_since);                                    \
+    (core)->run_since = 0;                                                     \
+  }                                                                            \
+} while (0)                                                                    \
+
+#else
+#define csp_stats_latency_queued(proc)
+#define csp_stats_latency_run(core, proc)
+#define csp_stats_latency_leave(core)
+#endif
+
+void csp_stats_snapshot(csp_stats_t *stats);
+bool csp_stats_snapshot_pid(size_t pid, csp_stats_t *stats);
+bool csp_stats_latency(csp_stats_hist_t *delay, csp_stats_hist_t *slice);
+bool csp_stats_latency_pid(
+  size_t pid, csp_stats_hist_t *delay, csp_stats_hist_t *slice
+);
+uint64_t csp_stats_hist_percentile(const csp_stats_hist_t *hist, double p);
+
+extern csp_stats_block_t csp_stats_shared;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
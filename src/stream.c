@@ -0,0 +1,222 @@
+/*
+ * Copyright (c) 2020, Yanhui Shi <lime.syh at gmail dot com>
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include "core.h"
+#include "netpoll.h"
+#include "stream.h"
+
+extern _Thread_local csp_core_t *csp_this_core;
+
+#ifndef csp_with_sysmalloc
+extern void *csp_mem_alloc(size_t pid, size_t size);
+extern void csp_mem_free(size_t pid, void *obj);
+#endif
+
+/* Allocate `buf` from the heap of the running core, which is kept in `pid`.
+ * The process may have moved to another core since the other buffer was
+ * allocated, so each buffer remembers its own heap. */
+static bool csp_stream_buf_alloc(char **buf, size_t *pid) {
+  if (*buf != NULL) {
+    return true;
+  }
+#ifdef csp_with_sysmalloc
+  *buf = (char *)malloc(csp_stream_buf_size);
+#else
+  csp_core_t *this_core = csp_this_core;
+  csp_core_enter(this_core);
+  *pid = this_core->pid;
+  *buf = (char *)csp_mem_alloc(*pid, csp_stream_buf_size);
+  csp_core_leave(this_core);
+#endif
+  if (*buf == NULL) {
+    errno = ENOMEM;
+    return false;
+  }
+  return true;
+}
+
+/* Free `buf` to the heap `pid`, it's a remote free if we are running on
+ * another core. */
+static void csp_stream_buf_free(char *buf, size_t pid) {
+  if (buf == NULL) {
+    return;
+  }
+#ifdef csp_with_sysmalloc
+  free(buf);
+#else
+  csp_core_t *this_core = csp_this_core;
+  csp_core_enter(this_core);
+  csp_mem_free(pid, buf);
+  csp_core_leave(this_core);
+#endif
+}
+
+/* Write all of `iov[0, n)`, which is consumed on the way. */
+static bool csp_stream_send(csp_stream_t *s, struct iovec *iov, int n) {
+  while (n > 0) {
+    ssize_t len = csp_netpoll_retry(
+      writev(s->fd, iov, n), csp_netpoll_wait_write(s->fd, s->timeout)
+    );
+    if (len == -1) {
+      return false;
+    }
+    for (; n > 0 && (size_t)len >= iov->iov_len; iov++, n--) {
+      len -= iov->iov_len;
+    }
+    if (n > 0) {
+      iov->iov_base = (char *)iov->iov_base + len;
+      iov->iov_len -= len;
+    }
+  }
+  return true;
+}
+
+int csp_stream_flush(csp_stream_t *s) {
+  if (s->wlen == 0) {
+    return 0;
+  }
+  struct iovec iov = {.iov_base = s->wbuf, .iov_len = s->wlen};
+  s->wlen = 0;
+  return csp_stream_send(s, &iov, 1) ? 0 : -1;
+}
+
+/* Flush the pending writes instead of parking if there are any, the read is
+ * retried right after them. */
+static int csp_stream_wait_read(csp_stream_t *s) {
+  if (s->wlen > 0) {
+    return csp_stream_flush(s) == 0 ? csp_netpoll_avail : -1;
+  }
+  return csp_netpoll_wait_read(s->fd, s->timeout);
+}
+
+void csp_stream_init(csp_stream_t *s, int fd, csp_timer_duration_t timeout) {
+  *s = (csp_stream_t){.fd = fd, .timeout = timeout};
+}
+
+ssize_t csp_stream_readv(csp_stream_t *s, const struct iovec *iov, int n) {
+  if (n > csp_stream_iovs_max - 1) {
+    n = csp_stream_iovs_max - 1;
+  }
+
+  /* Serve the buffered bytes first without any syscall. */
+  if (s->rpos < s->rlen) {
+    size_t total = 0;
+    for (int i = 0; i < n && s->rpos < s->rlen; i++) {
+      size_t len = s->rlen - s->rpos;
+      if (len > iov[i].iov_len) {
+        len = iov[i].iov_len;
+      }
+      memcpy(iov[i].iov_base, s->rbuf + s->rpos, len);
+      s->rpos += len;
+      total += len;
+    }
+    return total;
+  }
+
+  if (!csp_stream_buf_alloc(&s->rbuf, &s->rpid)) {
+    return -1;
+  }
+  struct iovec iovs[csp_stream_iovs_max];
+  size_t total = 0;
+  for (int i = 0; i < n; i++) {
+    iovs[i] = iov[i];
+    total += iov[i].iov_len;
+  }
+  iovs[n] = (struct iovec){.iov_base = s->rbuf, .iov_len = csp_stream_buf_size};
+
+  ssize_t len = csp_netpoll_retry(
+    readv(s->fd, iovs, n + 1), csp_stream_wait_read(s)
+  );
+  if (len == -1 || (size_t)len <= total) {
+    return len;
+  }
+  s->rpos = 0;
+  s->rlen = len - total;
+  return total;
+}
+
+ssize_t csp_stream_read(csp_stream_t *s, void *buf, size_t n) {
+  struct iovec iov = {.iov_base = buf, .iov_len = n};
+  return csp_stream_readv(s, &iov, 1);
+}
+
+/* Read exactly `n` bytes unless the peer closes the stream, e.g. the header or
+ * the body of a message. */
+ssize_t csp_stream_read_full(csp_stream_t *s, void *buf, size_t n) {
+  size_t total = 0;
+  while (total < n) {
+    ssize_t len = csp_stream_read(s, (char *)buf + total, n - total);
+    if (len <= 0) {
+      return len == 0 ? (ssize_t)total : -1;
+    }
+    total += len;
+  }
+  return total;
+}
+
+ssize_t csp_stream_writev(csp_stream_t *s, const struct iovec *iov, int n) {
+  size_t total = 0;
+  for (int i = 0; i < n; i++) {
+    total += iov[i].iov_len;
+  }
+  if (!csp_stream_buf_alloc(&s->wbuf, &s->wpid)) {
+    return -1;
+  }
+
+  if (s->wlen + total <= csp_stream_buf_size) {
+    for (int i = 0; i < n; i++) {
+      memcpy(s->wbuf + s->wlen, iov[i].iov_base, iov[i].iov_len);
+      s->wlen += iov[i].iov_len;
+    }
+    return total;
+  }
+
+  /* Write the pending bytes along with the new ones instead of copying. */
+  struct iovec iovs[csp_stream_iovs_max];
+  int len = 0;
+  if (s->wlen > 0) {
+    iovs[len++] = (struct iovec){.iov_base = s->wbuf, .iov_len = s->wlen};
+    s->wlen = 0;
+  }
+  for (int i = 0; i < n; i++) {
+    iovs[len++] = iov[i];
+    if (len == csp_stream_iovs_max || i == n - 1) {
+      if (!csp_stream_send(s, iovs, len)) {
+        return -1;
+      }
+      len = 0;
+    }
+  }
+  return total;
+}
+
+ssize_t csp_stream_write(csp_stream_t *s, const void *buf, size_t n) {
+  struct iovec iov = {.iov_base = (void *)buf, .iov_len = n};
+  return csp_stream_writev(s, &iov, 1);
+}
+
+void csp_stream_destroy(csp_stream_t *s) {
+  csp_stream_buf_free(s->rbuf, s->rpid);
+  csp_stream_buf_free(s->wbuf, s->wpid);
+  s->rbuf = s->wbuf = NULL;
+  s->rpos = s->rlen = s->wlen = 0;
+}
@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) 2020, Yanhui Shi <lime.syh at gmail dot com>
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef LIBCSP_STREAM_H
+#define LIBCSP_STREAM_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include "timer.h"
+
+/*
+ * `csp_stream_t` buffers the reads and writes of a fd registered to the
+ * netpoll, so that the small messages cost far fewer syscalls.
+ *
+ * The writes are copied to the write buffer and flushed with one `writev`
+ * when the buffer can't hold the next one, together with the next one so it's
+ * never copied. The pending writes are also flushed once the process is about
+ * to park in a read of the stream, since the peer is likely waiting for them,
+ * or explicitly with `csp_stream_flush`. The reads are served from the read
+ * buffer, and when it's empty they `readv` into the buffers of the caller and
+ * the read buffer at once.
+ *
+ * The buffers are allocated from the heap of the running core when they are
+ * first used, so an idle stream takes no memory for them. All the functions
+ * return what their syscall counterparts return, i.e. `-1` with `errno` set on
+ * failure, `ETIMEDOUT` if the fd is not ready after `timeout` nanoseconds. The
+ * stream should be destroyed after a failure. They must be called in a
+ * process, and a stream must be used by one process at a time.
+ */
+
+#ifndef csp_stream_buf_size
+#define csp_stream_buf_size       4096
+#endif
+
+/* The maximum number of buffers passed to one `writev` or `readv`. */
+#define csp_stream_iovs_max       16
+
+typedef struct {
+  int fd;
+  csp_timer_duration_t timeout;
+
+  /* The unread bytes are `rbuf[rpos, rlen)`, and `rbuf` is allocated from the
+   * heap of core `rpid`. */
+  char *rbuf;
+  size_t rpos, rlen, rpid;
+
+  /* The pending bytes are `wbuf[0, wlen)`, and `wbuf` is allocated from the
+   * heap of core `wpid`. */
+  char *wbuf;
+  size_t wlen, wpid;
+} csp_stream_t;
+
+void csp_stream_init(csp_stream_t *s, int fd, csp_timer_duration_t timeout);
+ssize_t csp_stream_read(csp_stream_t *s, void *buf, size_t n);
+ssize_t csp_stream_readv(csp_stream_t *s, const struct iovec *iov, int n);
+ssize_t csp_stream_read_full(csp_stream_t *s, void *buf, size_t n);
+ssize_t csp_stream_write(csp_stream_t *s, const void *buf, size_t n);
+ssize_t csp_stream_writev(csp_stream_t *s, const struct iovec *iov, int n);
+int csp_stream_flush(csp_stream_t *s);
+void csp_stream_destroy(csp_stream_t *s);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
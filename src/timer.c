@@ -21,17 +21,42 @@
 #include <stdlib.h>
 #include "common.h"
 #include "core.h"
-#include "mutex.h"
 #include "proc.h"
+#include "rbq.h"
+#include "spinlock.h"
+#include "stats.h"
 #include "timer.h"
 
+#if defined(__aarch64__)
+/* The generic timer counter of AArch64 has a fixed frequency(e.g. 25MHz on
+ * Graviton), so it's calibrated the same as the TSC. */
+#define csp_timer_getclock() ({                                                \
+  int64_t clock;                                                               \
+  __asm__ __volatile__("isb\nmrs %0, cntvct_el0\n" : "=r"(clock));             \
+  clock;                                                                       \
+})
+#else
 #define csp_timer_getclock() ({                                                \
   uint32_t high, low;                                                          \
   __asm__ __volatile__("rdtsc\n": "=d"(high), "=a"(low));                      \
   ((int64_t)high << 32) | low;                                                 \
-})                                                                             \
+})
+#endif
+
+/* Recalibrate the TSC clock of a thread once `2^30` clocks(about 0.3~1s)
+ * elapse since the last time. */
+#define csp_timer_tsc_period      ((int64_t)1 << 30)
+
+/* Nanoseconds per clock are in fixed-point with 32 fractional bits. */
+#define csp_timer_tsc_shift       32
 
 #define csp_timer_heap_default_cap 64
+
+/* The capacity of the inbox of every timer queue is 2^12. */
+#define csp_timer_inbox_cap_exp   12
+
+/* Canceling requests are sent to the inbox with the lowest bit set. */
+#define csp_timer_inbox_cancel    ((uintptr_t)1)
 #define csp_timer_heap_lte(heap, i, j)                                         \
   ((heap)->procs[i]->timer.when <= (heap)->procs[j]->timer.when)
 
@@ -53,30 +78,136 @@
 
 extern int csp_sched_np;
 extern _Thread_local csp_core_t *csp_this_core;
+extern _Thread_local bool csp_monitor_self;
 
 extern void csp_core_proc_exit(void);
 extern void csp_proc_destroy(csp_proc_t *proc);
 extern void csp_sched_yield(void);
+extern void csp_monitor_wakeup(csp_timer_time_t when);
+
+/* The time cached by the monitor for `csp_timer_now_coarse`. */
+atomic_int_fast64_t csp_timer_coarse_now;
+
+/* The initial nanoseconds per clock for every thread, measured once when the
+ * runtime starts and zero before that. */
+static uint64_t csp_timer_tsc_mult;
+
+/* The TSC clock of every thread. `clock` and `time` are the TSC and the
+ * monotonic time read together at the last calibration, `last` is the last
+ * time returned so that the clock never goes backward across calibrations. */
+static _Thread_local struct {
+  int64_t clock, time, last;
+  uint64_t mult;
+} csp_timer_tsc;
+
+/* Measure the TSC frequency against the monotonic clock for about 1ms. The
+ * frequency of the AArch64 counter is reported by `cntfrq_el0` directly. */
+static void csp_timer_tsc_init(void) {
+#if defined(__aarch64__)
+  uint64_t freq;
+  __asm__ __volatile__("mrs %0, cntfrq_el0\n" : "=r"(freq));
+  if (freq > 0) {
+    csp_timer_tsc_mult = (
+      ((unsigned __int128)csp_timer_second) << csp_timer_tsc_shift
+    ) / freq;
+    atomic_store(&csp_timer_coarse_now, csp_timer_now_precise());
+    return;
+  }
+#endif
+
+  csp_timer_time_t start = csp_timer_now_precise(), end;
+  int64_t clock = csp_timer_getclock();
+  while ((end = csp_timer_now_precise()) - start < csp_timer_millisecond);
+  int64_t clocks = csp_timer_getclock() - clock;
+
+  if (clocks > 0) {
+    csp_timer_tsc_mult = (
+      ((unsigned __int128)(end - start)) << csp_timer_tsc_shift
+    ) / clocks;
+  }
+  atomic_store(&csp_timer_coarse_now, end);
+}
 
-typedef struct csp_timer_heap_t {
+static csp_timer_time_t csp_timer_tsc_calibrate(int64_t clock) {
+  csp_timer_time_t time = csp_timer_now_precise();
+  int64_t clocks = clock - csp_timer_tsc.clock;
+
+  /* Refine the rate of this thread with the elapsed period, or start from the
+   * global one if it's the first time or the TSC went backward(e.g. the
+   * thread migrated to a core with an unsynchronized TSC). */
+  if (csp_timer_tsc.mult != 0 && clocks >= csp_timer_tsc_period) {
+    csp_timer_tsc.mult = (
+      ((unsigned __int128)(time - csp_timer_tsc.time)) << csp_timer_tsc_shift
+    ) / clocks;
+  } else {
+    csp_timer_tsc.mult = csp_timer_tsc_mult;
+  }
+  csp_timer_tsc.clock = clock;
+  csp_timer_tsc.time = time;
+  return time;
+}
+
+csp_timer_time_t csp_timer_clock_now(void) {
+  int64_t clock = csp_timer_getclock(), clocks = clock - csp_timer_tsc.clock;
+  csp_timer_time_t now;
+
+  if (csp_likely(csp_timer_tsc.mult != 0 &&
+        clocks >= 0 && clocks < csp_timer_tsc_period)) {
+    now = csp_timer_tsc.time + (csp_timer_time_t)(
+      ((unsigned __int128)clocks * csp_timer_tsc.mult) >> csp_timer_tsc_shift
+    );
+  } else {
+    now = csp_timer_tsc_calibrate(clock);
+  }
+
+  if (csp_unlikely(now < csp_timer_tsc.last)) {
+    return csp_timer_tsc.last;
+  }
+  return csp_timer_tsc.last = now;
+}
+
+void csp_timer_coarse_update(void) {
+  atomic_store_explicit(
+    &csp_timer_coarse_now, csp_timer_clock_now(), memory_order_relaxed
+  );
+}
+
+/* Timers are put to and canceled from the queues through their inbox, and
+ * only the monitor drains the inboxes and touches the queues. */
+csp_msrbq_declare(uintptr_t, timer);
+csp_msrbq_define(uintptr_t, timer);
+
+/* Claim an expired timer. It fails if the timer has been canceled, in which
+ * case the canceler has sent a request to destroy it. */
+static bool csp_timer_claim(csp_proc_t *proc) {
+  int64_t token = csp_proc_timer_token_get(proc);
+  while (token != -1 && !csp_proc_timer_token_cas(proc, token, -1));
+  proc->timer.idx = -1;
+  return token != -1;
+}
+
+#ifndef csp_with_timer_wheel
+
+/* The queues of the cores are in one array, each aligned to the cache line so
+ * that a core updating its heap doesn't slow down its neighbours. */
+typedef struct __attribute__((aligned(64))) csp_timer_heap_t {
   size_t cap, len;
   csp_proc_t **procs;
-  csp_timer_time_t time, clock;
   int64_t token;
-  csp_mutex_t mutex;
+  csp_msrbq_t(timer) *inbox;
+  csp_spinlock_t lock;
+  atomic_int_fast64_t deadline;
 } csp_timer_heap_t;
 
 bool csp_timer_heap_init(csp_timer_heap_t *heap, size_t pid) {
   heap->cap = csp_timer_heap_default_cap;
   heap->len = 0;
-  heap->time = csp_timer_now();
-  heap->clock = csp_timer_getclock();
   heap->procs = (csp_proc_t **)malloc(sizeof(csp_proc_t *) * heap->cap);
 
   /* Make tokens generated by different `csp_timer_heap_t` different. */
   heap->token = (uint64_t)pid << 53;
 
-  csp_mutex_init(&heap->mutex);
+  heap->inbox = NULL;
   return heap->procs != NULL;
 }
 
@@ -95,12 +226,12 @@ void csp_timer_heap_shift_up(csp_timer_heap_t *heap, int64_t idx) {
 
 /* Put a timer to the heap. */
 void csp_timer_heap_put(csp_timer_heap_t *heap, csp_proc_t *proc) {
-  csp_mutex_lock(&heap->mutex);
-
   /* Grow the heap if it's not large enough. */
   if (csp_unlikely(heap->len == heap->cap)) {
     size_t cap = heap->cap << 1;
-    csp_proc_t **procs = (csp_proc_t **)realloc(heap->procs, cap);
+    csp_proc_t **procs = (csp_proc_t **)realloc(
+      heap->procs, sizeof(csp_proc_t *) * cap
+    );
     if (csp_unlikely(procs == NULL)) {
       exit(EXIT_FAILURE);
     }
@@ -108,17 +239,12 @@ void csp_timer_heap_put(csp_timer_heap_t *heap, csp_proc_t *proc) {
     heap->cap = cap;
   }
 
-  csp_proc_timer_token_set(proc, heap->token);
-  heap->token++;
-
   heap->procs[heap->len] = proc;
   proc->timer.idx = heap->len++;
   csp_timer_heap_shift_up(heap, proc->timer.idx);
-
-  csp_mutex_unlock(&heap->mutex);
 }
 
-/* Delete a timer from the heap. The caller should take control of the mutex. */
+/* Delete a timer from the heap. */
 void csp_timer_heap_del(csp_timer_heap_t *heap, csp_proc_t *proc) {
   int64_t idx = proc->timer.idx;
   if (idx == --heap->len) {
@@ -155,34 +281,20 @@ void csp_timer_heap_del(csp_timer_heap_t *heap, csp_proc_t *proc) {
 /* Get all expired timers from the heap. */
 static int csp_timer_heap_get(csp_timer_heap_t *heap, csp_proc_t **start,
     csp_proc_t **end) {
-  csp_mutex_lock(&heap->mutex);
-
   if (heap->len == 0) {
-    csp_mutex_unlock(&heap->mutex);
     return 0;
   }
 
-  csp_timer_time_t clock = csp_timer_getclock(), curr_time;
-  csp_timer_duration_t duration = clock - heap->clock;
-
-  /* Use the approximation calculated by clock instead of the real time to
-   * reduce the syscall calls. */
-  if (duration < CLOCKS_PER_SEC) {
-    curr_time = heap->time + (csp_timer_duration_t)(
-      ((double)duration / CLOCKS_PER_SEC) * csp_timer_second
-    );
-  } else {
-    heap->clock = clock;
-    curr_time = heap->time = csp_timer_now();
-  }
+  csp_timer_time_t curr_time = csp_timer_now();
 
   int n = 0;
   csp_proc_t *head = NULL, *tail = NULL, *top;
 
   while (heap->len > 0 && (top = heap->procs[0])->timer.when <= curr_time) {
     csp_timer_heap_del(heap, top);
-    /*  Invalidate the token. */
-    csp_proc_timer_token_set(top, -1);
+    if (!csp_timer_claim(top)) {
+      continue;
+    }
 
     if (tail == NULL) {
       head = tail = top;
@@ -198,53 +310,378 @@ static int csp_timer_heap_get(csp_timer_heap_t *heap, csp_proc_t **start,
     *start = head;
     *end = tail;
   }
-
-  csp_mutex_unlock(&heap->mutex);
   return n;
 }
 
+/* The earliest deadline in the heap, or `INT64_MAX` if it's empty. */
+static csp_timer_time_t csp_timer_heap_next(csp_timer_heap_t *heap) {
+  return heap->len > 0 ? heap->procs[0]->timer.when : INT64_MAX;
+}
+
 void csp_timer_heap_destroy(csp_timer_heap_t *heap) {
   free(heap->procs);
 }
 
-struct { int len; csp_timer_heap_t *heaps; } csp_timer_heaps;
+#define csp_timer_queue_t         csp_timer_heap_t
+#define csp_timer_queue_init      csp_timer_heap_init
+#define csp_timer_queue_put       csp_timer_heap_put
+#define csp_timer_queue_del       csp_timer_heap_del
+#define csp_timer_queue_get       csp_timer_heap_get
+#define csp_timer_queue_next      csp_timer_heap_next
+#define csp_timer_queue_destroy   csp_timer_heap_destroy
+
+#else
+
+/* The hierarchical timing wheel. Level `l` has `csp_timer_wheel_slots` slots
+ * and every slot of it spans `csp_timer_wheel_slots ^ l` ticks, a tick is
+ * `csp_timer_slot` nanoseconds. A timer is put to the lowest level which can
+ * cover its expiration and moved down one level (cascaded) when the wheel
+ * rotates to its slot, so both inserting and deleting a timer are O(1). */
+#define csp_timer_wheel_bits      6
+#define csp_timer_wheel_slots     (1 << csp_timer_wheel_bits)
+#define csp_timer_wheel_mask      (csp_timer_wheel_slots - 1)
+#define csp_timer_wheel_levels    5
+
+#define csp_timer_wheel_span(level)                                            \
+  ((int64_t)1 << (csp_timer_wheel_bits * (level)))
+
+#define csp_timer_wheel_tick(wheel, when)                                      \
+  ((when) <= (wheel)->start ? 0 : csp_timer_wheel_tick_ceil(wheel, when))
+
+/* Round up so that a timer never fires before its `when`. */
+#define csp_timer_wheel_tick_ceil(wheel, when)                                 \
+  (((when) - (wheel)->start + (int64_t)csp_timer_slot - 1) /                   \
+   (int64_t)csp_timer_slot)
+
+/* The precision of timers, it can be set by `cspcli analyze --timer-slot`. */
+extern size_t csp_timer_slot;
+
+typedef struct __attribute__((aligned(64))) csp_timer_wheel_t {
+  /* The next tick to be expired. */
+  int64_t curr;
+  size_t len;
+  /* Bit `i` is set if the slot `i` of the first level is not empty. */
+  uint64_t bitmap;
+  csp_proc_t *slots[csp_timer_wheel_levels * csp_timer_wheel_slots];
+  csp_timer_time_t start;
+  int64_t token;
+  csp_msrbq_t(timer) *inbox;
+  csp_spinlock_t lock;
+  atomic_int_fast64_t deadline;
+} csp_timer_wheel_t;
+
+bool csp_timer_wheel_init(csp_timer_wheel_t *wheel, size_t pid) {
+  wheel->curr = 0;
+  wheel->len = 0;
+  wheel->bitmap = 0;
+  for (int i = 0; i < csp_timer_wheel_levels * csp_timer_wheel_slots; i++) {
+    wheel->slots[i] = NULL;
+  }
+  wheel->start = csp_timer_now();
+
+  /* Make tokens generated by different `csp_timer_wheel_t` different. */
+  wheel->token = (uint64_t)pid << 53;
+
+  wheel->inbox = NULL;
+  return true;
+}
+
+/* Link a timer to the slot covering its expiration. The timers beyond the
+ * top level are parked in the last slot of it and cascaded again lazily. */
+static void csp_timer_wheel_link(csp_timer_wheel_t *wheel, csp_proc_t *proc) {
+  int64_t expire = csp_timer_wheel_tick(wheel, proc->timer.when);
+  int64_t delta = expire - wheel->curr;
+  int level = 0;
+
+  if (delta < 0) {
+    expire = wheel->curr;
+  } else {
+    while (level < csp_timer_wheel_levels &&
+        delta >= csp_timer_wheel_span(level + 1)) {
+      level++;
+    }
+    if (level == csp_timer_wheel_levels) {
+      level--;
+      expire = wheel->curr + csp_timer_wheel_span(csp_timer_wheel_levels) - 1;
+    }
+  }
+
+  int64_t slot = (expire >> (csp_timer_wheel_bits * level)) &
+    csp_timer_wheel_mask;
+  int64_t idx = level * csp_timer_wheel_slots + slot;
+
+  proc->pre = NULL;
+  proc->next = wheel->slots[idx];
+  if (proc->next != NULL) {
+    proc->next->pre = proc;
+  }
+  wheel->slots[idx] = proc;
+  proc->timer.idx = idx;
+
+  if (level == 0) {
+    wheel->bitmap |= (uint64_t)1 << slot;
+  }
+}
+
+/* Put a timer to the wheel. */
+void csp_timer_wheel_put(csp_timer_wheel_t *wheel, csp_proc_t *proc) {
+  csp_timer_wheel_link(wheel, proc);
+  wheel->len++;
+}
+
+/* Delete a timer from the wheel. */
+void csp_timer_wheel_del(csp_timer_wheel_t *wheel, csp_proc_t *proc) {
+  int64_t idx = proc->timer.idx;
+
+  if (proc->pre != NULL) {
+    proc->pre->next = proc->next;
+  } else {
+    wheel->slots[idx] = proc->next;
+  }
+  if (proc->next != NULL) {
+    proc->next->pre = proc->pre;
+  }
+  proc->pre = proc->next = NULL;
+
+  if (idx < csp_timer_wheel_slots && wheel->slots[idx] == NULL) {
+    wheel->bitmap &= ~((uint64_t)1 << idx);
+  }
+  wheel->len--;
+}
 
-bool csp_timer_heaps_init(void) {
-  csp_timer_heaps.heaps = (csp_timer_heap_t *)malloc(
-    sizeof(csp_timer_heap_t) * csp_sched_np
+/* Move the timers in a slot of a higher level to the lower levels. */
+static void csp_timer_wheel_cascade(csp_timer_wheel_t *wheel, int level) {
+  int64_t idx = level * csp_timer_wheel_slots +
+    ((wheel->curr >> (csp_timer_wheel_bits * level)) & csp_timer_wheel_mask);
+  csp_proc_t *proc = wheel->slots[idx];
+  wheel->slots[idx] = NULL;
+
+  while (proc != NULL) {
+    csp_proc_t *next = proc->next;
+    csp_timer_wheel_link(wheel, proc);
+    proc = next;
+  }
+}
+
+/* Get all expired timers from the wheel. */
+static int csp_timer_wheel_get(csp_timer_wheel_t *wheel, csp_proc_t **start,
+    csp_proc_t **end) {
+  int64_t now = (csp_timer_now() - wheel->start) / (int64_t)csp_timer_slot;
+
+  if (wheel->len == 0) {
+    /* Nothing to cascade, catch up with the time directly. */
+    if (wheel->curr <= now) {
+      wheel->curr = now + 1;
+    }
+    return 0;
+  }
+
+  int n = 0;
+  csp_proc_t *head = NULL, *tail = NULL;
+
+  while (wheel->curr <= now) {
+    int64_t slot = wheel->curr & csp_timer_wheel_mask;
+
+    /* The first level has rotated a round, cascade the higher levels whose
+     * lower levels have rotated a round too. */
+    if (slot == 0) {
+      for (int level = 1; level < csp_timer_wheel_levels; level++) {
+        csp_timer_wheel_cascade(wheel, level);
+        if (((wheel->curr >> (csp_timer_wheel_bits * level)) &
+              csp_timer_wheel_mask) != 0) {
+          break;
+        }
+      }
+    }
+
+    /* Skip the empty slots of the first level until the next cascading. */
+    if (wheel->bitmap == 0) {
+      int64_t next = (wheel->curr | csp_timer_wheel_mask) + 1;
+      wheel->curr = next <= now ? next : now + 1;
+      continue;
+    }
+
+    csp_proc_t *proc = wheel->slots[slot];
+    wheel->slots[slot] = NULL;
+    wheel->bitmap &= ~((uint64_t)1 << slot);
+
+    while (proc != NULL) {
+      csp_proc_t *next = proc->next;
+      wheel->len--;
+      if (!csp_timer_claim(proc)) {
+        proc = next;
+        continue;
+      }
+      proc->next = NULL;
+
+      if (tail == NULL) {
+        head = tail = proc;
+        proc->pre = NULL;
+      } else {
+        tail->next = proc;
+        proc->pre = tail;
+        tail = proc;
+      }
+      n++;
+      proc = next;
+    }
+    wheel->curr++;
+  }
+
+  if (n > 0) {
+    *start = head;
+    *end = tail;
+  }
+  return n;
+}
+
+/* The time when the next slot which has timers or needs cascading expires,
+ * i.e. no timer fires before it. `INT64_MAX` is returned if it's empty. */
+static csp_timer_time_t csp_timer_wheel_next(csp_timer_wheel_t *wheel) {
+  if (wheel->len == 0) {
+    return INT64_MAX;
+  }
+
+  int64_t tick;
+  if (wheel->bitmap != 0) {
+    /* Rotate the bitmap so that bit `i` is the slot of tick `curr + i`. */
+    int slot = wheel->curr & csp_timer_wheel_mask;
+    uint64_t bitmap = wheel->bitmap >> slot;
+    if (slot != 0) {
+      bitmap |= wheel->bitmap << (csp_timer_wheel_slots - slot);
+    }
+    tick = wheel->curr + __builtin_ctzll(bitmap);
+  } else {
+    tick = (wheel->curr | csp_timer_wheel_mask) + 1;
+  }
+  return wheel->start + tick * (int64_t)csp_timer_slot;
+}
+
+void csp_timer_wheel_destroy(csp_timer_wheel_t *wheel) {}
+
+#define csp_timer_queue_t         csp_timer_wheel_t
+#define csp_timer_queue_init      csp_timer_wheel_init
+#define csp_timer_queue_put       csp_timer_wheel_put
+#define csp_timer_queue_del       csp_timer_wheel_del
+#define csp_timer_queue_get       csp_timer_wheel_get
+#define csp_timer_queue_next      csp_timer_wheel_next
+#define csp_timer_queue_destroy   csp_timer_wheel_destroy
+
+#endif
+
+/* The per-core timer queues, indexed by pid. A queue is owned by whoever holds
+ * its lock, i.e. the poller of the core, or the core itself when it's idle,
+ * see `csp_timer_poll_core`. `deadline` is its earliest deadline published for
+ * the others. */
+struct { int len; csp_timer_queue_t *queues; } csp_timer_queues;
+
+bool csp_timer_queues_init(void) {
+  csp_timer_tsc_init();
+
+  csp_timer_queues.queues = (csp_timer_queue_t *)aligned_alloc(
+    _Alignof(csp_timer_queue_t), sizeof(csp_timer_queue_t) * csp_sched_np
   );
-  if (csp_timer_heaps.heaps == NULL) {
+  if (csp_timer_queues.queues == NULL) {
     return false;
   }
 
   for (int i = 0; i < csp_sched_np; i++) {
-    if(!csp_timer_heap_init(&csp_timer_heaps.heaps[i], i)) {
-      csp_timer_heaps.len = i;
+    csp_timer_queue_t *queue = &csp_timer_queues.queues[i];
+    if (!csp_timer_queue_init(queue, i)) {
+      csp_timer_queues.len = i;
       return false;
     }
+    queue->inbox = csp_msrbq_new(timer)(csp_timer_inbox_cap_exp);
+    if (queue->inbox == NULL) {
+      csp_timer_queues.len = i + 1;
+      return false;
+    }
+    csp_spinlock_init(&queue->lock);
+    atomic_init(&queue->deadline, INT64_MAX);
   }
-  csp_timer_heaps.len = csp_sched_np;
+  csp_timer_queues.len = csp_sched_np;
   return true;
 }
 
-void csp_timer_heaps_destroy(void) {
-  for (size_t i = 0; i < csp_timer_heaps.len; i++) {
-    csp_timer_heap_destroy(&csp_timer_heaps.heaps[i]);
+void csp_timer_queues_destroy(void) {
+  for (size_t i = 0; i < csp_timer_queues.len; i++) {
+    csp_timer_queue_t *queue = &csp_timer_queues.queues[i];
+    if (queue->inbox != NULL) {
+      csp_msrbq_destroy(timer)(queue->inbox);
+    }
+    csp_timer_queue_destroy(queue);
   }
-  free(csp_timer_heaps.heaps);
+  free(csp_timer_queues.queues);
 }
 
+/* Only the core `pid` puts timers to its queue, so the token is generated
+ * without synchronization. The push spins only if the poller falls behind by
+ * a whole inbox. The poller is woken up if it's sleeping beyond the timer. */
 void csp_timer_put(size_t pid, csp_proc_t *proc) {
-  csp_timer_heap_put(&csp_timer_heaps.heaps[pid], proc);
+  csp_timer_queue_t *queue = &csp_timer_queues.queues[pid];
+  csp_timer_time_t when = proc->timer.when;
+
+  csp_proc_timer_token_set(proc, queue->token);
+  queue->token++;
+  csp_msrbq_push(timer)(queue->inbox, (uintptr_t)proc);
+  csp_monitor_wakeup(when);
+}
+
+/* Apply the requests in the inbox to the queue. A timer canceled before it
+ * is put is never put, and the canceling request which must be behind it
+ * destroys it. */
+static void csp_timer_queue_drain(csp_timer_queue_t *queue) {
+  size_t n;
+  uintptr_t reqs[16];
+
+  while ((n = csp_msrbq_try_popm(timer)(queue->inbox, reqs, 16)) > 0) {
+    for (size_t i = 0; i < n; i++) {
+      csp_proc_t *proc = (csp_proc_t *)(reqs[i] & ~csp_timer_inbox_cancel);
+      if (reqs[i] & csp_timer_inbox_cancel) {
+        if (proc->timer.idx != -1) {
+          csp_timer_queue_del(queue, proc);
+        }
+        csp_proc_destroy(proc);
+      } else if (csp_proc_timer_token_get(proc) == -1) {
+        proc->timer.idx = -1;
+      } else {
+        csp_timer_queue_put(queue, proc);
+      }
+    }
+    if (n < 16) {
+      break;
+    }
+  }
+}
+
+/* Poll the expired timers of core `pid`. The queue is skipped if someone else
+ * is polling it. */
+int csp_timer_poll_core(size_t pid, csp_proc_t **start, csp_proc_t **end) {
+  csp_timer_queue_t *queue = &csp_timer_queues.queues[pid];
+  if (!csp_spinlock_try_lock(&queue->lock)) {
+    return 0;
+  }
+
+  csp_timer_queue_drain(queue);
+  int n = csp_timer_queue_get(queue, start, end);
+  atomic_store_explicit(
+    &queue->deadline, csp_timer_queue_next(queue), memory_order_relaxed
+  );
+  csp_spinlock_unlock(&queue->lock);
+
+  if (n > 0) {
+    csp_stats_shared_add(timer_fires, n);
+  }
+  return n;
 }
 
-/* Poll all expired timers from all heaps. */
+/* Poll all expired timers from all queues. */
 int csp_timer_poll(csp_proc_t **start, csp_proc_t **end) {
   int total = 0;
   csp_proc_t *head, *tail;
 
-  for (int i = 0; i < csp_timer_heaps.len; i++) {
-    int n = csp_timer_heap_get(&csp_timer_heaps.heaps[i], &head, &tail);
+  for (int i = 0; i < csp_timer_queues.len; i++) {
+    int n = csp_timer_poll_core(i, &head, &tail);
     if (n > 0) {
       if (total != 0) {
         (*end)->next = head;
@@ -260,19 +697,85 @@ int csp_timer_poll(csp_proc_t **start, csp_proc_t **end) {
   return total;
 }
 
+/* The earliest deadline of the queue of core `pid` as of its last poll, or
+ * `INT64_MAX` if it has no timer. */
+csp_timer_time_t csp_timer_next_core(size_t pid) {
+  return atomic_load_explicit(
+    &csp_timer_queues.queues[pid].deadline, memory_order_relaxed
+  );
+}
+
+/* The earliest deadline of all queues, it should be called after
+ * `csp_timer_poll`. `INT64_MAX` is returned if there is no timer. */
+csp_timer_time_t csp_timer_next(void) {
+  csp_timer_time_t next = INT64_MAX;
+  for (int i = 0; i < csp_timer_queues.len; i++) {
+    csp_timer_time_t when = csp_timer_next_core(i);
+    if (when < next) {
+      next = when;
+    }
+  }
+  return next;
+}
+
+/* Whether there are requests not applied to the queue of core `pid` yet. */
+bool csp_timer_pending_core(size_t pid) {
+  return !csp_msrbq_is_empty(timer)(csp_timer_queues.queues[pid].inbox);
+}
+
+/* Whether there are requests not applied to the queues yet. */
+bool csp_timer_pending(void) {
+  for (int i = 0; i < csp_timer_queues.len; i++) {
+    if (csp_timer_pending_core(i)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/* Apply the canceling request directly after the pending ones if nobody else
+ * holds the queue. */
+static bool csp_timer_queue_try_cancel(csp_timer_queue_t *queue,
+    csp_proc_t *proc) {
+  if (!csp_spinlock_try_lock(&queue->lock)) {
+    return false;
+  }
+  csp_timer_queue_drain(queue);
+  if (proc->timer.idx != -1) {
+    csp_timer_queue_del(queue, proc);
+  }
+  csp_spinlock_unlock(&queue->lock);
+  csp_proc_destroy(proc);
+  return true;
+}
+
 bool csp_timer_cancel(csp_timer_t timer) {
-  csp_timer_heap_t *heap = &csp_timer_heaps.heaps[timer.ctx->borned_pid];
+  csp_timer_queue_t *queue = &csp_timer_queues.queues[timer.ctx->borned_pid];
 
-  csp_mutex_lock(&heap->mutex);
   /* Check whether the token is valid. */
-  if (!csp_proc_timer_token_cas(timer.ctx, timer.token, -1)) {
-    csp_mutex_unlock(&heap->mutex);
-    return false;
+  int64_t token = timer.token;
+  while (!csp_proc_timer_token_cas(timer.ctx, token, -1)) {
+    if (token != timer.token) {
+      return false;
+    }
+  }
+
+  /* The pollers(e.g. in `csp_netpoll_poll`) apply the request directly to
+   * save the round trip through the inbox. */
+  if (csp_monitor_self && csp_timer_queue_try_cancel(queue, timer.ctx)) {
+    return true;
   }
 
-  csp_timer_heap_del(heap, timer.ctx);
-  csp_mutex_unlock(&heap->mutex);
-  csp_proc_destroy(timer.ctx);
+  /* Otherwise the timer is destroyed by the owner of the queue. If the inbox
+   * is full we take the queue once it's free instead, so two pollers pushing
+   * to each other's full inbox never wait for each other. */
+  uintptr_t req = (uintptr_t)timer.ctx | csp_timer_inbox_cancel;
+  while (!csp_msrbq_try_push(timer)(queue->inbox, req)) {
+    if (csp_timer_queue_try_cancel(queue, timer.ctx)) {
+      return true;
+    }
+    csp_cpu_relax();
+  }
   return true;
 }
 
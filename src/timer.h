@@ -22,6 +22,7 @@
 extern "C" {
 #endif
 
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <time.h>
@@ -35,20 +36,39 @@ extern "C" {
 #define csp_timer_minute        (csp_timer_second * 60)
 #define csp_timer_hour          (csp_timer_minute * 60)
 
-/* `csp_timer_now` gets current time. */
-#define csp_timer_now() ({                                                     \
+/* `csp_timer_now` gets current time of the monotonic clock. It's computed
+ * from the TSC calibrated per thread, so it doesn't cost a syscall. */
+#define csp_timer_now() csp_timer_clock_now()
+
+/* `csp_timer_now_precise` reads the monotonic clock from the kernel. */
+#define csp_timer_now_precise() ({                                             \
   struct timespec ts;                                                          \
-  clock_gettime(CLOCK_REALTIME, &ts);                                          \
+  clock_gettime(CLOCK_MONOTONIC, &ts);                                         \
   (csp_timer_time_t)(ts.tv_sec * csp_timer_second + ts.tv_nsec);               \
 })                                                                             \
 
+/* `csp_timer_now_coarse` gets the time cached by the monitor. It's cheaper
+ * than `csp_timer_now` but may lag behind it by several milliseconds, or
+ * longer right after all the cores have been idle. */
+#define csp_timer_now_coarse()                                                 \
+  atomic_load_explicit(&csp_timer_coarse_now, memory_order_relaxed)            \
+
+/* Load the process returned by the wrapper of the timer task. */
+#if defined(__aarch64__)
+#define csp_timer_ctx_load(ctx)                                                \
+  __asm__ __volatile__("mov %0, x0\n" :"=r"(ctx) :: "x0", "memory")
+#else
+#define csp_timer_ctx_load(ctx)                                                \
+  __asm__ __volatile__("mov %%rax, %0\n" :"=r"(ctx) :: "rax", "memory")
+#endif
+
 /* `csp_timer_at` sets a timer triggered at `when` in nanoseconds. */
 #define csp_timer_at(when, task) ({                                            \
   csp_soft_mbarr();                                                            \
   csp_timer_t timer;                                                           \
   csp_timer_anchor(when);                                                      \
   task;                                                                        \
-  __asm__ __volatile__("mov %%rax, %0\n" :"=r"(timer.ctx) :: "rax", "memory"); \
+  csp_timer_ctx_load(timer.ctx);                                               \
   timer.token = csp_proc_timer_token_get(timer.ctx);                           \
   csp_soft_mbarr();                                                            \
   timer;                                                                       \
@@ -67,6 +87,10 @@ typedef int64_t csp_timer_duration_t;
 /* `csp_timer_t` implements the timer. */
 typedef struct { csp_proc_t *ctx; int64_t token; } csp_timer_t;
 
+extern atomic_int_fast64_t csp_timer_coarse_now;
+
+csp_timer_time_t csp_timer_clock_now(void);
+
 /* `csp_timer_cancel` cancels the timer. Return true if success. */
 bool csp_timer_cancel(csp_timer_t timer);
 
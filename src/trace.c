@@ -0,0 +1,133 @@
+/*
+ * Copyright (c) 2020, Yanhui Shi <lime.syh at gmail dot com>
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "core.h"
+#include "trace.h"
+
+extern _Thread_local csp_core_t *csp_this_core;
+
+_Thread_local csp_trace_buf_t *csp_trace_this;
+
+/* All the buffers ever allocated, the latest first. They are never freed so
+ * the events of the exited threads can still be dumped. */
+static _Atomic(csp_trace_buf_t *) csp_trace_bufs;
+static atomic_size_t csp_trace_ntids;
+
+static const char *csp_trace_event_names[] = {
+  [csp_trace_event_create] = "create",
+  [csp_trace_event_run]    = "run",
+  [csp_trace_event_yield]  = "yield",
+  [csp_trace_event_park]   = "park",
+  [csp_trace_event_wake]   = "wake",
+  [csp_trace_event_steal]  = "steal",
+  [csp_trace_event_exit]   = "exit",
+};
+
+csp_trace_buf_t *csp_trace_buf_new(void) {
+  csp_trace_buf_t *buf = (csp_trace_buf_t *)malloc(sizeof(csp_trace_buf_t));
+  if (buf == NULL) {
+    perror("libcsp failed to alloc the trace buffer.");
+    exit(EXIT_FAILURE);
+  }
+  atomic_init(&buf->head, 0);
+  buf->pid = csp_this_core != NULL ? (int64_t)csp_this_core->pid : -1;
+  buf->tid = atomic_fetch_add(&csp_trace_ntids, 1);
+
+  buf->next = atomic_load(&csp_trace_bufs);
+  while (!atomic_compare_exchange_weak(&csp_trace_bufs, &buf->next, buf));
+  return csp_trace_this = buf;
+}
+
+static void csp_trace_dump_event(FILE *file, csp_trace_buf_t *buf,
+    csp_trace_event_t *event, const char *ph) {
+  fprintf(file,
+    ",\n{\"name\":\"%s\",\"cat\":\"proc\",\"ph\":\"%s\",\"ts\":%.3f,"
+    "\"pid\":0,\"tid\":%zu,\"args\":{\"proc\":\"%#lx\",\"id\":%u}%s}",
+    csp_trace_event_names[event->type], ph, event->ts / 1000.0, buf->tid,
+    (unsigned long)event->proc, event->id, ph[0] == 'i' ? ",\"s\":\"t\"" : ""
+  );
+}
+
+/*
+ * Dump the events of a thread. A process runs from a `run` event to the next
+ * event of this thread which leaves it, i.e. `yield`, `park` or `exit`, so the
+ * pairs become the duration events and the others instant ones. The events
+ * the thread overwrites while we are reading may be garbled, thus it's better
+ * to dump when the program is quiet.
+ */
+static void csp_trace_dump_buf(FILE *file, csp_trace_buf_t *buf) {
+  uint_fast64_t head = atomic_load_explicit(&buf->head, memory_order_acquire);
+  uint_fast64_t tail = head > csp_trace_buf_cap ? head - csp_trace_buf_cap : 0;
+
+  if (buf->pid >= 0) {
+    fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,"
+      "\"tid\":%zu,\"args\":{\"name\":\"core %ld\"}}", buf->tid,
+      (long)buf->pid);
+  } else {
+    fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,"
+      "\"tid\":%zu,\"args\":{\"name\":\"thread\"}}", buf->tid);
+  }
+
+  uintptr_t running = 0;
+  for (uint_fast64_t i = tail; i < head; i++) {
+    csp_trace_event_t *event = &buf->events[i & (csp_trace_buf_cap - 1)];
+    switch (event->type) {
+      case csp_trace_event_run:
+        running = event->proc;
+        fprintf(file, ",\n{\"name\":\"proc %u\",\"cat\":\"proc\",\"ph\":\"B\","
+          "\"ts\":%.3f,\"pid\":0,\"tid\":%zu,\"args\":{\"proc\":\"%#lx\"}}",
+          event->id, event->ts / 1000.0, buf->tid,
+          (unsigned long)event->proc);
+        break;
+      case csp_trace_event_yield:
+      case csp_trace_event_park:
+      case csp_trace_event_exit:
+        if (running != 0 && running == event->proc) {
+          csp_trace_dump_event(file, buf, event, "E");
+          running = 0;
+        } else {
+          csp_trace_dump_event(file, buf, event, "i");
+        }
+        break;
+      default:
+        csp_trace_dump_event(file, buf, event, "i");
+    }
+  }
+}
+
+/* Dump the recorded events in the Chrome trace event format to `path`, which
+ * can be loaded by `chrome://tracing` and Perfetto. */
+bool csp_trace_dump(const char *path) {
+  FILE *file = fopen(path, "w");
+  if (file == NULL) {
+    return false;
+  }
+
+  fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n"
+    "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":0,"
+    "\"args\":{\"name\":\"libcsp\"}}");
+  for (csp_trace_buf_t *buf = atomic_load(&csp_trace_bufs); buf != NULL;
+      buf = buf->next) {
+    csp_trace_dump_buf(file, buf);
+  }
+  fprintf(file, "\n]}\n");
+  return fclose(file) == 0;
+}
@@ -0,0 +1,108 @@
+/*
+ * Copyright (c) 2020, Yanhui Shi <lime.syh at gmail dot com>
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef LIBCSP_TRACE_H
+#define LIBCSP_TRACE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "common.h"
+#include "proc.h"
+#include "timer.h"
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+/*
+ * `trace.h` records the scheduler events for `csp_trace_dump` if libcsp is
+ * configured with `--with-trace`, otherwise `csp_trace` expands to nothing.
+ *
+ * Every thread records to its own ring buffer which is allocated by its first
+ * event, so recording is a store of the event and a release store of `head`.
+ * The ring keeps the latest `csp_trace_buf_cap` events of the thread, i.e. it
+ * works as a flight recorder. The events are timestamped by `csp_timer_now`.
+ */
+#define csp_trace_buf_cap_exp       15
+#define csp_trace_buf_cap           (1 << csp_trace_buf_cap_exp)
+
+typedef enum {
+  csp_trace_event_create,
+  csp_trace_event_run,
+  csp_trace_event_yield,
+  csp_trace_event_park,
+  csp_trace_event_wake,
+  csp_trace_event_steal,
+  csp_trace_event_exit,
+} csp_trace_event_type_t;
+
+typedef struct {
+  csp_timer_time_t ts;
+  uintptr_t proc;
+  uint32_t type;
+
+  /* The id of the process assigned by the plugin, see `csp_proc_t`. */
+  uint32_t id;
+} csp_trace_event_t;
+
+typedef struct csp_trace_buf_t {
+  atomic_uint_fast64_t head;
+
+  /* The processor of the core which owns the buffer, or -1 if the thread is
+   * not a core, e.g. the monitor. */
+  int64_t pid;
+  size_t tid;
+  struct csp_trace_buf_t *next;
+  csp_trace_event_t events[csp_trace_buf_cap];
+} csp_trace_buf_t;
+
+csp_trace_buf_t *csp_trace_buf_new(void);
+bool csp_trace_dump(const char *path);
+
+extern _Thread_local csp_trace_buf_t *csp_trace_this;
+
+#ifdef csp_with_trace
+#define csp_trace(event, p) do {                                               \
+  csp_trace_buf_t *buf_ = csp_trace_this;                                      \
+  if (csp_unlikely(buf_ == NULL)) {                                            \
+    buf_ = csp_trace_buf_new();                                                \
+  }                                                                            \
+  csp_proc_t *proc_ = (p);                                                     \
+  uint_fast64_t head_ = atomic_load_explicit(&buf_->head,                      \
+    memory_order_relaxed);                                                     \
+  buf_->events[head_ & (csp_trace_buf_cap - 1)] = (csp_trace_event_t){         \
+    .ts = csp_timer_now(), .proc = (uintptr_t)proc_,                           \
+    .type = csp_trace_event_ ## event, .id = (uint32_t)proc_->id               \
+  };                                                                           \
+  atomic_store_explicit(&buf_->head, head_ + 1, memory_order_release);         \
+} while (0)                                                                    \
+
+#else
+#define csp_trace(event, p)
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) 2020, Yanhui Shi <lime.syh at gmail dot com>
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef LIBCSP_WAITGROUP_H
+#define LIBCSP_WAITGROUP_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include "waitq.h"
+
+/*
+ * `csp_waitgroup_t` waits for a collection of processes to finish. `cnt` is
+ * increased by `csp_waitgroup_add` before the processes are spawned and each
+ * of them calls `csp_waitgroup_done` when it's finished, then the ones parked
+ * in `csp_waitgroup_wait` are woken up as soon as `cnt` drops to zero.
+ */
+typedef struct {
+  atomic_int_fast64_t cnt;
+  csp_waitq_t waitq;
+} csp_waitgroup_t;
+
+#define csp_waitgroup_init(wg) do {                                            \
+  atomic_store(&(wg)->cnt, 0);                                                 \
+  csp_waitq_init(&(wg)->waitq);                                                \
+} while (0)                                                                    \
+
+/* `cnt` is updated before `waitq.len` is read, see `csp_waitq_wait`. */
+#define csp_waitgroup_add(wg, n) do {                                          \
+  csp_waitgroup_t *wg_ = (wg);                                                 \
+  int_fast64_t n_ = (n);                                                       \
+  if (atomic_fetch_add(&wg_->cnt, n_) + n_ == 0 &&                             \
+      atomic_load(&wg_->waitq.len) > 0) {                                      \
+    csp_waitq_broadcast(&wg_->waitq, &wg_->waitq.lock);                        \
+  }                                                                            \
+} while (0)                                                                    \
+
+#define csp_waitgroup_done(wg) csp_waitgroup_add(wg, -1)
+
+#define csp_waitgroup_wait(wg) do {                                            \
+  csp_waitgroup_t *wg_ = (wg);                                                 \
+  csp_waitq_wait(&wg_->waitq, atomic_load(&wg_->cnt) == 0);                    \
+} while (0)                                                                    \
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,205 @@
+/*
+ * Copyright (c) 2020, Yanhui Shi <lime.syh at gmail dot com>
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef LIBCSP_WAITQ_H
+#define LIBCSP_WAITQ_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "core.h"
+#include "proc.h"
+#include "spinlock.h"
+
+/*
+ * `csp_waitq_t` is a FIFO queue of parked processes, e.g. the senders waiting
+ * for room or the receivers waiting for items of a channel.
+ *
+ * The nodes live on the stacks of the waiting processes, which is safe since a
+ * process doesn't return from `csp_waitq_wait` until it's dequeued. `len` is
+ * read without the lock so that a waker pays nothing when there is no waiter.
+ *
+ * A process in `csp_select` queues one node per case and all of them share the
+ * same `done`. Only the waker which claims `done` first may wake the process,
+ * the other nodes are stale and simply dropped by `csp_waitq_pop`.
+ */
+
+typedef struct csp_waitq_node_t {
+  csp_proc_t *parked;
+
+  /* The item to hand off, e.g. the destination of an unbuffered receiver. */
+  void *data;
+
+  /* Where to record the fired case(i.e. `idx + 1`) of the select the node
+   * belongs to, or `NULL` if the node doesn't belong to a select. */
+  atomic_int_fast64_t *done;
+  int64_t idx;
+
+  struct csp_waitq_node_t *pre, *next;
+} csp_waitq_node_t;
+
+typedef struct {
+  csp_spinlock_t lock;
+  atomic_size_t len;
+  csp_waitq_node_t *head, *tail;
+} csp_waitq_t;
+
+#define csp_waitq_init(q) do {                                                 \
+  csp_spinlock_init(&(q)->lock);                                               \
+  atomic_store(&(q)->len, 0);                                                  \
+  (q)->head = (q)->tail = NULL;                                                \
+} while (0)                                                                    \
+
+/* `csp_waitq_push`, `csp_waitq_remove` and `csp_waitq_pop` must be called with
+ * `lock` held. */
+#define csp_waitq_push(q, node) do {                                           \
+  (node)->next = NULL;                                                         \
+  (node)->pre = (q)->tail;                                                     \
+  if ((q)->tail != NULL) {                                                     \
+    (q)->tail->next = (node);                                                  \
+  } else {                                                                     \
+    (q)->head = (node);                                                        \
+  }                                                                            \
+  (q)->tail = (node);                                                          \
+  atomic_fetch_add(&(q)->len, 1);                                              \
+} while (0)                                                                    \
+
+#define csp_waitq_remove(q, node) do {                                         \
+  if ((node)->pre != NULL) {                                                   \
+    (node)->pre->next = (node)->next;                                          \
+  } else {                                                                     \
+    (q)->head = (node)->next;                                                  \
+  }                                                                            \
+  if ((node)->next != NULL) {                                                  \
+    (node)->next->pre = (node)->pre;                                           \
+  } else {                                                                     \
+    (q)->tail = (node)->pre;                                                   \
+  }                                                                            \
+  (node)->pre = (node)->next = NULL;                                           \
+  atomic_fetch_sub(&(q)->len, 1);                                              \
+} while (0)                                                                    \
+
+#define csp_waitq_contains(q, node)                                            \
+  ((node)->pre != NULL || (q)->head == (node))                                 \
+
+/* Claim the node before waking its process up. It fails only if the node
+ * belongs to a select which has been fired by another case. */
+#define csp_waitq_claim(node) ({                                               \
+  int_fast64_t none_ = 0;                                                      \
+  (node)->done == NULL ||                                                      \
+    atomic_compare_exchange_strong((node)->done, &none_, (node)->idx + 1);     \
+})                                                                             \
+
+/* Pop the first node which can be claimed and drop the stale ones. */
+#define csp_waitq_pop(q) ({                                                    \
+  csp_waitq_node_t *node_;                                                     \
+  while ((node_ = (q)->head) != NULL) {                                        \
+    csp_waitq_remove(q, node_);                                                \
+    if (csp_waitq_claim(node_)) {                                              \
+      break;                                                                   \
+    }                                                                          \
+  }                                                                            \
+  node_;                                                                       \
+})                                                                             \
+
+/*
+ * Take and release the lock of a wait queue in a process. The process can't be
+ * preempted while holding it, since the preemption only interrupts the program
+ * text while the waiters may spin on the lock in libcsp, e.g. in `csp_select`,
+ * and never let the holder run again on the same core. The holder owns the
+ * processor as well, e.g. to wake up the waiters, see `csp_core_enter`. A lock
+ * released by `csp_sched_park` is counted off after the process has yielded.
+ */
+#define csp_waitq_lock(lock) do {                                              \
+  csp_core_enter(csp_this_core);                                               \
+  csp_spinlock_lock(lock);                                                     \
+} while (0)                                                                    \
+
+#define csp_waitq_unlock(lock) do {                                            \
+  csp_spinlock_unlock(lock);                                                   \
+  csp_core_leave(csp_this_core);                                               \
+} while (0)                                                                    \
+
+/*
+ * Park the running process in `q` until `ready` is true. `ready` is usually a
+ * non-blocking operation(e.g. `try_pop`) and it's evaluated once more after the
+ * process is queued. The queueing increases `len` before the evaluation while
+ * `csp_waitq_signal` reads `len` after the peer makes progress, so at least one
+ * of them sees the other and no wakeup will be lost.
+ *
+ * The lock is released by the scheduler after the context of the process has
+ * been saved, thus a waker never resumes a process which is still running.
+ */
+#define csp_waitq_wait(q, ready) do {                                          \
+  while (!(ready)) {                                                           \
+    csp_waitq_node_t node_ = {.parked = csp_this_core->running};               \
+    csp_waitq_lock(&(q)->lock);                                                \
+    csp_waitq_push(q, &node_);                                                 \
+    if (ready) {                                                               \
+      csp_waitq_remove(q, &node_);                                             \
+      csp_waitq_unlock(&(q)->lock);                                            \
+      break;                                                                   \
+    }                                                                          \
+    csp_sched_park(&(q)->lock);                                                \
+  }                                                                            \
+} while (0)                                                                    \
+
+/* Wake up at most `n` waiters in `q`. */
+#define csp_waitq_signal(q, n) do {                                            \
+  size_t n_ = (n);                                                             \
+  while (n_-- > 0 && atomic_load(&(q)->len) > 0) {                             \
+    csp_proc_t *proc_ = NULL;                                                  \
+    csp_waitq_lock(&(q)->lock);                                                \
+    csp_waitq_node_t *node_ = csp_waitq_pop(q);                                \
+    if (node_ != NULL) {                                                       \
+      proc_ = node_->parked;                                                   \
+    }                                                                          \
+    csp_waitq_unlock(&(q)->lock);                                              \
+    if (proc_ == NULL) {                                                       \
+      break;                                                                   \
+    }                                                                          \
+    csp_sched_put_proc(proc_);                                                 \
+  }                                                                            \
+} while (0)                                                                    \
+
+/* Wake up all waiters in `q` which is guarded by `lock`. `data` of the nodes
+ * is reset to tell the waiters that nothing has been handed off. */
+#define csp_waitq_broadcast(q, lock) do {                                      \
+  csp_waitq_lock(lock);                                                        \
+  csp_waitq_node_t *node_;                                                     \
+  while ((node_ = csp_waitq_pop(q)) != NULL) {                                 \
+    csp_proc_t *proc_ = node_->parked;                                         \
+    node_->data = NULL;                                                        \
+    csp_sched_put_proc(proc_);                                                 \
+  }                                                                            \
+  csp_waitq_unlock(lock);                                                      \
+} while (0)                                                                    \
+
+extern _Thread_local csp_core_t *csp_this_core;
+extern void csp_sched_park(csp_spinlock_t *lock);
+extern void csp_sched_put_proc(csp_proc_t *proc);
+extern void csp_sched_handoff(csp_proc_t *proc);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,233 @@
+/*
+ * Copyright (c) 2020, Yanhui Shi <lime.syh at gmail dot com>
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <assert.h>
+#include <pthread.h>
+#include "../src/bcast.h"
+
+#define CAP_EXP     3
+#define CAP         (1 << CAP_EXP)
+
+csp_bcast_declare(int, int);
+csp_bcast_define(int, int);
+
+void csp_sched_yield(void) {}
+
+/* The stubs of the scheduler used to check the parking, see `tests/chan.c`. */
+csp_proc_t test_proc, *test_woken;
+_Thread_local csp_core_t *csp_this_core = &(csp_core_t){.running = &test_proc};
+void (*test_on_park)(void);
+int test_parked;
+
+void csp_sched_park(csp_spinlock_t *lock) {
+  test_parked++;
+  csp_waitq_unlock(lock);
+  test_on_park();
+}
+
+void csp_sched_put_proc(csp_proc_t *proc) {
+  test_woken = proc;
+}
+
+void test_bcast_block(void) {
+  csp_bcast_t(int) *bcast = csp_bcast_new(int)(CAP_EXP, csp_bcast_block);
+  csp_bcast_sub_t(int) *sub1 = csp_bcast_subscribe(int)(bcast);
+  csp_bcast_sub_t(int) *sub2 = csp_bcast_subscribe(int)(bcast);
+  int val;
+
+  assert(!csp_bcast_try_recv(int)(sub1, &val));
+  for (int i = 0; i < CAP; i++) {
+    assert(csp_bcast_try_publish(int)(bcast, i));
+  }
+  assert(!csp_bcast_try_publish(int)(bcast, -1));
+
+  /* Every subscriber reads all the items, and the publisher waits for the
+   * slowest one. */
+  for (int i = 0; i < CAP; i++) {
+    assert(csp_bcast_try_recv(int)(sub1, &val) && val == i);
+  }
+  assert(!csp_bcast_try_recv(int)(sub1, &val));
+  assert(!csp_bcast_try_publish(int)(bcast, -1));
+  assert(csp_bcast_try_recv(int)(sub2, &val) && val == 0);
+  assert(csp_bcast_try_publish(int)(bcast, CAP));
+  assert(!csp_bcast_try_publish(int)(bcast, -1));
+
+  /* A new subscriber starts from the next item, and the publisher stops
+   * waiting for a subscriber once it unsubscribes. */
+  csp_bcast_sub_t(int) *sub3 = csp_bcast_subscribe(int)(bcast);
+  assert(!csp_bcast_try_recv(int)(sub3, &val));
+  csp_bcast_unsubscribe(int)(sub2);
+  assert(bcast->nsubs == 2 && bcast->subs[sub3->idx] == sub3);
+  assert(csp_bcast_try_publish(int)(bcast, CAP + 1));
+  assert(csp_bcast_try_recv(int)(sub3, &val) && val == CAP + 1);
+  assert(csp_bcast_try_recv(int)(sub1, &val) && val == CAP);
+  assert(csp_bcast_try_recv(int)(sub1, &val) && val == CAP + 1);
+
+  csp_bcast_destroy(int)(bcast);
+}
+
+void test_bcast_drop(void) {
+  csp_bcast_t(int) *bcast = csp_bcast_new(int)(CAP_EXP, csp_bcast_drop);
+  csp_bcast_sub_t(int) *sub = csp_bcast_subscribe(int)(bcast);
+  int val;
+
+  for (int i = 0; i < CAP + 2; i++) {
+    assert(csp_bcast_publish(int)(bcast, i) == (i < CAP));
+  }
+  assert(atomic_load(&bcast->dropped) == 2);
+  for (int i = 0; i < CAP; i++) {
+    assert(csp_bcast_try_recv(int)(sub, &val) && val == i);
+  }
+  assert(!csp_bcast_try_recv(int)(sub, &val));
+
+  csp_bcast_destroy(int)(bcast);
+}
+
+void test_bcast_skip(void) {
+  csp_bcast_t(int) *bcast = csp_bcast_new(int)(CAP_EXP, csp_bcast_skip);
+  csp_bcast_sub_t(int) *slow = csp_bcast_subscribe(int)(bcast);
+  csp_bcast_sub_t(int) *fast = csp_bcast_subscribe(int)(bcast);
+  int val, n = CAP * 2 + 3;
+
+  /* The publisher never waits, and the lagging subscriber skips to the
+   * oldest item which can't be overwritten while it's read. */
+  for (int i = 0; i < n; i++) {
+    assert(csp_bcast_publish(int)(bcast, i));
+    assert(csp_bcast_try_recv(int)(fast, &val) && val == i);
+  }
+  assert(fast->skipped == 0);
+  for (int i = n - CAP + 1; i < n; i++) {
+    assert(csp_bcast_try_recv(int)(slow, &val) && val == i);
+  }
+  assert(!csp_bcast_try_recv(int)(slow, &val));
+  assert(slow->skipped == n - CAP + 1);
+
+  csp_bcast_destroy(int)(bcast);
+}
+
+void test_bcast_close(void) {
+  csp_bcast_t(int) *bcast = csp_bcast_new(int)(CAP_EXP, csp_bcast_block);
+  csp_bcast_sub_t(int) *sub = csp_bcast_subscribe(int)(bcast);
+  int val;
+
+  assert(csp_bcast_publish(int)(bcast, 1));
+  csp_bcast_close(bcast);
+  assert(!csp_bcast_publish(int)(bcast, 2));
+  assert(csp_bcast_recv(int)(sub, &val) && val == 1);
+  assert(!csp_bcast_recv(int)(sub, &val));
+
+  csp_bcast_destroy(int)(bcast);
+}
+
+csp_bcast_t(int) *test_park_bcast;
+csp_bcast_sub_t(int) *test_park_sub;
+
+void test_publish_on_park(void) {
+  assert(atomic_load(&test_park_bcast->recvq.len) == 1);
+  assert(csp_bcast_publish(int)(test_park_bcast, 42));
+  assert(test_woken == &test_proc);
+}
+
+void test_recv_on_park(void) {
+  int val;
+  assert(atomic_load(&test_park_bcast->sendq.len) == 1);
+  assert(csp_bcast_recv(int)(test_park_sub, &val) && val == 0);
+  assert(test_woken == &test_proc);
+}
+
+void test_bcast_park(void) {
+  test_park_bcast = csp_bcast_new(int)(CAP_EXP, csp_bcast_block);
+  test_park_sub = csp_bcast_subscribe(int)(test_park_bcast);
+
+  /* The subscriber parks until an item is published. */
+  int val = -1;
+  test_parked = 0;
+  test_woken = NULL;
+  test_on_park = test_publish_on_park;
+  assert(csp_bcast_recv(int)(test_park_sub, &val) && val == 42);
+  assert(test_parked == 1);
+
+  /* The publisher parks until the slowest subscriber reads an item. */
+  for (int i = 0; i < CAP; i++) {
+    assert(csp_bcast_publish(int)(test_park_bcast, i));
+  }
+  test_parked = 0;
+  test_woken = NULL;
+  test_on_park = test_recv_on_park;
+  assert(csp_bcast_publish(int)(test_park_bcast, CAP));
+  assert(test_parked == 1);
+  assert(atomic_load(&test_park_bcast->sendq.len) == 0);
+  for (int i = 1; i <= CAP; i++) {
+    assert(csp_bcast_recv(int)(test_park_sub, &val) && val == i);
+  }
+
+  csp_bcast_destroy(int)(test_park_bcast);
+}
+
+#define TEST_ROUNDS (1 << 18)
+#define TEST_SUBS   2
+
+csp_bcast_t(int) *test_thread_bcast;
+csp_bcast_sub_t(int) *test_thread_subs[TEST_SUBS];
+
+void *publisher(void *data) {
+  for (int i = 0; i < TEST_ROUNDS; i++) {
+    while (!csp_bcast_try_publish(int)(test_thread_bcast, i)) {}
+  }
+  return NULL;
+}
+
+void *subscriber(void *data) {
+  csp_bcast_sub_t(int) *sub = (csp_bcast_sub_t(int) *)data;
+  int val;
+  for (int i = 0; i < TEST_ROUNDS; i++) {
+    while (!csp_bcast_try_recv(int)(sub, &val)) {}
+    assert(val == i);
+  }
+  return NULL;
+}
+
+void test_bcast_thread(void) {
+  test_thread_bcast = csp_bcast_new(int)(10, csp_bcast_block);
+  for (int i = 0; i < TEST_SUBS; i++) {
+    test_thread_subs[i] = csp_bcast_subscribe(int)(test_thread_bcast);
+  }
+
+  pthread_t tids[TEST_SUBS + 1];
+  pthread_create(&tids[0], NULL, publisher, NULL);
+  for (int i = 0; i < TEST_SUBS; i++) {
+    pthread_create(&tids[i + 1], NULL, subscriber, test_thread_subs[i]);
+  }
+  for (int i = 0; i <= TEST_SUBS; i++) {
+    pthread_join(tids[i], NULL);
+  }
+
+  csp_bcast_destroy(int)(test_thread_bcast);
+}
+
+int main(void) {
+  test_bcast_block();
+  test_bcast_drop();
+  test_bcast_skip();
+  test_bcast_close();
+  test_bcast_park();
+  test_bcast_thread();
+}
@@ -21,6 +21,8 @@
 
 #include <assert.h>
 #include <pthread.h>
+#include <stdio.h>
+#include <time.h>
 #include "../src/chan.h"
 
 #define CAP_EXP     3
@@ -38,8 +40,39 @@ csp_chan_define(ms, int, ms);
 csp_chan_declare(mm, int, mm);
 csp_chan_define(mm, int, mm);
 
+csp_chan_declare(el, int, el);
+csp_chan_define(el, int, el);
+
+csp_chan_declare(fc, int, fc);
+csp_chan_define(fc, int, fc);
+
+csp_chan_declare(un, int, un);
+csp_chan_define(un, int, un);
+
 void csp_sched_yield(void) {}
 
+/* The stubs of the scheduler used to check the parking of channels. The parked
+ * "process" makes the peer progress itself before it is resumed. */
+csp_proc_t test_proc, *test_woken;
+_Thread_local csp_core_t *csp_this_core = &(csp_core_t){.running = &test_proc};
+void (*test_on_park)(void);
+int test_parked;
+
+void csp_sched_park(csp_spinlock_t *lock) {
+  test_parked++;
+  csp_waitq_unlock(lock);
+  test_on_park();
+}
+
+void csp_sched_put_proc(csp_proc_t *proc) {
+  test_woken = proc;
+}
+
+csp_proc_t *test_handoff;
+void csp_sched_handoff(csp_proc_t *proc) {
+  test_handoff = proc;
+}
+
 int array[] = {8, 7, 6, 5, 4, 3, 2, 1};
 int array_len = sizeof(array) / sizeof(int);
 int array_cpy[sizeof(array) / sizeof(int)];
@@ -282,6 +315,63 @@ void start_thread(pthread_t *tid, int pid, void *(*fn)(void *), void *data) {
   pthread_attr_destroy(&attr);
 }
 
+void test_chan_el(void) {
+  size_t cap = CAP << 2;
+  csp_chan_t(el) *chan = csp_chan_new(el)(CAP_EXP + 2);
+  csp_elrbq_t(el) *rbq = (csp_elrbq_t(el) *)chan->rbq;
+  assert(rbq->ring->cap == CAP);
+
+  /* The ring grows with the backlog until the capacity is reached. */
+  for (int i = 0; i < cap; i++) {
+    assert(csp_chan_try_push(chan, i));
+  }
+  assert(rbq->ring->cap == cap);
+  assert(!csp_chan_try_push(chan, -1));
+  assert(!csp_chan_try_pushm(chan, array, array_len));
+
+  int val;
+  for (int i = 0; i < cap; i++) {
+    csp_chan_pop(chan, &val);
+    assert(val == i);
+  }
+  assert(!csp_chan_try_pop(chan, &val));
+
+  for (int i = 0; i < cap / array_len; i++) {
+    assert(csp_chan_pushm(chan, array, array_len) == array_len);
+  }
+  assert(!csp_chan_try_push(chan, -1));
+  for (int i = 0; i < cap / array_len; i++) {
+    assert(csp_chan_popm(chan, array_cpy, array_len) == array_len);
+    assert(memcmp(array, array_cpy, sizeof(array)) == 0);
+  }
+  assert(csp_chan_try_popm(chan, array_cpy, array_len) == 0);
+
+  csp_chan_destroy(chan);
+}
+
+void test_chan_fc(void) {
+  csp_chan_t(fc) *chan = csp_chan_new(fc)(CAP_EXP);
+  for (int i = 0; i < CAP; i++) {
+    csp_chan_push(chan, i);
+  }
+  assert(!csp_chan_try_push(chan, -1));
+  assert(!csp_chan_try_pushm(chan, array, array_len));
+
+  int val;
+  for (int i = 0; i < CAP; i++) {
+    csp_chan_pop(chan, &val);
+    assert(val == i);
+  }
+  assert(!csp_chan_try_pop(chan, &val));
+
+  assert(csp_chan_pushm(chan, array, array_len) == array_len);
+  assert(csp_chan_popm(chan, array_cpy, array_len) == array_len);
+  assert(memcmp(array, array_cpy, sizeof(array)) == 0);
+  assert(csp_chan_try_popm(chan, array_cpy, array_len) == 0);
+
+  csp_chan_destroy(chan);
+}
+
 void test_chan_ss_thread(void) {
   csp_chan_t(mm) *chan = csp_chan_new(mm)(10);
 
@@ -295,10 +385,362 @@ void test_chan_ss_thread(void) {
   csp_chan_destroy(chan);
 }
 
+csp_chan_t(mm) *test_park_chan;
+
+void test_push_on_park(void) {
+  assert(atomic_load(&test_park_chan->recvq.len) == 1);
+  assert(test_park_chan->recvq.head->parked == &test_proc);
+  csp_chan_push(test_park_chan, 42);
+  assert(test_woken == &test_proc);
+}
+
+void test_pop_on_park(void) {
+  int val;
+  assert(atomic_load(&test_park_chan->sendq.len) == 1);
+  csp_chan_pop(test_park_chan, &val);
+  assert(val == 1);
+  assert(test_woken == &test_proc);
+}
+
+/* The peers which only use the non-blocking operations. */
+void test_try_push_on_park(void) {
+  assert(atomic_load(&test_park_chan->recvq.len) == 1);
+  assert(csp_chan_try_push(test_park_chan, 43));
+  assert(test_woken == &test_proc);
+}
+
+void test_try_pop_on_park(void) {
+  int val;
+  assert(atomic_load(&test_park_chan->sendq.len) == 1);
+  assert(csp_chan_try_pop(test_park_chan, &val));
+  assert(val == 1);
+  assert(test_woken == &test_proc);
+}
+
+void test_try_pushm_on_park(void) {
+  int items[] = {44, 45};
+  assert(csp_chan_try_pushm(test_park_chan, items, 2));
+  assert(test_woken == &test_proc);
+}
+
+void test_try_popm_on_park(void) {
+  int items[2];
+  assert(csp_chan_try_popm(test_park_chan, items, 2) == 2);
+  assert(items[0] == 1 && items[1] == 2);
+  assert(test_woken == &test_proc);
+}
+
+void test_chan_park(void) {
+  test_park_chan = csp_chan_new(mm)(1);
+
+  /* The receiver parks on an empty channel. */
+  int val = -1;
+  test_parked = 0;
+  test_woken = NULL;
+  test_on_park = test_push_on_park;
+  csp_chan_pop(test_park_chan, &val);
+  assert(val == 42);
+  assert(test_parked == 1);
+  assert(atomic_load(&csp_this_core->nopreempt) == 0);
+  assert(atomic_load(&test_park_chan->recvq.len) == 0);
+  assert(test_park_chan->recvq.head == NULL);
+
+  /* The sender parks on a full channel. */
+  test_parked = 0;
+  test_woken = NULL;
+  test_on_park = test_pop_on_park;
+  csp_chan_push(test_park_chan, 1);
+  csp_chan_push(test_park_chan, 2);
+  assert(test_parked == 0);
+  csp_chan_push(test_park_chan, 3);
+  assert(test_parked == 1);
+  assert(atomic_load(&test_park_chan->sendq.len) == 0);
+
+  csp_chan_pop(test_park_chan, &val);
+  assert(val == 2);
+  csp_chan_pop(test_park_chan, &val);
+  assert(val == 3);
+
+  /* The peers making progress wake the parked processes. */
+  csp_proc_t proc;
+  csp_waitq_node_t node = {.parked = &proc};
+  csp_waitq_push(&test_park_chan->sendq, &node);
+  test_woken = NULL;
+  assert(csp_chan_try_push(test_park_chan, 4));
+  csp_chan_pop(test_park_chan, &val);
+  assert(test_woken == &proc);
+  assert(atomic_load(&test_park_chan->sendq.len) == 0);
+
+  csp_waitq_push(&test_park_chan->recvq, &node);
+  test_woken = NULL;
+  int items[] = {5, 6};
+  csp_chan_pushm(test_park_chan, items, 2);
+  assert(test_woken == &proc);
+  csp_chan_popm(test_park_chan, items, 2);
+  assert(items[0] == 5 && items[1] == 6);
+
+  /* The parked processes are woken up by the non-blocking operations too. */
+  test_parked = 0;
+  test_woken = NULL;
+  test_on_park = test_try_push_on_park;
+  csp_chan_pop(test_park_chan, &val);
+  assert(val == 43 && test_parked == 1);
+
+  test_woken = NULL;
+  test_on_park = test_try_pushm_on_park;
+  csp_chan_popm(test_park_chan, items, 2);
+  assert(items[0] == 44 && items[1] == 45 && test_parked == 2);
+
+  test_woken = NULL;
+  test_on_park = test_try_pop_on_park;
+  csp_chan_push(test_park_chan, 1);
+  csp_chan_push(test_park_chan, 2);
+  csp_chan_push(test_park_chan, 3);
+  assert(test_parked == 3);
+  csp_chan_pop(test_park_chan, &val);
+  assert(val == 2);
+  csp_chan_pop(test_park_chan, &val);
+  assert(val == 3);
+
+  test_woken = NULL;
+  test_on_park = test_try_popm_on_park;
+  items[0] = 1, items[1] = 2;
+  csp_chan_pushm(test_park_chan, items, 2);
+  items[0] = 3, items[1] = 4;
+  csp_chan_pushm(test_park_chan, items, 2);
+  assert(test_parked == 4);
+  csp_chan_popm(test_park_chan, items, 2);
+  assert(items[0] == 3 && items[1] == 4);
+
+  csp_chan_destroy(test_park_chan);
+}
+
+csp_chan_t(un) *test_un_chan;
+
+void test_un_push_on_park(void) {
+  test_handoff = NULL;
+  csp_chan_push(test_un_chan, 42);
+  assert(test_handoff == &test_proc);
+}
+
+void test_un_pop_on_park(void) {
+  int val;
+  test_woken = NULL;
+  csp_chan_pop(test_un_chan, &val);
+  assert(val == 24);
+  assert(test_woken == &test_proc);
+}
+
+void test_chan_un(void) {
+  test_un_chan = csp_chan_new(un)(0);
+
+  /* Nothing happens without a peer. */
+  int val = -1;
+  assert(!csp_chan_try_push(test_un_chan, 1));
+  assert(!csp_chan_try_pushm(test_un_chan, array, 1));
+  assert(!csp_chan_try_pop(test_un_chan, &val));
+  assert(csp_chan_try_popm(test_un_chan, array_cpy, array_len) == 0);
+
+  /* The sender writes the item to the stack of the parked receiver. */
+  test_parked = 0;
+  test_on_park = test_un_push_on_park;
+  csp_chan_pop(test_un_chan, &val);
+  assert(val == 42);
+  assert(test_parked == 1);
+  assert(atomic_load(&test_un_chan->recvq.len) == 0);
+
+  /* The receiver reads the item from the stack of the parked sender. */
+  test_parked = 0;
+  test_on_park = test_un_pop_on_park;
+  csp_chan_push(test_un_chan, 24);
+  assert(test_parked == 1);
+  assert(atomic_load(&test_un_chan->sendq.len) == 0);
+
+  /* `try_pushm` is all or nothing. */
+  csp_proc_t procs[2];
+  int vals[2] = {-1, -1};
+  csp_waitq_node_t nodes[2] = {
+    {.parked = &procs[0], .data = &vals[0]},
+    {.parked = &procs[1], .data = &vals[1]},
+  };
+  csp_waitq_push(&test_un_chan->recvq, &nodes[0]);
+  assert(!csp_chan_try_pushm(test_un_chan, array, 2));
+  csp_waitq_push(&test_un_chan->recvq, &nodes[1]);
+  test_woken = NULL;
+  assert(csp_chan_try_pushm(test_un_chan, array, 2));
+  assert(vals[0] == array[0] && vals[1] == array[1]);
+  assert(test_woken == &procs[1]);
+  assert(atomic_load(&test_un_chan->recvq.len) == 0);
+
+  csp_waitq_push(&test_un_chan->sendq, &nodes[0]);
+  test_woken = NULL;
+  assert(csp_chan_try_pop(test_un_chan, &val));
+  assert(val == array[0]);
+  assert(test_woken == &procs[0]);
+
+  csp_chan_destroy(test_un_chan);
+}
+
+void test_close_on_park(void) {
+  test_woken = NULL;
+  csp_chan_close(test_park_chan);
+  assert(test_woken == &test_proc);
+}
+
+void test_un_close_on_park(void) {
+  test_woken = NULL;
+  csp_chan_close(test_un_chan);
+  assert(test_woken == &test_proc);
+}
+
+void test_chan_close(void) {
+  test_park_chan = csp_chan_new(mm)(2);
+
+  /* The remaining items are still popped after closing. */
+  int val, items[] = {1, 2, 3};
+  assert(csp_chan_push(test_park_chan, 1));
+  assert(csp_chan_push(test_park_chan, 2));
+  csp_chan_close(test_park_chan);
+  assert(csp_chan_is_closed(test_park_chan));
+  assert(!csp_chan_push(test_park_chan, 3));
+  assert(csp_chan_pushm(test_park_chan, items, 3) == 0);
+  assert(csp_chan_popm(test_park_chan, array_cpy, 3) == 2);
+  assert(array_cpy[0] == 1 && array_cpy[1] == 2);
+  assert(!csp_chan_pop(test_park_chan, &val));
+  csp_chan_destroy(test_park_chan);
+
+  /* Closing wakes up all parked processes at once. */
+  test_park_chan = csp_chan_new(mm)(2);
+  csp_proc_t procs[3];
+  csp_waitq_node_t nodes[3];
+  for (int i = 0; i < 3; i++) {
+    nodes[i] = (csp_waitq_node_t){.parked = &procs[i]};
+    csp_waitq_push(&test_park_chan->recvq, &nodes[i]);
+  }
+  test_parked = 0;
+  test_on_park = test_close_on_park;
+  assert(!csp_chan_pop(test_park_chan, &val));
+  assert(test_parked == 1);
+  assert(atomic_load(&test_park_chan->recvq.len) == 0);
+  assert(test_park_chan->recvq.head == NULL);
+  csp_chan_destroy(test_park_chan);
+
+  /* The parked process of an unbuffered channel is told nothing is handed. */
+  test_un_chan = csp_chan_new(un)(0);
+  test_parked = 0;
+  test_on_park = test_un_close_on_park;
+  assert(!csp_chan_pop(test_un_chan, &val));
+  assert(test_parked == 1);
+  assert(!csp_chan_push(test_un_chan, 1));
+  assert(csp_chan_popm(test_un_chan, array_cpy, 2) == 0);
+  csp_chan_destroy(test_un_chan);
+
+  test_un_chan = csp_chan_new(un)(0);
+  test_parked = 0;
+  assert(!csp_chan_push(test_un_chan, 1));
+  assert(test_parked == 1);
+  assert(atomic_load(&test_un_chan->sendq.len) == 0);
+  csp_chan_destroy(test_un_chan);
+}
+
+void test_commit_on_park(void) {
+  csp_chan_rsv_t rsv;
+  int *items = csp_chan_reserve(test_park_chan, 1, &rsv);
+  *items = 42;
+  csp_chan_commit(test_park_chan, &rsv);
+  assert(test_woken == &test_proc);
+}
+
+void test_chan_claim(void) {
+  test_park_chan = csp_chan_new(mm)(CAP_EXP);
+  csp_chan_rsv_t rsv;
+
+  /* The reader parks until the writer commits. */
+  test_parked = 0;
+  test_woken = NULL;
+  test_on_park = test_commit_on_park;
+  int *items = csp_chan_peek(test_park_chan, CAP, &rsv);
+  assert(test_parked == 1);
+  assert(items != NULL && rsv.len == 1 && *items == 42);
+  csp_chan_release(test_park_chan, &rsv);
+
+  items = csp_chan_reserve(test_park_chan, CAP, &rsv);
+  assert(items != NULL && rsv.len == CAP - 1);
+  for (size_t i = 0; i < rsv.len; i++) {
+    items[i] = i;
+  }
+  csp_chan_commit(test_park_chan, &rsv);
+  assert(csp_chan_try_reserve(test_park_chan, CAP, &rsv) != NULL);
+  assert(rsv.len == 1);
+  csp_chan_commit(test_park_chan, &rsv);
+  assert(csp_chan_try_reserve(test_park_chan, 1, &rsv) == NULL);
+
+  items = csp_chan_try_peek(test_park_chan, 2, &rsv);
+  assert(items != NULL && rsv.len == 2 && items[0] == 0 && items[1] == 1);
+  csp_chan_release(test_park_chan, &rsv);
+  assert(csp_chan_popm(test_park_chan, array_cpy, CAP - 2) == CAP - 2);
+
+  csp_chan_close(test_park_chan);
+  assert(csp_chan_reserve(test_park_chan, 1, &rsv) == NULL);
+  assert(csp_chan_peek(test_park_chan, 1, &rsv) == NULL);
+  csp_chan_destroy(test_park_chan);
+
+  /* The unbuffered channel has nothing to lend. */
+  test_un_chan = csp_chan_new(un)(0);
+  assert(csp_chan_try_reserve(test_un_chan, 1, &rsv) == NULL);
+  assert(csp_chan_reserve(test_un_chan, 1, &rsv) == NULL);
+  assert(csp_chan_try_peek(test_un_chan, 1, &rsv) == NULL);
+  assert(csp_chan_peek(test_un_chan, 1, &rsv) == NULL);
+  csp_chan_destroy(test_un_chan);
+}
+
+#define BENCH_ROUNDS (1 << 22)
+
+static double bench_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* Compare the operations called through the function pointers with the ones
+ * selected at compile time. */
+void test_chan_bench(void) {
+  csp_chan_t(mm) *chn = csp_chan_new(mm)(CAP_EXP);
+  int val;
+  long sum = 0;
+
+  double start = bench_now();
+  for (int i = 0; i < BENCH_ROUNDS; i++) {
+    csp_chan_try_push(chn, i);
+    csp_chan_try_pop(chn, &val);
+    sum += val;
+  }
+  double dynamic = (bench_now() - start) / BENCH_ROUNDS;
+
+  start = bench_now();
+  for (int i = 0; i < BENCH_ROUNDS; i++) {
+    csp_chan_static(try_push, mm)(chn, i);
+    csp_chan_static(try_pop, mm)(chn, &val);
+    sum -= val;
+  }
+  double fixed = (bench_now() - start) / BENCH_ROUNDS;
+
+  assert(sum == 0);
+  printf("chan push+pop: dynamic %.2fns, static %.2fns\n", dynamic, fixed);
+  csp_chan_destroy(chn);
+}
+
 int main(void) {
+  test_chan_park();
+  test_chan_un();
+  test_chan_close();
+  test_chan_claim();
+  test_chan_bench();
   test_chan_ss_thread();
   test_chan_ss();
   test_chan_sm();
   test_chan_ms();
   test_chan_mm();
+  test_chan_el();
+  test_chan_fc();
 }
@@ -0,0 +1,226 @@
+/*
+ * Copyright (c) 2020, Yanhui Shi <lime.syh at gmail dot com>
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <cassert>
+#include <deque>
+#include <memory>
+#include <utility>
+#include <vector>
+#include "../src/csp.hpp"
+
+#define CAP_EXP     2
+#define CAP         (1 << CAP_EXP)
+
+/* The stubs of the scheduler. The spawned "processes" are queued and run one
+ * by one in `run`, so the coroutines are resumed in a deterministic order. */
+std::deque<std::pair<void (*)(void *), void *>> spawned;
+int yields;
+
+extern "C" {
+void csp_sched_spawn(void (*fn)(void *arg), void *arg) {
+  spawned.emplace_back(fn, arg);
+}
+
+void csp_sched_yield(void) {
+  yields++;
+}
+
+void csp_sched_hangup(uint64_t nanoseconds) {}
+
+int csp_netpoll_wait_read(int fd, int64_t timeout) {
+  return csp::netpoll_avail;
+}
+
+int csp_netpoll_wait_write(int fd, int64_t timeout) {
+  return csp::netpoll_timeout;
+}
+}
+
+void run(void) {
+  while (!spawned.empty()) {
+    auto [fn, arg] = spawned.front();
+    spawned.pop_front();
+    fn(arg);
+  }
+}
+
+void test_go(void) {
+  int ran = 0;
+  csp::go([&ran] { ran++; });
+  assert(ran == 0 && spawned.size() == 1);
+  run();
+  assert(ran == 1);
+
+  /* A task doesn't start until it's passed to `go`. */
+  auto greet = [](int &ran) -> csp::task {
+    co_await csp::yield();
+    ran++;
+  };
+  csp::task t = greet(ran);
+  assert(spawned.empty());
+  csp::go(std::move(t));
+  run();
+  assert(ran == 2 && yields == 1);
+}
+
+csp::task consume(csp::chan<int> &ch, std::vector<int> &got) {
+  while (auto item = co_await ch.pop()) {
+    got.push_back(*item);
+  }
+}
+
+csp::task produce(csp::chan<int> &ch, int from, int n, int &pushed) {
+  for (int i = from; i < from + n; i++) {
+    if (co_await ch.push(i)) {
+      pushed++;
+    }
+  }
+}
+
+void test_handoff(void) {
+  csp::chan<int> ch(CAP_EXP);
+  std::vector<int> got;
+
+  /* The receiver suspends on the empty channel and the item is handed to it
+   * by the sender. */
+  csp::go(consume(ch, got));
+  run();
+  assert(got.empty() && spawned.empty());
+  assert(ch.try_push(1));
+  assert(spawned.size() == 1);
+  run();
+  assert(got.size() == 1 && got[0] == 1);
+
+  /* The sender suspends once the channel is full, and the receiver makes room
+   * for it as it goes. */
+  int pushed = 0;
+  csp::go(produce(ch, 2, CAP * 3, pushed));
+  run();
+  assert(pushed == CAP * 3);
+  assert(got.size() == CAP * 3 + 1);
+  for (int i = 0; i < CAP * 3 + 1; i++) {
+    assert(got[i] == i + 1);
+  }
+  assert(!ch.try_pop());
+
+  ch.close();
+  run();
+}
+
+void test_close(void) {
+  csp::chan<int, csp::kind::ss> ch(CAP_EXP);
+  int pushed = 0;
+
+  /* The sender waiting on the full channel fails once it's closed. */
+  auto produce = [](csp::chan<int, csp::kind::ss> &ch, int n,
+      int &pushed, bool &failed) -> csp::task {
+    for (int i = 0; i < n; i++) {
+      if (!co_await ch.push(i)) {
+        failed = true;
+        co_return;
+      }
+      pushed++;
+    }
+  };
+  bool failed = false;
+  csp::go(produce(ch, CAP + 1, pushed, failed));
+  run();
+  assert(pushed == CAP && !failed);
+  ch.close();
+  run();
+  assert(failed && ch.is_closed());
+
+  /* The items pushed before the close are still received, and the waiting
+   * receivers get nothing after that. */
+  auto drain = [](csp::chan<int, csp::kind::ss> &ch,
+      int &received, bool &done) -> csp::task {
+    while (auto item = co_await ch.pop()) {
+      assert(*item == received);
+      received++;
+    }
+    done = true;
+  };
+  int received = 0;
+  bool done = false;
+  csp::go(drain(ch, received, done));
+  run();
+  assert(received == CAP && done);
+
+  /* A receiver suspended on an empty channel is woken up by the close. */
+  csp::chan<int> empty(CAP_EXP);
+  std::vector<int> got;
+  csp::go(consume(empty, got));
+  run();
+  assert(spawned.empty());
+  empty.close();
+  assert(spawned.size() == 1);
+  run();
+  assert(got.empty());
+}
+
+void test_move_only(void) {
+  using item_t = std::unique_ptr<int>;
+  auto ch = std::make_unique<csp::chan<item_t, csp::kind::ss>>(CAP_EXP);
+
+  auto produce = [](csp::chan<item_t, csp::kind::ss> &ch) -> csp::task {
+    for (int i = 0; i < CAP * 2; i++) {
+      bool ok = co_await ch.push(std::make_unique<int>(i));
+      assert(ok);
+    }
+    ch.close();
+  };
+  auto consume = [](csp::chan<item_t, csp::kind::ss> &ch,
+      int &sum) -> csp::task {
+    while (auto item = co_await ch.pop()) {
+      sum += **item;
+    }
+  };
+  int sum = 0;
+  csp::go(produce(*ch));
+  csp::go(consume(*ch, sum));
+  run();
+  assert(sum == (CAP * 2 - 1) * CAP);
+
+  /* The items left in the channel are destroyed with it. */
+  auto counted = std::make_shared<int>(0);
+  auto held = std::make_unique<csp::chan<std::shared_ptr<int>>>(CAP_EXP);
+  assert(held->try_push(std::shared_ptr<int>(counted)));
+  assert(held->try_push(counted));
+  assert(counted.use_count() == 3);
+  held.reset();
+  assert(counted.use_count() == 1);
+}
+
+void test_netpoll(void) {
+  int result = 0;
+  auto wait = [](int &result) -> csp::task {
+    result = co_await csp::wait_read(0, 0);
+    result += co_await csp::wait_write(1, 1000);
+    co_await csp::sleep_for(1000);
+  };
+  csp::go(wait(result));
+  run();
+  assert(result == csp::netpoll_avail + csp::netpoll_timeout);
+}
+
+int main(void) {
+  test_go();
+  test_handoff();
+  test_close();
+  test_move_only();
+  test_netpoll();
+}
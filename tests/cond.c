@@ -0,0 +1,95 @@
+/*
+ * Copyright (c) 2020, Yanhui Shi <lime.syh at gmail dot com>
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <assert.h>
+#include <pthread.h>
+#include <time.h>
+#include "../src/cond.h"
+
+size_t csp_spin_budget = 64;
+
+static csp_cond_t cond;
+static atomic_int received;
+
+void *test_cond_waiter(void *data) {
+  atomic_store(&received, csp_cond_wait(&cond));
+  return NULL;
+}
+
+void test_cond_signal_before_wait(void) {
+  csp_cond_init(&cond);
+  assert(cond.spins == csp_spin_budget);
+
+  /* The signal is kept until the waiter comes. */
+  csp_cond_signal(&cond, csp_cond_signal_proc_avail);
+  assert(csp_cond_wait(&cond) == csp_cond_signal_proc_avail);
+  assert(atomic_load(&cond.stat) == csp_cond_signal_none);
+  assert(!atomic_load(&cond.parked));
+
+  /* The spins never exceed the budget. */
+  assert(cond.spins == csp_spin_budget);
+}
+
+void test_cond_park(void) {
+  csp_cond_init(&cond);
+  atomic_store(&received, csp_cond_signal_none);
+
+  pthread_t tid;
+  assert(pthread_create(&tid, NULL, test_cond_waiter, NULL) == 0);
+
+  /* Wait until the waiter parks in the kernel. */
+  while (!atomic_load(&cond.parked)) {
+    nanosleep(&(struct timespec){.tv_nsec = 1000000}, NULL);
+  }
+  assert(atomic_load(&received) == csp_cond_signal_none);
+
+  csp_cond_signal(&cond, csp_cond_signal_wakeup);
+  assert(pthread_join(tid, NULL) == 0);
+  assert(atomic_load(&received) == csp_cond_signal_wakeup);
+  assert(!atomic_load(&cond.parked));
+
+  /* The spins are halved since we have parked. */
+  assert(cond.spins == csp_spin_budget >> 1);
+  for (int i = 0; i < 8; i++) {
+    assert(pthread_create(&tid, NULL, test_cond_waiter, NULL) == 0);
+    while (!atomic_load(&cond.parked)) {
+      nanosleep(&(struct timespec){.tv_nsec = 1000000}, NULL);
+    }
+    csp_cond_signal(&cond, csp_cond_signal_wakeup);
+    assert(pthread_join(tid, NULL) == 0);
+  }
+  assert(cond.spins == csp_cond_min_spins);
+}
+
+void test_cond_timedwait(void) {
+  csp_cond_init(&cond);
+
+  /* It times out without a signal and leaves nothing behind. */
+  assert(csp_cond_timedwait(&cond, 1000000) == csp_cond_signal_none);
+  assert(atomic_load(&cond.stat) == csp_cond_signal_none);
+  assert(!atomic_load(&cond.parked));
+
+  csp_cond_signal(&cond, csp_cond_signal_wakeup);
+  assert(csp_cond_timedwait(&cond, 1000000) == csp_cond_signal_wakeup);
+  assert(atomic_load(&cond.stat) == csp_cond_signal_none);
+}
+
+int main(void) {
+  test_cond_signal_before_wait();
+  test_cond_park();
+  test_cond_timedwait();
+}
@@ -23,25 +23,34 @@
 
 #include <assert.h>
 #include <stdlib.h>
+#include <string.h>
 #include "../src/runq.c"
 #include "../src/proc.c"
 #include "../src/core.c"
 #include "../src/corepool.c"
+#include "../src/cpus.c"
 
 int csp_sched_np = 1;
+size_t csp_cpu_cores = 0;
 size_t csp_max_threads = 1;
 size_t csp_max_procs_hint = 100;
+size_t csp_spin_budget = 1;
 
 size_t csp_procs_num = 1;
-size_t csp_procs_size[] = {4096};
+csp_proc_meta_t csp_procs_meta[] = {{4096}};
+size_t csp_elastic_stack_size = 0;
+size_t csp_time_slice = 0;
 
-void csp_sched_put_proc(csp_proc_t *proc) {}
 void csp_sched_yield() {}
 
 csp_proc_t *csp_sched_get(csp_core_t *this_core) {
   return NULL;
 }
 
+csp_proc_t *csp_sched_switch(csp_proc_t *next) {
+  return next;
+}
+
 void test_core_pool(void) {
   size_t stack_cap = 3, pid = 0, lrunq_cap_exp = 3;
   csp_core_t *cores[stack_cap], *core;
@@ -49,12 +58,13 @@ void test_core_pool(void) {
 
   /* Test csp_core_pool_new. */
   csp_core_pool_t *stack = csp_core_pool_new(stack_cap, pid, lrunq_cap_exp);
-  assert(stack->top == stack_cap);
+  assert(stack->top == 0 && stack->len == 0);
 
-  /* Test csp_core_pool_pop. */
+  /* Test csp_core_pool_pop, the cores are created on demand. */
   for (int i = 0; i < stack_cap; i++) {
     assert(csp_core_pool_pop(stack, &core));
-    assert(stack->top == stack_cap - i - 1);
+    assert(stack->top == 0 && stack->len == i + 1);
+    assert(stack->all[i] == core && core->pid == stack->pid);
     cores[i] = core;
   }
   assert(!csp_core_pool_pop(stack, &core));
@@ -66,10 +76,127 @@ void test_core_pool(void) {
     assert(stack->top == i + 1);
   }
   assert(stack->top == stack_cap);
+  assert(csp_core_pool_pop(stack, &core) && core == cores[stack_cap - 1]);
+
+  /* Test csp_core_pool_remove and csp_core_pool_push_bottom. */
+  assert(csp_core_pool_remove(stack, cores[0]));
+  assert(!csp_core_pool_remove(stack, cores[0]));
+  assert(stack->top == 1 && stack->cores[0] == cores[1]);
+  csp_core_pool_push_bottom(stack, cores[0]);
+  assert(stack->top == 2);
+  assert(stack->cores[0] == cores[0] && stack->cores[1] == cores[1]);
+  assert(csp_core_pool_pop(stack, &core) && core == cores[1]);
 
   csp_core_pool_destroy(stack);
 }
 
+void test_core_pool_victims(void) {
+  /* Two nodes of two cores with two SMT threads each, i.e.
+   *
+   *   pid:     0 1 2 3 4 5 6 7
+   *   node:    0 0 0 0 1 1 1 1
+   *   core_id: 0 1 0 1 0 1 0 1
+   */
+  int len = 8;
+  csp_core_pool_t topology[len], *pools[len];
+  for (int i = 0; i < len; i++) {
+    topology[i] = (csp_core_pool_t){
+      .node = i / 4, .package = i / 4, .core_id = i % 2
+    };
+    pools[i] = &topology[i];
+  }
+  for (int i = 0; i < len; i++) {
+    assert(csp_core_pool_victims_init(pools, len, i));
+  }
+
+  int victims0[] = {2, 1, 3, 4, 5, 6, 7}, victims5[] = {7, 6, 4, 0, 1, 2, 3};
+  for (int i = 0; i < len - 1; i++) {
+    assert(pools[0]->victims[i] == victims0[i]);
+    assert(pools[5]->victims[i] == victims5[i]);
+  }
+
+  /* Unknown topology falls back to round-robin from `pid + 1`. */
+  for (int i = 0; i < len; i++) {
+    free(pools[i]->victims);
+    topology[i].node = topology[i].package = topology[i].core_id = -1;
+  }
+  for (int i = 0; i < len; i++) {
+    assert(csp_core_pool_victims_init(pools, len, i));
+  }
+  for (int i = 0; i < len - 1; i++) {
+    assert(pools[3]->victims[i] == (3 + i + 1) % len);
+  }
+
+  for (int i = 0; i < len; i++) {
+    free(pools[i]->victims);
+  }
+
+  /* The heaps are bound only if the pools spread over multiple nodes. */
+  csp_core_pools.pools = pools;
+  csp_core_pools.numa = false;
+  assert(csp_core_pools_node(0) == -1);
+  csp_core_pools.numa = true;
+  topology[6].node = 1;
+  assert(csp_core_pools_node(6) == 1);
+  csp_core_pools.pools = NULL;
+}
+
+void test_core_pools_idle(void) {
+  /* Two nodes of four pools, i.e. the bits of node 1 start from word 1. */
+  int len = 8;
+  csp_core_pool_t topology[len], *pools[len];
+  csp_core_t cores[len], other;
+  memset(cores, 0, sizeof(cores));
+  memset(&other, 0, sizeof(other));
+  for (int i = 0; i < len; i++) {
+    topology[i] = (csp_core_pool_t){.node = i / 4};
+    pools[i] = &topology[i];
+    cores[i].pid = i;
+  }
+  csp_core_pools.pools = pools;
+  assert(csp_core_pools_idle_init(pools, len));
+  assert(csp_core_pools.nidle == 2);
+  assert(pools[3]->idle_bit == 3 && pools[4]->idle_bit == 64);
+  assert(pools[0]->idle_lo == 0 && pools[0]->idle_hi == 1);
+  assert(pools[7]->idle_lo == 1 && pools[7]->idle_hi == 2);
+
+  /* Only one core of a pool can be idle in the bitmap. */
+  assert(csp_core_pools_idle_put(&cores[5]));
+  assert(csp_core_pools_idle_put(&cores[1]));
+  other.pid = 1;
+  assert(!csp_core_pools_idle_put(&other));
+
+  /* The cores in the same node are woken up first. */
+  assert(csp_core_pools_idle_wakeup(0));
+  assert(cores[1].cond.stat == csp_cond_signal_proc_avail);
+  assert(pools[1]->idle == NULL && csp_core_pools.idle[0] == 0);
+  assert(csp_core_pools_idle_wakeup(0));
+  assert(cores[5].cond.stat == csp_cond_signal_proc_avail);
+  assert(!csp_core_pools_idle_wakeup(0));
+
+  /* A withdrawn core is not woken up. */
+  cores[2].cond.stat = csp_cond_signal_none;
+  assert(csp_core_pools_idle_put(&cores[2]));
+  csp_core_pools_idle_del(&cores[2]);
+  assert(pools[2]->idle == NULL && csp_core_pools.idle[0] == 0);
+  assert(!csp_core_pools_idle_wakeup(2));
+  assert(cores[2].cond.stat == csp_cond_signal_none);
+
+  /* The pool itself is woken up first if it's idle. */
+  assert(csp_core_pools_idle_put(&cores[2]));
+  assert(csp_core_pools_idle_put(&cores[3]));
+  assert(csp_core_pools_idle_wakeup(3));
+  assert(cores[3].cond.stat == csp_cond_signal_proc_avail);
+  assert(cores[2].cond.stat == csp_cond_signal_none);
+  assert(pools[2]->idle == &cores[2]);
+
+  free(csp_core_pools.idle);
+  free(csp_core_pools.idle_pids);
+  csp_core_pools.pools = NULL;
+}
+
 int main(void) {
   test_core_pool();
+  test_core_pool_victims();
+  test_core_pools_idle();
 }
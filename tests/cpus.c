@@ -0,0 +1,103 @@
+/*
+ * Copyright (c) 2020, Yanhui Shi <lime.syh at gmail dot com>
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <assert.h>
+#include <stdlib.h>
+#include "../src/cpus.c"
+
+int csp_sched_np;
+size_t csp_cpu_cores;
+
+void test_reset(void) {
+  free(csp_cpus.cpus);
+  memset(&csp_cpus, 0, sizeof(csp_cpus));
+  unsetenv("CSP_CPUS");
+  unsetenv("CSP_CORES");
+  unsetenv("CSP_PIN");
+  unsetenv("CSP_MONITOR_CPUS");
+  csp_cpu_cores = 0;
+}
+
+void test_cpus_parse(void) {
+  cpu_set_t set;
+  assert(csp_cpus_parse("3", &set));
+  assert(CPU_COUNT(&set) == 1 && CPU_ISSET(3, &set));
+
+  assert(csp_cpus_parse("0-2,5,7-8", &set));
+  assert(CPU_COUNT(&set) == 6);
+  assert(CPU_ISSET(0, &set) && CPU_ISSET(2, &set) && !CPU_ISSET(3, &set));
+  assert(CPU_ISSET(5, &set) && CPU_ISSET(8, &set));
+
+  assert(!csp_cpus_parse("", &set));
+  assert(!csp_cpus_parse("a", &set));
+  assert(!csp_cpus_parse("3-1", &set));
+  assert(!csp_cpus_parse("1;2", &set));
+  assert(!csp_cpus_parse("-1", &set));
+  assert(!csp_cpus_parse("100000", &set));
+}
+
+void test_cpus_init(void) {
+  /* The cores follow the affinity of the process by default. */
+  test_reset();
+  cpu_set_t set;
+  assert(sched_getaffinity(0, sizeof(set), &set) == 0);
+  assert(csp_cpus_init());
+  assert(csp_sched_np >= 1 && csp_sched_np <= CPU_COUNT(&set));
+  for (int i = 0; i < csp_sched_np; i++) {
+    assert(CPU_ISSET(csp_cpus_of(i), &set));
+  }
+  assert(csp_cpus.pinned && !csp_cpus.monitor_pinned);
+
+  /* The CPUs are shared round-robin by more cores. */
+  test_reset();
+  setenv("CSP_CPUS", "2,4-5", 1);
+  setenv("CSP_CORES", "5", 1);
+  setenv("CSP_PIN", "0", 1);
+  setenv("CSP_MONITOR_CPUS", "1", 1);
+  assert(csp_cpus_init());
+  assert(csp_sched_np == 5);
+  int cpus[] = {2, 4, 5, 2, 4};
+  for (int i = 0; i < 5; i++) {
+    assert(csp_cpus_of(i) == cpus[i]);
+  }
+  assert(!csp_cpus.pinned);
+  assert(csp_cpus.monitor_pinned && CPU_ISSET(1, &csp_cpus.monitor));
+
+  /* `--cpu-cores` caps the default number of cores. */
+  test_reset();
+  setenv("CSP_CPUS", "0-7", 1);
+  csp_cpu_cores = 3;
+  assert(csp_cpus_init());
+  assert(csp_sched_np >= 1 && csp_sched_np <= 3);
+
+  test_reset();
+  setenv("CSP_CORES", "0", 1);
+  assert(!csp_cpus_init() && errno == EINVAL);
+  test_reset();
+  setenv("CSP_CPUS", "x", 1);
+  assert(!csp_cpus_init() && errno == EINVAL);
+  test_reset();
+}
+
+int main(void) {
+  test_cpus_parse();
+  test_cpus_init();
+}
@@ -0,0 +1,127 @@
+/*
+ * Copyright (c) 2020, Yanhui Shi <lime.syh at gmail dot com>
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <assert.h>
+#include "../src/future.c"
+
+csp_future_declare(int, int);
+csp_future_declare(double, double);
+
+/* The stubs of the scheduler. The parked "process" makes the resolver progress
+ * itself before it is resumed, see `tests/select.c`. */
+csp_proc_t test_proc, *test_woken;
+_Thread_local csp_core_t *csp_this_core = &(csp_core_t){.running = &test_proc};
+void (*test_on_park)(void);
+int test_parked;
+
+void csp_sched_park(csp_spinlock_t *lock) {
+  test_parked++;
+  csp_waitq_unlock(lock);
+  test_on_park();
+}
+
+void csp_sched_park_fn(void (*fn)(void *arg), void *arg) {
+  test_parked++;
+  fn(arg);
+  test_on_park();
+}
+
+void csp_sched_put_proc(csp_proc_t *proc) {
+  test_woken = proc;
+}
+
+csp_future_t(int) test_int;
+csp_future_t(double) test_double;
+
+void test_reset(void) {
+  csp_future_init(&test_int);
+  csp_future_init(&test_double);
+  test_parked = 0;
+  test_woken = NULL;
+}
+
+void test_set_int(void) {
+  csp_future_set(&test_int, 42);
+}
+
+void test_set_double(void) {
+  csp_future_set(&test_double, 0.5);
+}
+
+void test_future_ready(void) {
+  test_reset();
+  assert(!csp_future_is_ready(&test_int));
+  csp_future_set(&test_int, 7);
+  assert(csp_future_is_ready(&test_int));
+  assert(csp_await(&test_int) == 7);
+  assert(csp_await(&test_int) == 7);
+  assert(test_parked == 0);
+  assert(test_woken == NULL);
+}
+
+void test_future_park(void) {
+  test_reset();
+  test_on_park = test_set_int;
+  assert(csp_await(&test_int) == 42);
+  assert(test_parked == 1);
+  assert(test_woken == &test_proc);
+  assert(atomic_load(&test_int.base.waitq.len) == 0);
+}
+
+void test_future_all(void) {
+  test_reset();
+  csp_future_set(&test_int, 1);
+  test_on_park = test_set_double;
+  csp_await_all(&test_int, &test_double);
+  assert(test_parked == 1);
+  assert(test_int.value == 1);
+  assert(test_double.value == 0.5);
+}
+
+void test_future_any(void) {
+  test_reset();
+  csp_future_set(&test_double, 0.25);
+  assert(csp_await_any(&test_int, &test_double) == 1);
+  assert(test_parked == 0);
+
+  /* The node left in the queue of the other future must be dropped. */
+  test_reset();
+  test_on_park = test_set_double;
+  assert(csp_await_any(&test_int, &test_double) == 1);
+  assert(test_parked == 1);
+  assert(test_woken == &test_proc);
+  assert(atomic_load(&test_int.base.waitq.len) == 0);
+  assert(atomic_load(&test_double.base.waitq.len) == 0);
+
+  /* The same future may be passed more than once. */
+  test_reset();
+  test_on_park = test_set_int;
+  assert(csp_await_any(&test_int, &test_double, &test_int) == 0);
+  assert(atomic_load(&test_int.base.waitq.len) == 0);
+  assert(atomic_load(&test_double.base.waitq.len) == 0);
+}
+
+int main(void) {
+  test_future_ready();
+  test_future_park();
+  test_future_all();
+  test_future_any();
+}
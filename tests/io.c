@@ -0,0 +1,148 @@
+/*
+ * Copyright (c) 2020, Yanhui Shi <lime.syh at gmail dot com>
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#define csp_with_io_uring
+
+#include <arpa/inet.h>
+#include <assert.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include "../src/io.c"
+
+csp_proc_t test_proc;
+
+int csp_sched_np = 1;
+_Thread_local csp_core_t *csp_this_core = &(csp_core_t){
+  .pid = 0, .running = &test_proc
+};
+
+bool csp_monitor_watch(size_t pid, int fd) {
+  return true;
+}
+
+/* Instead of yielding, wait here until the request completes. */
+void csp_sched_park_fn(void (*fn)(void *arg), void *arg) {
+  csp_proc_t *start, *end;
+  while (csp_io_poll_core(0, true, &start, &end) == 0);
+  assert(start == &test_proc && end == &test_proc);
+}
+
+void test_io_rw(void) {
+  int fds[2];
+  char buf[8];
+  assert(pipe(fds) == 0);
+
+  assert(write(fds[1], "hello", 5) == 5);
+  assert(csp_io_read(fds[0], buf, sizeof(buf)) == 5);
+  assert(memcmp(buf, "hello", 5) == 0);
+
+  assert(csp_io_write(fds[1], "world", 5) == 5);
+  assert(read(fds[0], buf, sizeof(buf)) == 5);
+  assert(memcmp(buf, "world", 5) == 0);
+
+  close(fds[0]);
+  close(fds[1]);
+
+  assert(csp_io_read(fds[0], buf, sizeof(buf)) == -1);
+  assert(errno == EBADF);
+}
+
+void test_io_batch(void) {
+  csp_io_ring_t *ring = &csp_io.rings[0];
+  csp_io_req_t req = {.proc = &test_proc, .res = -1};
+  csp_proc_t *start, *end;
+
+  struct io_uring_sqe *sqe = csp_io_sqe_get(ring);
+  sqe->opcode = IORING_OP_NOP;
+  sqe->user_data = (uintptr_t)&req;
+  assert(ring->pending == 1);
+
+  /* The request is flushed after `csp_io_batch` rounds. */
+  for (int i = 1; i < csp_io_batch; i++) {
+    assert(csp_io_poll_core(0, false, &start, &end) == 0);
+    assert(ring->pending == 1);
+  }
+  int n = csp_io_poll_core(0, false, &start, &end);
+  assert(ring->pending == 0);
+
+  while (n == 0) {
+    n = csp_io_poll(0, &start, &end);
+  }
+  assert(start == &test_proc && end == &test_proc);
+  assert(req.res == 0);
+}
+
+void test_io_fixed(void) {
+  int fds[2];
+  static char buf[64];
+  assert(pipe(fds) == 0);
+
+  struct iovec iov = {.iov_base = buf, .iov_len = sizeof(buf)};
+  assert(csp_io_register_buffers(&iov, 1));
+  assert(csp_io_register_files(fds, 2));
+
+  memcpy(buf, "hello", 5);
+  assert(csp_io_write_fixed(csp_io_fixed_file(1), buf, 5, 0) == 5);
+  assert(csp_io_read_fixed(csp_io_fixed_file(0), buf + 32, 32, 0) == 5);
+  assert(memcmp(buf + 32, "hello", 5) == 0);
+
+  close(fds[0]);
+  close(fds[1]);
+}
+
+void test_io_accept_connect(void) {
+  struct sockaddr_in addr = {
+    .sin_family = AF_INET,
+    .sin_addr = {.s_addr = htonl(INADDR_LOOPBACK)},
+  };
+  socklen_t len = sizeof(addr);
+
+  int server = socket(AF_INET, SOCK_STREAM, 0);
+  assert(server != -1);
+  assert(bind(server, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+  assert(listen(server, 8) == 0);
+  assert(getsockname(server, (struct sockaddr *)&addr, &len) == 0);
+
+  int client = socket(AF_INET, SOCK_STREAM, 0);
+  assert(client != -1);
+  assert(csp_io_connect(client, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+
+  int conn = csp_io_accept(server, NULL, NULL);
+  assert(conn != -1);
+  assert(csp_io_write(client, "ping", 4) == 4);
+
+  char buf[4];
+  assert(csp_io_read(conn, buf, sizeof(buf)) == 4);
+  assert(memcmp(buf, "ping", 4) == 0);
+
+  close(conn);
+  close(client);
+  close(server);
+}
+
+int main(void) {
+  if (!csp_io_init()) {
+    fprintf(stderr, "io_uring is not supported, skipped.\n");
+    return 0;
+  }
+
+  test_io_rw();
+  test_io_batch();
+  test_io_fixed();
+  test_io_accept_connect();
+  csp_io_destroy();
+}
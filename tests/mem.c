@@ -19,8 +19,11 @@
 #include "../src/mem.c"
 
 int csp_sched_np = 1;
+size_t csp_mem_retain = 64 << 12;
 _Thread_local csp_core_t *csp_this_core = &(csp_core_t){.pid = 0};
+csp_stats_block_t csp_stats_shared;
 void csp_sched_yield(void) {}
+int csp_core_pools_node(size_t pid) { return -1; }
 
 void test_meta_index(void) {
   csp_mem_meta_index_t index = {0, 0, 0}, other = {1, 2, 3};
@@ -114,6 +117,7 @@ void test_arena(void) {
   heap.start = 1L << csp_mem_heap_size_exp;
   heap.end = heap.start + csp_mem_heap_size;
   heap.curr = heap.start -= csp_mem_arena_size;
+  heap.node = 0;
 
   void *arena = csp_mem_arena_new(&heap);
   int32_t l1 = csp_mem_meta_l1_by_addr(&heap, arena);
@@ -123,6 +127,15 @@ void test_arena(void) {
   assert(heap.arenas->addr == arena);
   assert(heap.arenas->next == NULL);
 
+  /* The arena should prefer the node of the heap. */
+  int mode;
+  unsigned long mask[16] = {0};
+  if (syscall(SYS_get_mempolicy, &mode, mask, sizeof(mask) * 8, arena,
+        MPOL_F_ADDR) == 0) {
+    assert(mode == MPOL_PREFERRED);
+    assert(mask[0] == 0x01);
+  }
+
   csp_mem_heap_destroy_l1(&heap, l1);
   munmap(heap.arenas->addr, csp_mem_arena_size);
   free(heap.arenas);
@@ -184,7 +197,8 @@ void test_meta(void) {
   csp_mem_meta_destroy(meta);
 }
 
-void test_tree_node(void) {
+#ifndef csp_with_mem_bitmap
+void test_free_index(void) {
   assert(csp_mem_tree_node_num == 4096);
 
   csp_mem_heap_t heap = {
@@ -268,6 +282,224 @@ void test_tree_node(void) {
   csp_mem_meta_destroy(heap.metas[0]);
   csp_rbtree_destroy(heap.tree, heap.all_nodes);
 }
+#else
+void test_free_index(void) {
+  csp_mem_heap_t heap;
+  memset(heap.metas, 0, sizeof(heap.metas));
+  assert(csp_mem_free_init(&heap));
+  assert(csp_mem_free_last(&heap) == 0);
+  for (int i = 1; i <= csp_mem_arena_npages; i++) {
+    assert(csp_mem_free_get_gte(&heap, i) == NULL);
+    assert(csp_mem_free_head(&heap, i) == NULL);
+  }
+
+  heap.metas[0] = csp_mem_meta_new(0);
+  csp_mem_span_t *spans = heap.metas[0]->spans;
+
+  /* The sizes span several words of the bitmap, including the first and the
+   * last pages of the words. */
+  int sizes[] = {1, 63, 64, 65, 200, 4095, 4096};
+  int nsizes = sizeof(sizes) / sizeof(sizes[0]);
+  for (int i = 0; i < nsizes; i++) {
+    csp_mem_span_npages_set(&spans[i + 1], sizes[i]);
+    csp_mem_free_put(&heap, &spans[i + 1], sizes[i]);
+  }
+
+  /* The best fit is the smallest size not less than the request. */
+  for (int i = 0, n = 1; i < nsizes; i++) {
+    for (; n <= sizes[i]; n++) {
+      assert(csp_mem_free_get_gte(&heap, n) == &spans[i + 1]);
+    }
+  }
+
+  /* The sizes are walked from the largest down. */
+  int key = csp_mem_free_last(&heap);
+  for (int i = nsizes - 1; i >= 0; i--) {
+    assert(key == sizes[i]);
+    key = csp_mem_free_prev(&heap, key);
+  }
+  assert(key == 0);
+
+  /* A list keeps its bit until the last span is deleted. */
+  csp_mem_span_npages_set(&spans[10], 64);
+  csp_mem_free_put(&heap, &spans[10], 64);
+  assert(csp_mem_free_head(&heap, 64) == &spans[10]);
+  assert(csp_mem_free_del(&heap, &spans[10]) == &spans[3]);
+  assert(csp_mem_free_head(&heap, 64) == &spans[3]);
+  assert(csp_mem_free_del(&heap, &spans[3]) == NULL);
+  assert(csp_mem_free_get_gte(&heap, 64) == &spans[4]);
+
+  /* The first level bit is cleared with the last bit of its word. */
+  assert(csp_mem_free_del(&heap, &spans[4]) == NULL);
+  assert(csp_mem_free_del(&heap, &spans[5]) == NULL);
+  assert(csp_mem_free_get_gte(&heap, 64) == &spans[6]);
+  assert(!(heap.free_l1 & 0x0e));
+
+  for (int i = 0; i < nsizes; i++) {
+    if (csp_mem_free_head(&heap, sizes[i]) != NULL) {
+      csp_mem_free_del(&heap, &spans[i + 1]);
+    }
+  }
+  assert(heap.free_l1 == 0 && csp_mem_free_last(&heap) == 0);
+
+  csp_mem_meta_destroy(heap.metas[0]);
+  csp_mem_free_destroy(&heap);
+}
+#endif
+
+void test_slab(void) {
+  csp_mem_heap_t *heap = (csp_mem_heap_t *)malloc(sizeof(csp_mem_heap_t));
+  assert(csp_mem_heap_init(heap, 1L << csp_mem_heap_size_exp, -1));
+
+  for (int cls = 0; cls < csp_mem_slab_nclasses; cls++) {
+    assert(csp_mem_slab_sizes[cls] % 64 == 0);
+    assert(csp_mem_slab_nobjs(cls) >= 2);
+  }
+  assert(csp_mem_slab_sizes[csp_mem_slab_nclasses - 1] ==
+    csp_mem_slab_max_size);
+
+  /* Fill two slabs of the first class. */
+  int nobjs = csp_mem_slab_nobjs(0);
+  void *objs[2 * nobjs];
+  for (int i = 0; i < 2 * nobjs; i++) {
+    objs[i] = csp_mem_slab_alloc(heap, 0);
+    assert(((uintptr_t)objs[i] & 0x3f) == 0);
+    assert(((uintptr_t)objs[i] & (csp_mem_page_size - 1)) != 0);
+    memset(objs[i], i, csp_mem_slab_sizes[0]);
+  }
+  csp_mem_slab_t *first = csp_mem_slab_by_obj(objs[0]);
+  csp_mem_slab_t *second = csp_mem_slab_by_obj(objs[nobjs]);
+  assert(first != second);
+  assert(csp_mem_slab_by_obj(objs[nobjs - 1]) == first);
+  assert(objs[1] == (char *)objs[0] + csp_mem_slab_sizes[0]);
+  assert(heap->slabs[0] == NULL);
+
+  /* A freed object is reused first. */
+  csp_mem_heap_release(heap, objs[3]);
+  assert(heap->slabs[0] == first && first->nfree == 1);
+  assert(csp_mem_slab_alloc(heap, 0) == objs[3]);
+  assert(heap->slabs[0] == NULL);
+
+  /* An empty slab goes back to the heap unless it's the only one. */
+  for (int i = 0; i < nobjs; i++) {
+    csp_mem_heap_release(heap, objs[i]);
+  }
+  assert(heap->slabs[0] == first && first->nfree == nobjs);
+  csp_mem_heap_release(heap, objs[nobjs]);
+  for (int i = nobjs + 1; i < 2 * nobjs; i++) {
+    csp_mem_heap_release(heap, objs[i]);
+  }
+  assert(heap->slabs[0] == first && first->next == NULL);
+  assert(!csp_mem_meta_taken_bit(heap,
+    csp_mem_meta_l1_by_addr(heap, second), csp_mem_meta_l2_by_addr(heap, second)
+  ));
+
+  /* The objects returned by other cores refill the slabs. */
+  void *obj = csp_mem_slab_alloc(heap, 7);
+  csp_mem_slab_t *slab = csp_mem_slab_by_obj(obj);
+  assert(csp_mem_slab_alloc(heap, 7) != obj);
+  assert(heap->slabs[7] == NULL);
+  csp_msrbq_push(obj)(
+    heap->mailboxes[csp_mem_meta_l1_by_addr(heap, obj)], (uintptr_t)obj
+  );
+  assert(csp_mem_slab_alloc(heap, 7) == obj);
+  assert(csp_mem_slab_by_obj(obj) == slab);
+
+  csp_mem_heap_destroy(heap);
+  free(heap);
+}
+
+void test_batch(void) {
+  csp_sched_np = 2;
+  assert(csp_mem_init());
+
+  /* Core 0 frees the objects of the heap 1 in batches. */
+  void *objs[csp_mem_batch_cap + 1];
+  for (int i = 0; i < csp_mem_batch_cap + 1; i++) {
+    objs[i] = csp_mem_alloc(1, 256);
+  }
+  for (int i = 0; i < csp_mem_batch_cap - 1; i++) {
+    csp_mem_free(1, objs[i]);
+  }
+  assert(csp_mem.heaps[0].batches[1].len == csp_mem_batch_cap - 1);
+  assert(csp_mem_mailbox_len(1) == 0);
+  csp_mem_free(1, objs[csp_mem_batch_cap - 1]);
+  assert(csp_mem.heaps[0].batches[1].len == 0);
+  assert(csp_mem_mailbox_len(1) == csp_mem_batch_cap);
+
+  /* The rest is flushed when the core is idle. */
+  csp_mem_free(1, objs[csp_mem_batch_cap]);
+  csp_mem_idle(0);
+  assert(csp_mem.heaps[0].batches[1].len == 0);
+  assert(csp_mem_mailbox_len(1) == csp_mem_batch_cap + 1);
+
+  /* And the owner takes them back when it's idle. */
+  csp_this_core->pid = 1;
+  csp_mem_idle(1);
+  assert(csp_mem_mailbox_len(1) == 0);
+  assert(csp_mem.heaps[1].slabs[0] != NULL);
+  csp_this_core->pid = 0;
+
+  csp_mem_destroy();
+  csp_sched_np = 1;
+}
+
+/* Return the number of the resident pages in [addr, addr + npages pages). */
+static size_t resident_pages(void *addr, size_t npages) {
+  unsigned char vec[npages];
+  assert(mincore(addr, npages << csp_mem_page_size_exp, vec) == 0);
+  size_t n = 0;
+  for (size_t i = 0; i < npages; i++) {
+    n += vec[i] & 0x01;
+  }
+  return n;
+}
+
+void test_scavenge(void) {
+  csp_mem_heap_t *heap = (csp_mem_heap_t *)malloc(sizeof(csp_mem_heap_t));
+  assert(csp_mem_heap_init(heap, 1L << csp_mem_heap_size_exp, -1));
+  assert(heap->nresident == 0);
+
+  size_t retain = csp_mem_retain >> csp_mem_page_size_exp;
+  size_t npages = retain / 8 * 5, size = npages << csp_mem_page_size_exp;
+  void *old = csp_mem_heap_alloc(heap, size);
+  void *young = csp_mem_heap_alloc(heap, size);
+  memset(old, 1, size);
+  memset(young, 1, size);
+  assert(heap->nresident == 0);
+
+  /* Nothing is released below the target but the span gets old. */
+  csp_mem_heap_free(heap, old);
+  assert(heap->nresident == npages);
+  csp_mem_heap_scavenge(heap);
+  assert(heap->nresident == npages);
+  assert(resident_pages(old, npages) == npages);
+
+  /* The old span is released before the young one. */
+  csp_mem_heap_free(heap, young);
+  assert(heap->nresident == 2 * npages);
+  csp_mem_heap_scavenge(heap);
+  assert(heap->nresident == npages);
+  assert(resident_pages(old, npages) == 0);
+  assert(resident_pages(young, npages) == npages);
+
+  /* The released spans aren't joined with the resident ones. */
+  csp_mem_heap_merge(heap);
+  assert(heap->nresident == npages);
+  assert(csp_mem_span_npages_get(csp_mem_meta_span_by_addr(heap, young)) ==
+    npages);
+
+  /* The released pages are zero-filled when they are used again. */
+  csp_mem_retain = 0;
+  csp_mem_heap_scavenge(heap);
+  csp_mem_retain = retain << csp_mem_page_size_exp;
+  assert(heap->nresident == 0);
+  int *page = (int *)csp_mem_heap_alloc(heap, size);
+  assert((page == old || page == young) && *page == 0);
+
+  csp_mem_heap_destroy(heap);
+  free(heap);
+}
 
 int main(void) {
   test_page();
@@ -277,6 +509,9 @@ int main(void) {
   test_meta_index();
   test_heap();
   test_arena();
-  test_tree_node();
+  test_free_index();
   test_meta();
+  test_slab();
+  test_batch();
+  test_scavenge();
 }
@@ -0,0 +1,103 @@
+/*
+ * Copyright (c) 2020, Yanhui Shi <lime.syh at gmail dot com>
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <assert.h>
+#include "../src/mutex.c"
+
+/* The stubs of the scheduler. The parked "process" makes the holder unlock
+ * the mutex before it is resumed. */
+csp_proc_t test_proc, test_other, *test_woken;
+csp_core_t test_core = {.running = &test_proc};
+_Thread_local csp_core_t *csp_this_core = &test_core;
+csp_mutex_t test_mutex;
+int test_parked;
+
+void csp_sched_park(csp_spinlock_t *lock) {
+  test_parked++;
+  csp_waitq_unlock(lock);
+  csp_mutex_unlock(&test_mutex);
+}
+
+void csp_sched_put_proc(csp_proc_t *proc) {
+  test_woken = proc;
+}
+
+void csp_sched_handoff(csp_proc_t *proc) {
+  test_woken = proc;
+}
+
+void test_mutex_uncontended(void) {
+  csp_mutex_init(&test_mutex);
+  assert(csp_mutex_try_lock(&test_mutex));
+  assert(!csp_mutex_try_lock(&test_mutex));
+  csp_mutex_unlock(&test_mutex);
+  assert(!atomic_load(&test_mutex.locked));
+
+  csp_mutex_lock(&test_mutex);
+  assert(atomic_load(&test_mutex.locked));
+  csp_mutex_unlock(&test_mutex);
+  assert(!atomic_load(&test_mutex.locked));
+  assert(test_parked == 0 && test_woken == NULL);
+}
+
+void test_mutex_handoff(void) {
+  csp_mutex_init(&test_mutex);
+  csp_mutex_lock(&test_mutex);
+
+  /* We park after spinning and the unlocker hands the mutex over to us. */
+  csp_mutex_lock(&test_mutex);
+  assert(test_parked == 1);
+  assert(test_woken == &test_proc);
+  assert(atomic_load(&test_mutex.locked));
+  assert(atomic_load(&test_mutex.waitq.len) == 0);
+
+  csp_mutex_unlock(&test_mutex);
+  assert(!atomic_load(&test_mutex.locked));
+  test_parked = 0;
+  test_woken = NULL;
+}
+
+void test_mutex_late_waiter(void) {
+  csp_mutex_init(&test_mutex);
+  csp_waitq_node_t node = {.parked = &test_other};
+
+  /* A waiter is queued after the unlocker has released the mutex. */
+  csp_waitq_push(&test_mutex.waitq, &node);
+  csp_mutex_unlock_slow(&test_mutex, false);
+  assert(test_woken == &test_other);
+  assert(atomic_load(&test_mutex.locked));
+  assert(atomic_load(&test_mutex.waitq.len) == 0);
+
+  /* The newcomer which has taken the mutex wakes the waiter up instead. */
+  test_woken = NULL;
+  csp_waitq_push(&test_mutex.waitq, &node);
+  csp_mutex_unlock_slow(&test_mutex, false);
+  assert(test_woken == NULL);
+  assert(atomic_load(&test_mutex.waitq.len) == 1);
+  csp_mutex_unlock(&test_mutex);
+  assert(test_woken == &test_other);
+  assert(atomic_load(&test_mutex.locked));
+
+  csp_mutex_unlock(&test_mutex);
+  assert(!atomic_load(&test_mutex.locked));
+}
+
+int main(void) {
+  test_mutex_uncontended();
+  test_mutex_handoff();
+  test_mutex_late_waiter();
+}
@@ -0,0 +1,248 @@
+/*
+ * Copyright (c) 2020, Yanhui Shi <lime.syh at gmail dot com>
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+
+#include <assert.h>
+#include <unistd.h>
+#include "../src/netpoll.c"
+
+csp_proc_t test_proc;
+
+int csp_sched_np = 1;
+_Thread_local csp_core_t *csp_this_core = &(csp_core_t){
+  .pid = 0, .running = &test_proc
+};
+csp_stats_block_t csp_stats_shared;
+
+/* The processes handed back to the scheduler, and the one run by a timer. */
+csp_proc_t *put_proc, *timeout_proc;
+int putted, parked;
+
+bool csp_monitor_watch(size_t pid, int fd) {
+  return true;
+}
+
+void csp_sched_put_proc(csp_proc_t *proc) {
+  put_proc = proc;
+  putted++;
+}
+
+void csp_core_proc_exit_and_run(csp_proc_t *to_run) {
+  timeout_proc = to_run;
+}
+
+bool csp_timer_cancel(csp_timer_t timer) {
+  return true;
+}
+
+csp_timer_time_t csp_timer_clock_now(void) {
+  return 0;
+}
+
+void csp_timer_anchor(csp_timer_time_t when) {}
+
+/* What happens between the yield and the commit, and after the commit. */
+void (*before_commit)(void);
+void (*after_commit)(void);
+
+/* Instead of yielding, run the hooks around the commit. */
+void csp_sched_park_fn(void (*fn)(void *arg), void *arg) {
+  parked++;
+  if (before_commit != NULL) {
+    before_commit();
+  }
+  fn(arg);
+  if (after_commit != NULL) {
+    after_commit();
+  }
+}
+
+int fds[2];
+
+void reset(void) {
+  put_proc = timeout_proc = NULL;
+  putted = parked = 0;
+  before_commit = after_commit = NULL;
+}
+
+int poll_once(csp_proc_t **start, csp_proc_t **end) {
+  return csp_netpoll_poll(0, start, end);
+}
+
+void drain(void) {
+  char buf[64];
+  while (read(fds[0], buf, sizeof(buf)) > 0);
+}
+
+void deliver(void) {
+  csp_proc_t *start, *end;
+  assert(poll_once(&start, &end) == 1);
+  assert(start == &test_proc && end == &test_proc);
+}
+
+void deliver_none(void) {
+  csp_proc_t *start, *end;
+  assert(poll_once(&start, &end) == 0);
+}
+
+void write_event(void) {
+  assert(write(fds[1], "x", 1) == 1);
+}
+
+void write_and_deliver_none(void) {
+  write_event();
+  deliver_none();
+}
+
+void expire(void) {
+  csp_netpoll_on_timeout(fds[0], csp_netpoll_reader, &test_proc);
+}
+
+void test_netpoll_event_before_park(void) {
+  assert(pipe(fds) == 0);
+  assert(csp_netpoll_register(fds[0]));
+  csp_netpoll_slot_t *slot = &csp_netpoll_waiter(fds[0])->slots[0];
+
+  /* The event arrived while nobody was waiting is consumed without parking. */
+  reset();
+  write_and_deliver_none();
+  assert(atomic_load(&slot->proc) == csp_netpoll_ready);
+  assert(csp_netpoll_wait_read(fds[0], 0) == csp_netpoll_avail);
+  assert(parked == 0);
+  assert(atomic_load(&slot->proc) == csp_netpoll_nil);
+  drain();
+
+  /* The event arrived after the process has yielded but before it's
+   * published, the commit puts it back to the scheduler itself. */
+  reset();
+  before_commit = write_and_deliver_none;
+  assert(csp_netpoll_wait_read(fds[0], 0) == csp_netpoll_avail);
+  assert(parked == 1);
+  assert(putted == 1 && put_proc == &test_proc);
+  assert(atomic_load(&slot->proc) == csp_netpoll_nil);
+  drain();
+
+  /* The event arrived after the process is published. */
+  reset();
+  after_commit = deliver;
+  write_event();
+  assert(csp_netpoll_wait_read(fds[0], 0) == csp_netpoll_avail);
+  assert(putted == 0);
+  assert(atomic_load(&slot->proc) == csp_netpoll_nil);
+  drain();
+
+  assert(csp_netpoll_unregister(fds[0]));
+  close(fds[0]);
+  close(fds[1]);
+}
+
+void test_netpoll_timeout_race(void) {
+  assert(pipe(fds) == 0);
+  assert(csp_netpoll_register(fds[0]));
+  csp_netpoll_slot_t *slot = &csp_netpoll_waiter(fds[0])->slots[0];
+
+  /* The timer fired before the process is published, it must not be left in
+   * the slot for the event to run it again. */
+  reset();
+  before_commit = expire;
+  assert(csp_netpoll_wait_read(fds[0], 0) == csp_netpoll_timeout);
+  assert(timeout_proc == &test_proc);
+  assert(atomic_load(&slot->proc) == csp_netpoll_nil);
+  write_and_deliver_none();
+  assert(atomic_load(&slot->proc) == csp_netpoll_ready);
+  assert(csp_netpoll_wait_read(fds[0], 0) == csp_netpoll_avail);
+  drain();
+
+  /* The timer fired first and the event is kept for the next wait. */
+  reset();
+  after_commit = expire;
+  assert(csp_netpoll_wait_read(fds[0], 0) == csp_netpoll_timeout);
+  assert(timeout_proc == &test_proc);
+  assert(atomic_load(&slot->proc) == csp_netpoll_nil);
+  write_and_deliver_none();
+  assert(atomic_load(&slot->proc) == csp_netpoll_ready);
+  assert(csp_netpoll_wait_read(fds[0], 0) == csp_netpoll_avail);
+  assert(parked == 1);
+  drain();
+
+  /* The event came first and the late timer does nothing. */
+  reset();
+  after_commit = deliver;
+  write_event();
+  assert(csp_netpoll_wait_read(fds[0], 0) == csp_netpoll_avail);
+  expire();
+  assert(timeout_proc == NULL);
+  assert(csp_proc_stat_get(&test_proc) == csp_netpoll_avail);
+  drain();
+
+  /* The timer has switched the state but not yet cleared the slot when the
+   * event takes the process, the event is kept as well. */
+  reset();
+  atomic_store(&slot->proc, (uintptr_t)&test_proc);
+  csp_proc_stat_set(&test_proc, csp_proc_stat_netpoll_timeout);
+  write_and_deliver_none();
+  assert(atomic_load(&slot->proc) == csp_netpoll_ready);
+  uintptr_t waiting = (uintptr_t)&test_proc;
+  assert(!atomic_compare_exchange_strong(&slot->proc, &waiting,
+    csp_netpoll_nil));
+  assert(atomic_load(&slot->proc) == csp_netpoll_ready);
+  assert(csp_netpoll_wait_read(fds[0], 0) == csp_netpoll_avail);
+  drain();
+
+  assert(csp_netpoll_unregister(fds[0]));
+  close(fds[0]);
+  close(fds[1]);
+}
+
+void test_netpoll_oneshot(void) {
+  assert(pipe(fds) == 0);
+  assert(csp_netpoll_register_oneshot(fds[0]));
+  csp_netpoll_slot_t *slot = &csp_netpoll_waiter(fds[0])->slots[0];
+
+  /* The fd isn't armed until someone waits for it. */
+  reset();
+  write_and_deliver_none();
+  assert(atomic_load(&slot->proc) == csp_netpoll_nil);
+
+  /* Waiting arms it, and the pending data is reported right away. */
+  after_commit = deliver;
+  assert(csp_netpoll_wait_read(fds[0], 0) == csp_netpoll_avail);
+
+  /* It's disarmed after the event, even though the data is still there. */
+  after_commit = NULL;
+  deliver_none();
+  assert(atomic_load(&slot->proc) == csp_netpoll_nil);
+
+  /* The next wait re-arms it. */
+  after_commit = deliver;
+  assert(csp_netpoll_wait_read(fds[0], 0) == csp_netpoll_avail);
+  assert(parked == 2);
+  drain();
+
+  assert(csp_netpoll_unregister(fds[0]));
+  close(fds[0]);
+  close(fds[1]);
+}
+
+int main(void) {
+  assert(csp_netpoll_init());
+  test_netpoll_event_before_park();
+  test_netpoll_timeout_race();
+  test_netpoll_oneshot();
+  csp_netpoll_destroy();
+}
@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) 2020, Yanhui Shi <lime.syh at gmail dot com>
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <assert.h>
+#include <stdatomic.h>
+#include "../src/offload.c"
+
+static csp_proc_t *procs[4];
+static atomic_int ndone;
+static pthread_t self;
+
+_Thread_local csp_core_t *csp_this_core;
+
+void csp_monitor_poller_init(void) {}
+void csp_monitor_poller_destroy(void) {}
+
+/* Check the process which has done is handed over. */
+bool csp_monitor_poll(int (*poll)(csp_proc_t **, csp_proc_t **)) {
+  csp_proc_t *start, *end;
+  assert(poll(&start, &end) == 1 && start == end);
+  procs[atomic_fetch_add(&ndone, 1)] = start;
+  return true;
+}
+
+/* Submit the request as the scheduler does after the process has yielded, and
+ * wait until it's done since it lives on the stack of `csp_offload`. */
+void csp_sched_park_fn(void (*fn)(void *arg), void *arg) {
+  int done = atomic_load(&ndone);
+  fn(arg);
+  while (atomic_load(&ndone) == done);
+}
+
+static void offload_fn(void *arg) {
+  assert(!pthread_equal(pthread_self(), self));
+  (*(int *)arg)++;
+}
+
+void test_offload(void) {
+  csp_core_t core;
+  csp_this_core = &core;
+  self = pthread_self();
+
+  int cnt = 0;
+  for (int i = 0; i < 4; i++) {
+    core.running = (csp_proc_t *)(uintptr_t)(i + 1);
+    csp_offload(offload_fn, &cnt);
+    assert(cnt == i + 1);
+    assert(procs[i] == core.running);
+  }
+
+  /* The worker is reused while it's idle. */
+  pthread_mutex_lock(&csp_offload_pool.lock);
+  assert(csp_offload_pool.nworkers == 1);
+  assert(csp_offload_pool.nqueued == 0);
+  assert(csp_offload_pool.head == NULL && csp_offload_pool.tail == NULL);
+  pthread_mutex_unlock(&csp_offload_pool.lock);
+}
+
+int main(void) {
+  test_offload();
+}
@@ -19,14 +19,23 @@
 
 #include <assert.h>
 #include <stdio.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/wait.h>
 #include "../src/proc.c"
 
-_Thread_local csp_core_t *csp_this_core = &(csp_core_t){.pid = 0};
+_Thread_local csp_core_t *csp_this_core = &(csp_core_t){
+  .pid = 0, .proc_caches = (csp_proc_cache_t[4]){{0}}
+};
 
 csp_proc_t *main_proc, *proc;
 
-size_t csp_procs_num = 1;
-size_t csp_procs_size[] = {4096};
+size_t csp_procs_num = 4;
+csp_proc_meta_t csp_procs_meta[] = {
+  {4096}, {0}, {1 << 18, csp_proc_meta_nonblocking},
+  {4096, csp_proc_meta_nonblocking}
+};
+size_t csp_elastic_stack_size = 1 << 20;
 
 __attribute__((naked)) void yield(csp_proc_t *from, csp_proc_t *to) {
   __asm__ __volatile__(
@@ -64,6 +73,96 @@ void test_proc(void) {
   csp_proc_destroy(main_proc);
 }
 
+void test_elastic(void) {
+  csp_proc_t *elastic = csp_proc_new(1, false);
+  assert(elastic->id == 1);
+  assert((uintptr_t)elastic + sizeof(csp_proc_t) ==
+    elastic->base + csp_elastic_stack_size);
+  assert((elastic->rbp & 0x0f) == 0);
+
+  /* The whole stack above the guard page is usable. */
+  char *stack = (char *)elastic->base + csp_proc_guard_size;
+  memset(stack, 1, (char *)elastic - stack);
+
+  /* And an overflow hits the guard page. */
+  pid_t pid = fork();
+  if (pid == 0) {
+    stack[-1] = 1;
+    exit(EXIT_SUCCESS);
+  }
+  int wstatus;
+  assert(waitpid(pid, &wstatus, 0) == pid);
+  assert(WIFSIGNALED(wstatus) && WTERMSIG(wstatus) == SIGSEGV);
+
+  /* The normal processes are not affected. */
+  csp_proc_t *normal = csp_proc_new(0, false);
+  assert(normal->id == 0);
+
+  csp_proc_destroy(elastic);
+  csp_proc_destroy(normal);
+}
+
+void test_cache(void) {
+  size_t cap = csp_proc_cache_len(0);
+  assert(cap == csp_proc_cache_blocking_cap);
+  csp_proc_t *procs[cap + 1];
+  for (size_t i = 0; i < cap + 1; i++) {
+    procs[i] = csp_proc_new(0, false);
+  }
+  for (size_t i = 0; i < cap + 1; i++) {
+    csp_proc_destroy(procs[i]);
+  }
+  assert(csp_this_core->proc_caches[0].len == cap);
+
+  /* The cached processes are taken first and reinitialized. */
+  procs[cap - 1]->is_new = false;
+  procs[cap - 1]->nchild = 1;
+  csp_proc_t *proc = csp_proc_new(0, false);
+  assert(proc == procs[cap - 1]);
+  assert(proc->is_new && proc->nchild == 0 && proc->id == 0);
+  assert(csp_this_core->proc_caches[0].len == cap - 1);
+  csp_proc_destroy(proc);
+
+  /* An elastic stack is cached alone since it's large. */
+  assert(csp_proc_cache_len_max(csp_elastic_stack_size) == 1);
+  assert(csp_this_core->proc_caches[1].len == 1);
+  proc = csp_proc_new(1, false);
+  assert(csp_this_core->proc_caches[1].len == 0);
+  csp_proc_destroy(proc);
+
+  /* The processes born on other cores are not cached. */
+  proc = csp_proc_new(0, false);
+  proc->borned_pid = 1;
+  csp_proc_destroy(proc);
+  assert(csp_this_core->proc_caches[0].len == cap - 1);
+
+  /* The processes which never block take more of the bytes, but the large
+   * ones are still bounded by them. */
+  size_t large_cap = csp_proc_cache_len_max(csp_procs_meta[2].size);
+  assert(csp_proc_cache_len(2) == large_cap);
+  assert(large_cap < csp_proc_cache_blocking_cap);
+  assert(csp_proc_cache_len(3) == csp_proc_cache_cap);
+
+  csp_proc_t *burst[csp_proc_cache_cap + 1];
+  for (size_t i = 0; i < large_cap + 1; i++) {
+    burst[i] = csp_proc_new(2, false);
+  }
+  for (size_t i = 0; i < large_cap + 1; i++) {
+    csp_proc_destroy(burst[i]);
+  }
+  assert(csp_this_core->proc_caches[2].len == large_cap);
+
+  for (size_t i = 0; i < csp_proc_cache_cap + 1; i++) {
+    burst[i] = csp_proc_new(3, false);
+  }
+  for (size_t i = 0; i < csp_proc_cache_cap + 1; i++) {
+    csp_proc_destroy(burst[i]);
+  }
+  assert(csp_this_core->proc_caches[3].len == csp_proc_cache_cap);
+}
+
 int main(void) {
   test_proc();
+  test_elastic();
+  test_cache();
 }
@@ -16,6 +16,8 @@
  */
 
 #include <assert.h>
+#include <pthread.h>
+#include <sched.h>
 #include <string.h>
 #include "../src/rbq.h"
 
@@ -37,6 +39,12 @@ csp_mmrbq_define(int, mm);
 csp_rrbq_declare(int, r);
 csp_rrbq_define(int, r);
 
+csp_elrbq_declare(int, el);
+csp_elrbq_define(int, el);
+
+csp_fcrbq_declare(int, fc);
+csp_fcrbq_define(int, fc);
+
 void csp_sched_yield(void) {}
 
 int array[] = {8, 7, 6, 5, 4, 3, 2, 1};
@@ -268,10 +276,252 @@ void test_rrbq(void) {
   csp_rrbq_destroy(r)(rbq);
 }
 
+void test_rrbq_resize(void) {
+  csp_rrbq_t(r) *rbq = csp_rrbq_new(r)(CAP_EXP);
+  int val;
+
+  /* Wrap the items around the end of the ring before resizing. */
+  for (int i = 0; i < CAP - 2; i++) {
+    assert(csp_rrbq_try_push(r)(rbq, -1));
+    assert(csp_rrbq_try_pop(r)(rbq, &val));
+  }
+  for (int i = 0; i < CAP; i++) {
+    assert(csp_rrbq_try_push(r)(rbq, i));
+  }
+  assert(csp_rrbq_try_grow(r)(rbq));
+  assert(rbq->cap == CAP * 2 && rbq->mask == CAP * 2 - 1);
+  for (int i = CAP; i < CAP * 2; i++) {
+    assert(csp_rrbq_try_push(r)(rbq, i));
+  }
+  assert(!csp_rrbq_try_push(r)(rbq, -1));
+
+  /* It can't shrink until the items fit in the half. */
+  assert(!csp_rrbq_try_shrink(r)(rbq));
+  for (int i = 0; i < CAP + 3; i++) {
+    assert(csp_rrbq_try_pop(r)(rbq, &val) && val == i);
+  }
+  assert(csp_rrbq_try_shrink(r)(rbq));
+  assert(rbq->cap == CAP && rbq->mask == CAP - 1);
+  for (int i = CAP + 3; i < CAP * 2; i++) {
+    assert(csp_rrbq_try_pop(r)(rbq, &val) && val == i);
+  }
+  assert(!csp_rrbq_try_pop(r)(rbq, &val));
+
+  csp_rrbq_destroy(r)(rbq);
+}
+
+void test_elrbq(void) {
+  size_t cap_exp = CAP_EXP + 3, cap = 1 << cap_exp;
+  csp_elrbq_t(el) *rbq = csp_elrbq_new(el)(cap_exp);
+  assert(rbq->cap == cap && rbq->ring->cap == CAP);
+  int val;
+
+  /* The ring grows with the backlog up to the capacity. */
+  for (int i = 0; i < cap; i++) {
+    assert(csp_elrbq_try_push(el)(rbq, i));
+  }
+  assert(rbq->ring->cap == cap);
+  assert(csp_elrbq_is_full(el)(rbq));
+  assert(!csp_elrbq_try_push(el)(rbq, -1));
+  assert(!csp_elrbq_try_pushm(el)(rbq, array, array_len));
+
+  /* The ring doesn't grow while the slots are claimed. */
+  for (int i = 0; i < cap - CAP / 2; i++) {
+    assert(csp_elrbq_try_pop(el)(rbq, &val) && val == i);
+  }
+  csp_rbq_rsv_t rsv;
+  assert(csp_elrbq_try_peek(el)(rbq, 1, &rsv) != NULL && rsv.len == 1);
+  assert(csp_elrbq_try_popm(el)(rbq, array_cpy, array_len) == 0);
+  assert(rbq->ring->cap == cap);
+  csp_elrbq_release(el)(rbq, &rsv);
+
+  /* And it shrinks back once it has stayed mostly empty for a while, i.e. it
+   * takes at most `cap` pops to halve the ring of `cap` slots. */
+  size_t pops = 0;
+  while (rbq->ring->cap > CAP) {
+    assert(csp_elrbq_try_pop(el)(rbq, &val));
+    assert(csp_elrbq_try_push(el)(rbq, val));
+    pops++;
+  }
+  assert(pops <= cap + cap / 2 + cap / 4);
+  assert(csp_elrbq_try_popm(el)(rbq, array_cpy, array_len) == CAP / 2 - 1);
+  assert(csp_elrbq_is_empty(el)(rbq));
+
+  /* The claims of the writers grow the ring too. */
+  int *items = csp_elrbq_try_reserve(el)(rbq, CAP * 2, &rsv);
+  assert(items == rbq->ring->items + (rbq->ring->fast & rbq->ring->mask));
+  assert(rbq->ring->cap >= CAP * 2 && rsv.len > 0);
+  for (int i = 0; i < rsv.len; i++) {
+    items[i] = i;
+  }
+  assert(csp_elrbq_try_reserve(el)(rbq, 1, &(csp_rbq_rsv_t){}) == NULL);
+  assert(!csp_elrbq_try_push(el)(rbq, -1));
+  csp_elrbq_commit(el)(rbq, &rsv);
+  for (int i = 0; i < rsv.len; i++) {
+    assert(csp_elrbq_try_pop(el)(rbq, &val) && val == i);
+  }
+
+  csp_elrbq_destroy(el)(rbq);
+}
+
+#define test_claim(K, I) do {                                                  \
+  csp_ ## K ## rbq_t(I) *rbq = csp_ ## K ## rbq_new(I)(CAP_EXP);               \
+  csp_rbq_rsv_t rsv;                                                           \
+                                                                               \
+  int *items = csp_ ## K ## rbq_try_reserve(I)(rbq, 5, &rsv);                  \
+  assert(items == rbq->items && rsv.seq == 0 && rsv.len == 5);                 \
+  for (int i = 0; i < 5; i++) {                                                \
+    items[i] = i;                                                              \
+  }                                                                            \
+  /* Nothing is visible to the readers before committing. */                   \
+  assert(csp_ ## K ## rbq_try_peek(I)(rbq, CAP, &rsv) == NULL);                \
+  csp_ ## K ## rbq_commit(I)(rbq, &(csp_rbq_rsv_t){.seq = 0, .len = 5});       \
+                                                                               \
+  items = csp_ ## K ## rbq_try_peek(I)(rbq, CAP, &rsv);                        \
+  assert(items == rbq->items && rsv.len == 5);                                 \
+  for (int i = 0; i < 5; i++) {                                                \
+    assert(items[i] == i);                                                     \
+  }                                                                            \
+  csp_ ## K ## rbq_release(I)(rbq, &rsv);                                      \
+                                                                               \
+  /* The claims stop at the end of the ring. */                                \
+  items = csp_ ## K ## rbq_try_reserve(I)(rbq, CAP, &rsv);                     \
+  assert(items == rbq->items + 5 && rsv.len == 3);                             \
+  csp_ ## K ## rbq_commit(I)(rbq, &rsv);                                       \
+  items = csp_ ## K ## rbq_try_reserve(I)(rbq, CAP, &rsv);                     \
+  assert(items == rbq->items && rsv.len == 5);                                 \
+  csp_ ## K ## rbq_commit(I)(rbq, &rsv);                                       \
+  assert(csp_ ## K ## rbq_try_reserve(I)(rbq, 1, &rsv) == NULL);               \
+  assert(csp_ ## K ## rbq_is_full(I)(rbq));                                    \
+                                                                               \
+  items = csp_ ## K ## rbq_try_peek(I)(rbq, CAP, &rsv);                        \
+  assert(items == rbq->items + 5 && rsv.len == 3);                             \
+  csp_ ## K ## rbq_release(I)(rbq, &rsv);                                      \
+  items = csp_ ## K ## rbq_try_peek(I)(rbq, 2, &rsv);                          \
+  assert(items == rbq->items && rsv.len == 2);                                 \
+  csp_ ## K ## rbq_release(I)(rbq, &rsv);                                      \
+  assert(csp_ ## K ## rbq_try_popm(I)(rbq, array_cpy, CAP) == 3);              \
+  assert(csp_ ## K ## rbq_try_peek(I)(rbq, CAP, &rsv) == NULL);                \
+                                                                               \
+  csp_ ## K ## rbq_destroy(I)(rbq);                                            \
+} while (0)                                                                    \
+
+#define FC_THREADS  4
+#define FC_ITEMS    (1 << 16)
+
+atomic_int_fast64_t fc_sum;
+
+void *fc_pusher(void *rbq) {
+  for (int i = 0; i < FC_ITEMS; i++) {
+    while (!csp_fcrbq_try_push(fc)(rbq, i)) {
+      sched_yield();
+    }
+  }
+  return NULL;
+}
+
+void *fc_popper(void *rbq) {
+  int val;
+  for (int i = 0; i < FC_ITEMS; i++) {
+    while (!csp_fcrbq_try_pop(fc)(rbq, &val)) {
+      sched_yield();
+    }
+    atomic_fetch_add(&fc_sum, val);
+  }
+  return NULL;
+}
+
+void test_fcrbq(void) {
+  csp_fcrbq_t(fc) *rbq = csp_fcrbq_new(fc)(CAP_EXP);
+  assert(rbq->cap == CAP);
+  int val;
+
+  for (int i = 0; i < CAP; i++) {
+    assert(csp_fcrbq_try_push(fc)(rbq, i));
+  }
+  assert(csp_fcrbq_is_full(fc)(rbq));
+  assert(!csp_fcrbq_try_push(fc)(rbq, -1));
+  assert(!csp_fcrbq_try_pushm(fc)(rbq, array, array_len));
+  for (int i = 0; i < CAP; i++) {
+    assert(csp_fcrbq_try_pop(fc)(rbq, &val) && val == i);
+  }
+  assert(csp_fcrbq_is_empty(fc)(rbq));
+  assert(!csp_fcrbq_try_pop(fc)(rbq, &val));
+
+  /* The records are all freed after the requests. */
+  for (int i = 0; i < csp_fcrbq_records; i++) {
+    assert(atomic_load(&rbq->records[i].state) == csp_fcrbq_free);
+  }
+
+  /* A request goes to the ring directly if its record is in use. */
+  atomic_int *state = &rbq->records[csp_fcrbq_record_idx()].state;
+  atomic_store(state, csp_fcrbq_claimed);
+  assert(csp_fcrbq_try_push(fc)(rbq, 1024));
+  assert(csp_fcrbq_try_pop(fc)(rbq, &val) && val == 1024);
+  atomic_store(state, csp_fcrbq_free);
+
+  assert(csp_fcrbq_try_pushm(fc)(rbq, array, array_len));
+  assert(csp_fcrbq_try_popm(fc)(rbq, array_cpy, array_len) == array_len);
+  assert(memcmp(array, array_cpy, sizeof(array)) == 0);
+  csp_fcrbq_destroy(fc)(rbq);
+
+  /* Every item is pushed and popped once under contention. */
+  rbq = csp_fcrbq_new(fc)(CAP_EXP);
+  pthread_t tids[FC_THREADS * 2];
+  for (int i = 0; i < FC_THREADS * 2; i++) {
+    pthread_create(&tids[i], NULL, i & 1 ? fc_popper : fc_pusher, rbq);
+  }
+  for (int i = 0; i < FC_THREADS * 2; i++) {
+    pthread_join(tids[i], NULL);
+  }
+  assert(atomic_load(&fc_sum) ==
+    (int64_t)FC_THREADS * FC_ITEMS * (FC_ITEMS - 1) / 2);
+  assert(csp_fcrbq_is_empty(fc)(rbq));
+  csp_fcrbq_destroy(fc)(rbq);
+}
+
+void test_rbq_claim(void) {
+  test_claim(ss, ss);
+  test_claim(sm, sm);
+  test_claim(ms, ms);
+  test_claim(mm, mm);
+}
+
+/* Every flag of `stats` is in the array, and with at least as many lines as
+ * flags per line, the consecutive sequences never share a line. */
+void test_rbq_mptr_layout(void) {
+  csp_rbq_mptr_t ptr;
+  size_t cap = 1 << 8, mask = cap - 1;
+  assert(csp_rbq_mptr_init(ptr, cap));
+  assert((uintptr_t)ptr.stats % 64 == 0);
+
+  bool seen[cap << csp_rbq_stats_stride_exp];
+  memset(seen, 0, sizeof(seen));
+  for (size_t i = 0; i < cap; i++) {
+    size_t idx = csp_rbq_mptr_idx(i, mask);
+    assert(idx < cap << csp_rbq_stats_stride_exp && !seen[idx]);
+    seen[idx] = true;
+    assert(!csp_rbq_mptr_is_avail(ptr, i, mask));
+
+    size_t next = csp_rbq_mptr_idx(i + 1, mask);
+    assert(!csp_rbq_stats_shuffle || idx >> 3 != next >> 3);
+  }
+
+  csp_rbq_mptr_mark_avail(ptr, cap + 1, mask);
+  assert(csp_rbq_mptr_is_avail(ptr, cap + 1, mask));
+  assert(!csp_rbq_mptr_is_avail(ptr, 1, mask));
+  csp_rbq_mptr_destroy(ptr);
+}
+
 int main(void) {
   test_ssrbq();
   test_smrbq();
   test_msrbq();
   test_mmrbq();
   test_rrbq();
+  test_rrbq_resize();
+  test_elrbq();
+  test_fcrbq();
+  test_rbq_claim();
+  test_rbq_mptr_layout();
 }
@@ -117,6 +117,10 @@ void test_rbtree_in_order(void) {
     assert(node != NULL);
     assert(node->key == i);
     assert(tree->nnodes == i + 1);
+
+    node = csp_rbtree_find_lte(tree, INT_MAX);
+    assert(node != NULL);
+    assert(node->key == i);
   }
 
   for (int i = 0; i < max_num; i++) {
@@ -134,6 +138,7 @@ void test_rbtree_in_order(void) {
     } else {
       assert(node == NULL);
     }
+    assert(csp_rbtree_find_lte(tree, i) == NULL);
     assert(tree->nnodes == max_num - i - 1);
   }
 
@@ -18,12 +18,14 @@
 #define csp_with_sysmalloc
 
 #include <assert.h>
+#include <string.h>
 #include "../src/proc.c"
 #include "../src/runq.c"
 
 _Thread_local csp_core_t *csp_this_core = &(csp_core_t){.pid = 0};
 size_t csp_procs_num = 1;
-size_t csp_procs_size[] = {4096};
+csp_proc_meta_t csp_procs_meta[] = {{4096}};
+size_t csp_elastic_stack_size = 0;
 
 void csp_sched_yield(void) {}
 
@@ -31,23 +33,41 @@ void test_lrunq(void) {
   size_t cap_exp = 3, cap = 1 << cap_exp;
   csp_proc_t *proc = NULL;
 
-  csp_lrunq_t *runq = csp_lrunq_new();
+  csp_lrunq_t *runq = csp_lrunq_new(cap_exp);
   assert(csp_lrunq_len(runq) == 0);
-  assert(!csp_lrunq_try_pop_front(runq, &proc));
+  assert(csp_lrunq_try_pop(runq, &proc) == csp_lrunq_failed);
 
   csp_proc_t *proc1 = csp_proc_new(0, false);
   csp_proc_t *proc2 = csp_proc_new(0, false);
   csp_proc_t *proc3 = csp_proc_new(0, false);
 
-  csp_lrunq_push(runq, proc1);
-  csp_lrunq_push(runq, proc2);
-  csp_lrunq_push(runq, proc3);
+  assert(csp_lrunq_try_push(runq, proc1));
+  assert(csp_lrunq_try_push(runq, proc2));
+  assert(csp_lrunq_try_push(runq, proc3));
+  assert(csp_lrunq_len(runq) == 3);
 
   /* Test the order of poped processes. */
-  assert(csp_lrunq_try_pop_front(runq, &proc) && proc == proc1);
-  assert(csp_lrunq_try_pop_front(runq, &proc) && proc == proc2);
-  assert(csp_lrunq_try_pop_front(runq, &proc) && proc == proc3);
-  assert(!csp_lrunq_try_pop_front(runq, &proc));
+  assert(csp_lrunq_try_pop(runq, &proc) == csp_lrunq_ok && proc == proc1);
+  assert(csp_lrunq_try_pop(runq, &proc) == csp_lrunq_ok && proc == proc2);
+  assert(csp_lrunq_try_pop(runq, &proc) == csp_lrunq_ok && proc == proc3);
+  assert(csp_lrunq_try_pop(runq, &proc) == csp_lrunq_failed);
+
+  /* Test the capacity. */
+  for (int64_t i = 0; i < cap; i++) {
+    assert(csp_lrunq_try_push(runq, (csp_proc_t *)i));
+  }
+  assert(!csp_lrunq_try_push(runq, proc1));
+  for (int64_t i = 0; i < cap; i++) {
+    assert(csp_lrunq_try_pop(runq, &proc) == csp_lrunq_ok);
+    assert((int64_t)proc == i);
+  }
+  assert(csp_lrunq_len(runq) == 0);
+
+  /* Test the grunq checking every 32 times. */
+  runq->poped_times = 0x1f;
+  assert(csp_lrunq_try_push(runq, proc1));
+  assert(csp_lrunq_try_pop(runq, &proc) == csp_lrunq_missed);
+  assert(csp_lrunq_try_pop(runq, &proc) == csp_lrunq_ok && proc == proc1);
 
   csp_proc_destroy(proc1);
   csp_proc_destroy(proc2);
@@ -56,6 +76,55 @@ void test_lrunq(void) {
   csp_lrunq_destroy(runq);
 }
 
+void test_lrunq_steal(void) {
+  size_t cap_exp = 3, cap = 1 << cap_exp;
+  csp_proc_t *proc = NULL;
+
+  csp_lrunq_t *victim = csp_lrunq_new(cap_exp);
+  csp_lrunq_t *thief = csp_lrunq_new(cap_exp);
+  assert(csp_lrunq_steal(thief, victim) == NULL);
+
+  /* Steal one from one. */
+  assert(csp_lrunq_try_push(victim, (csp_proc_t *)1));
+  assert(csp_lrunq_steal(thief, victim) == (csp_proc_t *)1);
+  assert(csp_lrunq_len(victim) == 0);
+  assert(csp_lrunq_len(thief) == 0);
+
+  /* Steal half of them. */
+  for (int64_t i = 0; i < 5; i++) {
+    assert(csp_lrunq_try_push(victim, (csp_proc_t *)i));
+  }
+  assert(csp_lrunq_steal(thief, victim) == (csp_proc_t *)2);
+  assert(csp_lrunq_len(victim) == 2);
+  assert(csp_lrunq_len(thief) == 2);
+
+  assert(csp_lrunq_try_pop(thief, &proc) == csp_lrunq_ok);
+  assert(proc == (csp_proc_t *)0);
+  assert(csp_lrunq_try_pop(thief, &proc) == csp_lrunq_ok);
+  assert(proc == (csp_proc_t *)1);
+  assert(csp_lrunq_try_pop(thief, &proc) == csp_lrunq_failed);
+
+  assert(csp_lrunq_try_pop(victim, &proc) == csp_lrunq_ok);
+  assert(proc == (csp_proc_t *)3);
+  assert(csp_lrunq_try_pop(victim, &proc) == csp_lrunq_ok);
+  assert(proc == (csp_proc_t *)4);
+  assert(csp_lrunq_try_pop(victim, &proc) == csp_lrunq_failed);
+
+  /* The thief takes no more than its free slots. */
+  for (int64_t i = 0; i < cap; i++) {
+    assert(csp_lrunq_try_push(victim, (csp_proc_t *)i));
+  }
+  for (int64_t i = 0; i < cap - 2; i++) {
+    assert(csp_lrunq_try_push(thief, (csp_proc_t *)i));
+  }
+  assert(csp_lrunq_steal(thief, victim) == (csp_proc_t *)1);
+  assert(csp_lrunq_len(thief) == cap - 1);
+  assert(csp_lrunq_len(victim) == cap - 2);
+
+  csp_lrunq_destroy(victim);
+  csp_lrunq_destroy(thief);
+}
+
 void test_grunq(void) {
   size_t cap_exp = 3, cap = 1 << cap_exp;
   csp_proc_t *proc = (csp_proc_t *)-1;
@@ -63,21 +132,72 @@ void test_grunq(void) {
   csp_grunq_t *grunq = csp_grunq_new(cap_exp);
 
   assert(!csp_grunq_try_pop(grunq, &proc));
+  assert(csp_grunq_is_empty(grunq));
   for (int64_t i = 0; i < cap; i++) {
     assert(csp_grunq_try_push(grunq, (csp_proc_t *)i));
   }
   assert(!csp_grunq_try_push(grunq, 0));
+  assert(!csp_grunq_is_empty(grunq));
 
   for (int64_t i = 0; i < cap; i++) {
     assert(csp_grunq_try_pop(grunq, &proc));
     assert((int64_t)proc == i);
   }
   assert(!csp_grunq_try_pop(grunq, &proc));
+  assert(csp_grunq_is_empty(grunq));
+
+  csp_grunq_destroy(grunq);
+}
+
+void test_grunq_spill(void) {
+  size_t cap_exp = 2, cap = 1 << cap_exp, n = cap * 3;
+  csp_proc_t procs[n], *batch[cap], *proc = NULL;
+
+  memset(procs, 0, sizeof(procs));
+  csp_grunq_t *grunq = csp_grunq_new(cap_exp);
+  for (size_t i = 0; i < cap; i++) {
+    csp_grunq_push(grunq, &procs[i]);
+  }
+  assert(grunq->spill == NULL);
+
+  /* The ring is full, so the rest are spilled and `try_push` fails until the
+   * spilled ones are taken back. */
+  csp_grunq_push(grunq, &procs[cap]);
+  for (size_t i = 0; i < cap; i++) {
+    batch[i] = &procs[cap + 1 + i];
+  }
+  csp_grunq_pushm(grunq, batch, cap);
+  csp_grunq_push(grunq, &procs[cap * 2 + 1]);
+  assert(grunq->nspilled == cap + 2);
+
+  /* The spilled ones are counted even if the ring is drained. */
+  for (size_t i = 0; i < cap; i++) {
+    assert(csp_mmrbq_try_pop(proc)(grunq->ring, &batch[i]));
+  }
+  assert(!csp_grunq_is_empty(grunq));
+  for (size_t i = 0; i < cap; i++) {
+    assert(csp_mmrbq_try_push(proc)(grunq->ring, batch[i]));
+  }
+  assert(!csp_grunq_try_push(grunq, &procs[n - 1]));
+
+  bool popped[n];
+  memset(popped, 0, sizeof(popped));
+  for (size_t i = 0; i < cap * 2 + 2; i++) {
+    assert(csp_grunq_try_pop(grunq, &proc));
+    assert(proc >= procs && proc < procs + n && !popped[proc - procs]);
+    assert(proc->next == NULL);
+    popped[proc - procs] = true;
+  }
+  assert(!csp_grunq_try_pop(grunq, &proc));
+  assert(grunq->spill == NULL && grunq->nspilled == 0);
+  assert(csp_grunq_try_push(grunq, &procs[n - 1]));
 
   csp_grunq_destroy(grunq);
 }
 
 int main(void) {
   test_lrunq();
+  test_lrunq_steal();
   test_grunq();
+  test_grunq_spill();
 }
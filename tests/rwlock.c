@@ -0,0 +1,113 @@
+/*
+ * Copyright (c) 2020, Yanhui Shi <lime.syh at gmail dot com>
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <assert.h>
+#include "../src/mutex.c"
+#include "../src/rwlock.c"
+
+int csp_sched_np = 4;
+
+/* The stubs of the scheduler. The parked "process" makes the peer progress
+ * itself before it is resumed. */
+csp_proc_t test_proc, *test_woken;
+csp_core_t test_core = {.running = &test_proc};
+_Thread_local csp_core_t *csp_this_core = &test_core;
+void (*test_on_park)(void);
+int test_parked, test_nwoken;
+
+void csp_sched_park(csp_spinlock_t *lock) {
+  test_parked++;
+  csp_waitq_unlock(lock);
+  test_on_park();
+}
+
+void csp_sched_put_proc(csp_proc_t *proc) {
+  test_woken = proc;
+  test_nwoken++;
+}
+
+void csp_sched_handoff(csp_proc_t *proc) {
+  test_woken = proc;
+}
+
+csp_rwlock_t *test_rwlock;
+
+void test_runlock(void) {
+  /* The reader has been migrated to another core. */
+  test_core.pid = 3;
+  csp_rwlock_runlock(test_rwlock);
+}
+
+void test_unlock(void) {
+  csp_rwlock_unlock(test_rwlock);
+}
+
+void test_rwlock_readers(void) {
+  test_rwlock = csp_rwlock_new();
+  assert(test_rwlock != NULL);
+
+  for (size_t pid = 0; pid < 4; pid++) {
+    test_core.pid = pid;
+    csp_rwlock_rlock(test_rwlock);
+    assert(atomic_load(&test_rwlock->readers[pid].n) == 1);
+  }
+  assert(!csp_rwlock_try_lock(test_rwlock));
+  assert(!atomic_load(&test_rwlock->writing));
+  for (size_t pid = 0; pid < 4; pid++) {
+    test_core.pid = pid;
+    csp_rwlock_runlock(test_rwlock);
+  }
+  assert(test_parked == 0 && test_nwoken == 0);
+
+  assert(csp_rwlock_try_lock(test_rwlock));
+  assert(!csp_rwlock_try_rlock(test_rwlock));
+  assert(!csp_rwlock_try_lock(test_rwlock));
+  csp_rwlock_unlock(test_rwlock);
+  assert(csp_rwlock_try_rlock(test_rwlock));
+  csp_rwlock_runlock(test_rwlock);
+
+  csp_rwlock_destroy(test_rwlock);
+}
+
+void test_rwlock_writer_waits(void) {
+  test_rwlock = csp_rwlock_new();
+  test_core.pid = 0;
+  csp_rwlock_rlock(test_rwlock);
+
+  /* The writer parks until the reader leaves. */
+  test_on_park = test_runlock;
+  csp_rwlock_lock(test_rwlock);
+  assert(test_parked == 1 && test_nwoken == 1);
+  assert(atomic_load(&test_rwlock->writing));
+  assert(atomic_load(&test_rwlock->readers[0].n) == 1);
+  assert(atomic_load(&test_rwlock->readers[3].n) == -1);
+
+  /* Then a reader parks until the writer leaves. */
+  test_on_park = test_unlock;
+  csp_rwlock_rlock(test_rwlock);
+  assert(test_parked == 2 && test_nwoken == 2);
+  assert(!atomic_load(&test_rwlock->writing));
+  assert(atomic_load(&test_rwlock->readers[3].n) == 0);
+  csp_rwlock_runlock(test_rwlock);
+
+  csp_rwlock_destroy(test_rwlock);
+}
+
+int main(void) {
+  test_rwlock_readers();
+  test_rwlock_writer_waits();
+}
@@ -0,0 +1,222 @@
+/*
+ * Copyright (c) 2020, Yanhui Shi <lime.syh at gmail dot com>
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <assert.h>
+#include "../src/select.c"
+
+csp_chan_declare(mm, int, mm);
+csp_chan_define(mm, int, mm);
+
+csp_chan_declare(un, int, un);
+csp_chan_define(un, int, un);
+
+/* The stubs of the scheduler. The parked "process" makes the peer progress
+ * itself before it is resumed. */
+csp_proc_t test_proc, *test_woken;
+csp_core_t test_core = {.running = &test_proc};
+_Thread_local csp_core_t *csp_this_core = &test_core;
+void (*test_on_park)(void);
+int test_parked;
+
+void csp_sched_yield(void) {}
+void csp_sched_hangup(uint64_t nanoseconds) {}
+void csp_timer_anchor(csp_timer_time_t when) {}
+bool csp_timer_cancel(csp_timer_t timer) { return true; }
+csp_timer_time_t csp_timer_clock_now(void) { return csp_timer_now_precise(); }
+
+void csp_sched_park(csp_spinlock_t *lock) {
+  test_parked++;
+  csp_waitq_unlock(lock);
+  test_on_park();
+}
+
+void csp_sched_park_fn(void (*fn)(void *arg), void *arg) {
+  test_parked++;
+  fn(arg);
+  test_on_park();
+}
+
+void csp_sched_put_proc(csp_proc_t *proc) {
+  test_woken = proc;
+}
+
+void csp_sched_handoff(csp_proc_t *proc) {
+  test_woken = proc;
+}
+
+csp_chan_t(mm) *test_chans[2];
+csp_chan_t(un) *test_un_chan;
+
+void test_select_ready(void) {
+  int val = -1, item = 1;
+  assert(csp_select(csp_select_default,
+    csp_select_recv(test_chans[0], &val), csp_select_recv(test_chans[1], &val)
+  ) == csp_select_none);
+
+  csp_chan_push(test_chans[1], 42);
+  assert(csp_select(csp_select_block,
+    csp_select_recv(test_chans[0], &val), csp_select_recv(test_chans[1], &val)
+  ) == 1);
+  assert(val == 42);
+
+  assert(csp_select(csp_select_default,
+    csp_select_recv(test_chans[0], &val), csp_select_send(test_chans[1], &item)
+  ) == 1);
+  csp_chan_pop(test_chans[1], &val);
+  assert(val == 1);
+}
+
+void test_select_fair(void) {
+  int val, hits[2] = {0, 0};
+  for (int i = 0; i < 1000; i++) {
+    csp_chan_push(test_chans[0], 0);
+    csp_chan_push(test_chans[1], 1);
+    int idx = csp_select(csp_select_block,
+      csp_select_recv(test_chans[0], &val), csp_select_recv(test_chans[1], &val)
+    );
+    assert(idx == val);
+    hits[idx]++;
+    assert(csp_select(csp_select_default, csp_select_recv(test_chans[!idx],
+      &val)) == 0);
+  }
+  assert(hits[0] > 300 && hits[1] > 300);
+}
+
+void test_push_on_park(void) {
+  /* The select process is queued on both channels. */
+  assert(atomic_load(&test_chans[0]->recvq.len) == 1);
+  assert(atomic_load(&test_chans[1]->recvq.len) == 1);
+  csp_chan_push(test_chans[1], 24);
+  assert(test_woken == &test_proc);
+}
+
+void test_un_push_on_park(void) {
+  csp_chan_push(test_un_chan, 12);
+  assert(test_woken == &test_proc);
+}
+
+void test_select_park(void) {
+  int val = -1;
+
+  /* The buffered peer only wakes us up and the item is popped after that. */
+  test_parked = 0;
+  test_woken = NULL;
+  test_on_park = test_push_on_park;
+  assert(csp_select(csp_select_block,
+    csp_select_recv(test_chans[0], &val), csp_select_recv(test_chans[1], &val)
+  ) == 1);
+  assert(val == 24);
+  assert(test_parked == 1);
+  assert(atomic_load(&test_chans[0]->recvq.len) == 0);
+  assert(test_chans[0]->recvq.head == NULL);
+  assert(atomic_load(&test_chans[1]->recvq.len) == 0);
+
+  /* The unbuffered peer writes the item to us directly. */
+  test_parked = 0;
+  test_woken = NULL;
+  test_on_park = test_un_push_on_park;
+  assert(csp_select(csp_select_block,
+    csp_select_recv(test_chans[0], &val), csp_select_recv(test_un_chan, &val)
+  ) == 1);
+  assert(val == 12);
+  assert(test_parked == 1);
+  assert(atomic_load(&test_chans[0]->recvq.len) == 0);
+  assert(atomic_load(&test_un_chan->recvq.len) == 0);
+}
+
+void test_select_stale(void) {
+  /* The node of a fired select is dropped by the peers. */
+  atomic_int_fast64_t done = 1;
+  csp_proc_t proc;
+  csp_waitq_node_t node = {.parked = &proc, .done = &done};
+  csp_waitq_push(&test_un_chan->recvq, &node);
+  assert(!csp_chan_try_push(test_un_chan, 1));
+  assert(atomic_load(&test_un_chan->recvq.len) == 0);
+
+  /* The unbuffered receiver in a select can't be used by `try_pushm`. */
+  atomic_store(&done, 0);
+  int val = -1, items[] = {1};
+  node.data = &val;
+  csp_waitq_push(&test_un_chan->recvq, &node);
+  assert(!csp_chan_try_pushm(test_un_chan, items, 1));
+
+  test_woken = NULL;
+  int item = 7;
+  assert(csp_select(csp_select_default, csp_select_send(test_un_chan, &item))
+    == 0);
+  assert(val == 7);
+  assert(test_woken == &proc);
+  assert(atomic_load(&done) == 1);
+}
+
+void test_un_close_on_park(void) {
+  csp_chan_close(test_un_chan);
+  assert(test_woken == &test_proc);
+}
+
+void test_select_close(void) {
+  int val = -1;
+  bool ok = true;
+
+  /* A closed channel fires the receiving case after it's drained. */
+  csp_chan_push(test_chans[0], 5);
+  csp_chan_close(test_chans[0]);
+  assert(csp_select(csp_select_block,
+    csp_select_recv_ok(test_chans[0], &val, &ok)) == 0);
+  assert(ok && val == 5);
+  assert(csp_select(csp_select_block,
+    csp_select_recv_ok(test_chans[0], &val, &ok)) == 0);
+  assert(!ok);
+  assert(csp_select(csp_select_block,
+    csp_select_send_ok(test_chans[0], &val, &ok)) == 0);
+  assert(!ok);
+
+  /* Closing wakes up the select parked on an unbuffered channel. */
+  ok = true;
+  test_parked = 0;
+  test_woken = NULL;
+  test_on_park = test_un_close_on_park;
+  assert(csp_select(csp_select_block,
+    csp_select_recv(test_chans[1], &val),
+    csp_select_recv_ok(test_un_chan, &val, &ok)) == 1);
+  assert(!ok);
+  assert(test_parked == 1);
+  assert(atomic_load(&test_chans[1]->recvq.len) == 0);
+  assert(atomic_load(&test_un_chan->recvq.len) == 0);
+}
+
+int main(void) {
+  csp_rand_init(&test_core.rand);
+  test_chans[0] = csp_chan_new(mm)(3);
+  test_chans[1] = csp_chan_new(mm)(3);
+  test_un_chan = csp_chan_new(un)(0);
+
+  test_select_ready();
+  test_select_fair();
+  test_select_park();
+  test_select_stale();
+  test_select_close();
+
+  csp_chan_destroy(test_chans[0]);
+  csp_chan_destroy(test_chans[1]);
+  csp_chan_destroy(test_un_chan);
+  return 0;
+}
@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) 2020, Yanhui Shi <lime.syh at gmail dot com>
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <assert.h>
+#include "../src/sema.h"
+
+/* The stubs of the scheduler. The parked "process" makes the peer progress
+ * itself before it is resumed. */
+csp_proc_t test_proc, *test_woken;
+csp_core_t test_core = {.running = &test_proc};
+_Thread_local csp_core_t *csp_this_core = &test_core;
+void (*test_on_park)(void);
+int test_parked, test_nwoken;
+
+void csp_sched_park(csp_spinlock_t *lock) {
+  test_parked++;
+  csp_waitq_unlock(lock);
+  test_on_park();
+}
+
+void csp_sched_put_proc(csp_proc_t *proc) {
+  test_woken = proc;
+  test_nwoken++;
+}
+
+void csp_sched_handoff(csp_proc_t *proc) {
+  test_woken = proc;
+}
+
+csp_sema_t test_sema;
+
+void test_release(void) {
+  csp_sema_release(&test_sema);
+}
+
+void test_sema_count(void) {
+  csp_sema_init(&test_sema, 2);
+  assert(csp_sema_try_acquire(&test_sema));
+  assert(csp_sema_try_acquire(&test_sema));
+  assert(!csp_sema_try_acquire(&test_sema));
+  csp_sema_release(&test_sema);
+  assert(atomic_load(&test_sema.count) == 1);
+  csp_sema_acquire(&test_sema);
+  assert(atomic_load(&test_sema.count) == 0);
+  assert(test_parked == 0 && test_nwoken == 0);
+}
+
+void test_sema_wait(void) {
+  csp_sema_init(&test_sema, 0);
+  test_on_park = test_release;
+  csp_sema_acquire(&test_sema);
+  assert(test_parked == 1);
+  assert(test_nwoken == 1 && test_woken == &test_proc);
+  assert(atomic_load(&test_sema.count) == 0);
+  assert(atomic_load(&test_sema.waitq.len) == 0);
+}
+
+int main(void) {
+  test_sema_count();
+  test_sema_wait();
+}
@@ -0,0 +1,148 @@
+/*
+ * Copyright (c) 2020, Yanhui Shi <lime.syh at gmail dot com>
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#define csp_with_sysmalloc
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <assert.h>
+#include <stdlib.h>
+#include "../src/runq.c"
+#include "../src/proc.c"
+#include "../src/core.c"
+#include "../src/corepool.c"
+#include "../src/cpus.c"
+#include "../src/stats.c"
+
+int csp_sched_np = 2;
+size_t csp_cpu_cores = 0;
+size_t csp_max_threads = 4;
+size_t csp_max_procs_hint = 100;
+size_t csp_spin_budget = 1;
+
+size_t csp_procs_num = 1;
+csp_proc_meta_t csp_procs_meta[] = {{4096}};
+size_t csp_elastic_stack_size = 0;
+size_t csp_time_slice = 0;
+
+void csp_sched_yield() {}
+
+csp_proc_t *csp_sched_get(csp_core_t *this_core) {
+  return NULL;
+}
+
+csp_proc_t *csp_sched_switch(csp_proc_t *next) {
+  return next;
+}
+
+void test_stats_snapshot(void) {
+  csp_core_pool_t *pools[2];
+  csp_core_t *cores[3];
+  for (int pid = 0; pid < 2; pid++) {
+    pools[pid] = csp_core_pool_new(pid, 3, 2);
+    assert(pools[pid] != NULL);
+  }
+  csp_core_pools.pools = pools;
+  assert(csp_core_pool_pop(pools[0], &cores[0]));
+  assert(csp_core_pool_pop(pools[0], &cores[1]));
+  assert(csp_core_pool_pop(pools[1], &cores[2]));
+
+  csp_stats_t stats;
+  csp_stats_snapshot(&stats);
+  assert(stats.switches == 0 && stats.steals == 0 && stats.deep_sleeps == 0);
+  assert(stats.cores == 3);
+
+  csp_stats_incr(&cores[0]->stats, switches);
+  csp_stats_incr(&cores[1]->stats, switches);
+  csp_stats_add(&cores[2]->stats, switches, 3);
+  csp_stats_incr(&cores[2]->stats, steal_tries);
+  csp_stats_incr(&cores[2]->stats, steals);
+  csp_stats_shared_add(timer_fires, 5);
+  atomic_store(&cores[1]->cond.nsleeps, 2);
+
+  csp_proc_t proc;
+  assert(csp_lrunq_try_push(pools[1]->lrunqs[csp_proc_prio_normal], &proc));
+  assert(csp_grunq_try_push(pools[0]->grunq, &proc));
+
+  csp_stats_snapshot(&stats);
+  assert(stats.switches == 5);
+  assert(stats.steal_tries == 1 && stats.steals == 1);
+  assert(stats.timer_fires == 5);
+  assert(stats.deep_sleeps == 2);
+  assert(stats.lrunq_len == 1 && stats.grunq_len == 1);
+
+  /* The counters of the other threads are not per-processor. */
+  assert(csp_stats_snapshot_pid(0, &stats));
+  assert(stats.switches == 2 && stats.timer_fires == 0);
+  assert(stats.deep_sleeps == 2 && stats.cores == 2);
+  assert(stats.lrunq_len == 0 && stats.grunq_len == 1);
+  assert(csp_stats_snapshot_pid(1, &stats));
+  assert(stats.switches == 3 && stats.cores == 1 && stats.lrunq_len == 1);
+  assert(!csp_stats_snapshot_pid(2, &stats));
+
+  csp_core_pools.pools = NULL;
+  for (int pid = 0; pid < 2; pid++) {
+    csp_core_pool_destroy(pools[pid]);
+  }
+}
+
+void test_stats_hist(void) {
+  /* The small values have their own buckets. */
+  for (uint64_t val = 0; val < 16; val++) {
+    assert(csp_stats_hist_index(val) == val);
+    assert(csp_stats_hist_value(val) == val);
+  }
+  assert(csp_stats_hist_index(16) == 16);
+  assert(csp_stats_hist_index(17) == 17);
+  assert(csp_stats_hist_index(32) == 32);
+  assert(csp_stats_hist_index(33) == 32);
+  assert(csp_stats_hist_index(34) == 33);
+
+  /* A value is at most 1/16 above the lower bound of its bucket. */
+  uint64_t last = 0;
+  for (uint64_t val = 1; val < ((uint64_t)1 << 41); val = val * 3 + 1) {
+    size_t idx = csp_stats_hist_index(val);
+    assert(idx < csp_stats_hist_len && idx >= last);
+    uint64_t low = csp_stats_hist_value(idx);
+    assert(low <= val && val - low <= low / 16);
+    assert(csp_stats_hist_index(low) == idx);
+    last = idx;
+  }
+  assert(csp_stats_hist_index(UINT64_MAX) == csp_stats_hist_len - 1);
+
+  csp_stats_hist_t hist = {0};
+  assert(csp_stats_hist_percentile(&hist, 0.5) == 0);
+  hist.counts[csp_stats_hist_index(100)] = 90;
+  hist.counts[csp_stats_hist_index(1000)] = 9;
+  hist.counts[csp_stats_hist_index(100000)] = 1;
+  hist.total = 100;
+  assert(csp_stats_hist_percentile(&hist, 0) == 100);
+  assert(csp_stats_hist_percentile(&hist, 0.5) == 100);
+  assert(csp_stats_hist_percentile(&hist, 0.99) == 992);
+  assert(csp_stats_hist_percentile(&hist, 1) == 98304);
+
+  /* The histograms are only recorded with `csp_with_latency_stats`. */
+  assert(!csp_stats_latency(&hist, NULL));
+  assert(!csp_stats_latency_pid(0, NULL, &hist));
+}
+
+int main(void) {
+  test_stats_snapshot();
+  test_stats_hist();
+}
@@ -0,0 +1,160 @@
+/*
+ * Copyright (c) 2020, Yanhui Shi <lime.syh at gmail dot com>
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#define csp_with_sysmalloc
+
+#include <assert.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "../src/stream.c"
+
+_Thread_local csp_core_t *csp_this_core = &(csp_core_t){.pid = 0};
+
+/* The stubs of the netpoll which block the thread instead of the process. The
+ * peer may make progress itself before the wait, see `test_on_wait`. */
+int test_waits;
+void (*test_on_wait)(void);
+
+int test_wait(int fd, short events) {
+  test_waits++;
+  if (test_on_wait != NULL) {
+    test_on_wait();
+  }
+  struct pollfd pfd = {.fd = fd, .events = events};
+  return poll(&pfd, 1, -1) == 1 ? csp_netpoll_avail : -1;
+}
+
+int csp_netpoll_wait_read(int fd, csp_timer_duration_t timeout) {
+  return test_wait(fd, POLLIN);
+}
+
+int csp_netpoll_wait_write(int fd, csp_timer_duration_t timeout) {
+  return test_wait(fd, POLLOUT);
+}
+
+int test_fds[2];
+csp_stream_t test_stream;
+
+void test_reset(void) {
+  assert(socketpair(AF_UNIX, SOCK_STREAM, 0, test_fds) == 0);
+  fcntl(test_fds[0], F_SETFL, fcntl(test_fds[0], F_GETFL) | O_NONBLOCK);
+  fcntl(test_fds[1], F_SETFL, fcntl(test_fds[1], F_GETFL) | O_NONBLOCK);
+  csp_stream_init(&test_stream, test_fds[0], 0);
+  test_waits = 0;
+  test_on_wait = NULL;
+}
+
+void test_close(void) {
+  csp_stream_destroy(&test_stream);
+  close(test_fds[0]);
+  close(test_fds[1]);
+}
+
+void test_stream_write(void) {
+  test_reset();
+  assert(test_stream.wbuf == NULL && test_stream.rbuf == NULL);
+
+  /* The small writes stay in the buffer until flushed. */
+  char buf[csp_stream_buf_size * 2];
+  for (int i = 0; i < 100; i++) {
+    assert(csp_stream_write(&test_stream, "0123456789", 10) == 10);
+  }
+  assert(test_stream.wlen == 1000);
+  assert(read(test_fds[1], buf, sizeof(buf)) == -1 && errno == EAGAIN);
+  assert(csp_stream_flush(&test_stream) == 0);
+  assert(test_stream.wlen == 0);
+  assert(read(test_fds[1], buf, sizeof(buf)) == 1000);
+  assert(memcmp(buf + 990, "0123456789", 10) == 0);
+
+  /* A write which doesn't fit is written along with the pending bytes. */
+  memset(buf, 'x', sizeof(buf));
+  assert(csp_stream_write(&test_stream, "head", 4) == 4);
+  assert(csp_stream_write(&test_stream, buf, sizeof(buf)) == sizeof(buf));
+  assert(test_stream.wlen == 0);
+  char out[sizeof(buf) + 4];
+  assert(read(test_fds[1], out, sizeof(out)) == sizeof(out));
+  assert(memcmp(out, "head", 4) == 0 && out[sizeof(out) - 1] == 'x');
+
+  struct iovec iov[2] = {{"ab", 2}, {"cd", 2}};
+  assert(csp_stream_writev(&test_stream, iov, 2) == 4);
+  assert(csp_stream_flush(&test_stream) == 0);
+  assert(read(test_fds[1], out, sizeof(out)) == 4);
+  assert(memcmp(out, "abcd", 4) == 0);
+  assert(test_waits == 0);
+  test_close();
+}
+
+void test_stream_read(void) {
+  test_reset();
+
+  /* One syscall reads the first message and buffers the others. */
+  assert(write(test_fds[1], "onetwothree", 11) == 11);
+  char buf[8];
+  assert(csp_stream_read(&test_stream, buf, 3) == 3);
+  assert(memcmp(buf, "one", 3) == 0);
+  assert(test_stream.rlen - test_stream.rpos == 8);
+  close(test_fds[1]);
+
+  assert(csp_stream_read(&test_stream, buf, 3) == 3);
+  assert(memcmp(buf, "two", 3) == 0);
+
+  struct iovec iov[2] = {{buf, 2}, {buf + 2, 6}};
+  assert(csp_stream_readv(&test_stream, iov, 2) == 5);
+  assert(memcmp(buf, "three", 5) == 0);
+
+  /* The peer has closed the stream. */
+  assert(csp_stream_read(&test_stream, buf, 3) == 0);
+  assert(csp_stream_read_full(&test_stream, buf, 3) == 0);
+  close(test_fds[0]);
+  csp_stream_destroy(&test_stream);
+}
+
+/* The peer answers the request once it arrives. */
+void test_serve(void) {
+  char buf[8];
+  ssize_t n = read(test_fds[1], buf, sizeof(buf));
+  if (n == 4 && memcmp(buf, "ping", 4) == 0) {
+    assert(write(test_fds[1], "pong", 4) == 4);
+  }
+}
+
+void test_stream_flush_on_wait(void) {
+  test_reset();
+  test_on_wait = test_serve;
+
+  /* The pending request is flushed instead of parking in the read. */
+  assert(csp_stream_write(&test_stream, "ping", 4) == 4);
+  char buf[4];
+  assert(csp_stream_read_full(&test_stream, buf, 4) == 4);
+  assert(memcmp(buf, "pong", 4) == 0);
+  assert(test_stream.wlen == 0);
+  assert(test_waits == 1);
+  test_close();
+}
+
+int main(void) {
+  test_stream_write();
+  test_stream_read();
+  test_stream_flush_on_wait();
+}
@@ -19,16 +19,21 @@
 
 #include <assert.h>
 #include <stdlib.h>
+#include <unistd.h>
 #include "../src/proc.c"
 #include "../src/timer.c"
 
 int csp_sched_np = 8;
 size_t csp_procs_num = 1;
-size_t csp_procs_size[] = {4096};
+csp_proc_meta_t csp_procs_meta[] = {{4096}};
+size_t csp_elastic_stack_size = 0;
 _Thread_local csp_core_t *csp_this_core = &(csp_core_t){.pid = 0};
+csp_stats_block_t csp_stats_shared;
+_Thread_local bool csp_monitor_self;
 
 void csp_sched_yield(void) {}
 void csp_core_proc_exit(void) {}
+void csp_monitor_wakeup(csp_timer_time_t when) {}
 
 csp_proc_t *start, *end;
 
@@ -40,6 +45,27 @@ void put_proc(csp_proc_t *proc) {
   csp_proc_destroy(proc);
 }
 
+void test_timer_clock(void) {
+  csp_timer_tsc_init();
+  assert(csp_timer_tsc_mult != 0);
+
+  csp_timer_time_t last = csp_timer_now();
+  for (int i = 0; i < 1000; i++) {
+    csp_timer_time_t now = csp_timer_now();
+    assert(now >= last);
+    last = now;
+  }
+
+  /* The TSC clock should be close to the monotonic clock. */
+  usleep(10000);
+  csp_timer_duration_t diff = csp_timer_now() - csp_timer_now_precise();
+  assert(diff < csp_timer_millisecond && diff > -csp_timer_millisecond);
+  assert(csp_timer_now() - last >= 10 * csp_timer_millisecond);
+
+  csp_timer_coarse_update();
+  assert(csp_timer_now_coarse() <= csp_timer_now());
+}
+
 void test_timer_events(void) {
   csp_timer_heap_t heap;
   assert(csp_timer_heap_init(&heap, 0));
@@ -48,107 +74,193 @@ void test_timer_events(void) {
   proc1->timer.when = 100;
   csp_timer_heap_put(&heap, proc1);
   assert(heap.len == 1);
-  assert(heap.token == 1);
   assert(heap.procs[0] == proc1);
   assert(proc1->timer.idx == 0);
-  assert(proc1->timer.token == 0);
 
   csp_proc_t *proc2 = get_proc();
   proc2->timer.when = 50;
   csp_timer_heap_put(&heap, proc2);
   assert(heap.len == 2);
-  assert(heap.token == 2);
   assert(heap.procs[0] == proc2);
   assert(heap.procs[1] == proc1);
   assert(proc1->timer.idx == 1);
-  assert(proc1->timer.token == 0);
   assert(proc2->timer.idx == 0);
-  assert(proc2->timer.token == 1);
 
   csp_proc_t *proc3 = get_proc();
   proc3->timer.when = 150;
   csp_timer_heap_put(&heap, proc3);
   assert(heap.len == 3);
-  assert(heap.token == 3);
   assert(heap.procs[0] == proc2);
   assert(heap.procs[1] == proc1);
   assert(heap.procs[2] == proc3);
   assert(proc1->timer.idx == 1);
-  assert(proc1->timer.token == 0);
   assert(proc2->timer.idx == 0);
-  assert(proc2->timer.token == 1);
   assert(proc3->timer.idx == 2);
-  assert(proc3->timer.token == 2);
 
   csp_timer_heap_del(&heap, proc2);
   assert(heap.len == 2);
-  assert(heap.token == 3);
   assert(heap.procs[0] == proc1);
   assert(heap.procs[1] == proc3);
   assert(proc1->timer.idx == 0);
-  assert(proc1->timer.token == 0);
   assert(proc3->timer.idx == 1);
-  assert(proc3->timer.token == 2);
 
   csp_timer_heap_del(&heap, proc1);
   assert(heap.len == 1);
-  assert(heap.token == 3);
   assert(heap.procs[0] == proc3);
   assert(proc3->timer.idx == 0);
-  assert(proc3->timer.token == 2);
 
   csp_timer_heap_del(&heap, proc3);
   assert(heap.len == 0);
-  assert(heap.token == 3);
 
   csp_timer_heap_destroy(&heap);
 }
 
-void test_timer_heaps(void) {
-  assert(csp_timer_heaps_init());
-  csp_timer_heaps_destroy();
+void test_timer_queues(void) {
+  assert(csp_timer_queues_init());
+  for (int i = 0; i < csp_sched_np; i++) {
+    assert((uintptr_t)&csp_timer_queues.queues[i] % 64 == 0);
+  }
+  csp_timer_queues_destroy();
+}
+
+void test_timer_grow(void) {
+  csp_timer_heap_t heap;
+  assert(csp_timer_heap_init(&heap, 0));
+
+  csp_proc_t *procs[csp_timer_heap_default_cap * 2];
+  for (int i = 0; i < csp_timer_heap_default_cap * 2; i++) {
+    procs[i] = get_proc();
+    procs[i]->timer.when = csp_timer_heap_default_cap * 2 - i;
+    csp_timer_heap_put(&heap, procs[i]);
+  }
+  assert(heap.cap == csp_timer_heap_default_cap * 2);
+  assert(heap.procs[0] == procs[csp_timer_heap_default_cap * 2 - 1]);
+
+  for (int i = 0; i < csp_timer_heap_default_cap * 2; i++) {
+    csp_timer_heap_del(&heap, procs[i]);
+    put_proc(procs[i]);
+  }
+  assert(heap.len == 0);
+  csp_timer_heap_destroy(&heap);
 }
 
 void test_timer(void) {
-  csp_timer_heaps_init();
+  csp_timer_queues_init();
 
   csp_proc_t *proc1 = get_proc();
   proc1->timer.when = 0;
   csp_timer_put(0, proc1);
-  assert(csp_timer_heaps.heaps[0].len == 1);
-  assert(csp_timer_heaps.heaps[0].token == 1);
-  assert(csp_timer_heaps.heaps[0].procs[0] == proc1);
+  assert(csp_timer_queues.queues[0].token == 1);
   assert(proc1->borned_pid == 0);
-  assert(proc1->timer.idx == 0);
   assert(proc1->timer.token == 0);
 
   csp_proc_t *proc2 = get_proc();
   proc2->timer.when = INT64_MAX;
   csp_timer_put(0, proc2);
-  assert(csp_timer_heaps.heaps[0].len == 2);
-  assert(csp_timer_heaps.heaps[0].token == 2);
-  assert(csp_timer_heaps.heaps[0].procs[0] == proc1);
+  assert(csp_timer_queues.queues[0].token == 2);
   assert(proc2->borned_pid == 0);
-  assert(proc2->timer.idx == 1);
   assert(proc2->timer.token == 1);
 
-  for (int i = 1; i < csp_sched_np; i++) {
-    assert(csp_timer_heap_get(&csp_timer_heaps.heaps[i], &start, &end) == 0);
-  }
-  assert(csp_timer_heap_get(&csp_timer_heaps.heaps[0], &start, &end) == 1);
+  /* Timers are put to the heap when the inbox is drained. */
+  assert(csp_timer_queues.queues[0].len == 0);
+  assert(!csp_msrbq_is_empty(timer)(csp_timer_queues.queues[0].inbox));
+  assert(csp_timer_poll(&start, &end) == 1);
   assert(start == end);
   assert(start == proc1);
-  assert(csp_timer_heaps.heaps[0].len == 1);
-  assert(csp_timer_heaps.heaps[0].token == 2);
-  assert(csp_timer_heaps.heaps[0].procs[0] == proc2);
-  assert(csp_timer_heap_get(&csp_timer_heaps.heaps[0], &start, &end) == 0);
+  assert(proc1->timer.token == -1);
+  assert(csp_timer_queues.queues[0].len == 1);
+  assert(csp_timer_queues.queues[0].procs[0] == proc2);
+  assert(proc2->timer.idx == 0);
+
+  for (int i = 0; i < csp_sched_np; i++) {
+    assert(csp_timer_heap_get(&csp_timer_queues.queues[i], &start, &end) == 0);
+  }
+
+  /* An expired timer can't be canceled. */
+  assert(!csp_timer_cancel((csp_timer_t){.ctx = proc1, .token = 0}));
+  put_proc(proc1);
+
+  /* Cancel a timer in the heap. */
+  assert(csp_timer_cancel((csp_timer_t){.ctx = proc2, .token = 1}));
+  assert(!csp_timer_cancel((csp_timer_t){.ctx = proc2, .token = 1}));
+  assert(csp_timer_queues.queues[0].len == 1);
+  assert(csp_timer_poll(&start, &end) == 0);
+  assert(csp_timer_queues.queues[0].len == 0);
+
+  /* Cancel a timer before it's put to the heap. */
+  csp_proc_t *proc3 = get_proc();
+  proc3->timer.when = 0;
+  csp_timer_put(0, proc3);
+  assert(csp_timer_cancel((csp_timer_t){.ctx = proc3, .token = 2}));
+  assert(csp_timer_poll(&start, &end) == 0);
+  assert(csp_timer_queues.queues[0].len == 0);
+  assert(csp_msrbq_is_empty(timer)(csp_timer_queues.queues[0].inbox));
+
+  csp_timer_queues_destroy();
+}
+
+void test_timer_next(void) {
+  csp_timer_queues_init();
+  assert(csp_timer_next() == INT64_MAX);
+  assert(!csp_timer_pending());
+
+  csp_proc_t *proc1 = get_proc();
+  proc1->timer.when = csp_timer_now() + csp_timer_hour;
+  csp_timer_put(0, proc1);
+  assert(csp_timer_pending());
+
+  /* The deadline is known after the requests are applied. */
+  assert(csp_timer_poll(&start, &end) == 0);
+  assert(!csp_timer_pending());
+  assert(csp_timer_next() == proc1->timer.when);
+
+  assert(csp_timer_cancel((csp_timer_t){.ctx = proc1, .token = 0}));
+  assert(csp_timer_poll(&start, &end) == 0);
+  assert(csp_timer_next() == INT64_MAX);
+
+  csp_timer_queues_destroy();
+}
+
+void test_timer_owner(void) {
+  csp_timer_queues_init();
+  csp_timer_queue_t *queue = &csp_timer_queues.queues[0];
+
+  /* The queue is skipped while someone else is polling it. */
+  csp_proc_t *proc1 = get_proc();
+  proc1->timer.when = 0;
+  csp_timer_put(0, proc1);
+  assert(csp_spinlock_try_lock(&queue->lock));
+  assert(csp_timer_poll_core(0, &start, &end) == 0);
+  assert(csp_timer_pending_core(0));
+  csp_spinlock_unlock(&queue->lock);
+  assert(csp_timer_poll_core(0, &start, &end) == 1);
+  assert(start == proc1);
+  put_proc(proc1);
+
+  /* A canceler facing a full inbox applies the request itself. */
+  csp_proc_t *proc2 = get_proc();
+  proc2->timer.when = INT64_MAX;
+  csp_timer_put(0, proc2);
+  assert(csp_timer_poll_core(0, &start, &end) == 0);
+  assert(csp_timer_next_core(0) == INT64_MAX);
+  assert(queue->len == 1);
+  csp_proc_t *stale = get_proc();
+  csp_proc_timer_token_set(stale, -1);
+  while (csp_msrbq_try_push(timer)(queue->inbox, (uintptr_t)stale));
+  assert(csp_timer_cancel((csp_timer_t){.ctx = proc2, .token = 1}));
+  assert(queue->len == 0);
+  assert(!csp_timer_pending_core(0));
+  put_proc(stale);
 
-  put_proc(proc2);
-  csp_timer_heaps_destroy();
+  csp_timer_queues_destroy();
 }
 
 int main(void) {
+  test_timer_clock();
   test_timer_events();
-  test_timer_heaps();
+  test_timer_grow();
+  test_timer_queues();
   test_timer();
+  test_timer_next();
+  test_timer_owner();
 }
@@ -0,0 +1,230 @@
+/*
+ * Copyright (c) 2020, Yanhui Shi <lime.syh at gmail dot com>
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#define csp_with_sysmalloc
+#define csp_with_timer_wheel
+
+#include <assert.h>
+#include <stdlib.h>
+#include "../src/proc.c"
+#include "../src/timer.c"
+
+int csp_sched_np = 8;
+size_t csp_procs_num = 1;
+csp_proc_meta_t csp_procs_meta[] = {{4096}};
+size_t csp_elastic_stack_size = 0;
+size_t csp_timer_slot = 1000000;
+_Thread_local csp_core_t *csp_this_core = &(csp_core_t){.pid = 0};
+csp_stats_block_t csp_stats_shared;
+_Thread_local bool csp_monitor_self;
+
+void csp_sched_yield(void) {}
+void csp_core_proc_exit(void) {}
+void csp_monitor_wakeup(csp_timer_time_t when) {}
+
+csp_proc_t *start, *end;
+
+csp_proc_t *get_proc(csp_timer_wheel_t *wheel, int64_t ticks) {
+  csp_proc_t *proc = csp_proc_new(0, false);
+  proc->timer.when = wheel->start + ticks * (int64_t)csp_timer_slot;
+  csp_proc_timer_token_set(proc, 0);
+  return proc;
+}
+
+void put_proc(csp_proc_t *proc) {
+  csp_proc_destroy(proc);
+}
+
+/* Pretend that `ticks` ticks have passed by moving the start of the wheel
+ * and the timers backward together. */
+void advance(csp_timer_wheel_t *wheel, int64_t ticks, csp_proc_t **procs,
+    int n) {
+  int64_t duration = ticks * (int64_t)csp_timer_slot;
+  wheel->start -= duration;
+  for (int i = 0; i < n; i++) {
+    procs[i]->timer.when -= duration;
+  }
+}
+
+void test_timer_wheel_levels(void) {
+  csp_timer_wheel_t wheel;
+  assert(csp_timer_wheel_init(&wheel, 0));
+
+  csp_proc_t *proc1 = get_proc(&wheel, 10);
+  csp_timer_wheel_put(&wheel, proc1);
+  assert(wheel.len == 1);
+  assert(wheel.bitmap == (uint64_t)1 << 10);
+  assert(wheel.slots[10] == proc1);
+  assert(proc1->timer.idx == 10);
+
+  csp_proc_t *proc2 = get_proc(&wheel, 100);
+  csp_timer_wheel_put(&wheel, proc2);
+  assert(proc2->timer.idx == csp_timer_wheel_slots + (100 >> 6));
+
+  csp_proc_t *proc3 = get_proc(&wheel, 5000);
+  csp_timer_wheel_put(&wheel, proc3);
+  assert(proc3->timer.idx == 2 * csp_timer_wheel_slots + (5000 >> 12));
+
+  /* Timers beyond the top level are parked in its last slot. */
+  csp_proc_t *proc4 = get_proc(&wheel, 0);
+  proc4->timer.when = INT64_MAX;
+  csp_timer_wheel_put(&wheel, proc4);
+  assert(proc4->timer.idx == 5 * csp_timer_wheel_slots - 1);
+
+  /* Expired timers are put to the current slot. */
+  csp_proc_t *proc5 = get_proc(&wheel, -1);
+  csp_timer_wheel_put(&wheel, proc5);
+  assert(proc5->timer.idx == 0);
+  assert(wheel.len == 5);
+  assert(wheel.bitmap == (((uint64_t)1 << 10) | 1));
+
+  /* Timers in the same slot are linked. */
+  csp_proc_t *proc6 = get_proc(&wheel, 10);
+  csp_timer_wheel_put(&wheel, proc6);
+  assert(wheel.slots[10] == proc6);
+  assert(proc6->next == proc1);
+  assert(proc1->pre == proc6);
+
+  csp_timer_wheel_del(&wheel, proc6);
+  assert(wheel.slots[10] == proc1);
+  assert(proc1->pre == NULL);
+  assert(wheel.bitmap == (((uint64_t)1 << 10) | 1));
+
+  csp_timer_wheel_del(&wheel, proc1);
+  assert(wheel.slots[10] == NULL);
+  assert(wheel.bitmap == 1);
+
+  csp_timer_wheel_del(&wheel, proc5);
+  assert(wheel.bitmap == 0);
+
+  csp_timer_wheel_del(&wheel, proc2);
+  csp_timer_wheel_del(&wheel, proc3);
+  csp_timer_wheel_del(&wheel, proc4);
+  assert(wheel.len == 0);
+
+  put_proc(proc1);
+  put_proc(proc2);
+  put_proc(proc3);
+  put_proc(proc4);
+  put_proc(proc5);
+  put_proc(proc6);
+  csp_timer_wheel_destroy(&wheel);
+}
+
+void test_timer_wheel_cascade(void) {
+  csp_timer_wheel_t wheel;
+  assert(csp_timer_wheel_init(&wheel, 0));
+
+  csp_proc_t *proc1 = get_proc(&wheel, 10);
+  csp_proc_t *proc2 = get_proc(&wheel, 100);
+  csp_proc_t *proc3 = get_proc(&wheel, 5000);
+  csp_timer_wheel_put(&wheel, proc1);
+  csp_timer_wheel_put(&wheel, proc2);
+  csp_timer_wheel_put(&wheel, proc3);
+  assert(csp_timer_wheel_get(&wheel, &start, &end) == 0);
+
+  csp_proc_t *procs[] = {proc1, proc2, proc3};
+
+  advance(&wheel, 50, procs, 3);
+  assert(csp_timer_wheel_get(&wheel, &start, &end) == 1);
+  assert(start == proc1 && end == proc1);
+  assert(proc1->timer.token == -1);
+  assert(proc2->timer.idx == csp_timer_wheel_slots + (100 >> 6));
+
+  /* `proc2` is cascaded to the first level at tick 64. */
+  advance(&wheel, 40, procs, 3);
+  assert(csp_timer_wheel_get(&wheel, &start, &end) == 0);
+  assert(proc2->timer.idx == (100 & csp_timer_wheel_mask));
+
+  advance(&wheel, 4000, procs, 3);
+  assert(csp_timer_wheel_get(&wheel, &start, &end) == 1);
+  assert(start == proc2 && end == proc2);
+  assert(wheel.len == 1);
+
+  advance(&wheel, 1000, procs, 3);
+  assert(csp_timer_wheel_get(&wheel, &start, &end) == 1);
+  assert(start == proc3 && end == proc3);
+  assert(wheel.len == 0);
+  assert(wheel.bitmap == 0);
+
+  put_proc(proc1);
+  put_proc(proc2);
+  put_proc(proc3);
+  csp_timer_wheel_destroy(&wheel);
+}
+
+void test_timer_wheel_cancel(void) {
+  assert(csp_timer_queues_init());
+
+  csp_timer_wheel_t *wheel = &csp_timer_queues.queues[0];
+  csp_proc_t *proc1 = get_proc(wheel, 100);
+  csp_proc_t *proc2 = get_proc(wheel, 100);
+  csp_timer_put(0, proc1);
+  csp_timer_put(0, proc2);
+  assert(csp_timer_poll(&start, &end) == 0);
+  assert(wheel->len == 2);
+
+  csp_timer_t timer = {.ctx = proc1, .token = proc1->timer.token};
+  assert(csp_timer_cancel(timer));
+  assert(csp_timer_poll(&start, &end) == 0);
+  assert(wheel->len == 1);
+  assert(wheel->slots[proc2->timer.idx] == proc2);
+  assert(proc2->pre == NULL && proc2->next == NULL);
+
+  advance(wheel, 200, (csp_proc_t *[]){proc2}, 1);
+  assert(csp_timer_poll(&start, &end) == 1);
+  assert(start == proc2 && end == proc2);
+
+  /* The timer has expired. */
+  timer = (csp_timer_t){.ctx = proc2, .token = 1};
+  assert(!csp_timer_cancel(timer));
+
+  put_proc(proc2);
+  csp_timer_queues_destroy();
+}
+
+void test_timer_wheel_next(void) {
+  csp_timer_wheel_t wheel;
+  assert(csp_timer_wheel_init(&wheel, 0));
+  assert(csp_timer_wheel_next(&wheel) == INT64_MAX);
+
+  /* Only the higher levels have timers, wake up for the next cascading. */
+  csp_proc_t *proc1 = get_proc(&wheel, 100);
+  csp_timer_wheel_put(&wheel, proc1);
+  assert(csp_timer_wheel_next(&wheel) ==
+    wheel.start + csp_timer_wheel_slots * (int64_t)csp_timer_slot);
+
+  csp_proc_t *proc2 = get_proc(&wheel, 10);
+  csp_timer_wheel_put(&wheel, proc2);
+  assert(csp_timer_wheel_next(&wheel) == proc2->timer.when);
+
+  /* The slots before the current one belong to the next round. */
+  wheel.curr = 20;
+  assert(csp_timer_wheel_next(&wheel) ==
+    wheel.start + (csp_timer_wheel_slots + 10) * (int64_t)csp_timer_slot);
+
+  put_proc(proc1);
+  put_proc(proc2);
+  csp_timer_wheel_destroy(&wheel);
+}
+
+int main(void) {
+  test_timer_wheel_levels();
+  test_timer_wheel_cascade();
+  test_timer_wheel_cancel();
+  test_timer_wheel_next();
+}
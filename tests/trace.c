@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) 2020, Yanhui Shi <lime.syh at gmail dot com>
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#define csp_with_trace
+
+#include <assert.h>
+#include <string.h>
+#include "../src/trace.c"
+
+_Thread_local csp_core_t *csp_this_core = &(csp_core_t){.pid = 2};
+csp_timer_time_t test_now;
+
+csp_timer_time_t csp_timer_clock_now(void) {
+  return test_now += 1000;
+}
+
+void test_trace_record(void) {
+  csp_proc_t proc = {.id = 7};
+  assert(csp_trace_this == NULL);
+  csp_trace(create, &proc);
+  assert(csp_trace_this != NULL);
+  assert(csp_trace_this->pid == 2);
+
+  csp_trace(run, &proc);
+  csp_trace(yield, &proc);
+  csp_trace(wake, &proc);
+  assert(atomic_load(&csp_trace_this->head) == 4);
+
+  csp_trace_event_t *event = &csp_trace_this->events[1];
+  assert(event->type == csp_trace_event_run);
+  assert(event->proc == (uintptr_t)&proc && event->id == 7);
+  assert(event->ts == 2000);
+
+  /* The oldest events are overwritten. */
+  for (int i = 0; i < csp_trace_buf_cap; i++) {
+    csp_trace(steal, &proc);
+  }
+  assert(csp_trace_this->events[3].type == csp_trace_event_steal);
+}
+
+void test_trace_dump(void) {
+  csp_proc_t proc = {.id = 3};
+  csp_trace_this = NULL;
+  csp_trace(run, &proc);
+  csp_trace(park, &proc);
+  csp_trace(exit, &proc);
+
+  char path[] = "/tmp/libcsp_trace_XXXXXX";
+  int fd = mkstemp(path);
+  assert(fd != -1);
+  close(fd);
+  assert(csp_trace_dump(path));
+
+  FILE *file = fopen(path, "r");
+  static char json[1 << 24];
+  size_t len = fread(json, 1, sizeof(json) - 1, file);
+  json[len] = '\0';
+  fclose(file);
+  unlink(path);
+
+  assert(strstr(json, "\"traceEvents\"") != NULL);
+  assert(strstr(json, "\"name\":\"core 2\"") != NULL);
+  /* The run ends with the park, and the exit is left alone. */
+  const char *events[] = {
+    "\"name\":\"proc 3\",\"cat\":\"proc\",\"ph\":\"B\"",
+    "\"name\":\"park\",\"cat\":\"proc\",\"ph\":\"E\"",
+    "\"name\":\"exit\",\"cat\":\"proc\",\"ph\":\"i\"",
+  };
+  for (int i = 0; i < 3; i++) {
+    assert(strstr(json, events[i]) != NULL);
+  }
+  assert(strcmp(json + len - 4, "\n]}\n") == 0);
+}
+
+int main(void) {
+  test_trace_record();
+  test_trace_dump();
+}